@@ -0,0 +1,324 @@
+#include "pch.h"
+#include "AsyncFileWriter.h"
+#include "Trace.h"
+
+constexpr ULONG_PTR WriteCompletionKey = 0;
+constexpr ULONG_PTR SubmitCompletionKey = 1;
+constexpr ULONG_PTR StopCompletionKey = 2;
+
+// Writes to new files complete synchronously, so this is how many files
+// are written at once.
+constexpr uint32_t IoThreadCount = 4;
+// Big files are split up so several requests per file are in flight.
+constexpr uint64_t PieceSize = 8 * 1024 * 1024;
+// A multiple of both 512 byte and 4K sectors.
+constexpr uint64_t UnbufferedAlignment = 4096;
+// Below this, copying into aligned memory isn't worth it.
+constexpr uint64_t UnbufferedMinimumSize = 4 * 1024 * 1024;
+
+void SetFileLength(HANDLE file, uint64_t size)
+{
+    FILE_END_OF_FILE_INFO endOfFile = {};
+    endOfFile.EndOfFile.QuadPart = static_cast<LONGLONG>(size);
+    winrt::check_bool(SetFileInformationByHandle(file, FileEndOfFileInfo, &endOfFile, sizeof(endOfFile)));
+}
+
+AsyncFileWriter::AsyncFileWriter(FileWriteMode mode, uint64_t maxBytesInFlight)
+{
+    if (mode == FileWriteMode::MemoryMapped)
+    {
+        throw winrt::hresult_invalid_argument(L"Asynchronous writes can't be memory mapped!");
+    }
+    m_mode = mode;
+    m_maxBytesInFlight = maxBytesInFlight;
+    m_port.reset(CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, IoThreadCount));
+    winrt::check_bool(static_cast<bool>(m_port));
+    m_runningThreads = IoThreadCount;
+    for (uint32_t i = 0; i < IoThreadCount; i++)
+    {
+        m_threads.push_back(std::thread([this]()
+            {
+                Trace::SetThreadName("FileWrite");
+                IoLoop();
+            }));
+    }
+}
+
+AsyncFileWriter::~AsyncFileWriter()
+{
+    // The pieces still in flight point into our files.
+    try
+    {
+        Flush();
+    }
+    catch (...)
+    {
+    }
+    for (size_t i = 0; i < m_threads.size(); i++)
+    {
+        PostQueuedCompletionStatus(m_port.get(), 0, StopCompletionKey, nullptr);
+    }
+    for (auto&& thread : m_threads)
+    {
+        thread.join();
+    }
+}
+
+void AsyncFileWriter::Write(std::wstring const& path, std::vector<uint8_t>&& bytes)
+{
+    TraceScope trace("QueueFileWrite");
+    auto file = std::make_unique<PendingFile>();
+    file->Path = path;
+    file->Size = bytes.size();
+    file->Bytes = std::move(bytes);
+    file->Submitted = std::chrono::steady_clock::now();
+    {
+        std::unique_lock lock(m_lock);
+        // A file bigger than the limit still goes, on its own.
+        m_changed.wait(lock, [&]() { return m_stopped || m_bytesInFlight == 0 || m_bytesInFlight + file->Size <= m_maxBytesInFlight; });
+        if (m_stopped)
+        {
+            std::rethrow_exception(m_error);
+        }
+        m_bytesInFlight += file->Size;
+        m_filesInFlight++;
+        m_submitted.push_back(std::move(file));
+    }
+    winrt::check_bool(PostQueuedCompletionStatus(m_port.get(), 0, SubmitCompletionKey, nullptr));
+}
+
+void AsyncFileWriter::Flush()
+{
+    std::unique_lock lock(m_lock);
+    m_changed.wait(lock, [&]() { return m_filesInFlight == 0; });
+    if (m_error)
+    {
+        std::rethrow_exception(m_error);
+    }
+}
+
+void AsyncFileWriter::IoLoop()
+{
+    while (true)
+    {
+        DWORD bytesTransferred = 0;
+        ULONG_PTR key = 0;
+        OVERLAPPED* overlapped = nullptr;
+        auto succeeded = GetQueuedCompletionStatus(m_port.get(), &bytesTransferred, &key, &overlapped, INFINITE);
+        if (overlapped)
+        {
+            auto piece = CONTAINING_RECORD(overlapped, Piece, Overlapped);
+            CompletePiece(*piece, bytesTransferred, succeeded);
+        }
+        else if (!succeeded)
+        {
+            SetError(std::make_exception_ptr(winrt::hresult_error(HRESULT_FROM_WIN32(GetLastError()), L"Waiting for file writes failed!")));
+            break;
+        }
+        else if (key == StopCompletionKey)
+        {
+            break;
+        }
+        else if (key == SubmitCompletionKey)
+        {
+            std::unique_ptr<PendingFile> file;
+            {
+                std::scoped_lock lock(m_lock);
+                file = std::move(m_submitted.front());
+                m_submitted.pop_front();
+            }
+            StartFile(std::move(file));
+        }
+    }
+
+    // Once the last thread stops, nothing in flight can finish anymore.
+    auto isLastThread = false;
+    {
+        std::scoped_lock lock(m_lock);
+        isLastThread = --m_runningThreads == 0;
+    }
+    if (isLastThread)
+    {
+        AbandonFiles();
+    }
+}
+
+void AsyncFileWriter::StartFile(std::unique_ptr<PendingFile>&& newFile)
+{
+    TraceScope trace("StartFileWrite");
+    auto file = newFile.get();
+    {
+        std::scoped_lock lock(m_lock);
+        m_openFiles.push_back(std::move(newFile));
+        m_maxOpenFiles = std::max(m_maxOpenFiles, m_openFiles.size());
+    }
+
+    // Counted as a piece until everything is queued, so pieces completing
+    // on other threads can't finish the file while we're still using it.
+    file->PiecesLeft = 1;
+    uint64_t pieceCount = 0;
+    try
+    {
+        auto data = file->Bytes.data();
+        file->WriteSize = file->Size;
+        auto unbuffered = m_mode == FileWriteMode::Unbuffered && file->Size >= UnbufferedMinimumSize;
+        if (unbuffered)
+        {
+            // VirtualAlloc hands out zeroed pages, so the padding is zero.
+            file->WriteSize = (file->Size + UnbufferedAlignment - 1) & ~(UnbufferedAlignment - 1);
+            file->AlignedBytes.reset(static_cast<uint8_t*>(VirtualAlloc(nullptr, static_cast<size_t>(file->WriteSize), MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE)));
+            winrt::check_bool(static_cast<bool>(file->AlignedBytes));
+            memcpy(file->AlignedBytes.get(), data, static_cast<size_t>(file->Size));
+            file->Bytes = {};
+            data = file->AlignedBytes.get();
+        }
+
+        auto flags = FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED | (unbuffered ? FILE_FLAG_NO_BUFFERING : 0);
+        file->File.reset(CreateFileW(file->Path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, flags, nullptr));
+        winrt::check_bool(static_cast<bool>(file->File));
+        // Sized up front so it isn't grown piece by piece. The writes below
+        // still extend the valid data length, so they complete synchronously.
+        SetFileLength(file->File.get(), file->WriteSize);
+        winrt::check_bool(CreateIoCompletionPort(file->File.get(), m_port.get(), WriteCompletionKey, 0) != nullptr);
+
+        // Never resized after this, the OVERLAPPEDs have to stay put.
+        pieceCount = (file->WriteSize + PieceSize - 1) / PieceSize;
+        file->Pieces.resize(static_cast<size_t>(pieceCount));
+        file->PiecesLeft += static_cast<uint32_t>(pieceCount);
+        for (; file->PiecesQueued < pieceCount; file->PiecesQueued++)
+        {
+            auto& piece = file->Pieces[file->PiecesQueued];
+            auto offset = file->PiecesQueued * PieceSize;
+            piece.Owner = file;
+            piece.Size = static_cast<DWORD>(std::min(PieceSize, file->WriteSize - offset));
+            piece.Overlapped.Offset = static_cast<DWORD>(offset);
+            piece.Overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+            // Even when it completes right away, the completion is queued.
+            if (!WriteFile(file->File.get(), data + offset, piece.Size, nullptr, &piece.Overlapped) && GetLastError() != ERROR_IO_PENDING)
+            {
+                winrt::throw_last_error();
+            }
+        }
+    }
+    catch (...)
+    {
+        SetError(std::current_exception());
+        file->Failed = true;
+        // The pieces that didn't get queued will never complete.
+        file->PiecesLeft -= static_cast<uint32_t>(pieceCount) - file->PiecesQueued;
+    }
+
+    if (--file->PiecesLeft == 0)
+    {
+        FinishFile(file);
+    }
+}
+
+void AsyncFileWriter::CompletePiece(Piece& piece, DWORD bytesTransferred, bool succeeded)
+{
+    auto file = piece.Owner;
+    if (!succeeded || bytesTransferred != piece.Size)
+    {
+        auto error = succeeded ? ERROR_WRITE_FAULT : GetLastError();
+        SetError(std::make_exception_ptr(winrt::hresult_error(HRESULT_FROM_WIN32(error), L"Couldn't write " + file->Path)));
+        file->Failed = true;
+    }
+    if (--file->PiecesLeft == 0)
+    {
+        FinishFile(file);
+    }
+}
+
+void AsyncFileWriter::FinishFile(PendingFile* file)
+{
+    TraceScope trace("FinishFileWrite");
+    // Unbuffered files were padded to whole sectors. Their size can be
+    // set through the same handle, it's only the data that's unbuffered.
+    if (file->File && !file->Failed && file->WriteSize != file->Size)
+    {
+        try
+        {
+            SetFileLength(file->File.get(), file->Size);
+        }
+        catch (...)
+        {
+            SetError(std::current_exception());
+            file->Failed = true;
+        }
+    }
+    file->File.reset();
+
+    {
+        std::scoped_lock lock(m_lock);
+        if (!file->Failed)
+        {
+            m_filesWritten++;
+            m_bytesWritten += file->Size;
+            m_fileLatency.Add(MillisecondsSince(file->Submitted));
+        }
+        m_bytesInFlight -= file->Size;
+        m_filesInFlight--;
+        auto found = std::find_if(m_openFiles.begin(), m_openFiles.end(), [&](auto&& openFile) { return openFile.get() == file; });
+        m_openFiles.erase(found);
+    }
+    m_changed.notify_all();
+}
+
+void AsyncFileWriter::AbandonFiles()
+{
+    std::deque<std::unique_ptr<PendingFile>> submitted;
+    {
+        std::scoped_lock lock(m_lock);
+        m_stopped = true;
+        submitted.swap(m_submitted);
+        for (auto&& file : submitted)
+        {
+            m_bytesInFlight -= file->Size;
+            m_filesInFlight--;
+        }
+    }
+    // No other I/O thread is left to touch the open files.
+    while (!m_openFiles.empty())
+    {
+        auto file = m_openFiles.back().get();
+        if (file->File)
+        {
+            // The kernel still points at the pieces and their bytes until
+            // each write has really stopped. The handle is signaled by any
+            // of its writes, so the pieces are checked one by one too.
+            CancelIoEx(file->File.get(), nullptr);
+            for (uint32_t i = 0; i < file->PiecesQueued; i++)
+            {
+                auto& piece = file->Pieces[i];
+                DWORD bytesTransferred = 0;
+                GetOverlappedResult(file->File.get(), &piece.Overlapped, &bytesTransferred, TRUE);
+                while (!HasOverlappedIoCompleted(&piece.Overlapped))
+                {
+                    Sleep(1);
+                }
+            }
+        }
+        file->Failed = true;
+        FinishFile(file);
+    }
+    m_changed.notify_all();
+}
+
+void AsyncFileWriter::SetError(std::exception_ptr error)
+{
+    std::scoped_lock lock(m_lock);
+    if (!m_error)
+    {
+        m_error = error;
+    }
+}
+
+void AsyncFileWriter::PrintStatistics() const
+{
+    wprintf(L"Asynchronous writes:\n");
+    wprintf(L"  files            %llu written, %.1f MB, at most %zu in flight\n",
+        static_cast<unsigned long long>(m_filesWritten),
+        m_bytesWritten / (1024.0 * 1024.0),
+        m_maxOpenFiles);
+    ::PrintStatistics(L"file latency", m_fileLatency);
+}
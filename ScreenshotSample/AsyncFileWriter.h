@@ -0,0 +1,89 @@
+#pragma once
+#include "FileWriter.h"
+#include "Statistics.h"
+
+// Writes whole files with overlapped I/O, several of them at once. Write
+// hands the bytes over and returns, an I/O thread opens each file, sizes it
+// up front and queues all of its pieces, then whichever thread sees the last
+// one complete closes it. Write only blocks once maxBytesInFlight are
+// waiting to be written, so memory stays bounded.
+//
+// Sizing a file doesn't move its valid data length, so the writes to a new
+// file extend it and complete synchronously. An I/O thread is busy with one
+// file at a time, and it's having several threads that keeps the disk busy.
+//
+// Files are always sized before they're written, so Preallocated is the
+// same as Plain. With Unbuffered, files of a few MB or more bypass the file
+// cache. MemoryMapped isn't supported.
+class AsyncFileWriter
+{
+public:
+    AsyncFileWriter(FileWriteMode mode, uint64_t maxBytesInFlight);
+    // Waits for everything to be written, but doesn't throw.
+    ~AsyncFileWriter();
+
+    void Write(std::wstring const& path, std::vector<uint8_t>&& bytes);
+    // Waits for every file written so far to be closed, and rethrows the
+    // first error any of them ran into.
+    void Flush();
+
+    // Only valid after Flush.
+    void PrintStatistics() const;
+
+private:
+    struct PendingFile;
+
+    struct Piece
+    {
+        OVERLAPPED Overlapped = {};
+        PendingFile* Owner = nullptr;
+        DWORD Size = 0;
+    };
+
+    struct PendingFile
+    {
+        std::wstring Path;
+        std::vector<uint8_t> Bytes;
+        uint64_t Size = 0;
+        // Unbuffered writes need sector aligned memory and sizes.
+        wil::unique_virtualalloc_ptr<uint8_t> AlignedBytes;
+        uint64_t WriteSize = 0;
+        wil::unique_hfile File;
+        std::vector<Piece> Pieces;
+        uint32_t PiecesQueued = 0;
+        // Pieces can complete on any I/O thread.
+        std::atomic<uint32_t> PiecesLeft = 0;
+        std::atomic<bool> Failed = false;
+        std::chrono::steady_clock::time_point Submitted;
+    };
+
+    void IoLoop();
+    void StartFile(std::unique_ptr<PendingFile>&& file);
+    void CompletePiece(Piece& piece, DWORD bytesTransferred, bool succeeded);
+    void FinishFile(PendingFile* file);
+    // Fails every file once no I/O thread can go on.
+    void AbandonFiles();
+    void SetError(std::exception_ptr error);
+
+private:
+    FileWriteMode m_mode = FileWriteMode::Plain;
+    uint64_t m_maxBytesInFlight = 0;
+    wil::unique_handle m_port;
+    std::vector<std::thread> m_threads;
+
+    // Write and Flush wait on these, the I/O threads update them.
+    std::mutex m_lock;
+    std::condition_variable m_changed;
+    std::deque<std::unique_ptr<PendingFile>> m_submitted;
+    uint64_t m_bytesInFlight = 0;
+    uint32_t m_filesInFlight = 0;
+    std::exception_ptr m_error;
+    // Set when the I/O threads gave up, Write fails from then on.
+    bool m_stopped = false;
+    uint32_t m_runningThreads = 0;
+    std::vector<std::unique_ptr<PendingFile>> m_openFiles;
+    size_t m_maxOpenFiles = 0;
+    uint64_t m_filesWritten = 0;
+    uint64_t m_bytesWritten = 0;
+    Statistics m_fileLatency;
+};
@@ -0,0 +1,165 @@
+#include "pch.h"
+#include "Benchmark.h"
+#include "Compose.h"
+#include "SyntheticCaptureSource.h"
+#include "Statistics.h"
+
+namespace winrt
+{
+    using namespace Windows::Foundation;
+    using namespace Windows::Graphics::DirectX;
+}
+
+namespace util
+{
+    using namespace robmikh::common::uwp;
+}
+
+enum class BenchmarkStage
+{
+    Capture,
+    ToneMap,
+    Compose,
+    Readback,
+    Encode,
+    Count,
+};
+
+wchar_t const* const StageNames[] = { L"capture", L"tonemap", L"compose", L"readback", L"encode" };
+
+// D3D calls are asynchronous, so a stage that only issues GPU work
+// isn't done until the GPU says it is.
+void WaitForGpu(winrt::com_ptr<ID3D11Device> const& d3dDevice)
+{
+    winrt::com_ptr<ID3D11DeviceContext> d3dContext;
+    d3dDevice->GetImmediateContext(d3dContext.put());
+    auto multithreadLock = util::D3D11DeviceLock(d3dDevice.as<ID3D11Multithread>().get());
+
+    D3D11_QUERY_DESC queryDesc = {};
+    queryDesc.Query = D3D11_QUERY_EVENT;
+    winrt::com_ptr<ID3D11Query> query;
+    winrt::check_hresult(d3dDevice->CreateQuery(&queryDesc, query.put()));
+    d3dContext->End(query.get());
+    while (d3dContext->GetData(query.get(), nullptr, 0, 0) == S_FALSE)
+    {
+        std::this_thread::yield();
+    }
+}
+
+winrt::IAsyncAction RunBenchmarkAsync(
+    winrt::com_ptr<ID3D11Device> const& d3dDevice,
+    std::shared_ptr<ToneMapper> const& toneMapper,
+    std::shared_ptr<ImageEncoder> const& encoder,
+    uint32_t iterations,
+    std::wstring const& csvPath)
+{
+    auto device = d3dDevice;
+    auto hdrToneMapper = toneMapper;
+    auto imageEncoder = encoder;
+    auto outputPath = csvPath;
+
+    std::wstringstream csv;
+    csv << L"scenario,megapixels,stage,min_ms,avg_ms,max_ms" << std::endl;
+
+    wprintf(L"%-10s %9s", L"scenario", L"MP");
+    for (auto stageName : StageNames)
+    {
+        wprintf(L" %12s", stageName);
+    }
+    wprintf(L" %12s\n", L"total");
+
+    for (auto&& presetName : SyntheticCaptureSource::LayoutPresets())
+    {
+        auto displays = SyntheticCaptureSource::ParseLayout(presetName);
+        auto captureSource = std::make_shared<SyntheticCaptureSource>(device);
+        auto unionRect = ComputeUnionRect(displays);
+        auto megapixels = static_cast<double>(unionRect.right - unionRect.left) * static_cast<double>(unionRect.bottom - unionRect.top) / 1000000.0;
+
+        std::array<Statistics, static_cast<size_t>(BenchmarkStage::Count)> timings;
+        auto record = [&timings](BenchmarkStage stage, double milliseconds)
+        {
+            timings[static_cast<size_t>(stage)].Add(milliseconds);
+        };
+
+        // The first iteration warms up caches and lazily created resources.
+        for (uint32_t iteration = 0; iteration <= iterations; iteration++)
+        {
+            auto isWarmup = iteration == 0;
+
+            auto start = std::chrono::steady_clock::now();
+            std::vector<winrt::com_ptr<ID3D11Texture2D>> captures;
+            for (auto&& display : displays)
+            {
+                auto pixelFormat = display.IsHDR() ? winrt::DirectXPixelFormat::R16G16B16A16Float : winrt::DirectXPixelFormat::B8G8R8A8UIntNormalized;
+                captures.push_back(co_await captureSource->CaptureAsync(display, pixelFormat));
+            }
+            WaitForGpu(device);
+            auto captureTime = MillisecondsSince(start);
+
+            start = std::chrono::steady_clock::now();
+            std::vector<Snapshot> snapshots;
+            for (size_t i = 0; i < displays.size(); i++)
+            {
+                auto&& display = displays[i];
+                auto texture = captures[i];
+                if (display.IsHDR())
+                {
+                    texture = hdrToneMapper->ProcessTexture(texture, display.SDRWhiteLevelInNits(), display.MaxLuminance());
+                }
+                snapshots.push_back(Snapshot{ texture, display.Rect() });
+            }
+            WaitForGpu(device);
+            auto toneMapTime = MillisecondsSince(start);
+
+            start = std::chrono::steady_clock::now();
+            auto& texturePool = *hdrToneMapper->Pool();
+            auto composedTexture = ComposeSnapshots(device, texturePool, unionRect, snapshots);
+            WaitForGpu(device);
+            auto composeTime = MillisecondsSince(start);
+
+            start = std::chrono::steady_clock::now();
+            auto pixels = texturePool.MapTexture(composedTexture);
+            auto readbackTime = MillisecondsSince(start);
+
+            start = std::chrono::steady_clock::now();
+            auto encodedBytes = imageEncoder->Encode(pixels.Data(), pixels.RowPitch(), pixels.Desc().Width, pixels.Desc().Height);
+            auto encodeTime = MillisecondsSince(start);
+            // Unmaps and recycles the staging texture.
+            pixels = {};
+
+            // Later iterations reuse these, like repeated captures do.
+            RecycleSnapshots(texturePool, snapshots);
+            texturePool.Recycle(composedTexture);
+
+            if (!isWarmup)
+            {
+                record(BenchmarkStage::Capture, captureTime);
+                record(BenchmarkStage::ToneMap, toneMapTime);
+                record(BenchmarkStage::Compose, composeTime);
+                record(BenchmarkStage::Readback, readbackTime);
+                record(BenchmarkStage::Encode, encodeTime);
+            }
+        }
+
+        wprintf(L"%-10s %9.1f", presetName.c_str(), megapixels);
+        double total = 0.0;
+        for (size_t stage = 0; stage < timings.size(); stage++)
+        {
+            auto&& stageTimings = timings[stage];
+            total += stageTimings.Average();
+            wprintf(L" %9.2f ms", stageTimings.Average());
+            csv << presetName << L"," << megapixels << L"," << StageNames[stage] << L","
+                << stageTimings.Min() << L"," << stageTimings.Average() << L"," << stageTimings.Max() << std::endl;
+        }
+        wprintf(L" %9.2f ms\n", total);
+    }
+
+    if (!outputPath.empty())
+    {
+        std::wofstream file(outputPath);
+        file << csv.str();
+        wprintf(L"Wrote benchmark results to %s\n", outputPath.c_str());
+    }
+
+    co_return;
+}
@@ -0,0 +1,13 @@
+#pragma once
+#include "ToneMapper.h"
+#include "ImageEncoder.h"
+
+// Times each stage of the pipeline (capture, tone map, compose, readback
+// and encode) for every synthetic layout preset, using synthetic captures.
+// Results are printed, and written as CSV to csvPath if it isn't empty.
+winrt::Windows::Foundation::IAsyncAction RunBenchmarkAsync(
+    winrt::com_ptr<ID3D11Device> const& d3dDevice,
+    std::shared_ptr<ToneMapper> const& toneMapper,
+    std::shared_ptr<ImageEncoder> const& encoder,
+    uint32_t iterations,
+    std::wstring const& csvPath);
@@ -0,0 +1,64 @@
+#include "pch.h"
+#include "BmpEncoder.h"
+#include "Trace.h"
+#include "PixelConversion.h"
+
+// How many rows are prepared at a time.
+constexpr uint32_t BandRowCount = 256;
+
+constexpr uint32_t BmpHeadersSize = sizeof(BITMAPFILEHEADER) + sizeof(BITMAPINFOHEADER);
+
+size_t GetBmpRowSize(uint32_t width)
+{
+    return (static_cast<size_t>(width) * 3 + 3) & ~static_cast<size_t>(3);
+}
+
+void BmpEncoder::EncodeStreaming(
+    uint32_t width,
+    uint32_t height,
+    ImageRowSource& source,
+    std::function<void(uint8_t const*, size_t)> const& write)
+{
+    TraceScope trace("EncodeBmp");
+    // The file size is stored in 32 bits.
+    auto fileSize = EstimateSize(width, height);
+    if (fileSize > std::numeric_limits<uint32_t>::max() || height > static_cast<uint32_t>(std::numeric_limits<int32_t>::max()))
+    {
+        throw winrt::hresult_invalid_argument(L"The image is too large to be saved as a BMP!");
+    }
+
+    uint8_t headers[BmpHeadersSize] = {};
+    auto fileHeader = reinterpret_cast<BITMAPFILEHEADER*>(headers);
+    fileHeader->bfType = 'MB';
+    fileHeader->bfSize = static_cast<uint32_t>(fileSize);
+    fileHeader->bfOffBits = BmpHeadersSize;
+    auto infoHeader = reinterpret_cast<BITMAPINFOHEADER*>(headers + sizeof(BITMAPFILEHEADER));
+    infoHeader->biSize = sizeof(BITMAPINFOHEADER);
+    infoHeader->biWidth = static_cast<LONG>(width);
+    // A negative height means the rows are stored top down.
+    infoHeader->biHeight = -static_cast<LONG>(height);
+    infoHeader->biPlanes = 1;
+    infoHeader->biBitCount = 24;
+    infoHeader->biCompression = BI_RGB;
+    infoHeader->biSizeImage = static_cast<uint32_t>(fileSize - BmpHeadersSize);
+    write(headers, sizeof(headers));
+
+    // Rows are padded to 4 bytes, the padding stays zero.
+    auto rowSize = GetBmpRowSize(width);
+    std::vector<uint8_t> band(rowSize * std::min(BandRowCount, height), 0);
+    for (uint32_t bandStartRow = 0; bandStartRow < height; bandStartRow += BandRowCount)
+    {
+        auto bandEndRow = std::min(bandStartRow + BandRowCount, height);
+        source.PrepareRows(bandStartRow, bandEndRow);
+        for (auto row = bandStartRow; row < bandEndRow; row++)
+        {
+            ConvertBgraToBgr(source.GetRow(row), band.data() + rowSize * (row - bandStartRow), width);
+        }
+        write(band.data(), rowSize * (bandEndRow - bandStartRow));
+    }
+}
+
+uint64_t BmpEncoder::EstimateSize(uint32_t width, uint32_t height) const
+{
+    return BmpHeadersSize + static_cast<uint64_t>(GetBmpRowSize(width)) * height;
+}
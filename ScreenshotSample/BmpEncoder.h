@@ -0,0 +1,19 @@
+#pragma once
+#include "ImageEncoder.h"
+
+// Writes an uncompressed, top down, 24bpp BMP. Anything can open it and
+// there's nothing to do but drop the alpha from each row.
+class BmpEncoder : public ImageEncoder
+{
+public:
+    BmpEncoder() {}
+    ~BmpEncoder() override {}
+
+    ImageFormat Format() const override { return ImageFormat::Bmp; }
+    void EncodeStreaming(
+        uint32_t width,
+        uint32_t height,
+        ImageRowSource& source,
+        std::function<void(uint8_t const*, size_t)> const& write) override;
+    uint64_t EstimateSize(uint32_t width, uint32_t height) const override;
+};
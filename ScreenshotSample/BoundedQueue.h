@@ -0,0 +1,81 @@
+#pragma once
+
+// A blocking queue with a fixed capacity. Push blocks while the queue is
+// full, which is how a slow consumer pushes back on its producer. Closing
+// the queue wakes everyone up: Push drops its item and Pop returns nothing
+// once the queue is empty.
+template <typename T>
+class BoundedQueue
+{
+public:
+    BoundedQueue(size_t capacity) : m_capacity(std::max<size_t>(capacity, 1)) {}
+    ~BoundedQueue() {}
+
+    // Returns false if the queue was closed.
+    bool Push(T item)
+    {
+        std::unique_lock lock(m_lock);
+        if (m_items.size() >= m_capacity && !m_closed)
+        {
+            auto blockedStart = std::chrono::steady_clock::now();
+            m_notFull.wait(lock, [&] { return m_items.size() < m_capacity || m_closed; });
+            m_blockedTime += std::chrono::steady_clock::now() - blockedStart;
+            m_blockedPushes++;
+        }
+        if (m_closed)
+        {
+            return false;
+        }
+        m_items.push_back(std::move(item));
+        m_pushes++;
+        m_depthTotal += m_items.size();
+        m_maxDepth = std::max(m_maxDepth, m_items.size());
+        m_notEmpty.notify_one();
+        return true;
+    }
+
+    std::optional<T> Pop()
+    {
+        std::unique_lock lock(m_lock);
+        m_notEmpty.wait(lock, [&] { return !m_items.empty() || m_closed; });
+        if (m_items.empty())
+        {
+            return std::nullopt;
+        }
+        auto item = std::move(m_items.front());
+        m_items.pop_front();
+        m_notFull.notify_one();
+        return item;
+    }
+
+    void Close()
+    {
+        std::scoped_lock lock(m_lock);
+        m_closed = true;
+        m_notEmpty.notify_all();
+        m_notFull.notify_all();
+    }
+
+    size_t Capacity() const { return m_capacity; }
+
+    // Depth is measured right after each push.
+    size_t MaxDepth() const { std::scoped_lock lock(m_lock); return m_maxDepth; }
+    double AverageDepth() const { std::scoped_lock lock(m_lock); return m_pushes > 0 ? static_cast<double>(m_depthTotal) / m_pushes : 0.0; }
+    // How many pushes had to wait for room, and for how long in total.
+    uint64_t BlockedPushes() const { std::scoped_lock lock(m_lock); return m_blockedPushes; }
+    double BlockedMilliseconds() const { std::scoped_lock lock(m_lock); return std::chrono::duration<double, std::milli>(m_blockedTime).count(); }
+
+private:
+    size_t const m_capacity;
+    mutable std::mutex m_lock;
+    std::condition_variable m_notEmpty;
+    std::condition_variable m_notFull;
+    std::deque<T> m_items;
+    bool m_closed = false;
+
+    uint64_t m_pushes = 0;
+    uint64_t m_depthTotal = 0;
+    size_t m_maxDepth = 0;
+    uint64_t m_blockedPushes = 0;
+    std::chrono::steady_clock::duration m_blockedTime{ 0 };
+};
@@ -0,0 +1,328 @@
+#include "pch.h"
+#include "CapturePipeline.h"
+#include "Trace.h"
+#include "Output.h"
+
+namespace util
+{
+    using namespace robmikh::common::uwp;
+}
+
+CapturePipeline::CapturePipeline(
+    winrt::com_ptr<ID3D11Device> const& d3dDevice,
+    std::shared_ptr<ImageEncoder> const& encoder,
+    std::shared_ptr<TimelapseWriter> const& timelapse,
+    std::shared_ptr<AsyncFileWriter> const& asyncWriter,
+    uint32_t queueDepth,
+    FileWriteMode fileMode) :
+    m_stagingTextureCount(2 * queueDepth + 2),
+    m_freeStagingTextures(2 * queueDepth + 2),
+    m_readbackQueue(queueDepth),
+    m_encodeQueue(queueDepth),
+    m_writeQueue(queueDepth)
+{
+    m_d3dDevice = d3dDevice;
+    m_d3dDevice->GetImmediateContext(m_d3dContext.put());
+    m_d3dMultithread = m_d3dDevice.as<ID3D11Multithread>();
+    m_encoder = encoder;
+    m_timelapse = timelapse;
+    m_asyncWriter = asyncWriter;
+    m_fileMode = fileMode;
+
+    auto d3dDevice5 = m_d3dDevice.try_as<ID3D11Device5>();
+    m_d3dContext4 = m_d3dContext.try_as<ID3D11DeviceContext4>();
+    if (d3dDevice5 && m_d3dContext4 && SUCCEEDED(d3dDevice5->CreateFence(0, D3D11_FENCE_FLAG_NONE, winrt::guid_of<ID3D11Fence>(), m_fence.put_void())))
+    {
+        m_fenceEvent.create(wil::EventOptions::None);
+    }
+
+    m_threads.emplace_back([this]() { RunStage("Readback", &CapturePipeline::ReadbackLoop); });
+    m_threads.emplace_back([this]() { RunStage("Encode", &CapturePipeline::EncodeLoop); });
+    m_threads.emplace_back([this]() { RunStage("Write", &CapturePipeline::WriteLoop); });
+}
+
+CapturePipeline::~CapturePipeline()
+{
+    // If Finish wasn't called, we're being torn down because of an error.
+    Close();
+    for (auto&& thread : m_threads)
+    {
+        if (thread.joinable())
+        {
+            thread.join();
+        }
+    }
+}
+
+void CapturePipeline::Submit(
+    winrt::com_ptr<ID3D11Texture2D> const& texture,
+    std::wstring const& fileName,
+    std::chrono::steady_clock::time_point shotStart)
+{
+    TraceScope trace("Submit");
+    D3D11_TEXTURE2D_DESC desc = {};
+    texture->GetDesc(&desc);
+    auto stagingTexture = AcquireStagingTexture(desc);
+
+    PendingReadback readback = {};
+    readback.StagingTexture = stagingTexture;
+    readback.FileName = fileName;
+    readback.ShotStart = shotStart;
+    {
+        auto multithreadLock = util::D3D11DeviceLock(m_d3dMultithread.get());
+        m_d3dContext->CopyResource(stagingTexture.get(), texture.get());
+        if (m_fence)
+        {
+            readback.FenceValue = ++m_fenceValue;
+            winrt::check_hresult(m_d3dContext4->Signal(m_fence.get(), readback.FenceValue));
+        }
+        else
+        {
+            D3D11_QUERY_DESC queryDesc = {};
+            queryDesc.Query = D3D11_QUERY_EVENT;
+            winrt::check_hresult(m_d3dDevice->CreateQuery(&queryDesc, readback.Query.put()));
+            m_d3dContext->End(readback.Query.get());
+        }
+        // Get the copy started now rather than whenever the next flush happens.
+        m_d3dContext->Flush();
+    }
+
+    if (!m_readbackQueue.Push(std::move(readback)))
+    {
+        RethrowError();
+    }
+}
+
+void CapturePipeline::Finish()
+{
+    // Each stage closes the next queue once it runs out of work.
+    m_readbackQueue.Close();
+    for (auto&& thread : m_threads)
+    {
+        thread.join();
+    }
+    RethrowError();
+}
+
+winrt::com_ptr<ID3D11Texture2D> CapturePipeline::AcquireStagingTexture(D3D11_TEXTURE2D_DESC const& desc)
+{
+    winrt::com_ptr<ID3D11Texture2D> stagingTexture;
+    if (m_stagingTexturesCreated < m_stagingTextureCount)
+    {
+        m_stagingTexturesCreated++;
+    }
+    else
+    {
+        // Wait for encode to hand one back.
+        auto waitStart = std::chrono::steady_clock::now();
+        auto freeTexture = m_freeStagingTextures.Pop();
+        m_stagingWait.Add(MillisecondsSince(waitStart));
+        if (!freeTexture.has_value())
+        {
+            RethrowError();
+            throw winrt::hresult_illegal_method_call(L"The capture pipeline has been closed.");
+        }
+        stagingTexture = freeTexture.value();
+
+        D3D11_TEXTURE2D_DESC stagingDesc = {};
+        stagingTexture->GetDesc(&stagingDesc);
+        if (stagingDesc.Width != desc.Width || stagingDesc.Height != desc.Height || stagingDesc.Format != desc.Format)
+        {
+            stagingTexture = nullptr;
+        }
+    }
+
+    if (!stagingTexture)
+    {
+        auto stagingDesc = desc;
+        stagingDesc.Usage = D3D11_USAGE_STAGING;
+        stagingDesc.BindFlags = 0;
+        stagingDesc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+        stagingDesc.MiscFlags = 0;
+        winrt::check_hresult(m_d3dDevice->CreateTexture2D(&stagingDesc, nullptr, stagingTexture.put()));
+    }
+    return stagingTexture;
+}
+
+void CapturePipeline::WaitForCopy(PendingReadback const& readback)
+{
+    if (m_fence)
+    {
+        winrt::check_hresult(m_fence->SetEventOnCompletion(readback.FenceValue, m_fenceEvent.get()));
+        m_fenceEvent.wait();
+        return;
+    }
+
+    while (true)
+    {
+        {
+            auto multithreadLock = util::D3D11DeviceLock(m_d3dMultithread.get());
+            if (m_d3dContext->GetData(readback.Query.get(), nullptr, 0, D3D11_ASYNC_GETDATA_DONOTFLUSH) == S_OK)
+            {
+                return;
+            }
+        }
+        std::this_thread::yield();
+    }
+}
+
+void CapturePipeline::ReadbackLoop()
+{
+    while (auto readback = m_readbackQueue.Pop())
+    {
+        TraceScope trace("Readback");
+        auto start = std::chrono::steady_clock::now();
+        // Map would also wait for the copy, but with the device lock held.
+        {
+            TraceScope waitTrace("WaitForCopy");
+            WaitForCopy(readback.value());
+        }
+
+        D3D11_TEXTURE2D_DESC desc = {};
+        readback->StagingTexture->GetDesc(&desc);
+        D3D11_MAPPED_SUBRESOURCE mapped = {};
+        {
+            auto multithreadLock = util::D3D11DeviceLock(m_d3dMultithread.get());
+            winrt::check_hresult(m_d3dContext->Map(readback->StagingTexture.get(), 0, D3D11_MAP_READ, 0, &mapped));
+        }
+
+        // Encode unmaps it once it's done with the pixels.
+        PendingEncode encode = {};
+        encode.StagingTexture = std::move(readback->StagingTexture);
+        encode.Pixels = static_cast<uint8_t const*>(mapped.pData);
+        encode.Width = desc.Width;
+        encode.Height = desc.Height;
+        encode.Stride = mapped.RowPitch;
+        encode.FileName = std::move(readback->FileName);
+        encode.ShotStart = readback->ShotStart;
+        m_readbackTime.Add(MillisecondsSince(start));
+
+        if (!m_encodeQueue.Push(std::move(encode)))
+        {
+            break;
+        }
+    }
+    m_encodeQueue.Close();
+}
+
+void CapturePipeline::EncodeLoop()
+{
+    while (auto encode = m_encodeQueue.Pop())
+    {
+        TraceScope trace("Encode");
+        auto start = std::chrono::steady_clock::now();
+        PendingWrite write = {};
+        if (m_timelapse)
+        {
+            m_timelapse->AddFrame(encode->Pixels, encode->Stride, encode->Width, encode->Height);
+        }
+        else
+        {
+            write.Bytes = m_encoder->Encode(encode->Pixels, encode->Stride, encode->Width, encode->Height);
+        }
+        {
+            auto multithreadLock = util::D3D11DeviceLock(m_d3dMultithread.get());
+            m_d3dContext->Unmap(encode->StagingTexture.get(), 0);
+        }
+        m_freeStagingTextures.Push(std::move(encode->StagingTexture));
+        write.FileName = std::move(encode->FileName);
+        write.ShotStart = encode->ShotStart;
+        m_encodeTime.Add(MillisecondsSince(start));
+
+        // The timelapse has already written it.
+        if (m_timelapse)
+        {
+            m_shotLatency.Add(MillisecondsSince(write.ShotStart));
+            continue;
+        }
+        if (!m_writeQueue.Push(std::move(write)))
+        {
+            break;
+        }
+    }
+    m_writeQueue.Close();
+}
+
+void CapturePipeline::WriteLoop()
+{
+    while (auto write = m_writeQueue.Pop())
+    {
+        TraceScope trace("Write");
+        auto start = std::chrono::steady_clock::now();
+        if (m_asyncWriter)
+        {
+            // Only queued, the shot's latency doesn't include the write.
+            m_asyncWriter->Write(GetLocalFilePath(write->FileName), std::move(write->Bytes));
+        }
+        else
+        {
+            WriteBytesToFile(write->FileName, write->Bytes, m_fileMode);
+        }
+        m_writeTime.Add(MillisecondsSince(start));
+        m_shotLatency.Add(MillisecondsSince(write->ShotStart));
+    }
+}
+
+void CapturePipeline::RunStage(char const* name, void (CapturePipeline::*loop)())
+{
+    Trace::SetThreadName(name);
+    try
+    {
+        (this->*loop)();
+    }
+    catch (...)
+    {
+        {
+            std::scoped_lock lock(m_errorLock);
+            if (!m_error)
+            {
+                m_error = std::current_exception();
+            }
+        }
+        // Stop everyone else, there's no point in finishing.
+        Close();
+    }
+}
+
+void CapturePipeline::Close()
+{
+    m_freeStagingTextures.Close();
+    m_readbackQueue.Close();
+    m_encodeQueue.Close();
+    m_writeQueue.Close();
+}
+
+void CapturePipeline::RethrowError()
+{
+    std::scoped_lock lock(m_errorLock);
+    if (m_error)
+    {
+        std::rethrow_exception(m_error);
+    }
+}
+
+template <typename T>
+void PrintQueueStatistics(wchar_t const* name, BoundedQueue<T> const& queue)
+{
+    wprintf(L"  %-16s depth avg %5.2f  max %zu/%zu  blocked %llu times for %.2f ms\n",
+        name,
+        queue.AverageDepth(),
+        queue.MaxDepth(),
+        queue.Capacity(),
+        static_cast<unsigned long long>(queue.BlockedPushes()),
+        queue.BlockedMilliseconds());
+}
+
+void CapturePipeline::PrintStatistics() const
+{
+    wprintf(L"Pipeline stages:\n");
+    ::PrintStatistics(L"staging wait", m_stagingWait);
+    ::PrintStatistics(L"readback", m_readbackTime);
+    ::PrintStatistics(L"encode", m_encodeTime);
+    ::PrintStatistics(L"write", m_writeTime);
+    ::PrintStatistics(L"shot latency", m_shotLatency);
+    wprintf(L"Pipeline queues:\n");
+    PrintQueueStatistics(L"readback queue", m_readbackQueue);
+    PrintQueueStatistics(L"encode queue", m_encodeQueue);
+    PrintQueueStatistics(L"write queue", m_writeQueue);
+}
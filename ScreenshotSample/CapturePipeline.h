@@ -0,0 +1,117 @@
+#pragma once
+#include "BoundedQueue.h"
+#include "ImageEncoder.h"
+#include "FileWriter.h"
+#include "Statistics.h"
+#include "TimelapseWriter.h"
+#include "AsyncFileWriter.h"
+
+// Overlaps the stages of taking many screenshots. The caller captures and
+// composes frames and submits them; readback, encoding and writing each run
+// on their own thread, connected by bounded queues. Readback copies into a
+// ring of staging textures and waits for the GPU off the capture thread, so
+// frame N+1 can be captured while frame N is still being encoded. The encoder
+// reads straight from the mapped staging texture, which stays mapped until
+// it's done. When any stage falls behind, the queues fill up and Submit
+// blocks. With a timelapse, the encode stage appends frames to it instead,
+// and nothing goes through the write stage. With an AsyncFileWriter, the
+// write stage only hands files to it, and the caller flushes it.
+class CapturePipeline
+{
+public:
+    // queueDepth is the capacity of each queue. Staging textures are held
+    // until their frame is encoded, so there are enough to fill the readback
+    // and encode queues with one more in each of those stages.
+    CapturePipeline(
+        winrt::com_ptr<ID3D11Device> const& d3dDevice,
+        std::shared_ptr<ImageEncoder> const& encoder,
+        std::shared_ptr<TimelapseWriter> const& timelapse,
+        std::shared_ptr<AsyncFileWriter> const& asyncWriter,
+        uint32_t queueDepth,
+        FileWriteMode fileMode);
+    ~CapturePipeline();
+
+    // Queues a composed BGRA8 texture to be written to fileName.
+    void Submit(
+        winrt::com_ptr<ID3D11Texture2D> const& texture,
+        std::wstring const& fileName,
+        std::chrono::steady_clock::time_point shotStart);
+    // Waits for everything submitted so far to be written, and rethrows
+    // the first error any stage ran into.
+    void Finish();
+
+    // Only valid after Finish.
+    void PrintStatistics() const;
+
+private:
+    struct PendingReadback
+    {
+        winrt::com_ptr<ID3D11Texture2D> StagingTexture;
+        winrt::com_ptr<ID3D11Query> Query;
+        uint64_t FenceValue = 0;
+        std::wstring FileName;
+        std::chrono::steady_clock::time_point ShotStart;
+    };
+
+    struct PendingEncode
+    {
+        // Mapped, Pixels points into it.
+        winrt::com_ptr<ID3D11Texture2D> StagingTexture;
+        uint8_t const* Pixels = nullptr;
+        uint32_t Width = 0;
+        uint32_t Height = 0;
+        uint32_t Stride = 0;
+        std::wstring FileName;
+        std::chrono::steady_clock::time_point ShotStart;
+    };
+
+    struct PendingWrite
+    {
+        std::vector<uint8_t> Bytes;
+        std::wstring FileName;
+        std::chrono::steady_clock::time_point ShotStart;
+    };
+
+    winrt::com_ptr<ID3D11Texture2D> AcquireStagingTexture(D3D11_TEXTURE2D_DESC const& desc);
+    void WaitForCopy(PendingReadback const& readback);
+    void ReadbackLoop();
+    void EncodeLoop();
+    void WriteLoop();
+    void RunStage(char const* name, void (CapturePipeline::*loop)());
+    void Close();
+    void RethrowError();
+
+private:
+    winrt::com_ptr<ID3D11Device> m_d3dDevice;
+    winrt::com_ptr<ID3D11DeviceContext> m_d3dContext;
+    winrt::com_ptr<ID3D11Multithread> m_d3dMultithread;
+    std::shared_ptr<ImageEncoder> m_encoder;
+    std::shared_ptr<TimelapseWriter> m_timelapse;
+    std::shared_ptr<AsyncFileWriter> m_asyncWriter;
+    FileWriteMode m_fileMode = FileWriteMode::Plain;
+
+    // Fences let readback sleep until the copy is done. Without them
+    // we fall back to polling an event query.
+    winrt::com_ptr<ID3D11DeviceContext4> m_d3dContext4;
+    winrt::com_ptr<ID3D11Fence> m_fence;
+    uint64_t m_fenceValue = 0;
+    wil::unique_event m_fenceEvent;
+
+    uint32_t m_stagingTextureCount = 0;
+    uint32_t m_stagingTexturesCreated = 0;
+    BoundedQueue<winrt::com_ptr<ID3D11Texture2D>> m_freeStagingTextures;
+    BoundedQueue<PendingReadback> m_readbackQueue;
+    BoundedQueue<PendingEncode> m_encodeQueue;
+    BoundedQueue<PendingWrite> m_writeQueue;
+    std::vector<std::thread> m_threads;
+
+    std::mutex m_errorLock;
+    std::exception_ptr m_error;
+
+    // Each of these is only touched by one stage.
+    Statistics m_stagingWait;
+    Statistics m_readbackTime;
+    Statistics m_encodeTime;
+    Statistics m_writeTime;
+    Statistics m_shotLatency;
+};
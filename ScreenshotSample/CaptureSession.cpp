@@ -0,0 +1,167 @@
+#include "pch.h"
+#include "CaptureSession.h"
+
+namespace winrt
+{
+    using namespace Windows::Foundation;
+    using namespace Windows::Graphics;
+    using namespace Windows::Graphics::Capture;
+    using namespace Windows::Graphics::DirectX;
+    using namespace Windows::Graphics::DirectX::Direct3D11;
+}
+
+namespace util
+{
+    using namespace robmikh::common::desktop;
+    using namespace robmikh::common::uwp;
+}
+
+std::shared_ptr<CaptureSession> CaptureSession::Create(
+    winrt::IDirect3DDevice const& device,
+    Display const& display,
+    winrt::DirectXPixelFormat pixelFormat,
+    uint32_t bufferCount)
+{
+    auto session = std::make_shared<CaptureSession>(device, display, pixelFormat, bufferCount);
+    session->Start();
+    return session;
+}
+
+CaptureSession::CaptureSession(
+    winrt::IDirect3DDevice const& device,
+    Display const& display,
+    winrt::DirectXPixelFormat pixelFormat,
+    uint32_t bufferCount) : m_firstFrameEvent(wil::EventOptions::ManualReset)
+{
+    m_device = device;
+    m_d3dDevice = GetDXGIInterfaceFromObject<ID3D11Device>(device);
+    m_d3dDevice->GetImmediateContext(m_d3dContext.put());
+    m_d3dMultithread = m_d3dDevice.as<ID3D11Multithread>();
+    m_pixelFormat = pixelFormat;
+    // We always hold on to one frame, so we need at least one more
+    // buffer for new frames to arrive in.
+    m_bufferCount = std::max(bufferCount, 2u);
+
+    m_item = util::CreateCaptureItemForMonitor(display.Handle());
+    m_lastSize = m_item.Size();
+    m_framePool = winrt::Direct3D11CaptureFramePool::CreateFreeThreaded(
+        m_device,
+        m_pixelFormat,
+        m_bufferCount,
+        m_lastSize);
+    m_session = m_framePool.CreateCaptureSession(m_item);
+}
+
+void CaptureSession::Start()
+{
+    // A frame can already be on its way when the session is destroyed and
+    // the handler revoked, so it only gets a weak reference.
+    m_frameArrived = m_framePool.FrameArrived(winrt::auto_revoke, [weakThis = weak_from_this()](auto&& sender, auto&& args)
+        {
+            if (auto strongThis = weakThis.lock())
+            {
+                strongThis->OnFrameArrived(sender, args);
+            }
+        });
+    m_session.StartCapture();
+}
+
+void CaptureSession::Close()
+{
+    m_frameArrived.revoke();
+    std::scoped_lock lock(m_lock);
+    if (m_latestFrame)
+    {
+        m_latestFrame.Close();
+        m_latestFrame = nullptr;
+    }
+    if (m_session)
+    {
+        m_session.Close();
+        m_session = nullptr;
+    }
+    if (m_framePool)
+    {
+        m_framePool.Close();
+        m_framePool = nullptr;
+    }
+}
+
+void CaptureSession::OnFrameArrived(winrt::Direct3D11CaptureFramePool const& sender, winrt::IInspectable const&)
+{
+    // Drain the pool, we only care about the newest frame.
+    winrt::Direct3D11CaptureFrame frame{ nullptr };
+    while (auto nextFrame = sender.TryGetNextFrame())
+    {
+        if (frame)
+        {
+            frame.Close();
+        }
+        frame = nextFrame;
+    }
+    if (!frame)
+    {
+        return;
+    }
+
+    // If the display changed size, the pool needs to change with it.
+    auto contentSize = frame.ContentSize();
+    if (contentSize.Width != m_lastSize.Width || contentSize.Height != m_lastSize.Height)
+    {
+        m_lastSize = contentSize;
+        sender.Recreate(m_device, m_pixelFormat, m_bufferCount, m_lastSize);
+    }
+
+    {
+        std::scoped_lock lock(m_lock);
+        // Returning the previous frame to the pool frees
+        // up its buffer for the next one.
+        if (m_latestFrame)
+        {
+            m_latestFrame.Close();
+        }
+        m_latestFrame = frame;
+        m_frameCount++;
+    }
+    m_firstFrameEvent.SetEvent();
+}
+
+wil::task<CaptureFrame> CaptureSession::CaptureAsync()
+{
+    co_await winrt::resume_on_signal(m_firstFrameEvent.get());
+    co_return CopyLatestFrame();
+}
+
+CaptureFrame CaptureSession::CopyLatestFrame()
+{
+    std::scoped_lock lock(m_lock);
+    if (!m_latestFrame)
+    {
+        throw winrt::hresult_illegal_method_call(L"The capture session has been closed.");
+    }
+    auto frameTexture = GetDXGIInterfaceFromObject<ID3D11Texture2D>(m_latestFrame.Surface());
+
+    // The frame goes back to the pool eventually, so the caller gets a copy.
+    D3D11_TEXTURE2D_DESC desc = {};
+    frameTexture->GetDesc(&desc);
+    desc.Usage = D3D11_USAGE_DEFAULT;
+    desc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_RENDER_TARGET;
+    desc.CPUAccessFlags = 0;
+    desc.MiscFlags = 0;
+    winrt::com_ptr<ID3D11Texture2D> texture;
+    winrt::check_hresult(m_d3dDevice->CreateTexture2D(&desc, nullptr, texture.put()));
+    {
+        auto multithreadLock = util::D3D11DeviceLock(m_d3dMultithread.get());
+        m_d3dContext->CopyResource(texture.get(), frameTexture.get());
+    }
+
+    // Frames only arrive when something changed. We can't tell what changed
+    // without the dirty region API, which needs a newer SDK than we target.
+    std::optional<std::vector<RECT>> dirtyRects;
+    if (m_frameCount == m_lastCapturedFrameCount)
+    {
+        dirtyRects.emplace();
+    }
+    m_lastCapturedFrameCount = m_frameCount;
+    return CaptureFrame{ texture, std::move(dirtyRects) };
+}
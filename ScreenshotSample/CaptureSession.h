@@ -0,0 +1,57 @@
+#pragma once
+#include "CaptureSource.h"
+
+// A long lived Windows.Graphics.Capture session for one display. The most
+// recent frame is always held on to, so a capture is a copy of that frame
+// rather than a new session. The capture system only delivers frames when
+// something changes, so the latest frame is the current state of the display.
+// Frames arrive on other threads, which only hold a weak reference, so
+// sessions are always created through Create.
+class CaptureSession : public std::enable_shared_from_this<CaptureSession>
+{
+public:
+    static std::shared_ptr<CaptureSession> Create(
+        winrt::Windows::Graphics::DirectX::Direct3D11::IDirect3DDevice const& device,
+        Display const& display,
+        winrt::Windows::Graphics::DirectX::DirectXPixelFormat pixelFormat,
+        uint32_t bufferCount);
+    CaptureSession(
+        winrt::Windows::Graphics::DirectX::Direct3D11::IDirect3DDevice const& device,
+        Display const& display,
+        winrt::Windows::Graphics::DirectX::DirectXPixelFormat pixelFormat,
+        uint32_t bufferCount);
+    ~CaptureSession() { Close(); }
+
+    // Returns a copy of the latest frame, waiting for the first one if needed.
+    // If no new frame arrived since the previous capture, the frame is
+    // reported as unchanged.
+    wil::task<CaptureFrame> CaptureAsync();
+    void Close();
+
+private:
+    void Start();
+    void OnFrameArrived(
+        winrt::Windows::Graphics::Capture::Direct3D11CaptureFramePool const& sender,
+        winrt::Windows::Foundation::IInspectable const& args);
+    CaptureFrame CopyLatestFrame();
+
+private:
+    winrt::Windows::Graphics::DirectX::Direct3D11::IDirect3DDevice m_device{ nullptr };
+    winrt::com_ptr<ID3D11Device> m_d3dDevice;
+    winrt::com_ptr<ID3D11DeviceContext> m_d3dContext;
+    winrt::com_ptr<ID3D11Multithread> m_d3dMultithread;
+    winrt::Windows::Graphics::DirectX::DirectXPixelFormat m_pixelFormat;
+    uint32_t m_bufferCount = 0;
+
+    winrt::Windows::Graphics::Capture::GraphicsCaptureItem m_item{ nullptr };
+    winrt::Windows::Graphics::Capture::Direct3D11CaptureFramePool m_framePool{ nullptr };
+    winrt::Windows::Graphics::Capture::GraphicsCaptureSession m_session{ nullptr };
+    winrt::Windows::Graphics::Capture::Direct3D11CaptureFramePool::FrameArrived_revoker m_frameArrived;
+    winrt::Windows::Graphics::SizeInt32 m_lastSize = {};
+
+    std::mutex m_lock;
+    winrt::Windows::Graphics::Capture::Direct3D11CaptureFrame m_latestFrame{ nullptr };
+    uint64_t m_frameCount = 0;
+    uint64_t m_lastCapturedFrameCount = 0;
+    wil::shared_event m_firstFrameEvent;
+};
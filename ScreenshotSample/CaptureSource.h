@@ -0,0 +1,32 @@
+#pragma once
+#include "Display.h"
+
+struct CaptureFrame
+{
+    winrt::com_ptr<ID3D11Texture2D> Texture;
+    // The parts of the frame (in texture coordinates) that may have changed
+    // since the previous capture of the same display and pixel format. Empty
+    // means nothing changed, no value means the source doesn't know.
+    std::optional<std::vector<RECT>> DirtyRects;
+};
+
+// Where Snapshot gets its frames from.
+class CaptureSource
+{
+public:
+    virtual ~CaptureSource() {}
+
+    // Returns a single frame of the display in the requested pixel format.
+    virtual wil::task<winrt::com_ptr<ID3D11Texture2D>> CaptureAsync(
+        Display const& display,
+        winrt::Windows::Graphics::DirectX::DirectXPixelFormat pixelFormat) = 0;
+
+    // Like CaptureAsync, but also reports what changed if the source can tell.
+    virtual wil::task<CaptureFrame> CaptureFrameAsync(
+        Display const& display,
+        winrt::Windows::Graphics::DirectX::DirectXPixelFormat pixelFormat)
+    {
+        auto texture = co_await CaptureAsync(display, pixelFormat);
+        co_return CaptureFrame{ texture, std::nullopt };
+    }
+};
@@ -0,0 +1,97 @@
+#include "pch.h"
+#include "Checksum.h"
+
+constexpr uint32_t AdlerModulus = 65521;
+// The most bytes we can sum before the 32-bit sums could overflow.
+constexpr size_t AdlerMaxRun = 5552;
+
+// Slicing-by-8 tables for the reflected 0xEDB88320 polynomial.
+std::array<std::array<uint32_t, 256>, 8> BuildCrcTables()
+{
+    std::array<std::array<uint32_t, 256>, 8> tables = {};
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        auto crc = i;
+        for (uint32_t bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320u : crc >> 1;
+        }
+        tables[0][i] = crc;
+    }
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        for (uint32_t table = 1; table < 8; table++)
+        {
+            auto previous = tables[table - 1][i];
+            tables[table][i] = (previous >> 8) ^ tables[0][previous & 0xff];
+        }
+    }
+    return tables;
+}
+
+uint32_t Crc32(uint8_t const* data, size_t size, uint32_t crc)
+{
+    static auto const tables = BuildCrcTables();
+
+    crc = ~crc;
+    while (size >= 8)
+    {
+        uint32_t low = 0;
+        uint32_t high = 0;
+        memcpy(&low, data, sizeof(low));
+        memcpy(&high, data + 4, sizeof(high));
+        low ^= crc;
+        crc = tables[7][low & 0xff] ^
+            tables[6][(low >> 8) & 0xff] ^
+            tables[5][(low >> 16) & 0xff] ^
+            tables[4][low >> 24] ^
+            tables[3][high & 0xff] ^
+            tables[2][(high >> 8) & 0xff] ^
+            tables[1][(high >> 16) & 0xff] ^
+            tables[0][high >> 24];
+        data += 8;
+        size -= 8;
+    }
+    while (size > 0)
+    {
+        crc = (crc >> 8) ^ tables[0][(crc ^ *data) & 0xff];
+        data++;
+        size--;
+    }
+    return ~crc;
+}
+
+uint32_t Adler32(uint8_t const* data, size_t size, uint32_t adler)
+{
+    uint32_t a = adler & 0xffff;
+    uint32_t b = adler >> 16;
+    while (size > 0)
+    {
+        auto run = std::min(size, AdlerMaxRun);
+        size -= run;
+        while (run > 0)
+        {
+            a += *data++;
+            b += a;
+            run--;
+        }
+        a %= AdlerModulus;
+        b %= AdlerModulus;
+    }
+    return (b << 16) | a;
+}
+
+uint32_t Adler32Combine(uint32_t adler1, uint32_t adler2, size_t size2)
+{
+    uint64_t remainder = size2 % AdlerModulus;
+    uint64_t a1 = adler1 & 0xffff;
+    uint64_t b1 = adler1 >> 16;
+    uint64_t a2 = adler2 & 0xffff;
+    uint64_t b2 = adler2 >> 16;
+
+    // The second buffer's sums were started from a=1, b=0. Starting
+    // from a1 instead adds a1 - 1 to every a, and size2 * (a1 - 1) to b.
+    auto a = (a1 + a2 + AdlerModulus - 1) % AdlerModulus;
+    auto b = (b1 + b2 + remainder * a1 + AdlerModulus - remainder) % AdlerModulus;
+    return static_cast<uint32_t>((b << 16) | a);
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+// CRC-32 as used by PNG chunks and gzip. Pass the previous
+// result as crc to continue a running checksum.
+uint32_t Crc32(uint8_t const* data, size_t size, uint32_t crc = 0);
+
+// Adler-32 as used by zlib streams.
+uint32_t Adler32(uint8_t const* data, size_t size, uint32_t adler = 1);
+// Combines the checksums of two adjacent buffers, where size2
+// is the size of the second buffer.
+uint32_t Adler32Combine(uint32_t adler1, uint32_t adler2, size_t size2);
@@ -0,0 +1,402 @@
+#include "pch.h"
+#include "Compose.h"
+#include "Trace.h"
+#include "HalfFloat.h"
+
+namespace winrt
+{
+    using namespace Windows::Graphics::DirectX::Direct3D11;
+}
+
+namespace util
+{
+    using namespace robmikh::common::uwp;
+}
+
+float CLEARCOLOR[] = { 0.0f, 0.0f, 0.0f, 1.0f }; // RGBA
+
+RECT ComputeUnionRect(std::vector<Display> const& displays)
+{
+    RECT unionRect = {};
+    unionRect.left = LONG_MAX;
+    unionRect.top = LONG_MAX;
+    unionRect.right = LONG_MIN;
+    unionRect.bottom = LONG_MIN;
+    for (auto&& display : displays)
+    {
+        auto& displayRect = display.Rect();
+
+        if (unionRect.left > displayRect.left)
+        {
+            unionRect.left = displayRect.left;
+        }
+        if (unionRect.top > displayRect.top)
+        {
+            unionRect.top = displayRect.top;
+        }
+        if (unionRect.right < displayRect.right)
+        {
+            unionRect.right = displayRect.right;
+        }
+        if (unionRect.bottom < displayRect.bottom)
+        {
+            unionRect.bottom = displayRect.bottom;
+        }
+    }
+    return unionRect;
+}
+
+std::vector<Display> GetDisplaysInRegion(std::vector<Display> const& displays, RECT const& region)
+{
+    std::vector<Display> result;
+    for (auto&& display : displays)
+    {
+        RECT intersection = {};
+        if (IntersectRect(&intersection, &display.Rect(), &region))
+        {
+            result.push_back(display);
+        }
+    }
+    return result;
+}
+
+bool FitsInTexture(RECT const& rect)
+{
+    return rect.right - rect.left <= D3D11_REQ_TEXTURE2D_U_OR_V_DIMENSION &&
+        rect.bottom - rect.top <= D3D11_REQ_TEXTURE2D_U_OR_V_DIMENSION;
+}
+
+wil::task<DesktopSnapshots> TakeSnapshotsAsync(
+    std::vector<Display> const& displays,
+    std::shared_ptr<CaptureSource> const& captureSource,
+    std::shared_ptr<ToneMapper> const& toneMapper,
+    std::optional<RECT> region)
+{
+    // Determine the union of all displays, or use the region. The captures
+    // hold on to the displays they were given until they're done.
+    std::vector<wil::task<Snapshot>> futures;
+    std::vector<Display> regionDisplays;
+    RECT unionRect = {};
+    if (region.has_value())
+    {
+        unionRect = region.value();
+        regionDisplays = GetDisplaysInRegion(displays, unionRect);
+        if (regionDisplays.empty())
+        {
+            throw winrt::hresult_invalid_argument(L"The region doesn't overlap any display!");
+        }
+
+        // Capture the part of each display in the region
+        for (auto&& display : regionDisplays)
+        {
+            RECT cropRect = {};
+            IntersectRect(&cropRect, &display.Rect(), &unionRect);
+            auto future = Snapshot::TakeAsync(display, captureSource, toneMapper, cropRect);
+            futures.push_back(std::move(future));
+        }
+    }
+    else
+    {
+        unionRect = ComputeUnionRect(displays);
+
+        // Capture each display
+        for (auto&& display : displays)
+        {
+            auto future = Snapshot::TakeAsync(display, captureSource, toneMapper);
+            futures.push_back(std::move(future));
+        }
+    }
+
+    DesktopSnapshots result = {};
+    result.UnionRect = unionRect;
+    for (auto&& future : futures)
+    {
+        result.Snapshots.push_back(co_await std::move(future));
+    }
+    co_return result;
+}
+
+wil::task<winrt::com_ptr<ID3D11Texture2D>> ComposeSnapshotsAsync(
+    winrt::IDirect3DDevice const& device,
+    std::vector<Display> const& displays,
+    std::shared_ptr<CaptureSource> const& captureSource,
+    std::shared_ptr<ToneMapper> const& toneMapper,
+    std::optional<RECT> region)
+{
+    auto d3dDevice = GetDXGIInterfaceFromObject<ID3D11Device>(device);
+    auto snapshots = co_await TakeSnapshotsAsync(displays, captureSource, toneMapper, region);
+
+    auto& texturePool = *toneMapper->Pool();
+    auto composedTexture = ComposeSnapshots(d3dDevice, texturePool, snapshots.UnionRect, snapshots.Snapshots);
+    RecycleSnapshots(texturePool, snapshots.Snapshots);
+    co_return composedTexture;
+}
+
+wil::task<SparseImage> ComposeSparseSnapshotsAsync(
+    std::vector<Display> const& displays,
+    std::shared_ptr<CaptureSource> const& captureSource,
+    std::shared_ptr<ToneMapper> const& toneMapper)
+{
+    auto unionRect = ComputeUnionRect(displays);
+
+    // Capture each display
+    std::vector<wil::task<Snapshot>> futures;
+    for (auto&& display : displays)
+    {
+        auto future = Snapshot::TakeAsync(display, captureSource, toneMapper);
+        futures.push_back(std::move(future));
+    }
+
+    SparseImage image = {};
+    image.Width = static_cast<uint32_t>(unionRect.right - unionRect.left);
+    image.Height = static_cast<uint32_t>(unionRect.bottom - unionRect.top);
+    image.Origin = { unionRect.left, unionRect.top };
+    image.Background = {
+        static_cast<uint8_t>(CLEARCOLOR[2] * 255.0f),
+        static_cast<uint8_t>(CLEARCOLOR[1] * 255.0f),
+        static_cast<uint8_t>(CLEARCOLOR[0] * 255.0f),
+        static_cast<uint8_t>(CLEARCOLOR[3] * 255.0f) };
+    for (size_t i = 0; i < futures.size(); i++)
+    {
+        auto snapshot = co_await std::move(futures[i]);
+
+        D3D11_TEXTURE2D_DESC desc = {};
+        snapshot.Texture->GetDesc(&desc);
+        SparseRegion region = {};
+        region.X = snapshot.DisplayRect.left - unionRect.left;
+        region.Y = snapshot.DisplayRect.top - unionRect.top;
+        region.Width = desc.Width;
+        region.Height = desc.Height;
+        region.DisplayRect = snapshot.DisplayRect;
+        region.IsHDR = CaptureParameters::ForDisplay(displays[i]).IsHDR;
+        {
+            TraceScope trace("CopyBytesFromTexture", displays[i].Handle());
+            region.Pixels = toneMapper->Pool()->ReadTextureBytes(snapshot.Texture);
+        }
+        toneMapper->Pool()->Recycle(snapshot.Texture);
+        image.Regions.push_back(std::move(region));
+    }
+
+    co_return image;
+}
+
+winrt::com_ptr<ID3D11Texture2D> ComposeSnapshots(
+    winrt::com_ptr<ID3D11Device> const& d3dDevice,
+    TexturePool& texturePool,
+    RECT const& unionRect,
+    std::vector<Snapshot> const& snapshots)
+{
+    TraceScope trace("ComposeSnapshots");
+    if (!FitsInTexture(unionRect))
+    {
+        throw winrt::hresult_invalid_argument(L"The desktop is too big to compose into one texture!");
+    }
+    winrt::com_ptr<ID3D11DeviceContext> d3dContext;
+    d3dDevice->GetImmediateContext(d3dContext.put());
+    // Tone mapping and capture may be using the context on other threads.
+    auto multithreadLock = util::D3D11DeviceLock(d3dDevice.as<ID3D11Multithread>().get());
+
+    // Get the texture we'll compose everything to
+    D3D11_TEXTURE2D_DESC textureDesc = {};
+    textureDesc.Width = static_cast<uint32_t>(unionRect.right - unionRect.left);
+    textureDesc.Height = static_cast<uint32_t>(unionRect.bottom - unionRect.top);
+    textureDesc.MipLevels = 1;
+    textureDesc.ArraySize = 1;
+    textureDesc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
+    if (!snapshots.empty())
+    {
+        D3D11_TEXTURE2D_DESC desc = {};
+        snapshots.front().Texture->GetDesc(&desc);
+        textureDesc.Format = desc.Format;
+    }
+    textureDesc.SampleDesc.Count = 1;
+    textureDesc.Usage = D3D11_USAGE_DEFAULT;
+    textureDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_RENDER_TARGET;
+    auto composedTexture = texturePool.Acquire(textureDesc);
+    // Clear to black
+    auto composedRenderTargetView = texturePool.GetRenderTargetView(composedTexture);
+    d3dContext->ClearRenderTargetView(composedRenderTargetView.get(), CLEARCOLOR);
+
+    // Compose our textures into one texture
+    for (auto&& snapshot : snapshots)
+    {
+        D3D11_TEXTURE2D_DESC desc = {};
+        snapshot.Texture->GetDesc(&desc);
+
+        auto destX = snapshot.DisplayRect.left - unionRect.left;
+        auto destY = snapshot.DisplayRect.top - unionRect.top;
+
+        D3D11_BOX region = {};
+        region.left = 0;
+        region.right = desc.Width;
+        region.top = 0;
+        region.bottom = desc.Height;
+        region.back = 1;
+
+        TraceScope copyTrace("CopySubresourceRegion");
+        d3dContext->CopySubresourceRegion(composedTexture.get(), 0, destX, destY, 0, snapshot.Texture.get(), 0, &region);
+    }
+
+    return composedTexture;
+}
+
+void RecycleSnapshots(TexturePool& texturePool, std::vector<Snapshot> const& snapshots)
+{
+    for (auto&& snapshot : snapshots)
+    {
+        texturePool.Recycle(snapshot.Texture);
+    }
+}
+
+StripComposer::StripComposer(TexturePool& texturePool, RECT const& unionRect, std::vector<Snapshot> const& snapshots) : m_texturePool(texturePool), m_snapshots(snapshots)
+{
+    m_unionRect = unionRect;
+    m_width = static_cast<uint32_t>(unionRect.right - unionRect.left);
+    m_height = static_cast<uint32_t>(unionRect.bottom - unionRect.top);
+    m_strips.resize(snapshots.size());
+
+    // The same background ComposeSnapshots clears to.
+    auto format = DXGI_FORMAT_B8G8R8A8_UNORM;
+    if (!snapshots.empty())
+    {
+        D3D11_TEXTURE2D_DESC desc = {};
+        snapshots.front().Texture->GetDesc(&desc);
+        format = desc.Format;
+
+        winrt::com_ptr<ID3D11Device> d3dDevice;
+        snapshots.front().Texture->GetDevice(d3dDevice.put());
+        d3dDevice->GetImmediateContext(m_d3dContext.put());
+        m_d3dMultithread = d3dDevice.as<ID3D11Multithread>();
+    }
+    m_bytesPerPixel = GetBytesPerPixel(format);
+    if (format == DXGI_FORMAT_R16G16B16A16_FLOAT)
+    {
+        for (size_t channel = 0; channel < 4; channel++)
+        {
+            auto half = FloatToHalf(CLEARCOLOR[channel]);
+            memcpy(m_background.data() + channel * 2, &half, sizeof(half));
+        }
+    }
+    else
+    {
+        m_background = {
+            static_cast<uint8_t>(CLEARCOLOR[2] * 255.0f),
+            static_cast<uint8_t>(CLEARCOLOR[1] * 255.0f),
+            static_cast<uint8_t>(CLEARCOLOR[0] * 255.0f),
+            static_cast<uint8_t>(CLEARCOLOR[3] * 255.0f) };
+    }
+    m_rowPitch = static_cast<size_t>(m_width) * m_bytesPerPixel;
+}
+
+StripComposer::~StripComposer()
+{
+    for (auto&& strip : m_strips)
+    {
+        m_texturePool.Recycle(strip.StagingTexture);
+    }
+}
+
+void StripComposer::PrepareRows(uint32_t startRow, uint32_t endRow)
+{
+    TraceScope trace("ComposeStrip");
+
+    // The row above the band is needed to filter the band's first row.
+    auto copyStartRow = startRow > 0 ? startRow - 1 : 0;
+    auto rowCount = endRow - copyStartRow;
+    m_firstRow = copyStartRow;
+    m_band.resize(static_cast<size_t>(rowCount) * m_rowPitch);
+    {
+        TraceScope clearTrace("ClearStrip");
+        for (size_t offset = 0; offset < m_rowPitch; offset += m_bytesPerPixel)
+        {
+            memcpy(m_band.data() + offset, m_background.data(), m_bytesPerPixel);
+        }
+        for (uint32_t row = 1; row < rowCount; row++)
+        {
+            memcpy(m_band.data() + row * m_rowPitch, m_band.data(), m_rowPitch);
+        }
+    }
+    if (m_snapshots.empty())
+    {
+        return;
+    }
+
+    auto bandTop = m_unionRect.top + static_cast<LONG>(copyStartRow);
+    auto bandBottom = m_unionRect.top + static_cast<LONG>(endRow);
+    // Tone mapping and capture may be using the context on other threads.
+    auto multithreadLock = util::D3D11DeviceLock(m_d3dMultithread.get());
+
+    // Queue every copy before waiting on any of them.
+    for (size_t i = 0; i < m_snapshots.size(); i++)
+    {
+        auto&& snapshot = m_snapshots[i];
+        auto& strip = m_strips[i];
+        D3D11_TEXTURE2D_DESC desc = {};
+        snapshot.Texture->GetDesc(&desc);
+        strip.Top = std::max(snapshot.DisplayRect.top, bandTop);
+        strip.Bottom = std::min(snapshot.DisplayRect.top + static_cast<LONG>(desc.Height), bandBottom);
+        if (strip.Top >= strip.Bottom)
+        {
+            continue;
+        }
+
+        // A display shorter than the band never needs more than its height.
+        auto stripRows = std::min<uint32_t>(rowCount, desc.Height);
+        if (!strip.StagingTexture || strip.RowCount < stripRows)
+        {
+            auto stagingDesc = desc;
+            stagingDesc.Height = stripRows;
+            stagingDesc.MipLevels = 1;
+            stagingDesc.ArraySize = 1;
+            stagingDesc.Usage = D3D11_USAGE_STAGING;
+            stagingDesc.BindFlags = 0;
+            stagingDesc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+            stagingDesc.MiscFlags = 0;
+            m_texturePool.Recycle(strip.StagingTexture);
+            strip.StagingTexture = m_texturePool.Acquire(stagingDesc);
+            strip.RowCount = stripRows;
+        }
+
+        D3D11_BOX box = {};
+        box.left = 0;
+        box.right = desc.Width;
+        box.top = static_cast<uint32_t>(strip.Top - snapshot.DisplayRect.top);
+        box.bottom = static_cast<uint32_t>(strip.Bottom - snapshot.DisplayRect.top);
+        box.back = 1;
+        TraceScope copyTrace("CopySubresourceRegion");
+        m_d3dContext->CopySubresourceRegion(strip.StagingTexture.get(), 0, 0, 0, 0, snapshot.Texture.get(), 0, &box);
+    }
+
+    for (size_t i = 0; i < m_snapshots.size(); i++)
+    {
+        auto&& snapshot = m_snapshots[i];
+        auto& strip = m_strips[i];
+        if (strip.Top >= strip.Bottom)
+        {
+            continue;
+        }
+
+        D3D11_TEXTURE2D_DESC desc = {};
+        snapshot.Texture->GetDesc(&desc);
+        auto destX = static_cast<uint32_t>(snapshot.DisplayRect.left - m_unionRect.left);
+        auto rowBytes = static_cast<size_t>(std::min(desc.Width, m_width - destX)) * m_bytesPerPixel;
+        auto dest = m_band.data() + static_cast<size_t>(strip.Top - bandTop) * m_rowPitch + static_cast<size_t>(destX) * m_bytesPerPixel;
+
+        TraceScope readTrace("CopyBytesFromTexture");
+        D3D11_MAPPED_SUBRESOURCE mapped = {};
+        winrt::check_hresult(m_d3dContext->Map(strip.StagingTexture.get(), 0, D3D11_MAP_READ, 0, &mapped));
+        auto source = static_cast<uint8_t const*>(mapped.pData);
+        for (auto row = strip.Top; row < strip.Bottom; row++)
+        {
+            memcpy(dest, source, rowBytes);
+            dest += m_rowPitch;
+            source += mapped.RowPitch;
+        }
+        m_d3dContext->Unmap(strip.StagingTexture.get(), 0);
+    }
+}
+
+uint8_t const* StripComposer::GetRow(uint32_t row)
+{
+    return m_band.data() + static_cast<size_t>(row - m_firstRow) * m_rowPitch;
+}
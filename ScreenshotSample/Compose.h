@@ -0,0 +1,102 @@
+#pragma once
+#include "Snapshot.h"
+#include "SparseImage.h"
+#include "ImageEncoder.h"
+
+// The union of all display rects, in desktop coordinates.
+RECT ComputeUnionRect(std::vector<Display> const& displays);
+
+// The displays that overlap a region, in desktop coordinates.
+std::vector<Display> GetDisplaysInRegion(std::vector<Display> const& displays, RECT const& region);
+
+// Snapshots that haven't been composed yet, and the rect they go in, in
+// desktop coordinates.
+struct DesktopSnapshots
+{
+    RECT UnionRect = {};
+    std::vector<Snapshot> Snapshots;
+};
+
+// Whether an image this size fits in a single D3D11 texture.
+bool FitsInTexture(RECT const& rect);
+
+// Captures every display, or the part of each display in the region,
+// without composing them.
+wil::task<DesktopSnapshots> TakeSnapshotsAsync(
+    std::vector<Display> const& displays,
+    std::shared_ptr<CaptureSource> const& captureSource,
+    std::shared_ptr<ToneMapper> const& toneMapper,
+    std::optional<RECT> region = std::nullopt);
+
+// Captures every display and composes the results into one BGRA8 texture,
+// or FP16 with -keepHDR, from the tone mapper's pool. With a region, only the displays overlapping it are
+// captured, and the texture covers just the region.
+wil::task<winrt::com_ptr<ID3D11Texture2D>> ComposeSnapshotsAsync(
+    winrt::Windows::Graphics::DirectX::Direct3D11::IDirect3DDevice const& device,
+    std::vector<Display> const& displays,
+    std::shared_ptr<CaptureSource> const& captureSource,
+    std::shared_ptr<ToneMapper> const& toneMapper,
+    std::optional<RECT> region = std::nullopt);
+
+// Captures every display and reads each one back on its own, without
+// composing them into a texture covering the union of all displays.
+wil::task<SparseImage> ComposeSparseSnapshotsAsync(
+    std::vector<Display> const& displays,
+    std::shared_ptr<CaptureSource> const& captureSource,
+    std::shared_ptr<ToneMapper> const& toneMapper);
+
+// Composes snapshots that have already been taken. They all need the same
+// format, which the composed texture is created with. The composed texture
+// comes from the pool, recycle it once it's been saved.
+winrt::com_ptr<ID3D11Texture2D> ComposeSnapshots(
+    winrt::com_ptr<ID3D11Device> const& d3dDevice,
+    TexturePool& texturePool,
+    RECT const& unionRect,
+    std::vector<Snapshot> const& snapshots);
+
+// Hands the snapshots' textures back to the pool.
+void RecycleSnapshots(TexturePool& texturePool, std::vector<Snapshot> const& snapshots);
+
+// Composes snapshots a band of rows at a time, for desktops too big for
+// ComposeSnapshots' texture. Each band only reads back the rows of the
+// snapshots that overlap it, through a staging texture per snapshot that's
+// a band high, so memory grows with the width of the desktop but not its
+// height. The snapshots have to outlive it.
+class StripComposer : public ImageRowSource
+{
+public:
+    StripComposer(TexturePool& texturePool, RECT const& unionRect, std::vector<Snapshot> const& snapshots);
+    ~StripComposer() override;
+
+    uint32_t Width() const { return m_width; }
+    uint32_t Height() const { return m_height; }
+
+    void PrepareRows(uint32_t startRow, uint32_t endRow) override;
+    uint8_t const* GetRow(uint32_t row) override;
+
+private:
+    struct Strip
+    {
+        winrt::com_ptr<ID3D11Texture2D> StagingTexture;
+        uint32_t RowCount = 0;
+        // The snapshot rows copied for the current band, in desktop rows.
+        LONG Top = 0;
+        LONG Bottom = 0;
+    };
+
+private:
+    TexturePool& m_texturePool;
+    std::vector<Snapshot> const& m_snapshots;
+    RECT m_unionRect = {};
+    uint32_t m_width = 0;
+    uint32_t m_height = 0;
+    winrt::com_ptr<ID3D11DeviceContext> m_d3dContext;
+    winrt::com_ptr<ID3D11Multithread> m_d3dMultithread;
+
+    uint32_t m_bytesPerPixel = 4;
+    std::array<uint8_t, 8> m_background = {};
+    std::vector<Strip> m_strips;
+    std::vector<uint8_t> m_band;
+    size_t m_rowPitch = 0;
+    uint32_t m_firstRow = 0;
+};
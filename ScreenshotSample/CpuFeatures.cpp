@@ -0,0 +1,44 @@
+#include "pch.h"
+#include "CpuFeatures.h"
+
+CpuFeatures DetectCpuFeatures()
+{
+    CpuFeatures features = {};
+#if defined(_M_X64) || defined(_M_IX86)
+    int info[4] = {};
+    __cpuid(info, 0);
+    auto maxLeaf = info[0];
+
+    __cpuid(info, 1);
+    auto ecx1 = static_cast<uint32_t>(info[2]);
+    auto edx1 = static_cast<uint32_t>(info[3]);
+    features.SSE2 = (edx1 & (1u << 26)) != 0;
+    features.SSSE3 = (ecx1 & (1u << 9)) != 0;
+    features.SSE41 = (ecx1 & (1u << 19)) != 0;
+
+    // AVX and friends also need the OS to save the YMM/ZMM state
+    // on context switches, which we check through XGETBV.
+    auto osxsave = (ecx1 & (1u << 27)) != 0;
+    uint64_t xcr0 = osxsave ? _xgetbv(_XCR_XFEATURE_ENABLED_MASK) : 0;
+    auto ymmEnabled = (xcr0 & 0x6) == 0x6;
+    auto zmmEnabled = (xcr0 & 0xe6) == 0xe6;
+
+    features.AVX = ymmEnabled && (ecx1 & (1u << 28)) != 0;
+    features.F16C = features.AVX && (ecx1 & (1u << 29)) != 0;
+    if (maxLeaf >= 7)
+    {
+        __cpuidex(info, 7, 0);
+        auto ebx7 = static_cast<uint32_t>(info[1]);
+        features.AVX2 = features.AVX && (ebx7 & (1u << 5)) != 0;
+        // We only use the foundation and byte/word instructions.
+        features.AVX512 = zmmEnabled && (ebx7 & (1u << 16)) != 0 && (ebx7 & (1u << 30)) != 0;
+    }
+#endif
+    return features;
+}
+
+CpuFeatures const& CpuFeatures::Get()
+{
+    static CpuFeatures const features = DetectCpuFeatures();
+    return features;
+}
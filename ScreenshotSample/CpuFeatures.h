@@ -0,0 +1,14 @@
+#pragma once
+
+struct CpuFeatures
+{
+    static CpuFeatures const& Get();
+
+    bool SSE2 = false;
+    bool SSSE3 = false;
+    bool SSE41 = false;
+    bool AVX = false;
+    bool AVX2 = false;
+    bool F16C = false;
+    bool AVX512 = false;
+};
@@ -0,0 +1,307 @@
+#include "pch.h"
+#include "CpuToneMapper.h"
+#include "CpuFeatures.h"
+#include "HalfFloat.h"
+#include "ToneMapLut.h"
+
+// Same values as D2D1_SCENE_REFERRED_SDR_WHITE_LEVEL and the 10% highlight
+// reservation ToneMapper uses for the white level adjustment effect.
+constexpr float SceneReferredSdrWhiteLevel = 80.0f;
+constexpr float WhiteLevelReservation = 0.90f;
+
+// BT.709 luminance coefficients, scRGB shares its primaries with sRGB.
+constexpr float LuminanceR = 0.2126f;
+constexpr float LuminanceG = 0.7152f;
+constexpr float LuminanceB = 0.0722f;
+
+// Linear to sRGB encoding goes through a table so that the scalar
+// and SIMD paths agree on every output value.
+constexpr uint32_t SrgbLutSize = 16384;
+constexpr float SrgbLutScale = static_cast<float>(SrgbLutSize - 1);
+
+std::array<uint8_t, SrgbLutSize> BuildSrgbLut()
+{
+    std::array<uint8_t, SrgbLutSize> lut = {};
+    for (uint32_t i = 0; i < SrgbLutSize; i++)
+    {
+        auto linear = static_cast<double>(i) / static_cast<double>(SrgbLutSize - 1);
+        auto encoded = linear <= 0.0031308 ? linear * 12.92 : 1.055 * std::pow(linear, 1.0 / 2.4) - 0.055;
+        lut[i] = static_cast<uint8_t>(std::clamp(encoded * 255.0 + 0.5, 0.0, 255.0));
+    }
+    return lut;
+}
+
+std::array<uint8_t, SrgbLutSize> const& SrgbLut()
+{
+    static auto const lut = BuildSrgbLut();
+    return lut;
+}
+
+CpuToneMapper::CpuToneMapper(std::shared_ptr<ThreadPool> const& threadPool, bool useSimd, bool useLut)
+{
+    m_threadPool = threadPool;
+    auto&& features = CpuFeatures::Get();
+    m_useSimd = useSimd && features.AVX2 && features.F16C;
+    m_useLut = useLut;
+    // Make sure the table is built before any workers touch it.
+    SrgbLut();
+}
+
+CpuToneMapper::Params CpuToneMapper::ComputeParams(float sdrWhiteLevelInNits, float maxLuminance)
+{
+    if (sdrWhiteLevelInNits <= 0.0f)
+    {
+        sdrWhiteLevelInNits = SceneReferredSdrWhiteLevel;
+    }
+
+    Params params = {};
+    // Content that already fits under the output peak is passed through.
+    // A zero input scale turns the curve into a multiplication by 1.
+    if (maxLuminance > sdrWhiteLevelInNits)
+    {
+        auto whitePoint = maxLuminance / sdrWhiteLevelInNits;
+        params.CurveInputScale = SceneReferredSdrWhiteLevel / sdrWhiteLevelInNits;
+        params.CurveWhitePoint = 1.0f / (whitePoint * whitePoint);
+    }
+    // Here we're reserving 10% of our range for highlights, the same
+    // way ToneMapper sets up the white level adjustment effect.
+    params.WhiteScale = (SceneReferredSdrWhiteLevel * WhiteLevelReservation) / sdrWhiteLevelInNits;
+    return params;
+}
+
+void CpuToneMapper::Process(
+    uint16_t const* hdrPixels,
+    uint32_t hdrStride,
+    uint8_t* sdrPixels,
+    uint32_t sdrStride,
+    uint32_t width,
+    uint32_t height,
+    float sdrWhiteLevelInNits,
+    float maxLuminance)
+{
+    auto params = ComputeParams(sdrWhiteLevelInNits, maxLuminance);
+    auto useSimd = m_useSimd;
+    std::shared_ptr<ToneMapLut const> lut;
+    if (m_useLut)
+    {
+        lut = ToneMapLut::Get(sdrWhiteLevelInNits, maxLuminance);
+    }
+
+    // Hand out a few bands per thread so that uneven scheduling
+    // doesn't leave us waiting on one slow band.
+    auto bandCount = std::min(height, m_threadPool->ThreadCount() * 4);
+    auto rowsPerBand = (height + bandCount - 1) / std::max(bandCount, 1u);
+    m_threadPool->ParallelFor(bandCount, [=](uint32_t band)
+        {
+            auto startRow = band * rowsPerBand;
+            auto endRow = std::min(startRow + rowsPerBand, height);
+            for (auto row = startRow; row < endRow; row++)
+            {
+                auto hdrRow = reinterpret_cast<uint16_t const*>(reinterpret_cast<uint8_t const*>(hdrPixels) + static_cast<size_t>(row) * hdrStride);
+                auto sdrRow = sdrPixels + static_cast<size_t>(row) * sdrStride;
+                if (lut)
+                {
+                    lut->ProcessRow(hdrRow, sdrRow, width, useSimd);
+                }
+                else
+                {
+                    ProcessRow(hdrRow, sdrRow, width, params, useSimd);
+                }
+            }
+        });
+}
+
+void CpuToneMapper::ProcessRow(uint16_t const* hdrRow, uint8_t* sdrRow, uint32_t width, Params const& params, bool useSimd)
+{
+#if defined(_M_X64) || defined(_M_IX86)
+    if (useSimd)
+    {
+        ProcessRowAvx2(hdrRow, sdrRow, width, params);
+        return;
+    }
+#else
+    UNREFERENCED_PARAMETER(useSimd);
+#endif
+    ProcessRowScalar(hdrRow, sdrRow, width, params);
+}
+
+void CpuToneMapper::ScaleRow(uint16_t const* hdrRow, uint8_t* sdrRow, uint32_t width, Params const& params, bool useSimd)
+{
+#if defined(_M_X64) || defined(_M_IX86)
+    if (useSimd)
+    {
+        ScaleRowAvx2(hdrRow, sdrRow, width, params.WhiteScale);
+        return;
+    }
+#else
+    UNREFERENCED_PARAMETER(useSimd);
+#endif
+    ScaleRowScalar(hdrRow, sdrRow, width, params.WhiteScale);
+}
+
+// Per pixel we compute
+//   y = luminance(rgb), clamped to 0
+//   l = y * CurveInputScale
+//   m = (1 + l * CurveWhitePoint) / (1 + l) * WhiteScale
+//   out = srgb(clamp(rgb * m, 0, 1))
+// which is an extended Reinhard curve that maps the display's max luminance
+// to the SDR white level. Every operation is an IEEE add/mul/div/min/max, and
+// the SIMD path performs them in exactly the same order.
+std::array<float, 3> CpuToneMapper::MapPixel(float r, float g, float b, Params const& params)
+{
+    auto y = ((LuminanceR * r) + (LuminanceG * g)) + (LuminanceB * b);
+    y = y > 0.0f ? y : 0.0f;
+    auto l = y * params.CurveInputScale;
+    auto m = ((1.0f + (l * params.CurveWhitePoint)) / (1.0f + l)) * params.WhiteScale;
+
+    std::array<float, 3> channels = { b * m, g * m, r * m };
+    for (auto&& value : channels)
+    {
+        value = value > 0.0f ? value : 0.0f;
+        value = value < 1.0f ? value : 1.0f;
+    }
+    return channels;
+}
+
+void CpuToneMapper::ProcessRowScalar(uint16_t const* hdrRow, uint8_t* sdrRow, uint32_t width, Params const& params)
+{
+    auto&& lut = SrgbLut();
+    for (uint32_t x = 0; x < width; x++)
+    {
+        auto r = HalfToFloat(hdrRow[x * 4 + 0]);
+        auto g = HalfToFloat(hdrRow[x * 4 + 1]);
+        auto b = HalfToFloat(hdrRow[x * 4 + 2]);
+
+        auto channels = MapPixel(r, g, b, params);
+        for (uint32_t i = 0; i < 3; i++)
+        {
+            auto index = static_cast<int32_t>((channels[i] * SrgbLutScale) + 0.5f);
+            sdrRow[x * 4 + i] = lut[index];
+        }
+        sdrRow[x * 4 + 3] = 255;
+    }
+}
+
+void CpuToneMapper::ScaleRowScalar(uint16_t const* hdrRow, uint8_t* sdrRow, uint32_t width, float whiteScale)
+{
+    auto&& lut = SrgbLut();
+    for (uint32_t x = 0; x < width; x++)
+    {
+        for (uint32_t i = 0; i < 3; i++)
+        {
+            // BGR out of RGB
+            auto value = HalfToFloat(hdrRow[x * 4 + 2 - i]) * whiteScale;
+            value = value > 0.0f ? value : 0.0f;
+            value = value < 1.0f ? value : 1.0f;
+            auto index = static_cast<int32_t>((value * SrgbLutScale) + 0.5f);
+            sdrRow[x * 4 + i] = lut[index];
+        }
+        sdrRow[x * 4 + 3] = 255;
+    }
+}
+
+#if defined(_M_X64) || defined(_M_IX86)
+void CpuToneMapper::ProcessRowAvx2(uint16_t const* hdrRow, uint8_t* sdrRow, uint32_t width, Params const& params)
+{
+    auto&& lut = SrgbLut();
+    auto zero = _mm256_setzero_ps();
+    auto one = _mm256_set1_ps(1.0f);
+    auto half = _mm256_set1_ps(0.5f);
+    auto lutScale = _mm256_set1_ps(SrgbLutScale);
+    auto lumR = _mm256_set1_ps(LuminanceR);
+    auto lumG = _mm256_set1_ps(LuminanceG);
+    auto lumB = _mm256_set1_ps(LuminanceB);
+    auto inputScale = _mm256_set1_ps(params.CurveInputScale);
+    auto whitePoint = _mm256_set1_ps(params.CurveWhitePoint);
+    auto whiteScale = _mm256_set1_ps(params.WhiteScale);
+
+    // After the transpose below, lane i holds this pixel.
+    constexpr uint32_t laneToPixel[8] = { 0, 2, 4, 6, 1, 3, 5, 7 };
+
+    uint32_t x = 0;
+    for (; x + 8 <= width; x += 8)
+    {
+        // Each conversion gives us two RGBA pixels.
+        auto source = reinterpret_cast<__m128i const*>(hdrRow + x * 4);
+        auto p01 = _mm256_cvtph_ps(_mm_loadu_si128(source + 0));
+        auto p23 = _mm256_cvtph_ps(_mm_loadu_si128(source + 1));
+        auto p45 = _mm256_cvtph_ps(_mm_loadu_si128(source + 2));
+        auto p67 = _mm256_cvtph_ps(_mm_loadu_si128(source + 3));
+
+        // Transpose to one register per channel.
+        auto rg0 = _mm256_unpacklo_ps(p01, p23);
+        auto ba0 = _mm256_unpackhi_ps(p01, p23);
+        auto rg1 = _mm256_unpacklo_ps(p45, p67);
+        auto ba1 = _mm256_unpackhi_ps(p45, p67);
+        auto r = _mm256_shuffle_ps(rg0, rg1, _MM_SHUFFLE(1, 0, 1, 0));
+        auto g = _mm256_shuffle_ps(rg0, rg1, _MM_SHUFFLE(3, 2, 3, 2));
+        auto b = _mm256_shuffle_ps(ba0, ba1, _MM_SHUFFLE(1, 0, 1, 0));
+
+        auto y = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(lumR, r), _mm256_mul_ps(lumG, g)), _mm256_mul_ps(lumB, b));
+        y = _mm256_max_ps(y, zero);
+        auto l = _mm256_mul_ps(y, inputScale);
+        auto m = _mm256_mul_ps(_mm256_div_ps(_mm256_add_ps(one, _mm256_mul_ps(l, whitePoint)), _mm256_add_ps(one, l)), whiteScale);
+
+        __m256 channels[3] = { _mm256_mul_ps(b, m), _mm256_mul_ps(g, m), _mm256_mul_ps(r, m) };
+        alignas(32) int32_t indices[3][8];
+        for (uint32_t i = 0; i < 3; i++)
+        {
+            auto value = _mm256_min_ps(_mm256_max_ps(channels[i], zero), one);
+            auto index = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(value, lutScale), half));
+            _mm256_store_si256(reinterpret_cast<__m256i*>(indices[i]), index);
+        }
+
+        auto destination = sdrRow + x * 4;
+        for (uint32_t lane = 0; lane < 8; lane++)
+        {
+            auto pixel = destination + laneToPixel[lane] * 4;
+            pixel[0] = lut[indices[0][lane]];
+            pixel[1] = lut[indices[1][lane]];
+            pixel[2] = lut[indices[2][lane]];
+            pixel[3] = 255;
+        }
+    }
+
+    if (x < width)
+    {
+        ProcessRowScalar(hdrRow + x * 4, sdrRow + x * 4, width - x, params);
+    }
+}
+#endif
+
+#if defined(_M_X64) || defined(_M_IX86)
+void CpuToneMapper::ScaleRowAvx2(uint16_t const* hdrRow, uint8_t* sdrRow, uint32_t width, float whiteScale)
+{
+    auto&& lut = SrgbLut();
+    auto zero = _mm256_setzero_ps();
+    auto one = _mm256_set1_ps(1.0f);
+    auto half = _mm256_set1_ps(0.5f);
+    auto lutScale = _mm256_set1_ps(SrgbLutScale);
+    auto scale = _mm256_set1_ps(whiteScale);
+
+    // Every channel is scaled on its own, so there's nothing to transpose.
+    // Each conversion gives us two RGBA pixels.
+    uint32_t x = 0;
+    for (; x + 2 <= width; x += 2)
+    {
+        auto pixels = _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<__m128i const*>(hdrRow + x * 4)));
+        auto value = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(pixels, scale), zero), one);
+        alignas(32) int32_t indices[8];
+        _mm256_store_si256(reinterpret_cast<__m256i*>(indices), _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(value, lutScale), half)));
+
+        auto destination = sdrRow + x * 4;
+        for (uint32_t pixel = 0; pixel < 2; pixel++)
+        {
+            destination[pixel * 4 + 0] = lut[indices[pixel * 4 + 2]];
+            destination[pixel * 4 + 1] = lut[indices[pixel * 4 + 1]];
+            destination[pixel * 4 + 2] = lut[indices[pixel * 4 + 0]];
+            destination[pixel * 4 + 3] = 255;
+        }
+    }
+
+    if (x < width)
+    {
+        ScaleRowScalar(hdrRow + x * 4, sdrRow + x * 4, width - x, whiteScale);
+    }
+}
+#endif
@@ -0,0 +1,64 @@
+#pragma once
+#include "ThreadPool.h"
+
+// A CPU implementation of the conversion ToneMapper performs with D2D: FP16 scRGB
+// in, BGRA8 sRGB out. There is a scalar reference implementation and an
+// F16C/AVX2 implementation, and both produce bit-identical output.
+class CpuToneMapper
+{
+public:
+    struct Params
+    {
+        // Multiplier applied to the luminance before it goes through the curve.
+        float CurveInputScale = 0.0f;
+        // 1 / (input peak / output peak)^2, see MapPixel for the curve itself.
+        float CurveWhitePoint = 0.0f;
+        // Maps the tone mapped content back into the SDR range.
+        float WhiteScale = 1.0f;
+    };
+
+    // With useLut, Process goes through ToneMapLut instead of evaluating
+    // the curve for every pixel.
+    CpuToneMapper(std::shared_ptr<ThreadPool> const& threadPool, bool useSimd, bool useLut);
+    ~CpuToneMapper() {}
+
+    static Params ComputeParams(float sdrWhiteLevelInNits, float maxLuminance);
+
+    // Strides are in bytes.
+    void Process(
+        uint16_t const* hdrPixels,
+        uint32_t hdrStride,
+        uint8_t* sdrPixels,
+        uint32_t sdrStride,
+        uint32_t width,
+        uint32_t height,
+        float sdrWhiteLevelInNits,
+        float maxLuminance);
+
+    // Converts a single row of pixels without going through the thread pool.
+    static void ProcessRow(uint16_t const* hdrRow, uint8_t* sdrRow, uint32_t width, Params const& params, bool useSimd);
+    // For content that fits under the SDR white level, where the curve
+    // passes everything through: only scales by params.WhiteScale and
+    // encodes to sRGB. Same output as ProcessRow for finite pixels.
+    static void ScaleRow(uint16_t const* hdrRow, uint8_t* sdrRow, uint32_t width, Params const& params, bool useSimd);
+
+    // Runs one pixel through the curve and returns linear BGR in [0, 1],
+    // before it's encoded to sRGB.
+    static std::array<float, 3> MapPixel(float r, float g, float b, Params const& params);
+
+    bool UsesSimd() const { return m_useSimd; }
+    bool UsesLut() const { return m_useLut; }
+
+private:
+    static void ProcessRowScalar(uint16_t const* hdrRow, uint8_t* sdrRow, uint32_t width, Params const& params);
+    static void ScaleRowScalar(uint16_t const* hdrRow, uint8_t* sdrRow, uint32_t width, float whiteScale);
+#if defined(_M_X64) || defined(_M_IX86)
+    static void ProcessRowAvx2(uint16_t const* hdrRow, uint8_t* sdrRow, uint32_t width, Params const& params);
+    static void ScaleRowAvx2(uint16_t const* hdrRow, uint8_t* sdrRow, uint32_t width, float whiteScale);
+#endif
+
+private:
+    std::shared_ptr<ThreadPool> m_threadPool;
+    bool m_useSimd = false;
+    bool m_useLut = false;
+};
@@ -0,0 +1,665 @@
+#include "pch.h"
+#include "Deflate.h"
+
+constexpr uint32_t WindowSize = 32768;
+constexpr uint32_t WindowMask = WindowSize - 1;
+constexpr uint32_t HashBits = 15;
+constexpr uint32_t HashSize = 1 << HashBits;
+constexpr uint32_t MinMatch = 3;
+constexpr uint32_t MaxMatch = 258;
+// Minimum length matches this far back usually cost more than the literals.
+constexpr uint32_t MaxMinMatchDistance = 4096;
+// Marks an empty hash slot, positions are offset by one when stored.
+constexpr uint32_t NoPosition = 0;
+// How many tokens we collect before emitting a block.
+constexpr size_t MaxBlockTokens = 32768;
+constexpr size_t MaxStoredBlockSize = 65535;
+
+constexpr uint32_t LiteralLengthCount = 286;
+constexpr uint32_t DistanceCount = 30;
+constexpr uint32_t CodeLengthCount = 19;
+constexpr uint32_t EndOfBlock = 256;
+constexpr uint32_t MaxCodeBits = 15;
+constexpr uint32_t MaxCodeLengthBits = 7;
+
+constexpr uint16_t LengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+constexpr uint8_t LengthExtraBits[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+constexpr uint16_t DistanceBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+constexpr uint8_t DistanceExtraBits[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+constexpr uint8_t CodeLengthOrder[CodeLengthCount] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+struct SymbolTables
+{
+    // Indexed by match length, gives the index into LengthBase.
+    std::array<uint8_t, MaxMatch + 1> LengthCode = {};
+    // Indexed by distance - 1 for distances up to 256, and by
+    // 256 + ((distance - 1) >> 7) for the rest.
+    std::array<uint8_t, 512> DistanceCode = {};
+};
+
+SymbolTables BuildSymbolTables()
+{
+    SymbolTables tables = {};
+    for (uint32_t code = 0; code < 29; code++)
+    {
+        auto end = code == 28 ? MaxMatch + 1 : LengthBase[code] + (1u << LengthExtraBits[code]);
+        for (uint32_t length = LengthBase[code]; length < end && length <= MaxMatch; length++)
+        {
+            tables.LengthCode[length] = static_cast<uint8_t>(code);
+        }
+    }
+    // Length 258 has its own code even though 227 + 31 would cover it.
+    tables.LengthCode[MaxMatch] = 28;
+    for (uint32_t code = 0; code < 30; code++)
+    {
+        for (uint32_t distance = DistanceBase[code]; distance < DistanceBase[code] + (1u << DistanceExtraBits[code]); distance++)
+        {
+            if (distance <= 256)
+            {
+                tables.DistanceCode[distance - 1] = static_cast<uint8_t>(code);
+            }
+            else
+            {
+                tables.DistanceCode[256 + ((distance - 1) >> 7)] = static_cast<uint8_t>(code);
+            }
+        }
+    }
+    return tables;
+}
+
+SymbolTables const& GetSymbolTables()
+{
+    static auto const tables = BuildSymbolTables();
+    return tables;
+}
+
+uint32_t DistanceToCode(uint32_t distance)
+{
+    auto&& tables = GetSymbolTables();
+    return distance <= 256 ? tables.DistanceCode[distance - 1] : tables.DistanceCode[256 + ((distance - 1) >> 7)];
+}
+
+class BitWriter
+{
+public:
+    BitWriter(std::vector<uint8_t>& output) : m_output(output) {}
+
+    void Write(uint32_t value, uint32_t bitCount)
+    {
+        m_bits |= static_cast<uint64_t>(value) << m_bitCount;
+        m_bitCount += bitCount;
+        while (m_bitCount >= 8)
+        {
+            m_output.push_back(static_cast<uint8_t>(m_bits));
+            m_bits >>= 8;
+            m_bitCount -= 8;
+        }
+    }
+
+    void AlignToByte()
+    {
+        if (m_bitCount > 0)
+        {
+            Write(0, 8 - m_bitCount);
+        }
+    }
+
+    void WriteBytes(uint8_t const* data, size_t size)
+    {
+        m_output.insert(m_output.end(), data, data + size);
+    }
+
+private:
+    std::vector<uint8_t>& m_output;
+    uint64_t m_bits = 0;
+    uint32_t m_bitCount = 0;
+};
+
+struct HuffmanCode
+{
+    // Codes are stored bit reversed, since deflate packs them MSB first.
+    std::vector<uint16_t> Codes;
+    std::vector<uint8_t> Lengths;
+};
+
+// Builds length limited code lengths from symbol frequencies. Lengths are
+// first computed with a regular Huffman tree and then limited by rebalancing
+// the per length counts until the code fits in maxBits again.
+std::vector<uint8_t> BuildCodeLengths(uint32_t const* frequencies, uint32_t count, uint32_t maxBits)
+{
+    std::vector<uint8_t> lengths(count, 0);
+
+    std::vector<uint32_t> symbols;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (frequencies[i] > 0)
+        {
+            symbols.push_back(i);
+        }
+    }
+    // Make sure we always produce a complete code with at least two symbols,
+    // some decoders don't accept codes with only one.
+    if (symbols.size() < 2)
+    {
+        auto used = symbols.empty() ? 0u : symbols[0];
+        lengths[used] = 1;
+        lengths[used == 0 ? 1 : 0] = 1;
+        return lengths;
+    }
+    std::stable_sort(symbols.begin(), symbols.end(), [frequencies](auto a, auto b) { return frequencies[a] < frequencies[b]; });
+
+    // Two queue Huffman construction. Leaves are already sorted and internal
+    // nodes are created in increasing weight order.
+    auto leafCount = symbols.size();
+    std::vector<uint64_t> nodeWeights;
+    std::vector<uint32_t> parents(leafCount * 2, 0);
+    nodeWeights.reserve(leafCount);
+    size_t nextLeaf = 0;
+    size_t nextNode = 0;
+    auto takeSmallest = [&]() -> size_t
+    {
+        if (nextLeaf < leafCount && (nextNode >= nodeWeights.size() || frequencies[symbols[nextLeaf]] <= nodeWeights[nextNode]))
+        {
+            return nextLeaf++;
+        }
+        return leafCount + nextNode++;
+    };
+    auto weightOf = [&](size_t node) -> uint64_t
+    {
+        return node < leafCount ? frequencies[symbols[node]] : nodeWeights[node - leafCount];
+    };
+    for (size_t i = 0; i + 1 < leafCount; i++)
+    {
+        auto first = takeSmallest();
+        auto second = takeSmallest();
+        auto node = leafCount + nodeWeights.size();
+        nodeWeights.push_back(weightOf(first) + weightOf(second));
+        parents[first] = static_cast<uint32_t>(node);
+        parents[second] = static_cast<uint32_t>(node);
+    }
+
+    // Depths of internal nodes, the root is the last node created.
+    auto root = leafCount + nodeWeights.size() - 1;
+    std::vector<uint32_t> depths(root + 1, 0);
+    for (auto node = root; node-- > leafCount;)
+    {
+        depths[node] = depths[parents[node]] + 1;
+    }
+    std::vector<uint32_t> lengthCounts(MaxCodeBits + 2, 0);
+    for (size_t leaf = 0; leaf < leafCount; leaf++)
+    {
+        auto depth = depths[parents[leaf]] + 1;
+        lengthCounts[std::min(depth, maxBits)]++;
+    }
+
+    // Clamping lengths makes the code oversubscribed. Lengthen codes
+    // until the Kraft sum fits again.
+    uint64_t total = 0;
+    for (uint32_t bits = 1; bits <= maxBits; bits++)
+    {
+        total += static_cast<uint64_t>(lengthCounts[bits]) << (maxBits - bits);
+    }
+    while (total > (1ull << maxBits))
+    {
+        lengthCounts[maxBits]--;
+        for (auto bits = maxBits - 1; bits > 0; bits--)
+        {
+            if (lengthCounts[bits] > 0)
+            {
+                lengthCounts[bits]--;
+                lengthCounts[bits + 1] += 2;
+                break;
+            }
+        }
+        total--;
+    }
+
+    // The most frequent symbols get the shortest codes.
+    auto symbol = symbols.rbegin();
+    for (uint32_t bits = 1; bits <= maxBits; bits++)
+    {
+        for (uint32_t i = 0; i < lengthCounts[bits]; i++)
+        {
+            lengths[*symbol++] = static_cast<uint8_t>(bits);
+        }
+    }
+    return lengths;
+}
+
+HuffmanCode BuildCanonicalCode(std::vector<uint8_t> const& lengths)
+{
+    HuffmanCode code;
+    code.Lengths = lengths;
+    code.Codes.resize(lengths.size(), 0);
+
+    uint32_t lengthCounts[MaxCodeBits + 1] = {};
+    for (auto length : lengths)
+    {
+        lengthCounts[length]++;
+    }
+    lengthCounts[0] = 0;
+    uint32_t nextCode[MaxCodeBits + 1] = {};
+    uint32_t value = 0;
+    for (uint32_t bits = 1; bits <= MaxCodeBits; bits++)
+    {
+        value = (value + lengthCounts[bits - 1]) << 1;
+        nextCode[bits] = value;
+    }
+    for (size_t symbol = 0; symbol < lengths.size(); symbol++)
+    {
+        auto length = lengths[symbol];
+        if (length == 0)
+        {
+            continue;
+        }
+        auto canonical = nextCode[length]++;
+        uint32_t reversed = 0;
+        for (uint32_t bit = 0; bit < length; bit++)
+        {
+            reversed |= ((canonical >> bit) & 1) << (length - 1 - bit);
+        }
+        code.Codes[symbol] = static_cast<uint16_t>(reversed);
+    }
+    return code;
+}
+
+HuffmanCode const& FixedLiteralLengthCode()
+{
+    static auto const code = []()
+    {
+        std::vector<uint8_t> lengths(288, 0);
+        std::fill(lengths.begin(), lengths.begin() + 144, static_cast<uint8_t>(8));
+        std::fill(lengths.begin() + 144, lengths.begin() + 256, static_cast<uint8_t>(9));
+        std::fill(lengths.begin() + 256, lengths.begin() + 280, static_cast<uint8_t>(7));
+        std::fill(lengths.begin() + 280, lengths.end(), static_cast<uint8_t>(8));
+        return BuildCanonicalCode(lengths);
+    }();
+    return code;
+}
+
+HuffmanCode const& FixedDistanceCode()
+{
+    static auto const code = BuildCanonicalCode(std::vector<uint8_t>(30, 5));
+    return code;
+}
+
+// Run length encodes the code lengths of a dynamic block header
+// with the 16/17/18 repeat symbols. Each entry is symbol | (extra << 8).
+std::vector<uint16_t> EncodeCodeLengths(std::vector<uint8_t> const& lengths)
+{
+    std::vector<uint16_t> encoded;
+    size_t i = 0;
+    while (i < lengths.size())
+    {
+        auto length = lengths[i];
+        size_t run = 1;
+        while (i + run < lengths.size() && lengths[i + run] == length)
+        {
+            run++;
+        }
+
+        if (length == 0 && run >= 3)
+        {
+            auto count = std::min<size_t>(run, 138);
+            if (count >= 11)
+            {
+                encoded.push_back(static_cast<uint16_t>(18 | ((count - 11) << 8)));
+            }
+            else
+            {
+                encoded.push_back(static_cast<uint16_t>(17 | ((count - 3) << 8)));
+            }
+            i += count;
+        }
+        else if (length != 0 && run >= 4)
+        {
+            // The first length is written as is, the rest are repeats.
+            encoded.push_back(length);
+            auto count = std::min<size_t>(run - 1, 6);
+            encoded.push_back(static_cast<uint16_t>(16 | ((count - 3) << 8)));
+            i += count + 1;
+        }
+        else
+        {
+            encoded.push_back(length);
+            i++;
+        }
+    }
+    return encoded;
+}
+
+Deflater::Deflater(DeflateSettings const& settings)
+{
+    m_settings = settings;
+    m_settings.NiceLength = std::clamp(m_settings.NiceLength, MinMatch, MaxMatch);
+    m_settings.MaxChainLength = std::max(m_settings.MaxChainLength, 1u);
+}
+
+void Deflater::InsertHash(uint8_t const* data, size_t position)
+{
+    uint32_t value = (static_cast<uint32_t>(data[position]) << 16) | (static_cast<uint32_t>(data[position + 1]) << 8) | data[position + 2];
+    auto hash = (value * 2654435761u) >> (32 - HashBits);
+    m_previous[position & WindowMask] = m_head[hash];
+    m_head[hash] = static_cast<uint32_t>(position) + 1;
+}
+
+uint32_t Deflater::FindMatch(uint8_t const* data, size_t position, size_t size, uint32_t& distance) const
+{
+    uint32_t value = (static_cast<uint32_t>(data[position]) << 16) | (static_cast<uint32_t>(data[position + 1]) << 8) | data[position + 2];
+    auto hash = (value * 2654435761u) >> (32 - HashBits);
+
+    auto maxLength = static_cast<uint32_t>(std::min<size_t>(MaxMatch, size - position));
+    uint32_t bestLength = 0;
+    auto candidate = m_head[hash];
+    auto chain = m_settings.MaxChainLength;
+    auto current = data + position;
+    while (candidate != NoPosition && chain-- > 0)
+    {
+        size_t candidatePosition = candidate - 1;
+        if (position - candidatePosition > WindowSize)
+        {
+            break;
+        }
+
+        // Quick reject on the byte that would extend our best match.
+        auto match = data + candidatePosition;
+        if (match[bestLength] == current[bestLength] && match[0] == current[0])
+        {
+            uint32_t length = 0;
+            while (length + 8 <= maxLength)
+            {
+                uint64_t a = 0;
+                uint64_t b = 0;
+                memcpy(&a, current + length, sizeof(a));
+                memcpy(&b, match + length, sizeof(b));
+                auto difference = a ^ b;
+                if (difference != 0)
+                {
+                    length += static_cast<uint32_t>(std::countr_zero(difference)) / 8;
+                    break;
+                }
+                length += 8;
+            }
+            if (length + 8 > maxLength)
+            {
+                while (length < maxLength && current[length] == match[length])
+                {
+                    length++;
+                }
+            }
+            length = std::min(length, maxLength);
+
+            if (length > bestLength)
+            {
+                bestLength = length;
+                distance = static_cast<uint32_t>(position - candidatePosition);
+                if (length >= m_settings.NiceLength || length == maxLength)
+                {
+                    break;
+                }
+            }
+        }
+        candidate = m_previous[candidatePosition & WindowMask];
+    }
+    if (bestLength < MinMatch || (bestLength == MinMatch && distance > MaxMinMatchDistance))
+    {
+        return 0;
+    }
+    return bestLength;
+}
+
+void Deflater::Compress(uint8_t const* data, size_t dictionarySize, size_t size, bool isFinal, std::vector<uint8_t>& output)
+{
+    m_head.assign(HashSize, NoPosition);
+    m_previous.assign(WindowSize, NoPosition);
+    m_tokens.clear();
+    m_tokens.reserve(MaxBlockTokens);
+
+    // Only the last window's worth of the dictionary can be referenced.
+    auto start = dictionarySize > WindowSize ? dictionarySize - WindowSize : 0;
+    for (auto position = start; position + MinMatch <= std::min(dictionarySize, size); position++)
+    {
+        InsertHash(data, position);
+    }
+
+    BitWriter writer(output);
+    auto blockStart = dictionarySize;
+    auto position = dictionarySize;
+    uint32_t pendingLength = 0;
+    uint32_t pendingDistance = 0;
+    while (position < size)
+    {
+        uint32_t length = 0;
+        uint32_t distance = 0;
+        if (position + MinMatch <= size)
+        {
+            length = FindMatch(data, position, size, distance);
+            InsertHash(data, position);
+        }
+
+        if (m_settings.LazyMatching && pendingLength > 0)
+        {
+            // We deferred the match at position - 1, keep it
+            // unless this position found something better.
+            if (length > pendingLength)
+            {
+                m_tokens.push_back({ data[position - 1], 0 });
+                pendingLength = length;
+                pendingDistance = distance;
+                position++;
+            }
+            else
+            {
+                m_tokens.push_back({ static_cast<uint16_t>(pendingLength), static_cast<uint16_t>(pendingDistance) });
+                // Position - 1 and position are already hashed.
+                auto end = position - 1 + pendingLength;
+                for (position++; position < end; position++)
+                {
+                    if (position + MinMatch <= size)
+                    {
+                        InsertHash(data, position);
+                    }
+                }
+                pendingLength = 0;
+            }
+        }
+        else if (length > 0 && m_settings.LazyMatching && length < m_settings.NiceLength)
+        {
+            pendingLength = length;
+            pendingDistance = distance;
+            position++;
+        }
+        else if (length > 0)
+        {
+            m_tokens.push_back({ static_cast<uint16_t>(length), static_cast<uint16_t>(distance) });
+            auto end = position + length;
+            for (position++; position < end; position++)
+            {
+                if (position + MinMatch <= size)
+                {
+                    InsertHash(data, position);
+                }
+            }
+        }
+        else
+        {
+            m_tokens.push_back({ data[position], 0 });
+            position++;
+        }
+
+        if (m_tokens.size() >= MaxBlockTokens && pendingLength == 0)
+        {
+            FlushBlock(data, blockStart, position, false, writer);
+            blockStart = position;
+        }
+    }
+    if (pendingLength > 0)
+    {
+        m_tokens.push_back({ static_cast<uint16_t>(pendingLength), static_cast<uint16_t>(pendingDistance) });
+    }
+
+    FlushBlock(data, blockStart, size, isFinal, writer);
+    if (!isFinal)
+    {
+        // An empty stored block gets us to a byte boundary.
+        writer.Write(0, 3);
+        writer.AlignToByte();
+        uint8_t const emptyStored[] = { 0x00, 0x00, 0xff, 0xff };
+        writer.WriteBytes(emptyStored, sizeof(emptyStored));
+    }
+    else
+    {
+        writer.AlignToByte();
+    }
+}
+
+void Deflater::FlushBlock(uint8_t const* data, size_t blockStart, size_t blockEnd, bool isFinal, BitWriter& writer)
+{
+    auto&& tables = GetSymbolTables();
+
+    uint32_t literalFrequencies[LiteralLengthCount] = {};
+    uint32_t distanceFrequencies[DistanceCount] = {};
+    uint64_t extraBits = 0;
+    for (auto&& token : m_tokens)
+    {
+        if (token.Distance == 0)
+        {
+            literalFrequencies[token.LiteralOrLength]++;
+        }
+        else
+        {
+            auto lengthCode = tables.LengthCode[token.LiteralOrLength];
+            auto distanceCode = DistanceToCode(token.Distance);
+            literalFrequencies[257 + lengthCode]++;
+            distanceFrequencies[distanceCode]++;
+            extraBits += LengthExtraBits[lengthCode] + DistanceExtraBits[distanceCode];
+        }
+    }
+    literalFrequencies[EndOfBlock]++;
+
+    auto literalCode = BuildCanonicalCode(BuildCodeLengths(literalFrequencies, LiteralLengthCount, MaxCodeBits));
+    auto distanceCode = BuildCanonicalCode(BuildCodeLengths(distanceFrequencies, DistanceCount, MaxCodeBits));
+
+    // Build the dynamic header so we know how big it is.
+    uint32_t literalCount = LiteralLengthCount;
+    while (literalCount > 257 && literalCode.Lengths[literalCount - 1] == 0)
+    {
+        literalCount--;
+    }
+    uint32_t distanceCodeCount = DistanceCount;
+    while (distanceCodeCount > 1 && distanceCode.Lengths[distanceCodeCount - 1] == 0)
+    {
+        distanceCodeCount--;
+    }
+    std::vector<uint8_t> allLengths(literalCode.Lengths.begin(), literalCode.Lengths.begin() + literalCount);
+    allLengths.insert(allLengths.end(), distanceCode.Lengths.begin(), distanceCode.Lengths.begin() + distanceCodeCount);
+    auto encodedLengths = EncodeCodeLengths(allLengths);
+    uint32_t codeLengthFrequencies[CodeLengthCount] = {};
+    for (auto entry : encodedLengths)
+    {
+        codeLengthFrequencies[entry & 0xff]++;
+    }
+    auto codeLengthCode = BuildCanonicalCode(BuildCodeLengths(codeLengthFrequencies, CodeLengthCount, MaxCodeLengthBits));
+    uint32_t codeLengthCodeCount = CodeLengthCount;
+    while (codeLengthCodeCount > 4 && codeLengthCode.Lengths[CodeLengthOrder[codeLengthCodeCount - 1]] == 0)
+    {
+        codeLengthCodeCount--;
+    }
+
+    // Figure out which block type is cheapest.
+    uint64_t dynamicBits = 5 + 5 + 4 + codeLengthCodeCount * 3 + extraBits;
+    for (auto entry : encodedLengths)
+    {
+        auto symbol = entry & 0xff;
+        dynamicBits += codeLengthCode.Lengths[symbol] + (symbol == 16 ? 2 : symbol == 17 ? 3 : symbol == 18 ? 7 : 0);
+    }
+    uint64_t fixedBits = extraBits;
+    auto&& fixedLiteral = FixedLiteralLengthCode();
+    for (uint32_t i = 0; i < LiteralLengthCount; i++)
+    {
+        dynamicBits += static_cast<uint64_t>(literalFrequencies[i]) * literalCode.Lengths[i];
+        fixedBits += static_cast<uint64_t>(literalFrequencies[i]) * fixedLiteral.Lengths[i];
+    }
+    for (uint32_t i = 0; i < DistanceCount; i++)
+    {
+        dynamicBits += static_cast<uint64_t>(distanceFrequencies[i]) * distanceCode.Lengths[i];
+        fixedBits += static_cast<uint64_t>(distanceFrequencies[i]) * 5;
+    }
+    auto blockSize = blockEnd - blockStart;
+    auto storedBlocks = std::max<size_t>((blockSize + MaxStoredBlockSize - 1) / MaxStoredBlockSize, 1);
+    uint64_t storedBits = (blockSize + storedBlocks * 5) * 8 + 7;
+
+    if (storedBits <= dynamicBits && storedBits <= fixedBits)
+    {
+        auto remaining = blockSize;
+        auto source = data + blockStart;
+        do
+        {
+            auto chunk = static_cast<uint16_t>(std::min(remaining, MaxStoredBlockSize));
+            remaining -= chunk;
+            writer.Write((isFinal && remaining == 0) ? 1 : 0, 1);
+            writer.Write(0, 2);
+            writer.AlignToByte();
+            uint8_t header[4] = {
+                static_cast<uint8_t>(chunk), static_cast<uint8_t>(chunk >> 8),
+                static_cast<uint8_t>(~chunk), static_cast<uint8_t>(static_cast<uint16_t>(~chunk) >> 8) };
+            writer.WriteBytes(header, sizeof(header));
+            writer.WriteBytes(source, chunk);
+            source += chunk;
+        } while (remaining > 0);
+        m_tokens.clear();
+        return;
+    }
+
+    auto useFixed = fixedBits <= dynamicBits;
+    auto&& literals = useFixed ? fixedLiteral : literalCode;
+    auto&& distances = useFixed ? FixedDistanceCode() : distanceCode;
+    writer.Write(isFinal ? 1 : 0, 1);
+    writer.Write(useFixed ? 1 : 2, 2);
+    if (!useFixed)
+    {
+        writer.Write(literalCount - 257, 5);
+        writer.Write(distanceCodeCount - 1, 5);
+        writer.Write(codeLengthCodeCount - 4, 4);
+        for (uint32_t i = 0; i < codeLengthCodeCount; i++)
+        {
+            writer.Write(codeLengthCode.Lengths[CodeLengthOrder[i]], 3);
+        }
+        for (auto entry : encodedLengths)
+        {
+            auto symbol = entry & 0xff;
+            writer.Write(codeLengthCode.Codes[symbol], codeLengthCode.Lengths[symbol]);
+            if (symbol == 16)
+            {
+                writer.Write(entry >> 8, 2);
+            }
+            else if (symbol == 17)
+            {
+                writer.Write(entry >> 8, 3);
+            }
+            else if (symbol == 18)
+            {
+                writer.Write(entry >> 8, 7);
+            }
+        }
+    }
+
+    for (auto&& token : m_tokens)
+    {
+        if (token.Distance == 0)
+        {
+            writer.Write(literals.Codes[token.LiteralOrLength], literals.Lengths[token.LiteralOrLength]);
+        }
+        else
+        {
+            auto lengthCode = tables.LengthCode[token.LiteralOrLength];
+            writer.Write(literals.Codes[257 + lengthCode], literals.Lengths[257 + lengthCode]);
+            writer.Write(token.LiteralOrLength - LengthBase[lengthCode], LengthExtraBits[lengthCode]);
+            auto code = DistanceToCode(token.Distance);
+            writer.Write(distances.Codes[code], distances.Lengths[code]);
+            writer.Write(token.Distance - DistanceBase[code], DistanceExtraBits[code]);
+        }
+    }
+    writer.Write(literals.Codes[EndOfBlock], literals.Lengths[EndOfBlock]);
+    m_tokens.clear();
+}
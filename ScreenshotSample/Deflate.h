@@ -0,0 +1,46 @@
+#pragma once
+
+struct DeflateSettings
+{
+    // How many previous occurrences of a hash we look at per match.
+    uint32_t MaxChainLength = 32;
+    // Stop searching once we find a match at least this long.
+    uint32_t NiceLength = 128;
+    // Check whether the next position has a better match before
+    // committing to the current one.
+    bool LazyMatching = true;
+};
+
+// Produces raw deflate (RFC 1951) data. Independent chunks of one stream can
+// be compressed in parallel by passing the tail of the previous chunk as a
+// dictionary and only marking the last chunk as final, the same way pigz does.
+class Deflater
+{
+public:
+    Deflater(DeflateSettings const& settings);
+    ~Deflater() {}
+
+    // Compresses data[dictionarySize, size), data[0, dictionarySize) is only
+    // used for back references. Only the last 32KB of the dictionary is used.
+    // When isFinal is false the output ends with an empty stored block, so
+    // that it ends on a byte boundary and the next chunk can be appended.
+    void Compress(uint8_t const* data, size_t dictionarySize, size_t size, bool isFinal, std::vector<uint8_t>& output);
+
+private:
+    struct Token
+    {
+        // The literal byte, or the match length when Distance isn't 0.
+        uint16_t LiteralOrLength;
+        uint16_t Distance;
+    };
+
+    uint32_t FindMatch(uint8_t const* data, size_t position, size_t size, uint32_t& distance) const;
+    void InsertHash(uint8_t const* data, size_t position);
+    void FlushBlock(uint8_t const* data, size_t blockStart, size_t blockEnd, bool isFinal, class BitWriter& writer);
+
+private:
+    DeflateSettings m_settings;
+    std::vector<uint32_t> m_head;
+    std::vector<uint32_t> m_previous;
+    std::vector<Token> m_tokens;
+};
@@ -0,0 +1,315 @@
+#include "pch.h"
+#include "DisplayTopology.h"
+#include "Trace.h"
+
+std::vector<std::pair<HMONITOR, float>> GetDisplayMaxLuminances()
+{
+    std::vector<std::pair<HMONITOR, float>> maxLuminances;
+
+    winrt::com_ptr<IDXGIFactory1> factory;
+    winrt::check_hresult(CreateDXGIFactory1(winrt::guid_of<IDXGIFactory1>(), factory.put_void()));
+
+    UINT adapterCount = 0;
+    winrt::com_ptr<IDXGIAdapter1> adapter;
+    while (SUCCEEDED(factory->EnumAdapters1(adapterCount, adapter.put())))
+    {
+        UINT outputCount = 0;
+        winrt::com_ptr<IDXGIOutput> output;
+        while (SUCCEEDED(adapter->EnumOutputs(outputCount, output.put())))
+        {
+            auto output6 = output.as<IDXGIOutput6>();
+            DXGI_OUTPUT_DESC1 desc = {};
+            winrt::check_hresult(output6->GetDesc1(&desc));
+            if (desc.AttachedToDesktop)
+            {
+                auto displayHandle = desc.Monitor;
+                auto maxLuminance = desc.MaxLuminance;
+                maxLuminances.push_back({ displayHandle, maxLuminance });
+            }
+
+            output = nullptr;
+            outputCount++;
+        }
+
+        adapter = nullptr;
+        adapterCount++;
+    }
+
+    return maxLuminances;
+}
+
+std::vector<DISPLAYCONFIG_PATH_INFO> GetDisplayConfigPathInfos()
+{
+    uint32_t numPaths = 0;
+    uint32_t numModes = 0;
+    winrt::check_win32(GetDisplayConfigBufferSizes(
+        QDC_ONLY_ACTIVE_PATHS,
+        &numPaths,
+        &numModes));
+    std::vector<DISPLAYCONFIG_PATH_INFO> pathInfos(numPaths, DISPLAYCONFIG_PATH_INFO{});
+    std::vector<DISPLAYCONFIG_MODE_INFO> modeInfos(numModes, DISPLAYCONFIG_MODE_INFO{});
+    winrt::check_win32(QueryDisplayConfig(
+        QDC_ONLY_ACTIVE_PATHS,
+        &numPaths,
+        pathInfos.data(),
+        &numModes,
+        modeInfos.data(),
+        nullptr));
+    pathInfos.resize(numPaths);
+    return pathInfos;
+}
+
+struct DisplayHDRInfo
+{
+    bool IsHDR = false;
+    // Only valid if IsHDR is true
+    float SDRWhiteLevelInNits = 0.0f;
+};
+
+std::vector<std::pair<std::wstring, DisplayHDRInfo>> GetDisplayHDRInfos()
+{
+    auto pathInfos = GetDisplayConfigPathInfos();
+    std::vector<std::pair<std::wstring, DisplayHDRInfo>> namesToHDRInfos;
+    for (auto&& pathInfo : pathInfos)
+    {
+        // Get the device name.
+        DISPLAYCONFIG_SOURCE_DEVICE_NAME deviceName = {};
+        deviceName.header.size = sizeof(deviceName);
+        deviceName.header.type = DISPLAYCONFIG_DEVICE_INFO_GET_SOURCE_NAME;
+        deviceName.header.adapterId = pathInfo.sourceInfo.adapterId;
+        deviceName.header.id = pathInfo.sourceInfo.id;
+        winrt::check_win32(DisplayConfigGetDeviceInfo(&deviceName.header));
+        std::wstring name(deviceName.viewGdiDeviceName);
+
+        // Check to see if the display is in HDR mode.
+        DISPLAYCONFIG_GET_ADVANCED_COLOR_INFO colorInfo = {};
+        colorInfo.header.size = sizeof(colorInfo);
+        colorInfo.header.type = DISPLAYCONFIG_DEVICE_INFO_GET_ADVANCED_COLOR_INFO;
+        colorInfo.header.adapterId = pathInfo.targetInfo.adapterId;
+        colorInfo.header.id = pathInfo.targetInfo.id;
+        winrt::check_win32(DisplayConfigGetDeviceInfo(&colorInfo.header));
+        bool isHDR = colorInfo.advancedColorEnabled && !colorInfo.wideColorEnforced;
+
+        // Get the SDR white level.
+        float sdrWhiteLevelInNits = 0.0f;
+        if (isHDR)
+        {
+            DISPLAYCONFIG_SDR_WHITE_LEVEL whiteLevel = {};
+            whiteLevel.header.size = sizeof(whiteLevel);
+            whiteLevel.header.type = DISPLAYCONFIG_DEVICE_INFO_GET_SDR_WHITE_LEVEL;
+            whiteLevel.header.adapterId = pathInfo.targetInfo.adapterId;
+            whiteLevel.header.id = pathInfo.targetInfo.id;
+            winrt::check_win32(DisplayConfigGetDeviceInfo(&whiteLevel.header));
+            sdrWhiteLevelInNits = static_cast<float>((whiteLevel.SDRWhiteLevel / 1000.0) * 80.0);
+        }
+
+        namesToHDRInfos.push_back({ name, { isHDR, sdrWhiteLevelInNits } });
+    }
+
+    return namesToHDRInfos;
+}
+
+std::vector<Display> SystemDisplayTopologyProvider::QueryDisplays()
+{
+    // Get all the display handles
+    std::vector<HMONITOR> displayHandles;
+    EnumDisplayMonitors(nullptr, nullptr, [](HMONITOR hmon, HDC, LPRECT, LPARAM lparam)
+    {
+        auto& displayHandles = *reinterpret_cast<std::vector<HMONITOR>*>(lparam);
+        displayHandles.push_back(hmon);
+
+        return TRUE;
+    }, reinterpret_cast<LPARAM>(&displayHandles));
+
+    // We need the max luminance of the display, which we get from DXGI
+    auto maxLuminances = GetDisplayMaxLuminances();
+
+    // Build a mapping of device names to HDR information
+    auto namesToHDRInfos = GetDisplayHDRInfos();
+    
+    // Go through each display and find the matching hdr info
+    std::vector<Display> displays;
+    for (auto&& displayHandle : displayHandles)
+    {
+        // Get the monitor rect and device name.
+        MONITORINFOEXW monitorInfo = {};
+        monitorInfo.cbSize = sizeof(monitorInfo);
+        winrt::check_bool(GetMonitorInfoW(displayHandle, &monitorInfo));
+        std::wstring name(monitorInfo.szDevice);
+
+        // There are only ever a handful of displays, so a linear search beats
+        // building maps. Displays we can't find information for are treated
+        // as SDR.
+        DisplayHDRInfo hdrInfo = {};
+        auto foundHDRInfo = std::find_if(namesToHDRInfos.begin(), namesToHDRInfos.end(), [&](auto&& pair) { return pair.first == name; });
+        if (foundHDRInfo != namesToHDRInfos.end())
+        {
+            hdrInfo = foundHDRInfo->second;
+        }
+        float maxLuminance = 0.0f;
+        auto foundMaxLuminance = std::find_if(maxLuminances.begin(), maxLuminances.end(), [&](auto&& pair) { return pair.first == displayHandle; });
+        if (foundMaxLuminance != maxLuminances.end())
+        {
+            maxLuminance = foundMaxLuminance->second;
+        }
+        displays.push_back(Display(displayHandle, monitorInfo.rcMonitor, hdrInfo.IsHDR, hdrInfo.SDRWhiteLevelInNits, maxLuminance));
+    }
+
+    return displays;
+}
+
+
+SystemDisplayTopologyProvider::~SystemDisplayTopologyProvider()
+{
+    if (m_thread.joinable())
+    {
+        if (m_window != nullptr)
+        {
+            PostMessageW(m_window, WM_CLOSE, 0, 0);
+        }
+        m_thread.join();
+    }
+}
+
+bool SystemDisplayTopologyProvider::Start(std::function<void()> const& onChanged)
+{
+    m_onChanged = onChanged;
+
+    // Wait for the window to exist so that we can't miss a change
+    // that happens right after we return.
+    wil::unique_event ready(wil::EventOptions::ManualReset);
+    m_thread = std::thread([this, &ready]()
+        {
+            Run(ready);
+        });
+    ready.wait();
+    return m_window != nullptr;
+}
+
+void SystemDisplayTopologyProvider::Run(wil::unique_event const& ready)
+{
+    auto instance = GetModuleHandleW(nullptr);
+    WNDCLASSEXW windowClass = {};
+    windowClass.cbSize = sizeof(windowClass);
+    windowClass.lpfnWndProc = WndProc;
+    windowClass.hInstance = instance;
+    windowClass.lpszClassName = L"ScreenshotSample.DisplayTopology";
+    // Fails harmlessly if another provider already registered it.
+    RegisterClassExW(&windowClass);
+
+    // Message-only windows don't get broadcasts like WM_DISPLAYCHANGE,
+    // so this has to be a real (but never shown) top level window.
+    m_window = CreateWindowExW(0, windowClass.lpszClassName, L"", WS_OVERLAPPED, 0, 0, 0, 0, nullptr, nullptr, instance, this);
+    ready.SetEvent();
+    if (m_window == nullptr)
+    {
+        return;
+    }
+
+    MSG message = {};
+    while (GetMessageW(&message, nullptr, 0, 0) > 0)
+    {
+        TranslateMessage(&message);
+        DispatchMessageW(&message);
+    }
+}
+
+LRESULT CALLBACK SystemDisplayTopologyProvider::WndProc(HWND window, UINT message, WPARAM wparam, LPARAM lparam)
+{
+    if (message == WM_NCCREATE)
+    {
+        auto createStruct = reinterpret_cast<CREATESTRUCTW*>(lparam);
+        SetWindowLongPtrW(window, GWLP_USERDATA, reinterpret_cast<LONG_PTR>(createStruct->lpCreateParams));
+    }
+
+    auto provider = reinterpret_cast<SystemDisplayTopologyProvider*>(GetWindowLongPtrW(window, GWLP_USERDATA));
+    switch (message)
+    {
+    // Resolution, arrangement and HDR mode changes come through as
+    // WM_DISPLAYCHANGE, some of the rest (like the SDR white level)
+    // only as WM_SETTINGCHANGE.
+    case WM_DISPLAYCHANGE:
+    case WM_SETTINGCHANGE:
+    case WM_DEVICECHANGE:
+        if (provider)
+        {
+            provider->m_onChanged();
+        }
+        break;
+    case WM_DESTROY:
+        PostQuitMessage(0);
+        break;
+    }
+    return DefWindowProcW(window, message, wparam, lparam);
+}
+
+FakeDisplayTopologyProvider::FakeDisplayTopologyProvider(std::vector<Display> const& displays)
+{
+    m_displays = displays;
+}
+
+bool FakeDisplayTopologyProvider::Start(std::function<void()> const& onChanged)
+{
+    std::lock_guard lock(m_lock);
+    m_onChanged = onChanged;
+    return true;
+}
+
+std::vector<Display> FakeDisplayTopologyProvider::QueryDisplays()
+{
+    std::lock_guard lock(m_lock);
+    m_queryCount++;
+    return m_displays;
+}
+
+void FakeDisplayTopologyProvider::SetDisplays(std::vector<Display> const& displays)
+{
+    std::function<void()> onChanged;
+    {
+        std::lock_guard lock(m_lock);
+        m_displays = displays;
+        onChanged = m_onChanged;
+    }
+    if (onChanged)
+    {
+        onChanged();
+    }
+}
+
+DisplayTopology::DisplayTopology(std::unique_ptr<DisplayTopologyProvider> provider)
+{
+    m_provider = std::move(provider);
+    // Without notifications we'd serve stale displays forever,
+    // so fall back to querying every time.
+    m_alwaysQuery = !m_provider->Start([this]()
+        {
+            Invalidate();
+        });
+}
+
+std::shared_ptr<DisplayTopology> const& DisplayTopology::System()
+{
+    static auto const topology = std::make_shared<DisplayTopology>(std::make_unique<SystemDisplayTopologyProvider>());
+    return topology;
+}
+
+std::vector<Display> DisplayTopology::Displays()
+{
+    std::lock_guard lock(m_lock);
+    // A change that comes in while we're querying bumps the generation
+    // again, so the next call queries again too.
+    auto generation = m_generation.load();
+    if (m_alwaysQuery || !m_hasDisplays || generation != m_cachedGeneration)
+    {
+        TraceScope trace("QueryDisplays");
+        m_displays = m_provider->QueryDisplays();
+        m_cachedGeneration = generation;
+        m_hasDisplays = true;
+    }
+    return m_displays;
+}
+
+void DisplayTopology::Invalidate()
+{
+    m_generation++;
+}
@@ -0,0 +1,86 @@
+#pragma once
+#include "Display.h"
+
+// Where DisplayTopology gets its displays from.
+class DisplayTopologyProvider
+{
+public:
+    virtual ~DisplayTopologyProvider() {}
+
+    // Called once, before the first query. onChanged should be called
+    // (from any thread) whenever the displays may have changed. Returns
+    // false if changes can't be reported.
+    virtual bool Start(std::function<void()> const& onChanged) = 0;
+    virtual std::vector<Display> QueryDisplays() = 0;
+};
+
+// Asks the OS: EnumDisplayMonitors, DXGI for the max luminance and
+// QueryDisplayConfig for the HDR state. Changes are picked up from
+// WM_DISPLAYCHANGE and WM_SETTINGCHANGE on a hidden window.
+class SystemDisplayTopologyProvider : public DisplayTopologyProvider
+{
+public:
+    SystemDisplayTopologyProvider() {}
+    ~SystemDisplayTopologyProvider() override;
+
+    bool Start(std::function<void()> const& onChanged) override;
+    std::vector<Display> QueryDisplays() override;
+
+private:
+    static LRESULT CALLBACK WndProc(HWND window, UINT message, WPARAM wparam, LPARAM lparam);
+    void Run(wil::unique_event const& ready);
+
+private:
+    std::function<void()> m_onChanged;
+    std::thread m_thread;
+    HWND m_window = nullptr;
+};
+
+// Hands out whatever displays it was last given. Used for synthetic
+// layouts, and to drive DisplayTopology without real displays.
+class FakeDisplayTopologyProvider : public DisplayTopologyProvider
+{
+public:
+    FakeDisplayTopologyProvider(std::vector<Display> const& displays);
+    ~FakeDisplayTopologyProvider() override {}
+
+    bool Start(std::function<void()> const& onChanged) override;
+    std::vector<Display> QueryDisplays() override;
+
+    // Replaces the displays and reports a change.
+    void SetDisplays(std::vector<Display> const& displays);
+    uint32_t QueryCount() const { return m_queryCount; }
+
+private:
+    std::mutex m_lock;
+    std::function<void()> m_onChanged;
+    std::vector<Display> m_displays;
+    std::atomic<uint32_t> m_queryCount = 0;
+};
+
+// Caches the display table from a provider and only queries it again
+// after the provider reports a change.
+class DisplayTopology
+{
+public:
+    DisplayTopology(std::unique_ptr<DisplayTopologyProvider> provider);
+    ~DisplayTopology() {}
+
+    // The topology of the displays attached to this machine.
+    static std::shared_ptr<DisplayTopology> const& System();
+
+    std::vector<Display> Displays();
+    // Bumped on every change notification. Compare it against a previous
+    // value to find out if Displays needs to be called again.
+    uint32_t Generation() const { return m_generation; }
+    void Invalidate();
+
+private:
+    std::unique_ptr<DisplayTopologyProvider> m_provider;
+    std::mutex m_lock;
+    std::vector<Display> m_displays;
+    std::atomic<uint32_t> m_generation = 0;
+    uint32_t m_cachedGeneration = 0;
+    bool m_hasDisplays = false;
+    bool m_alwaysQuery = false;
+};
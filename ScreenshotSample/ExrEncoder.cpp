@@ -0,0 +1,249 @@
+#include "pch.h"
+#include "ExrEncoder.h"
+#include "Checksum.h"
+#include "Trace.h"
+
+constexpr uint8_t ExrMagic[] = { 0x76, 0x2f, 0x31, 0x01 };
+// Version 2, single part scanline file
+constexpr uint8_t ExrVersion[] = { 0x02, 0x00, 0x00, 0x00 };
+constexpr int32_t ExrHalf = 1;
+constexpr uint8_t ExrNoCompression = 0;
+constexpr uint8_t ExrZipCompression = 3;
+constexpr uint32_t ExrZipLinesPerBlock = 16;
+constexpr float ScRgbWhiteInNits = 80.0f;
+// How many rows are prepared at a time without compression.
+constexpr uint32_t UncompressedBandRowCount = 256;
+
+// Channels are stored in alphabetical order, our pixels are RGBA.
+constexpr char ExrChannelNames[] = { 'A', 'B', 'G', 'R' };
+constexpr uint32_t ExrChannelSources[] = { 3, 2, 1, 0 };
+
+template <typename T>
+void AppendLittleEndian(std::vector<uint8_t>& output, T value)
+{
+    auto bytes = reinterpret_cast<uint8_t const*>(&value);
+    output.insert(output.end(), bytes, bytes + sizeof(value));
+}
+
+void AppendExrAttribute(std::vector<uint8_t>& output, char const* name, char const* type, std::vector<uint8_t> const& value)
+{
+    output.insert(output.end(), name, name + strlen(name) + 1);
+    output.insert(output.end(), type, type + strlen(type) + 1);
+    AppendLittleEndian(output, static_cast<int32_t>(value.size()));
+    output.insert(output.end(), value.begin(), value.end());
+}
+
+std::vector<uint8_t> CreateExrHeader(uint32_t width, uint32_t height, uint8_t compression)
+{
+    std::vector<uint8_t> header(std::begin(ExrMagic), std::end(ExrMagic));
+    header.insert(header.end(), std::begin(ExrVersion), std::end(ExrVersion));
+
+    std::vector<uint8_t> channels;
+    for (auto name : ExrChannelNames)
+    {
+        channels.insert(channels.end(), { static_cast<uint8_t>(name), 0 });
+        AppendLittleEndian(channels, ExrHalf);
+        // pLinear and reserved
+        channels.insert(channels.end(), { 0, 0, 0, 0 });
+        // No subsampling
+        AppendLittleEndian(channels, 1);
+        AppendLittleEndian(channels, 1);
+    }
+    channels.push_back(0);
+    AppendExrAttribute(header, "channels", "chlist", channels);
+
+    AppendExrAttribute(header, "compression", "compression", { compression });
+
+    std::vector<uint8_t> window;
+    AppendLittleEndian(window, 0);
+    AppendLittleEndian(window, 0);
+    AppendLittleEndian(window, static_cast<int32_t>(width) - 1);
+    AppendLittleEndian(window, static_cast<int32_t>(height) - 1);
+    AppendExrAttribute(header, "dataWindow", "box2i", window);
+    AppendExrAttribute(header, "displayWindow", "box2i", window);
+
+    // Increasing y
+    AppendExrAttribute(header, "lineOrder", "lineOrder", { 0 });
+
+    std::vector<uint8_t> value;
+    AppendLittleEndian(value, 1.0f);
+    AppendExrAttribute(header, "pixelAspectRatio", "float", value);
+    value.clear();
+    AppendLittleEndian(value, 0.0f);
+    AppendLittleEndian(value, 0.0f);
+    AppendExrAttribute(header, "screenWindowCenter", "v2f", value);
+    value.clear();
+    AppendLittleEndian(value, 1.0f);
+    AppendExrAttribute(header, "screenWindowWidth", "float", value);
+    // scRGB, so 1.0 is 80 nits
+    value.clear();
+    AppendLittleEndian(value, ScRgbWhiteInNits);
+    AppendExrAttribute(header, "whiteLuminance", "float", value);
+
+    header.push_back(0);
+    return header;
+}
+
+// Splits a row of RGBA halfs into the channel planes of an EXR scanline.
+void SplitExrChannels(uint16_t const* rgbaRow, uint32_t width, uint8_t* output)
+{
+    auto planes = reinterpret_cast<uint16_t*>(output);
+    for (uint32_t channel = 0; channel < 4; channel++)
+    {
+        auto plane = planes + static_cast<size_t>(channel) * width;
+        auto sourceChannel = ExrChannelSources[channel];
+        for (uint32_t x = 0; x < width; x++)
+        {
+            plane[x] = rgbaRow[x * 4 + sourceChannel];
+        }
+    }
+}
+
+// Builds a block of scanlines and zip compresses it the way OpenEXR does:
+// the even bytes are moved before the odd ones, each byte is replaced by its
+// difference from the one before, and the result goes into a zlib stream.
+// Blocks that don't get smaller are stored as they are.
+void CompressExrBlock(
+    ImageRowSource& source,
+    uint32_t width,
+    uint32_t startRow,
+    uint32_t endRow,
+    DeflateSettings const& settings,
+    std::vector<uint8_t>& chunk)
+{
+    TraceScope trace("CompressExrBlock");
+    auto lineSize = static_cast<size_t>(width) * 8;
+    auto size = lineSize * (endRow - startRow);
+    std::vector<uint8_t> raw(size);
+    for (auto row = startRow; row < endRow; row++)
+    {
+        SplitExrChannels(reinterpret_cast<uint16_t const*>(source.GetRow(row)), width, raw.data() + lineSize * (row - startRow));
+    }
+
+    std::vector<uint8_t> predicted(size);
+    auto evenBytes = predicted.data();
+    auto oddBytes = predicted.data() + (size + 1) / 2;
+    for (size_t i = 0; i < size; i += 2)
+    {
+        *evenBytes++ = raw[i];
+        if (i + 1 < size)
+        {
+            *oddBytes++ = raw[i + 1];
+        }
+    }
+    auto previous = predicted[0];
+    for (size_t i = 1; i < size; i++)
+    {
+        auto current = predicted[i];
+        predicted[i] = static_cast<uint8_t>(current - previous + 128);
+        previous = current;
+    }
+
+    std::vector<uint8_t> compressed;
+    compressed.reserve(size / 2);
+    // zlib header: deflate with a 32KB window, no preset dictionary
+    compressed.insert(compressed.end(), { 0x78, 0x9c });
+    Deflater deflater(settings);
+    deflater.Compress(predicted.data(), 0, size, true, compressed);
+    auto adler = Adler32(predicted.data(), size);
+    compressed.insert(compressed.end(), {
+        static_cast<uint8_t>(adler >> 24),
+        static_cast<uint8_t>(adler >> 16),
+        static_cast<uint8_t>(adler >> 8),
+        static_cast<uint8_t>(adler) });
+
+    auto& data = compressed.size() < size ? compressed : raw;
+    chunk.clear();
+    AppendLittleEndian(chunk, static_cast<int32_t>(startRow));
+    AppendLittleEndian(chunk, static_cast<int32_t>(data.size()));
+    chunk.insert(chunk.end(), data.begin(), data.end());
+}
+
+ExrEncoder::ExrEncoder(std::shared_ptr<ThreadPool> const& threadPool, ExrCompressionMode compression, PngCompressionPreset preset)
+{
+    m_threadPool = threadPool;
+    m_compression = compression;
+    m_deflateSettings = GetDeflateSettings(preset);
+}
+
+void ExrEncoder::EncodeStreaming(
+    uint32_t width,
+    uint32_t height,
+    ImageRowSource& source,
+    std::function<void(uint8_t const*, size_t)> const& write)
+{
+    TraceScope trace("EncodeExr");
+    auto isZip = m_compression == ExrCompressionMode::Zip;
+    auto header = CreateExrHeader(width, height, isZip ? ExrZipCompression : ExrNoCompression);
+    auto lineSize = static_cast<size_t>(width) * 8;
+
+    if (!isZip)
+    {
+        // Every block is one scanline, so we know where they all go.
+        std::vector<uint8_t> offsets;
+        uint64_t offset = header.size() + static_cast<uint64_t>(height) * sizeof(uint64_t);
+        for (uint32_t row = 0; row < height; row++)
+        {
+            AppendLittleEndian(offsets, offset);
+            offset += 8 + lineSize;
+        }
+        write(header.data(), header.size());
+        write(offsets.data(), offsets.size());
+
+        std::vector<uint8_t> chunk;
+        for (uint32_t bandStartRow = 0; bandStartRow < height; bandStartRow += UncompressedBandRowCount)
+        {
+            auto bandEndRow = std::min(bandStartRow + UncompressedBandRowCount, height);
+            source.PrepareRows(bandStartRow, bandEndRow);
+            for (auto row = bandStartRow; row < bandEndRow; row++)
+            {
+                chunk.clear();
+                AppendLittleEndian(chunk, static_cast<int32_t>(row));
+                AppendLittleEndian(chunk, static_cast<int32_t>(lineSize));
+                chunk.resize(8 + lineSize);
+                SplitExrChannels(reinterpret_cast<uint16_t const*>(source.GetRow(row)), width, chunk.data() + 8);
+                write(chunk.data(), chunk.size());
+            }
+        }
+        return;
+    }
+
+    auto blockCount = (height + ExrZipLinesPerBlock - 1) / ExrZipLinesPerBlock;
+    auto blocksPerBand = m_threadPool->ThreadCount() * 2;
+    auto rowsPerBand = blocksPerBand * ExrZipLinesPerBlock;
+    std::vector<std::vector<uint8_t>> chunks(blockCount);
+    for (uint32_t bandStartRow = 0; bandStartRow < height; bandStartRow += rowsPerBand)
+    {
+        auto bandEndRow = std::min(bandStartRow + rowsPerBand, height);
+        auto firstBlock = bandStartRow / ExrZipLinesPerBlock;
+        auto bandBlockCount = (bandEndRow - bandStartRow + ExrZipLinesPerBlock - 1) / ExrZipLinesPerBlock;
+        source.PrepareRows(bandStartRow, bandEndRow);
+        m_threadPool->ParallelFor(bandBlockCount, [&](uint32_t index)
+            {
+                auto startRow = bandStartRow + index * ExrZipLinesPerBlock;
+                auto endRow = std::min(startRow + ExrZipLinesPerBlock, bandEndRow);
+                CompressExrBlock(source, width, startRow, endRow, m_deflateSettings, chunks[firstBlock + index]);
+            });
+    }
+
+    std::vector<uint8_t> offsets;
+    uint64_t offset = header.size() + static_cast<uint64_t>(blockCount) * sizeof(uint64_t);
+    for (auto&& chunk : chunks)
+    {
+        AppendLittleEndian(offsets, offset);
+        offset += chunk.size();
+    }
+    write(header.data(), header.size());
+    write(offsets.data(), offsets.size());
+    for (auto&& chunk : chunks)
+    {
+        write(chunk.data(), chunk.size());
+    }
+}
+
+uint64_t ExrEncoder::EstimateSize(uint32_t width, uint32_t height) const
+{
+    // Roughly the header and the offset table, plus the pixels.
+    auto pixelsSize = static_cast<uint64_t>(width) * height * 8 + static_cast<uint64_t>(height) * 16 + 512;
+    return m_compression == ExrCompressionMode::Zip ? pixelsSize / 2 : pixelsSize;
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include "ImageEncoder.h"
+#include "PngEncoder.h"
+#include "ThreadPool.h"
+
+enum class ExrCompressionMode
+{
+    None,
+    // Blocks of 16 scanlines, deflated on the thread pool
+    Zip,
+};
+
+// Writes FP16 scRGB pixels to a half float RGBA OpenEXR file, for -keepHDR.
+// The file is scanline based: the pixels are already half floats, so the
+// only work is splitting them into channels and, with Zip, compressing.
+//
+// EXR puts the offset of every block before the first one. Uncompressed
+// files are streamed, but compressed blocks are kept in memory until the
+// last one is done and the offsets are known.
+class ExrEncoder : public ImageEncoder
+{
+public:
+    ExrEncoder(std::shared_ptr<ThreadPool> const& threadPool, ExrCompressionMode compression, PngCompressionPreset preset);
+    ~ExrEncoder() override {}
+
+    ImageFormat Format() const override { return ImageFormat::Exr; }
+    DXGI_FORMAT InputFormat() const override { return DXGI_FORMAT_R16G16B16A16_FLOAT; }
+    void EncodeStreaming(
+        uint32_t width,
+        uint32_t height,
+        ImageRowSource& source,
+        std::function<void(uint8_t const*, size_t)> const& write) override;
+    uint64_t EstimateSize(uint32_t width, uint32_t height) const override;
+
+private:
+    std::shared_ptr<ThreadPool> m_threadPool;
+    ExrCompressionMode m_compression = ExrCompressionMode::Zip;
+    DeflateSettings m_deflateSettings;
+};
@@ -0,0 +1,215 @@
+#include "pch.h"
+#include "FileWriter.h"
+
+constexpr size_t WriteBufferSize = 1024 * 1024;
+constexpr size_t MappedWindowSize = 64 * 1024 * 1024;
+
+FileWriter::FileWriter(std::wstring const& path, FileWriteMode mode, uint64_t expectedSize)
+{
+    m_mode = mode;
+    m_expectedSize = expectedSize;
+    // DELETE so a file that never got closed can be removed.
+    auto access = GENERIC_WRITE | DELETE | (mode == FileWriteMode::MemoryMapped ? GENERIC_READ : 0);
+    m_file.reset(CreateFileW(path.c_str(), access, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr));
+    winrt::check_bool(static_cast<bool>(m_file));
+
+    switch (m_mode)
+    {
+    case FileWriteMode::Preallocated:
+    {
+        // This only reserves space, the file's size doesn't change.
+        FILE_ALLOCATION_INFO allocationInfo = {};
+        allocationInfo.AllocationSize.QuadPart = static_cast<LONGLONG>(expectedSize);
+        winrt::check_bool(SetFileInformationByHandle(m_file.get(), FileAllocationInfo, &allocationInfo, sizeof(allocationInfo)));
+        m_buffer.reserve(WriteBufferSize);
+        break;
+    }
+    case FileWriteMode::MemoryMapped:
+        GrowMapping(std::max<uint64_t>(expectedSize, 1));
+        break;
+    case FileWriteMode::Plain:
+    case FileWriteMode::Unbuffered:
+    default:
+        m_buffer.reserve(WriteBufferSize);
+        break;
+    }
+}
+
+FileWriter::~FileWriter()
+{
+    if (m_file)
+    {
+        // The view and mapping have to go before the file can be deleted.
+        m_view.reset();
+        m_mapping.reset();
+        FILE_DISPOSITION_INFO disposition = {};
+        disposition.DeleteFile = TRUE;
+        SetFileInformationByHandle(m_file.get(), FileDispositionInfo, &disposition, sizeof(disposition));
+    }
+}
+
+void FileWriter::Write(uint8_t const* data, size_t size)
+{
+    if (m_mode != FileWriteMode::MemoryMapped)
+    {
+        if (m_buffer.size() + size > WriteBufferSize)
+        {
+            FlushBuffer();
+        }
+        if (size >= WriteBufferSize)
+        {
+            WriteToHandle(data, size);
+        }
+        else
+        {
+            m_buffer.insert(m_buffer.end(), data, data + size);
+        }
+        m_bytesWritten += size;
+        return;
+    }
+
+    if (m_bytesWritten + size > m_fileSize)
+    {
+        GrowMapping(m_bytesWritten + size);
+    }
+    while (size > 0)
+    {
+        if (!m_view || m_bytesWritten < m_viewOffset || m_bytesWritten >= m_viewOffset + m_viewSize)
+        {
+            MapWindow(m_bytesWritten);
+        }
+        auto viewPosition = static_cast<size_t>(m_bytesWritten - m_viewOffset);
+        auto copySize = std::min(size, m_viewSize - viewPosition);
+        memcpy(m_view.get() + viewPosition, data, copySize);
+        data += copySize;
+        size -= copySize;
+        m_bytesWritten += copySize;
+    }
+}
+
+void FileWriter::Close()
+{
+    if (!m_file)
+    {
+        return;
+    }
+    if (m_mode == FileWriteMode::MemoryMapped)
+    {
+        if (m_view)
+        {
+            winrt::check_bool(FlushViewOfFile(m_view.get(), 0));
+        }
+        m_view.reset();
+        m_mapping.reset();
+        // The mapping made the file bigger than what we wrote.
+        SetFileSize(m_bytesWritten);
+    }
+    else
+    {
+        FlushBuffer();
+    }
+    m_file.reset();
+}
+
+void FileWriter::FlushBuffer()
+{
+    if (!m_buffer.empty())
+    {
+        WriteToHandle(m_buffer.data(), m_buffer.size());
+        m_buffer.clear();
+    }
+}
+
+void FileWriter::WriteToHandle(uint8_t const* data, size_t size)
+{
+    // WriteFile takes a DWORD, so large writes go out in pieces.
+    while (size > 0)
+    {
+        auto pieceSize = static_cast<DWORD>(std::min<size_t>(size, 1u << 30));
+        DWORD written = 0;
+        winrt::check_bool(WriteFile(m_file.get(), data, pieceSize, &written, nullptr));
+        data += written;
+        size -= written;
+    }
+}
+
+void FileWriter::GrowMapping(uint64_t minimumSize)
+{
+    // Grow geometrically so a bad size hint doesn't mean remapping constantly.
+    auto newSize = std::max({ minimumSize, m_fileSize + m_fileSize / 2, m_expectedSize });
+    m_view.reset();
+    m_mapping.reset();
+    SetFileSize(newSize);
+    m_fileSize = newSize;
+    m_mapping.reset(CreateFileMappingW(m_file.get(), nullptr, PAGE_READWRITE, 0, 0, nullptr));
+    winrt::check_bool(static_cast<bool>(m_mapping));
+}
+
+void FileWriter::MapWindow(uint64_t offset)
+{
+    // Views have to start on an allocation granularity boundary.
+    SYSTEM_INFO systemInfo = {};
+    GetSystemInfo(&systemInfo);
+    auto granularity = static_cast<uint64_t>(systemInfo.dwAllocationGranularity);
+    auto viewOffset = offset - offset % granularity;
+    auto viewSize = static_cast<size_t>(std::min<uint64_t>(MappedWindowSize, m_fileSize - viewOffset));
+
+    m_view.reset();
+    m_view.reset(static_cast<uint8_t*>(MapViewOfFile(
+        m_mapping.get(),
+        FILE_MAP_WRITE,
+        static_cast<DWORD>(viewOffset >> 32),
+        static_cast<DWORD>(viewOffset),
+        viewSize)));
+    winrt::check_bool(static_cast<bool>(m_view));
+    m_viewOffset = viewOffset;
+    m_viewSize = viewSize;
+}
+
+void FileWriter::SetFileSize(uint64_t size)
+{
+    LARGE_INTEGER position = {};
+    position.QuadPart = static_cast<LONGLONG>(size);
+    winrt::check_bool(SetFilePointerEx(m_file.get(), position, nullptr, FILE_BEGIN));
+    winrt::check_bool(SetEndOfFile(m_file.get()));
+}
+
+uint64_t QueryFileSize(HANDLE file)
+{
+    LARGE_INTEGER size = {};
+    winrt::check_bool(GetFileSizeEx(file, &size));
+    return static_cast<uint64_t>(size.QuadPart);
+}
+
+bool ReadFileAt(HANDLE file, uint64_t offset, void* data, uint32_t size)
+{
+    OVERLAPPED overlapped = {};
+    overlapped.Offset = static_cast<DWORD>(offset);
+    overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+    DWORD bytesRead = 0;
+    if (!ReadFile(file, data, size, &bytesRead, &overlapped))
+    {
+        auto error = GetLastError();
+        if (error != ERROR_HANDLE_EOF)
+        {
+            winrt::throw_hresult(HRESULT_FROM_WIN32(error));
+        }
+    }
+    return bytesRead == size;
+}
+
+void WriteFileAt(HANDLE file, uint64_t offset, uint8_t const* data, size_t size)
+{
+    while (size > 0)
+    {
+        OVERLAPPED overlapped = {};
+        overlapped.Offset = static_cast<DWORD>(offset);
+        overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+        auto chunkSize = static_cast<DWORD>(std::min<size_t>(size, 64 * 1024 * 1024));
+        DWORD bytesWritten = 0;
+        winrt::check_bool(WriteFile(file, data, chunkSize, &bytesWritten, &overlapped));
+        data += bytesWritten;
+        offset += bytesWritten;
+        size -= bytesWritten;
+    }
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+enum class FileWriteMode
+{
+    // WriteFile through a plain handle
+    Plain,
+    // Reserve the expected size up front so the file doesn't fragment
+    Preallocated,
+    // Copy into mapped views of the file
+    MemoryMapped,
+    // Bypass the file cache for large files, see AsyncFileWriter. FileWriter
+    // writes these like Plain.
+    Unbuffered,
+};
+
+// Writes a file front to back, keeping at most a small buffer (or one
+// mapped window) of it in memory. Nothing is final until Close, which
+// trims the file to what was written. If it's destroyed without a
+// successful Close, say because encoding threw, the file is deleted.
+class FileWriter
+{
+public:
+    // expectedSize is a hint, writing more or less than it is fine.
+    FileWriter(std::wstring const& path, FileWriteMode mode, uint64_t expectedSize);
+    ~FileWriter();
+
+    void Write(uint8_t const* data, size_t size);
+    void Close();
+
+    uint64_t BytesWritten() const { return m_bytesWritten; }
+
+private:
+    void FlushBuffer();
+    void WriteToHandle(uint8_t const* data, size_t size);
+    void GrowMapping(uint64_t minimumSize);
+    void MapWindow(uint64_t offset);
+    void SetFileSize(uint64_t size);
+
+private:
+    FileWriteMode m_mode = FileWriteMode::Plain;
+    wil::unique_hfile m_file;
+    uint64_t m_bytesWritten = 0;
+
+    // Plain and Preallocated coalesce small writes.
+    std::vector<uint8_t> m_buffer;
+
+    // MemoryMapped keeps the file a bit ahead of what was written.
+    uint64_t m_expectedSize = 0;
+    uint64_t m_fileSize = 0;
+    wil::unique_handle m_mapping;
+    wil::unique_mapview_ptr<uint8_t> m_view;
+    uint64_t m_viewOffset = 0;
+    size_t m_viewSize = 0;
+};
+
+// For files that are patched in place rather than written front to back.
+uint64_t QueryFileSize(HANDLE file);
+// Returns false if the file is too short, throws if reading fails.
+bool ReadFileAt(HANDLE file, uint64_t offset, void* data, uint32_t size);
+void WriteFileAt(HANDLE file, uint64_t offset, uint8_t const* data, size_t size);
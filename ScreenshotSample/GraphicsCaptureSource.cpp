@@ -0,0 +1,65 @@
+#include "pch.h"
+#include "GraphicsCaptureSource.h"
+#include "Trace.h"
+
+namespace winrt
+{
+    using namespace Windows::Graphics::Capture;
+    using namespace Windows::Graphics::DirectX;
+    using namespace Windows::Graphics::DirectX::Direct3D11;
+}
+
+namespace util
+{
+    using namespace robmikh::common::desktop;
+    using namespace robmikh::common::uwp;
+}
+
+GraphicsCaptureSource::GraphicsCaptureSource(winrt::IDirect3DDevice const& device)
+{
+    m_device = device;
+}
+
+wil::task<winrt::com_ptr<ID3D11Texture2D>> GraphicsCaptureSource::CaptureAsync(
+    Display const& display,
+    winrt::DirectXPixelFormat pixelFormat)
+{
+    auto device = m_device;
+
+    // Setup our capture objects. If you want, this is where you 
+    // should adjust any properties of the GraphicsCaptureSession
+    // (e.g. IsCursorCaptureEnabled, IsBorderRequired).
+    // The CreateCaptureItemForMonitor helper can be found here: https://github.com/robmikh/robmikh.common/blob/f2311df8de56f31410d14f55de7307464d9a673d/robmikh.common/include/robmikh.common/capture.desktop.interop.h#L16-L23
+    auto item = util::CreateCaptureItemForMonitor(display.Handle());
+    auto framePool = winrt::Direct3D11CaptureFramePool::CreateFreeThreaded(
+        device,
+        pixelFormat,
+        1,
+        item.Size());
+    auto session = framePool.CreateCaptureSession(item);
+
+    // Get one frame and then end the capture.
+    winrt::com_ptr<ID3D11Texture2D> captureTexture;
+    wil::shared_event captureEvent(wil::EventOptions::ManualReset);
+    framePool.FrameArrived([session, captureEvent, &captureTexture](auto&& framePool, auto&&) -> void
+        {
+            auto frame = framePool.TryGetNextFrame();
+            auto surface = frame.Surface();
+            auto frameTexture = GetDXGIInterfaceFromObject<ID3D11Texture2D>(surface);
+
+            framePool.Close();
+            session.Close();
+
+            captureTexture.copy_from(frameTexture.get());
+            captureEvent.SetEvent();
+        });
+    session.StartCapture();
+
+    // Wait for the next frame to show up.
+    {
+        TraceScope trace("WaitForFrameArrived", display.Handle());
+        co_await winrt::resume_on_signal(captureEvent.get());
+    }
+
+    co_return captureTexture;
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include "CaptureSource.h"
+
+// Captures displays using Windows.Graphics.Capture.
+class GraphicsCaptureSource : public CaptureSource
+{
+public:
+    GraphicsCaptureSource(winrt::Windows::Graphics::DirectX::Direct3D11::IDirect3DDevice const& device);
+    ~GraphicsCaptureSource() override {}
+
+    wil::task<winrt::com_ptr<ID3D11Texture2D>> CaptureAsync(
+        Display const& display,
+        winrt::Windows::Graphics::DirectX::DirectXPixelFormat pixelFormat) override;
+
+private:
+    winrt::Windows::Graphics::DirectX::Direct3D11::IDirect3DDevice m_device{ nullptr };
+};
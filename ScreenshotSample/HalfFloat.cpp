@@ -0,0 +1,89 @@
+#include "pch.h"
+#include "HalfFloat.h"
+
+float HalfToFloat(uint16_t value)
+{
+    uint32_t sign = static_cast<uint32_t>(value & 0x8000) << 16;
+    uint32_t exponent = (value >> 10) & 0x1f;
+    uint32_t mantissa = value & 0x3ff;
+
+    uint32_t bits = 0;
+    if (exponent == 0)
+    {
+        if (mantissa == 0)
+        {
+            bits = sign;
+        }
+        else
+        {
+            // Denormal halfs are normal floats
+            exponent = 127 - 15 + 1;
+            while ((mantissa & 0x400) == 0)
+            {
+                mantissa <<= 1;
+                exponent--;
+            }
+            mantissa &= 0x3ff;
+            bits = sign | (exponent << 23) | (mantissa << 13);
+        }
+    }
+    else if (exponent == 0x1f)
+    {
+        // Inf/NaN, NaNs come out quiet just like with F16C
+        bits = sign | 0x7f800000 | (mantissa << 13) | (mantissa != 0 ? 0x400000 : 0);
+    }
+    else
+    {
+        bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+    }
+
+    float result = 0.0f;
+    memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+uint16_t FloatToHalf(float value)
+{
+    uint32_t bits = 0;
+    memcpy(&bits, &value, sizeof(bits));
+    auto sign = static_cast<uint16_t>((bits >> 16) & 0x8000);
+    auto exponent = static_cast<int32_t>((bits >> 23) & 0xff);
+    uint32_t mantissa = bits & 0x7fffff;
+
+    if (exponent == 0xff)
+    {
+        // Inf/NaN
+        return static_cast<uint16_t>(sign | 0x7c00 | (mantissa != 0 ? 0x200 | (mantissa >> 13) : 0));
+    }
+
+    auto halfExponent = exponent - 127 + 15;
+    if (halfExponent >= 0x1f)
+    {
+        // Too big, becomes infinity
+        return static_cast<uint16_t>(sign | 0x7c00);
+    }
+
+    uint32_t shift = 13;
+    if (halfExponent <= 0)
+    {
+        // Denormal or zero
+        if (halfExponent < -10)
+        {
+            return sign;
+        }
+        mantissa |= 0x800000;
+        shift = static_cast<uint32_t>(14 - halfExponent);
+        halfExponent = 0;
+    }
+
+    // Round to nearest even. A carry out of the mantissa
+    // correctly bumps the exponent.
+    uint32_t result = (static_cast<uint32_t>(halfExponent) << 10) | (mantissa >> shift);
+    auto remainder = mantissa & ((1u << shift) - 1);
+    auto halfway = 1u << (shift - 1);
+    if (remainder > halfway || (remainder == halfway && (result & 1)))
+    {
+        result++;
+    }
+    return static_cast<uint16_t>(sign | result);
+}
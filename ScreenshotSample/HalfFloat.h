@@ -0,0 +1,6 @@
+#pragma once
+
+// IEEE 754 half precision conversions. HalfToFloat is exact, FloatToHalf
+// rounds to nearest even, matching F16C.
+float HalfToFloat(uint16_t value);
+uint16_t FloatToHalf(float value);
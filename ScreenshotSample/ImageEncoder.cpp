@@ -0,0 +1,14 @@
+#include "pch.h"
+#include "ImageEncoder.h"
+
+std::vector<uint8_t> ImageEncoder::Encode(uint8_t const* pixels, uint32_t stride, uint32_t width, uint32_t height)
+{
+    std::vector<uint8_t> output;
+    output.reserve(static_cast<size_t>(EstimateSize(width, height)));
+    MemoryRowSource source(pixels, stride);
+    EncodeStreaming(width, height, source, [&](uint8_t const* data, size_t size)
+        {
+            output.insert(output.end(), data, data + size);
+        });
+    return output;
+}
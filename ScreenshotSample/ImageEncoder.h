@@ -0,0 +1,81 @@
+#pragma once
+
+enum class ImageFormat
+{
+    Png,
+    Qoi,
+    // BGRA8 rows behind a RawImageHeader
+    Raw,
+    Bmp,
+    // Half float scRGB, for -keepHDR
+    Exr,
+    // A TileManifestHeader and tile offsets into a TileStore
+    Tiles,
+};
+
+inline uint32_t GetBytesPerPixel(DXGI_FORMAT format)
+{
+    return format == DXGI_FORMAT_R16G16B16A16_FLOAT ? 8 : 4;
+}
+
+// Supplies rows to ImageEncoder::EncodeStreaming one band at a time, so the
+// whole image never has to be in memory. Rows are in the encoder's
+// InputFormat.
+class ImageRowSource
+{
+public:
+    virtual ~ImageRowSource() {}
+
+    // Called in order before any row in [startRow, endRow) is read.
+    virtual void PrepareRows(uint32_t startRow, uint32_t endRow) = 0;
+    // Returns a row of the prepared band, or the row right above it. Called
+    // from several threads at once, and valid until the next PrepareRows.
+    virtual uint8_t const* GetRow(uint32_t row) = 0;
+};
+
+// Rows of an image that is already in memory.
+class MemoryRowSource : public ImageRowSource
+{
+public:
+    MemoryRowSource(uint8_t const* pixels, uint32_t stride)
+    {
+        m_pixels = pixels;
+        m_stride = stride;
+    }
+    ~MemoryRowSource() override {}
+
+    void PrepareRows(uint32_t, uint32_t) override {}
+    uint8_t const* GetRow(uint32_t row) override { return m_pixels + static_cast<size_t>(row) * m_stride; }
+
+private:
+    uint8_t const* m_pixels = nullptr;
+    uint32_t m_stride = 0;
+};
+
+// Turns pixels into a file. Encoders may be used from several threads, but
+// only one image is encoded at a time.
+class ImageEncoder
+{
+public:
+    virtual ~ImageEncoder() {}
+
+    virtual ImageFormat Format() const = 0;
+    // BGRA8 for everything but the -keepHDR encoders, which take the FP16
+    // scRGB captures as they are.
+    virtual DXGI_FORMAT InputFormat() const { return DXGI_FORMAT_B8G8R8A8_UNORM; }
+
+    // Encodes the image in one go. By default this collects the output of
+    // EncodeStreaming.
+    virtual std::vector<uint8_t> Encode(uint8_t const* pixels, uint32_t stride, uint32_t width, uint32_t height);
+
+    // Hands the file to write in pieces, in order, as they're produced.
+    virtual void EncodeStreaming(
+        uint32_t width,
+        uint32_t height,
+        ImageRowSource& source,
+        std::function<void(uint8_t const*, size_t)> const& write) = 0;
+
+    // How big the file will be, or a reasonable guess for compressed
+    // formats. Used to preallocate output files.
+    virtual uint64_t EstimateSize(uint32_t width, uint32_t height) const = 0;
+};
@@ -0,0 +1,94 @@
+#include "pch.h"
+#include "ImageFormats.h"
+#include "QoiEncoder.h"
+#include "RawEncoder.h"
+#include "BmpEncoder.h"
+#include "TileManifestEncoder.h"
+
+std::shared_ptr<ImageEncoder> CreatePngEncoder(std::shared_ptr<ThreadPool> const& threadPool, ImageEncoderSettings const& settings)
+{
+    return std::make_shared<PngEncoder>(threadPool, settings.Compression, settings.Grayscale ? PngPixelFormat::Gray8 : PngPixelFormat::Srgb8);
+}
+
+std::shared_ptr<ImageEncoder> CreatePqPngEncoder(std::shared_ptr<ThreadPool> const& threadPool, ImageEncoderSettings const& settings)
+{
+    return std::make_shared<PngEncoder>(threadPool, settings.Compression, PngPixelFormat::Pq16);
+}
+
+std::shared_ptr<ImageEncoder> CreateQoiEncoder(std::shared_ptr<ThreadPool> const& threadPool, ImageEncoderSettings const&)
+{
+    return std::make_shared<QoiEncoder>(threadPool);
+}
+
+std::shared_ptr<ImageEncoder> CreateRawEncoder(std::shared_ptr<ThreadPool> const&, ImageEncoderSettings const&)
+{
+    return std::make_shared<RawEncoder>();
+}
+
+std::shared_ptr<ImageEncoder> CreateBmpEncoder(std::shared_ptr<ThreadPool> const&, ImageEncoderSettings const&)
+{
+    return std::make_shared<BmpEncoder>();
+}
+
+std::shared_ptr<ImageEncoder> CreateExrEncoder(std::shared_ptr<ThreadPool> const& threadPool, ImageEncoderSettings const& settings)
+{
+    return std::make_shared<ExrEncoder>(threadPool, settings.ExrCompression, settings.Compression);
+}
+
+std::shared_ptr<ImageEncoder> CreateTileManifestEncoder(std::shared_ptr<ThreadPool> const&, ImageEncoderSettings const& settings)
+{
+    if (!settings.Store)
+    {
+        throw winrt::hresult_invalid_argument(L"Tile manifests need a tile store, see -store!");
+    }
+    return std::make_shared<TileManifestEncoder>(settings.Store);
+}
+
+std::vector<ImageFormatInfo> const& GetImageFormats()
+{
+    static std::vector<ImageFormatInfo> const formats =
+    {
+        { ImageFormat::Png, L"png", L"png", L"Lossless and compressed, opens anywhere. RGB, gray with -grayscale, 16-bit PQ with -keepHDR.", CreatePngEncoder, CreatePqPngEncoder },
+        { ImageFormat::Qoi, L"qoi", L"qoi", L"Lossless, much faster to encode but larger than PNG.", CreateQoiEncoder, nullptr },
+        { ImageFormat::Raw, L"raw", L"raw", L"BGRA8 rows behind a 16 byte header, no encoding at all.", CreateRawEncoder, nullptr },
+        { ImageFormat::Bmp, L"bmp", L"bmp", L"Uncompressed 24bpp bitmap.", CreateBmpEncoder, nullptr },
+        { ImageFormat::Exr, L"exr", L"exr", L"Half float scRGB OpenEXR, -keepHDR only.", nullptr, CreateExrEncoder },
+        { ImageFormat::Tiles, L"tiles", L"tiles", L"A manifest of tiles kept in -store, only new tiles are written. See -reconstruct.", CreateTileManifestEncoder, nullptr },
+    };
+    return formats;
+}
+
+ImageFormatInfo const& GetImageFormatInfo(ImageFormat format)
+{
+    for (auto&& info : GetImageFormats())
+    {
+        if (info.Format == format)
+        {
+            return info;
+        }
+    }
+    throw winrt::hresult_invalid_argument(L"Unknown image format!");
+}
+
+std::optional<ImageFormat> ParseImageFormat(std::wstring const& name)
+{
+    for (auto&& info : GetImageFormats())
+    {
+        if (name == info.Name)
+        {
+            return info.Format;
+        }
+    }
+    return std::nullopt;
+}
+
+std::shared_ptr<ImageEncoder> CreateImageEncoder(ImageFormat format, bool keepHDR, std::shared_ptr<ThreadPool> const& threadPool, ImageEncoderSettings const& settings)
+{
+    auto& info = GetImageFormatInfo(format);
+    auto factory = keepHDR ? info.CreateHdrEncoder : info.CreateEncoder;
+    if (factory == nullptr)
+    {
+        throw winrt::hresult_invalid_argument(keepHDR ? L"The format can't hold HDR images!" : L"The format only holds HDR images!");
+    }
+    return factory(threadPool, settings);
+}
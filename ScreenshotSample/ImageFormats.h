@@ -0,0 +1,39 @@
+#pragma once
+#include "ImageEncoder.h"
+#include "PngEncoder.h"
+#include "ExrEncoder.h"
+#include "ThreadPool.h"
+#include "TileStore.h"
+
+// What encoders are created with, from the command line.
+struct ImageEncoderSettings
+{
+    PngCompressionPreset Compression = PngCompressionPreset::Balanced;
+    ExrCompressionMode ExrCompression = ExrCompressionMode::Zip;
+    // Write 8-bit grayscale PNGs.
+    bool Grayscale = false;
+    // Where ImageFormat::Tiles keeps its tiles.
+    std::shared_ptr<TileStore> Store;
+};
+
+using ImageEncoderFactory = std::shared_ptr<ImageEncoder>(*)(std::shared_ptr<ThreadPool> const& threadPool, ImageEncoderSettings const& settings);
+
+struct ImageFormatInfo
+{
+    ImageFormat Format;
+    // What -format takes
+    wchar_t const* Name;
+    wchar_t const* Extension;
+    wchar_t const* Description;
+    // Either may be null if the format can't hold SDR or HDR images.
+    ImageEncoderFactory CreateEncoder;
+    ImageEncoderFactory CreateHdrEncoder;
+};
+
+// Every format we can write, in the order they're listed in the help.
+std::vector<ImageFormatInfo> const& GetImageFormats();
+ImageFormatInfo const& GetImageFormatInfo(ImageFormat format);
+std::optional<ImageFormat> ParseImageFormat(std::wstring const& name);
+
+// With keepHDR, the encoder takes FP16 scRGB instead of BGRA8.
+std::shared_ptr<ImageEncoder> CreateImageEncoder(ImageFormat format, bool keepHDR, std::shared_ptr<ThreadPool> const& threadPool, ImageEncoderSettings const& settings);
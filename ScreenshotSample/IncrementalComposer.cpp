@@ -0,0 +1,238 @@
+#include "pch.h"
+#include "IncrementalComposer.h"
+#include "Compose.h"
+#include "Options.h"
+#include "TileHash.h"
+#include "ToneMapLut.h"
+#include "Trace.h"
+
+namespace util
+{
+    using namespace robmikh::common::uwp;
+}
+
+IncrementalComposer::IncrementalComposer(
+    winrt::com_ptr<ID3D11Device> const& d3dDevice,
+    std::shared_ptr<ThreadPool> const& threadPool,
+    std::vector<Display> const& displays)
+{
+    m_d3dDevice = d3dDevice;
+    m_d3dDevice->GetImmediateContext(m_d3dContext.put());
+    m_d3dMultithread = m_d3dDevice.as<ID3D11Multithread>();
+    m_threadPool = threadPool;
+    // Tiles are tone mapped on their own, which only the CPU tone mapper can do.
+    auto toneMapperType = Options::ToneMapper();
+    auto useSimd = toneMapperType != ToneMapperType::CpuScalar && toneMapperType != ToneMapperType::LutScalar;
+    auto useLut = toneMapperType == ToneMapperType::Lut || toneMapperType == ToneMapperType::LutScalar;
+    m_toneMapper = std::make_unique<CpuToneMapper>(m_threadPool, useSimd, useLut);
+
+    m_unionRect = ComputeUnionRect(displays);
+    m_width = static_cast<uint32_t>(m_unionRect.right - m_unionRect.left);
+    m_height = static_cast<uint32_t>(m_unionRect.bottom - m_unionRect.top);
+
+    // Anything not covered by a display is opaque black.
+    m_pixels.resize(static_cast<size_t>(m_width) * m_height * 4);
+    for (size_t i = 3; i < m_pixels.size(); i += 4)
+    {
+        m_pixels[i] = 255;
+    }
+    m_dirtyRows.assign(m_height, 1);
+}
+
+void IncrementalComposer::ResetDirtyRows()
+{
+    std::fill(m_dirtyRows.begin(), m_dirtyRows.end(), static_cast<uint8_t>(0));
+    m_tileCount = 0;
+    m_changedTileCount = 0;
+}
+
+IncrementalComposer::DisplayState& IncrementalComposer::GetDisplayState(HMONITOR handle, D3D11_TEXTURE2D_DESC const& desc)
+{
+    auto& state = m_displays[handle];
+    // Start over if the display changed size or format.
+    if (!state.StagingTexture || state.Desc.Width != desc.Width || state.Desc.Height != desc.Height || state.Desc.Format != desc.Format)
+    {
+        auto stagingDesc = desc;
+        stagingDesc.MipLevels = 1;
+        stagingDesc.ArraySize = 1;
+        stagingDesc.SampleDesc.Count = 1;
+        stagingDesc.Usage = D3D11_USAGE_STAGING;
+        stagingDesc.BindFlags = 0;
+        stagingDesc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+        stagingDesc.MiscFlags = 0;
+        state.StagingTexture = nullptr;
+        winrt::check_hresult(m_d3dDevice->CreateTexture2D(&stagingDesc, nullptr, state.StagingTexture.put()));
+        state.Desc = desc;
+        state.TilesX = (desc.Width + TileSize - 1) / TileSize;
+        state.TilesY = (desc.Height + TileSize - 1) / TileSize;
+        state.TileHashes.assign(static_cast<size_t>(state.TilesX) * state.TilesY, 0);
+        state.HasHashes = false;
+    }
+    return state;
+}
+
+void IncrementalComposer::Update(Display const& display, CaptureFrame const& frame)
+{
+    TraceScope trace("UpdateTiles", display.Handle());
+    D3D11_TEXTURE2D_DESC desc = {};
+    frame.Texture->GetDesc(&desc);
+    auto& state = GetDisplayState(display.Handle(), desc);
+    auto tileCount = state.TilesX * state.TilesY;
+    m_tileCount += tileCount;
+
+    // Work out which tiles could have changed. Without a previous frame or
+    // help from the capture source, that's all of them.
+    std::vector<uint32_t> tiles;
+    if (state.HasHashes && frame.DirtyRects.has_value())
+    {
+        std::vector<uint8_t> isCandidate(tileCount, 0);
+        for (auto&& rect : frame.DirtyRects.value())
+        {
+            auto left = static_cast<uint32_t>(std::clamp<LONG>(rect.left, 0, static_cast<LONG>(desc.Width)));
+            auto top = static_cast<uint32_t>(std::clamp<LONG>(rect.top, 0, static_cast<LONG>(desc.Height)));
+            auto right = static_cast<uint32_t>(std::clamp<LONG>(rect.right, 0, static_cast<LONG>(desc.Width)));
+            auto bottom = static_cast<uint32_t>(std::clamp<LONG>(rect.bottom, 0, static_cast<LONG>(desc.Height)));
+            if (left >= right || top >= bottom)
+            {
+                continue;
+            }
+            for (auto tileY = top / TileSize; tileY <= (bottom - 1) / TileSize; tileY++)
+            {
+                for (auto tileX = left / TileSize; tileX <= (right - 1) / TileSize; tileX++)
+                {
+                    isCandidate[tileY * state.TilesX + tileX] = 1;
+                }
+            }
+        }
+        for (uint32_t tile = 0; tile < tileCount; tile++)
+        {
+            if (isCandidate[tile])
+            {
+                tiles.push_back(tile);
+            }
+        }
+        if (tiles.empty())
+        {
+            return;
+        }
+    }
+    else
+    {
+        tiles.resize(tileCount);
+        std::iota(tiles.begin(), tiles.end(), 0);
+    }
+
+    auto getTileBox = [&](uint32_t tile)
+    {
+        D3D11_BOX box = {};
+        box.left = (tile % state.TilesX) * TileSize;
+        box.top = (tile / state.TilesX) * TileSize;
+        box.right = std::min(box.left + TileSize, desc.Width);
+        box.bottom = std::min(box.top + TileSize, desc.Height);
+        box.back = 1;
+        return box;
+    };
+
+    // Only read back the tiles we're going to look at.
+    D3D11_MAPPED_SUBRESOURCE mapped = {};
+    {
+        auto multithreadLock = util::D3D11DeviceLock(m_d3dMultithread.get());
+        if (tiles.size() == tileCount)
+        {
+            m_d3dContext->CopyResource(state.StagingTexture.get(), frame.Texture.get());
+        }
+        else
+        {
+            for (auto&& tile : tiles)
+            {
+                auto box = getTileBox(tile);
+                m_d3dContext->CopySubresourceRegion(state.StagingTexture.get(), 0, box.left, box.top, 0, frame.Texture.get(), 0, &box);
+            }
+        }
+        winrt::check_hresult(m_d3dContext->Map(state.StagingTexture.get(), 0, D3D11_MAP_READ, 0, &mapped));
+    }
+    auto unmap = wil::scope_exit([&]()
+        {
+            auto multithreadLock = util::D3D11DeviceLock(m_d3dMultithread.get());
+            m_d3dContext->Unmap(state.StagingTexture.get(), 0);
+        });
+
+    auto parameters = CaptureParameters::ForDisplay(display);
+    auto isHDR = desc.Format == DXGI_FORMAT_R16G16B16A16_FLOAT;
+    auto bytesPerPixel = isHDR ? 8u : 4u;
+    auto toneMapperParams = CpuToneMapper::ComputeParams(parameters.SDRWhiteLevelInNits, parameters.MaxLuminance);
+    auto useSimd = m_toneMapper->UsesSimd();
+    std::shared_ptr<ToneMapLut const> lut;
+    if (isHDR && m_toneMapper->UsesLut())
+    {
+        lut = ToneMapLut::Get(parameters.SDRWhiteLevelInNits, parameters.MaxLuminance);
+    }
+
+    // The display may hang off the edge of the union if it changed size.
+    auto destX = display.Rect().left - m_unionRect.left;
+    auto destY = display.Rect().top - m_unionRect.top;
+    auto source = static_cast<uint8_t const*>(mapped.pData);
+
+    std::vector<uint8_t> isChanged(tiles.size(), 0);
+    m_threadPool->ParallelFor(static_cast<uint32_t>(tiles.size()), [&](uint32_t index)
+        {
+            auto tile = tiles[index];
+            auto box = getTileBox(tile);
+            auto tileWidth = box.right - box.left;
+            auto tileHeight = box.bottom - box.top;
+            auto tilePixels = source + static_cast<size_t>(box.top) * mapped.RowPitch + static_cast<size_t>(box.left) * bytesPerPixel;
+
+            auto hash = HashPixels(tilePixels, mapped.RowPitch, tileWidth * bytesPerPixel, tileHeight);
+            if (state.HasHashes && state.TileHashes[tile] == hash)
+            {
+                return;
+            }
+            state.TileHashes[tile] = hash;
+            isChanged[index] = 1;
+
+            // Clip the tile against the composed image.
+            auto left = std::max<LONG>(destX + static_cast<LONG>(box.left), 0);
+            auto right = std::min<LONG>(destX + static_cast<LONG>(box.right), static_cast<LONG>(m_width));
+            auto top = std::max<LONG>(destY + static_cast<LONG>(box.top), 0);
+            auto bottom = std::min<LONG>(destY + static_cast<LONG>(box.bottom), static_cast<LONG>(m_height));
+            if (left >= right || top >= bottom)
+            {
+                return;
+            }
+            auto width = static_cast<uint32_t>(right - left);
+            for (auto y = top; y < bottom; y++)
+            {
+                auto sourceRow = source + static_cast<size_t>(y - destY) * mapped.RowPitch + static_cast<size_t>(left - destX) * bytesPerPixel;
+                auto destRow = m_pixels.data() + (static_cast<size_t>(y) * m_width + left) * 4;
+                if (lut)
+                {
+                    lut->ProcessRow(reinterpret_cast<uint16_t const*>(sourceRow), destRow, width, useSimd);
+                }
+                else if (isHDR)
+                {
+                    CpuToneMapper::ProcessRow(reinterpret_cast<uint16_t const*>(sourceRow), destRow, width, toneMapperParams, useSimd);
+                }
+                else
+                {
+                    memcpy(destRow, sourceRow, static_cast<size_t>(width) * 4);
+                }
+            }
+        });
+    state.HasHashes = true;
+
+    for (size_t index = 0; index < tiles.size(); index++)
+    {
+        if (!isChanged[index])
+        {
+            continue;
+        }
+        m_changedTileCount++;
+        auto box = getTileBox(tiles[index]);
+        auto top = std::max<LONG>(destY + static_cast<LONG>(box.top), 0);
+        auto bottom = std::min<LONG>(destY + static_cast<LONG>(box.bottom), static_cast<LONG>(m_height));
+        for (auto y = top; y < bottom; y++)
+        {
+            m_dirtyRows[y] = 1;
+        }
+    }
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include "CaptureSource.h"
+#include "CpuToneMapper.h"
+#include "ThreadPool.h"
+
+// Composes repeated captures of the same displays into a BGRA8 image in
+// system memory, only reading back, tone mapping and copying the tiles that
+// changed since the previous capture. What changed comes from the capture
+// source when it knows, and from comparing tile hashes when it doesn't. The
+// rows that changed are tracked so the encoder can skip the rest.
+class IncrementalComposer
+{
+public:
+    static constexpr uint32_t TileSize = 64;
+
+    IncrementalComposer(
+        winrt::com_ptr<ID3D11Device> const& d3dDevice,
+        std::shared_ptr<ThreadPool> const& threadPool,
+        std::vector<Display> const& displays);
+    ~IncrementalComposer() {}
+
+    // Applies a new capture of one of the displays we were created with.
+    void Update(Display const& display, CaptureFrame const& frame);
+
+    uint8_t const* Pixels() const { return m_pixels.data(); }
+    uint32_t Stride() const { return m_width * 4; }
+    uint32_t Width() const { return m_width; }
+    uint32_t Height() const { return m_height; }
+
+    // One entry per row, non zero if the row changed since the last reset.
+    std::vector<uint8_t> const& DirtyRows() const { return m_dirtyRows; }
+    void ResetDirtyRows();
+
+    // Tile statistics since the last reset.
+    uint32_t TileCount() const { return m_tileCount; }
+    uint32_t ChangedTileCount() const { return m_changedTileCount; }
+
+private:
+    struct DisplayState
+    {
+        winrt::com_ptr<ID3D11Texture2D> StagingTexture;
+        D3D11_TEXTURE2D_DESC Desc = {};
+        uint32_t TilesX = 0;
+        uint32_t TilesY = 0;
+        std::vector<uint64_t> TileHashes;
+        bool HasHashes = false;
+    };
+
+    DisplayState& GetDisplayState(HMONITOR handle, D3D11_TEXTURE2D_DESC const& desc);
+
+private:
+    winrt::com_ptr<ID3D11Device> m_d3dDevice;
+    winrt::com_ptr<ID3D11DeviceContext> m_d3dContext;
+    winrt::com_ptr<ID3D11Multithread> m_d3dMultithread;
+    std::shared_ptr<ThreadPool> m_threadPool;
+    std::unique_ptr<CpuToneMapper> m_toneMapper;
+
+    RECT m_unionRect = {};
+    uint32_t m_width = 0;
+    uint32_t m_height = 0;
+    std::vector<uint8_t> m_pixels;
+    std::vector<uint8_t> m_dirtyRows;
+    uint32_t m_tileCount = 0;
+    uint32_t m_changedTileCount = 0;
+    std::map<HMONITOR, DisplayState> m_displays;
+};
@@ -0,0 +1,244 @@
+#include "pch.h"
+#include "IntervalCapture.h"
+#include "CapturePipeline.h"
+#include "ImageFormats.h"
+#include "IncrementalComposer.h"
+#include "Options.h"
+#include "Output.h"
+#include "Statistics.h"
+#include "Trace.h"
+
+namespace winrt
+{
+    using namespace Windows::Foundation;
+    using namespace Windows::Graphics::DirectX::Direct3D11;
+}
+
+// Most encoded bytes -asyncWrite holds before shots wait for the disk.
+constexpr uint64_t MaxAsyncWriteBytes = 512ull * 1024 * 1024;
+
+bool AreSameDisplays(std::vector<Display> const& first, std::vector<Display> const& second)
+{
+    return std::equal(first.begin(), first.end(), second.begin(), second.end(), [](Display const& a, Display const& b)
+        {
+            return a.Handle() == b.Handle() &&
+                EqualRect(&a.Rect(), &b.Rect()) &&
+                a.IsHDR() == b.IsHDR() &&
+                a.SDRWhiteLevelInNits() == b.SDRWhiteLevelInNits() &&
+                a.MaxLuminance() == b.MaxLuminance();
+        });
+}
+
+winrt::IAsyncAction RunIntervalCaptureAsync(
+    winrt::IDirect3DDevice const& device,
+    std::shared_ptr<DisplayTopology> const& topology,
+    std::shared_ptr<CaptureSource> const& captureSource,
+    std::shared_ptr<ToneMapper> const& toneMapper,
+    std::shared_ptr<ImageEncoder> const& encoder,
+    std::shared_ptr<ThreadPool> const& threadPool,
+    uint32_t count,
+    std::chrono::milliseconds interval)
+{
+    // Copy everything we need, the caller's references
+    // may not survive our coroutine.
+    auto d3dDevice = device;
+    auto displayTopology = topology;
+    auto displayGeneration = displayTopology->Generation();
+    auto allDisplays = displayTopology->Displays();
+    auto source = captureSource;
+    auto hdrToneMapper = toneMapper;
+    auto imageEncoder = encoder;
+    auto extension = GetImageFormatInfo(imageEncoder->Format()).Extension;
+    // Only PNG can reuse the previous shot's strips.
+    auto pngEncoder = std::dynamic_pointer_cast<PngEncoder>(imageEncoder);
+    // Or every shot goes into one file.
+    std::shared_ptr<TimelapseWriter> timelapse;
+    if (!Options::TimelapsePath().empty())
+    {
+        timelapse = std::make_shared<TimelapseWriter>(GetLocalFilePath(Options::TimelapsePath()), threadPool, Options::Compression(), Options::FrameDelay());
+    }
+    // Or many files are written at once.
+    std::shared_ptr<AsyncFileWriter> asyncWriter;
+    if (Options::AsyncWrite())
+    {
+        asyncWriter = std::make_shared<AsyncFileWriter>(Options::FileMode(), MaxAsyncWriteBytes);
+    }
+
+    // Dirty tile tracking composes on the CPU and remembers
+    // the previous shot's PNG strips. Otherwise, everything after
+    // composition happens on the pipeline's threads.
+    std::unique_ptr<IncrementalComposer> composer;
+    std::unique_ptr<CapturePipeline> pipeline;
+    PngStripCache stripCache;
+    auto d3dDevice11 = GetDXGIInterfaceFromObject<ID3D11Device>(d3dDevice);
+    if (Options::DirtyTiles())
+    {
+        composer = std::make_unique<IncrementalComposer>(d3dDevice11, threadPool, allDisplays);
+    }
+    else
+    {
+        pipeline = std::make_unique<CapturePipeline>(d3dDevice11, imageEncoder, timelapse, asyncWriter, Options::QueueDepth(), Options::FileMode());
+    }
+
+    // The default timer resolution is ~15ms, which is way too coarse
+    // for intervals of a few hundred milliseconds.
+    wil::unique_handle timer(CreateWaitableTimerExW(nullptr, nullptr, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS));
+    winrt::check_bool(static_cast<bool>(timer));
+
+    Statistics jitter;
+    Statistics captureLatency;
+    Statistics shotLatency;
+    Statistics changedTiles;
+    Statistics encodedStrips;
+    uint32_t overruns = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < count; i++)
+    {
+        auto deadline = start + interval * i;
+        auto now = std::chrono::steady_clock::now();
+        if (deadline > now)
+        {
+            // Relative due times are negative, in 100ns units.
+            auto wait = std::chrono::duration_cast<winrt::TimeSpan>(deadline - now);
+            LARGE_INTEGER dueTime = {};
+            dueTime.QuadPart = -static_cast<LONGLONG>(wait.count());
+            winrt::check_bool(SetWaitableTimer(timer.get(), &dueTime, 0, nullptr, nullptr, FALSE));
+            co_await winrt::resume_on_signal(timer.get());
+        }
+
+        TraceScope trace("Shot");
+        auto shotStart = std::chrono::steady_clock::now();
+        jitter.Add(std::chrono::duration<double, std::milli>(shotStart - deadline).count());
+
+        // Unless a change was reported, this doesn't touch the OS at all.
+        auto generation = displayTopology->Generation();
+        if (generation != displayGeneration)
+        {
+            displayGeneration = generation;
+            auto newDisplays = displayTopology->Displays();
+            // Plenty of unrelated settings changes get reported too.
+            if (!AreSameDisplays(newDisplays, allDisplays))
+            {
+                wprintf(L"Displays changed, capturing %zu display(s) from shot %u on\n", newDisplays.size(), i);
+                allDisplays = std::move(newDisplays);
+                if (composer)
+                {
+                    composer = std::make_unique<IncrementalComposer>(d3dDevice11, threadPool, allDisplays);
+                    stripCache = {};
+                }
+            }
+        }
+
+        auto fileName = FormatFileName(Options::NamePattern(), i) + L"." + extension;
+        if (composer)
+        {
+            std::vector<wil::task<CaptureFrame>> futures;
+            for (auto&& display : allDisplays)
+            {
+                futures.push_back(source->CaptureFrameAsync(display, CaptureParameters::ForDisplay(display).PixelFormat));
+            }
+            for (size_t index = 0; index < futures.size(); index++)
+            {
+                composer->Update(allDisplays[index], co_await std::move(futures[index]));
+            }
+            captureLatency.Add(MillisecondsSince(shotStart));
+
+            std::vector<uint8_t> encodedBytes;
+            if (timelapse)
+            {
+                timelapse->AddFrame(composer->Pixels(), composer->Stride(), composer->Width(), composer->Height());
+            }
+            else if (pngEncoder)
+            {
+                encodedBytes = pngEncoder->EncodeIncremental(stripCache, composer->Pixels(), composer->Stride(), composer->Width(), composer->Height(), composer->DirtyRows());
+                encodedStrips.Add(100.0 * stripCache.StripsEncoded / std::max(stripCache.StripCount, 1u));
+            }
+            else
+            {
+                encodedBytes = imageEncoder->Encode(composer->Pixels(), composer->Stride(), composer->Width(), composer->Height());
+            }
+            changedTiles.Add(100.0 * composer->ChangedTileCount() / std::max(composer->TileCount(), 1u));
+            composer->ResetDirtyRows();
+
+            if (asyncWriter)
+            {
+                asyncWriter->Write(GetLocalFilePath(fileName), std::move(encodedBytes));
+            }
+            else if (!timelapse)
+            {
+                WriteBytesToFile(fileName, encodedBytes, Options::FileMode());
+            }
+            shotLatency.Add(MillisecondsSince(shotStart));
+        }
+        else
+        {
+            auto composedTexture = co_await ComposeSnapshotsAsync(d3dDevice, allDisplays, source, hdrToneMapper);
+            captureLatency.Add(MillisecondsSince(shotStart));
+
+            // Blocks if the later stages are falling behind.
+            pipeline->Submit(composedTexture, fileName, shotStart);
+            // Submit already queued the copy out of it.
+            hdrToneMapper->Pool()->Recycle(composedTexture);
+        }
+
+        if (std::chrono::steady_clock::now() > deadline + interval)
+        {
+            overruns++;
+        }
+    }
+
+    if (pipeline)
+    {
+        pipeline->Finish();
+    }
+    if (asyncWriter)
+    {
+        asyncWriter->Flush();
+    }
+    auto totalTime = MillisecondsSince(start);
+
+    wprintf(L"Took %u screenshots every %lld ms (%u overran their interval)\n", count, static_cast<long long>(interval.count()), overruns);
+    PrintStatistics(L"start jitter", jitter);
+    PrintStatistics(L"capture latency", captureLatency);
+    wprintf(L"  throughput       %.2f shots per second\n", count * 1000.0 / totalTime);
+    auto& texturePool = *hdrToneMapper->Pool();
+    wprintf(L"  texture pool     %llu reused, %llu created, %.1f MB held\n",
+        static_cast<unsigned long long>(texturePool.Hits()),
+        static_cast<unsigned long long>(texturePool.Misses()),
+        texturePool.PooledBytes() / (1024.0 * 1024.0));
+    if (Options::MeasurePeak())
+    {
+        wprintf(L"  measured peak    %llu HDR captures only scaled, %llu tone mapped\n",
+            static_cast<unsigned long long>(hdrToneMapper->ScaledFrames()),
+            static_cast<unsigned long long>(hdrToneMapper->ToneMappedFrames()));
+    }
+    if (pipeline)
+    {
+        pipeline->PrintStatistics();
+    }
+    if (asyncWriter)
+    {
+        asyncWriter->PrintStatistics();
+    }
+    if (composer)
+    {
+        PrintStatistics(L"shot latency", shotLatency);
+        wprintf(L"  changed tiles    avg %6.2f%%  max %6.2f%%\n", changedTiles.Average(), changedTiles.Max());
+        if (pngEncoder && !timelapse)
+        {
+            wprintf(L"  encoded strips   avg %6.2f%%  max %6.2f%%\n", encodedStrips.Average(), encodedStrips.Max());
+        }
+    }
+    if (timelapse)
+    {
+        wprintf(L"  timelapse        %u of %u shots written, changed area avg %6.2f%%  max %6.2f%%, %.1f MB\n",
+            timelapse->FramesWritten(),
+            timelapse->FrameCount(),
+            timelapse->ChangedArea().Average(),
+            timelapse->ChangedArea().Max(),
+            timelapse->BytesWritten() / (1024.0 * 1024.0));
+    }
+
+    co_return;
+}
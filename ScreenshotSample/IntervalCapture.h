@@ -0,0 +1,23 @@
+#pragma once
+#include "Compose.h"
+#include "ImageEncoder.h"
+#include "DisplayTopology.h"
+
+// Takes count screenshots, one every interval. Each shot is scheduled
+// against a fixed deadline (start + index * interval) rather than relative
+// to the previous shot, so slow shots don't push every later one back.
+// Prints jitter and latency statistics at the end. Readback, encoding and
+// writing go through a CapturePipeline so they overlap the next capture.
+// With the -dirtyTiles option, shots after the first only redo the tiles and,
+// for PNG, the strips that changed instead. With -timelapse, shots are appended
+// to one animated PNG instead of each getting a file. Display changes are
+// picked up between shots.
+winrt::Windows::Foundation::IAsyncAction RunIntervalCaptureAsync(
+    winrt::Windows::Graphics::DirectX::Direct3D11::IDirect3DDevice const& device,
+    std::shared_ptr<DisplayTopology> const& topology,
+    std::shared_ptr<CaptureSource> const& captureSource,
+    std::shared_ptr<ToneMapper> const& toneMapper,
+    std::shared_ptr<ImageEncoder> const& encoder,
+    std::shared_ptr<ThreadPool> const& threadPool,
+    uint32_t count,
+    std::chrono::milliseconds interval);
@@ -0,0 +1,158 @@
+#include "pch.h"
+#include "LuminanceHistogram.h"
+#include "CpuFeatures.h"
+#include "HalfFloat.h"
+
+// scRGB 1.0 is 80 nits.
+constexpr float ScRGBWhiteLevelInNits = 80.0f;
+
+// BT.709 luminance coefficients, the same ones CpuToneMapper uses.
+constexpr float LuminanceR = 0.2126f;
+constexpr float LuminanceG = 0.7152f;
+constexpr float LuminanceB = 0.0722f;
+
+// A positive float's exponent and top two mantissa bits split it into
+// quarter stops, so the bin is just its bits shifted down.
+constexpr uint32_t BinShift = 21;
+constexpr int32_t FirstBinKey = (127 + LuminanceHistogram::MinExponent) * static_cast<int32_t>(LuminanceHistogram::BinsPerStop);
+
+uint32_t GetLuminanceBin(float nits)
+{
+    auto bin = static_cast<int32_t>(std::bit_cast<uint32_t>(nits) >> BinShift) - FirstBinKey + 1;
+    return static_cast<uint32_t>(std::clamp<int32_t>(bin, 0, LuminanceHistogram::BinCount - 1));
+}
+
+float GetLuminance(uint16_t const* pixel)
+{
+    auto r = HalfToFloat(pixel[0]);
+    auto g = HalfToFloat(pixel[1]);
+    auto b = HalfToFloat(pixel[2]);
+    auto y = ((LuminanceR * r) + (LuminanceG * g)) + (LuminanceB * b);
+    return y > 0.0f ? y : 0.0f;
+}
+
+void MeasureLuminanceRowScalar(uint16_t const* row, uint32_t width, uint64_t* bins, float& maxLuminance)
+{
+    for (uint32_t x = 0; x < width; x++)
+    {
+        auto y = GetLuminance(row + x * 4);
+        maxLuminance = std::max(maxLuminance, y);
+        bins[GetLuminanceBin(y * ScRGBWhiteLevelInNits)]++;
+    }
+}
+
+#if defined(_M_X64) || defined(_M_IX86)
+void MeasureLuminanceRowAvx2(uint16_t const* row, uint32_t width, uint64_t* bins, float& maxLuminance)
+{
+    auto zero = _mm256_setzero_ps();
+    auto lumR = _mm256_set1_ps(LuminanceR);
+    auto lumG = _mm256_set1_ps(LuminanceG);
+    auto lumB = _mm256_set1_ps(LuminanceB);
+    auto whiteLevel = _mm256_set1_ps(ScRGBWhiteLevelInNits);
+    auto firstBinKey = _mm256_set1_epi32(FirstBinKey - 1);
+    auto lastBin = _mm256_set1_epi32(LuminanceHistogram::BinCount - 1);
+    auto maxValues = zero;
+
+    uint32_t x = 0;
+    for (; x + 8 <= width; x += 8)
+    {
+        // Same transpose as CpuToneMapper, the order of the lanes
+        // doesn't matter here.
+        auto source = reinterpret_cast<__m128i const*>(row + x * 4);
+        auto p01 = _mm256_cvtph_ps(_mm_loadu_si128(source + 0));
+        auto p23 = _mm256_cvtph_ps(_mm_loadu_si128(source + 1));
+        auto p45 = _mm256_cvtph_ps(_mm_loadu_si128(source + 2));
+        auto p67 = _mm256_cvtph_ps(_mm_loadu_si128(source + 3));
+        auto rg0 = _mm256_unpacklo_ps(p01, p23);
+        auto ba0 = _mm256_unpackhi_ps(p01, p23);
+        auto rg1 = _mm256_unpacklo_ps(p45, p67);
+        auto ba1 = _mm256_unpackhi_ps(p45, p67);
+        auto r = _mm256_shuffle_ps(rg0, rg1, _MM_SHUFFLE(1, 0, 1, 0));
+        auto g = _mm256_shuffle_ps(rg0, rg1, _MM_SHUFFLE(3, 2, 3, 2));
+        auto b = _mm256_shuffle_ps(ba0, ba1, _MM_SHUFFLE(1, 0, 1, 0));
+
+        auto y = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(lumR, r), _mm256_mul_ps(lumG, g)), _mm256_mul_ps(lumB, b));
+        y = _mm256_max_ps(y, zero);
+        maxValues = _mm256_max_ps(maxValues, y);
+
+        auto keys = _mm256_srli_epi32(_mm256_castps_si256(_mm256_mul_ps(y, whiteLevel)), BinShift);
+        auto binIndices = _mm256_min_epi32(_mm256_max_epi32(_mm256_sub_epi32(keys, firstBinKey), _mm256_setzero_si256()), lastBin);
+        alignas(32) uint32_t indices[8];
+        _mm256_store_si256(reinterpret_cast<__m256i*>(indices), binIndices);
+        for (auto index : indices)
+        {
+            bins[index]++;
+        }
+    }
+
+    alignas(32) float maxLanes[8];
+    _mm256_store_ps(maxLanes, maxValues);
+    for (auto value : maxLanes)
+    {
+        maxLuminance = std::max(maxLuminance, value);
+    }
+
+    if (x < width)
+    {
+        MeasureLuminanceRowScalar(row + x * 4, width - x, bins, maxLuminance);
+    }
+}
+#endif
+
+LuminanceHistogram LuminanceHistogram::Measure(ThreadPool& threadPool, uint16_t const* pixels, uint32_t stride, uint32_t width, uint32_t height)
+{
+    auto&& features = CpuFeatures::Get();
+    auto useSimd = features.AVX2 && features.F16C;
+
+    // Every band counts into its own bins, they're added up at the end.
+    auto bandCount = std::min(height, threadPool.ThreadCount() * 4);
+    auto rowsPerBand = (height + bandCount - 1) / std::max(bandCount, 1u);
+    std::vector<std::array<uint64_t, BinCount>> bandBins(bandCount);
+    std::vector<float> bandMax(bandCount, 0.0f);
+    threadPool.ParallelFor(bandCount, [&](uint32_t band)
+        {
+            auto startRow = band * rowsPerBand;
+            auto endRow = std::min(startRow + rowsPerBand, height);
+            auto bins = bandBins[band].data();
+            auto& maxLuminance = bandMax[band];
+            for (auto row = startRow; row < endRow; row++)
+            {
+                auto hdrRow = reinterpret_cast<uint16_t const*>(reinterpret_cast<uint8_t const*>(pixels) + static_cast<size_t>(row) * stride);
+#if defined(_M_X64) || defined(_M_IX86)
+                if (useSimd)
+                {
+                    MeasureLuminanceRowAvx2(hdrRow, width, bins, maxLuminance);
+                    continue;
+                }
+#endif
+                MeasureLuminanceRowScalar(hdrRow, width, bins, maxLuminance);
+            }
+        });
+
+    LuminanceHistogram histogram;
+    for (uint32_t band = 0; band < bandCount; band++)
+    {
+        for (uint32_t bin = 0; bin < BinCount; bin++)
+        {
+            histogram.m_bins[bin] += bandBins[band][bin];
+        }
+        histogram.m_maxInNits = std::max(histogram.m_maxInNits, bandMax[band] * ScRGBWhiteLevelInNits);
+    }
+    histogram.m_pixelCount = static_cast<uint64_t>(width) * height;
+    return histogram;
+}
+
+float LuminanceHistogram::PeakInNits() const
+{
+    uint32_t bin = BinCount - 1;
+    while (bin > 0 && m_bins[bin] == 0)
+    {
+        bin--;
+    }
+    // Nothing past the last bin's start to round up to.
+    if (bin == BinCount - 1)
+    {
+        return m_maxInNits;
+    }
+    return std::bit_cast<float>(static_cast<uint32_t>(FirstBinKey + static_cast<int32_t>(bin)) << BinShift);
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include "ThreadPool.h"
+
+// How bright an FP16 scRGB image is. Every pixel's luminance, in nits, is
+// counted into quarter stop bins, and the brightest one is kept as well.
+// The AVX2 path computes luminance the same way CpuToneMapper does, so both
+// paths and the tone mapper agree on every pixel.
+class LuminanceHistogram
+{
+public:
+    // The bins cover 1/16 to 16384 nits, with one more at each end for
+    // everything darker and brighter.
+    static constexpr int32_t MinExponent = -4;
+    static constexpr int32_t MaxExponent = 14;
+    static constexpr uint32_t BinsPerStop = 4;
+    static constexpr uint32_t BinCount = (MaxExponent - MinExponent) * BinsPerStop + 2;
+
+    // The stride is in bytes.
+    static LuminanceHistogram Measure(ThreadPool& threadPool, uint16_t const* pixels, uint32_t stride, uint32_t width, uint32_t height);
+
+    std::array<uint64_t, BinCount> const& Bins() const { return m_bins; }
+    uint64_t PixelCount() const { return m_pixelCount; }
+    // The brightest pixel, exactly.
+    float MaxInNits() const { return m_maxInNits; }
+    // The top of the brightest bin with any pixels in it. Coarse enough that
+    // captures of similar content share their tone map tables.
+    float PeakInNits() const;
+
+private:
+    std::array<uint64_t, BinCount> m_bins = {};
+    uint64_t m_pixelCount = 0;
+    float m_maxInNits = 0.0f;
+};
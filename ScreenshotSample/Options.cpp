@@ -3,9 +3,92 @@
 
 Options Options::s_options = {};
 
-void Options::InitOptions(bool dxDebug, bool forceHDR, bool clipHDR)
+void Options::InitOptions(bool dxDebug, bool forceHDR, bool clipHDR, bool keepHDR, ToneMapperType toneMapper, bool measurePeak, PngCompressionPreset compression)
 {
     s_options.m_dxDebug = dxDebug;
     s_options.m_forceHDR = forceHDR;
     s_options.m_clipHDR = clipHDR;
+    s_options.m_keepHDR = keepHDR;
+    s_options.m_toneMapper = toneMapper;
+    s_options.m_measurePeak = measurePeak;
+    s_options.m_compression = compression;
+}
+
+void Options::InitPoolOptions(uint64_t texturePoolBytes)
+{
+    s_options.m_texturePoolBytes = texturePoolBytes;
+}
+
+void Options::InitBenchmarkOptions(std::wstring const& syntheticLayout, bool useWarp, bool benchmark, bool selfTest, uint32_t iterations, std::wstring const& benchmarkCsvPath)
+{
+    s_options.m_syntheticLayout = syntheticLayout;
+    s_options.m_useWarp = useWarp;
+    s_options.m_benchmark = benchmark;
+    s_options.m_selfTest = selfTest;
+    s_options.m_benchmarkIterations = iterations;
+    s_options.m_benchmarkCsvPath = benchmarkCsvPath;
+}
+
+void Options::InitIntervalOptions(uint32_t count, std::chrono::milliseconds interval, uint32_t bufferCount, bool dirtyTiles, uint32_t queueDepth)
+{
+    s_options.m_captureCount = count;
+    s_options.m_captureInterval = interval;
+    s_options.m_captureBufferCount = bufferCount;
+    s_options.m_dirtyTiles = dirtyTiles;
+    s_options.m_queueDepth = queueDepth;
+}
+
+void Options::InitOutputOptions(bool sparse, bool perDisplay, bool strips, FileWriteMode fileMode, ImageFormat format, ExrCompressionMode exrCompression, bool grayscale)
+{
+    s_options.m_sparse = sparse;
+    s_options.m_perDisplay = perDisplay;
+    s_options.m_strips = strips;
+    s_options.m_fileMode = fileMode;
+    s_options.m_format = format;
+    s_options.m_exrCompression = exrCompression;
+    s_options.m_grayscale = grayscale;
+}
+
+void Options::InitScaleOptions(float scale, std::vector<uint32_t> const& thumbnailSizes, ResampleFilter filter)
+{
+    s_options.m_scale = scale;
+    s_options.m_thumbnailSizes = thumbnailSizes;
+    s_options.m_filter = filter;
+}
+
+void Options::InitRegionOptions(std::optional<RECT> const& region)
+{
+    s_options.m_region = region;
+}
+
+void Options::InitServiceOptions(std::wstring const& servePipeName, std::wstring const& connectPipeName, bool stopService, bool inlineOutput)
+{
+    s_options.m_servePipeName = servePipeName;
+    s_options.m_connectPipeName = connectPipeName;
+    s_options.m_stopService = stopService;
+    s_options.m_inlineOutput = inlineOutput;
+}
+
+void Options::InitTileStoreOptions(std::wstring const& tileStorePath, std::wstring const& reconstructPath)
+{
+    s_options.m_tileStorePath = tileStorePath;
+    s_options.m_reconstructPath = reconstructPath;
+}
+
+void Options::InitTimelapseOptions(std::wstring const& timelapsePath, std::chrono::milliseconds frameDelay)
+{
+    s_options.m_timelapsePath = timelapsePath;
+    s_options.m_frameDelay = frameDelay;
+}
+
+void Options::InitFileOptions(std::wstring const& outputDirectory, std::wstring const& namePattern, bool asyncWrite)
+{
+    s_options.m_outputDirectory = outputDirectory;
+    s_options.m_namePattern = namePattern;
+    s_options.m_asyncWrite = asyncWrite;
+}
+
+void Options::InitProfileOptions(std::wstring const& profilePath)
+{
+    s_options.m_profilePath = profilePath;
 }
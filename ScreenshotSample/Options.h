@@ -1,13 +1,123 @@
 #pragma once
+#include "PngEncoder.h"
+#include "ExrEncoder.h"
+#include "FileWriter.h"
+#include "Resampler.h"
+
+enum class ToneMapperType
+{
+    // The D2D effect graph
+    D2D,
+    // The SIMD CPU implementation
+    Cpu,
+    // The scalar CPU reference implementation
+    CpuScalar,
+    // The CPU curve baked into a 3D LUT, see ToneMapLut
+    Lut,
+    // The LUT without SIMD
+    LutScalar,
+};
 
 class Options
 {
 public:
-    static void InitOptions(bool dxDebug, bool forceHDR, bool clipHDR);
+    static void InitOptions(bool dxDebug, bool forceHDR, bool clipHDR, bool keepHDR, ToneMapperType toneMapper, bool measurePeak, PngCompressionPreset compression);
 
     static bool DxDebug() { return s_options.m_dxDebug; }
     static bool ForceHDR() { return s_options.m_forceHDR; }
     static bool ClipHDR() { return s_options.m_clipHDR; }
+    // Skip tone mapping and compose and save FP16 scRGB.
+    static bool KeepHDR() { return s_options.m_keepHDR; }
+    static ToneMapperType ToneMapper() { return s_options.m_toneMapper; }
+    // Tone map each HDR capture for its brightest pixel instead of the
+    // display's max luminance, and only scale it if that's under SDR white.
+    static bool MeasurePeak() { return s_options.m_measurePeak; }
+    static PngCompressionPreset Compression() { return s_options.m_compression; }
+
+    static void InitPoolOptions(uint64_t texturePoolBytes);
+
+    // Most texture memory kept around for reuse, see TexturePool.
+    static uint64_t TexturePoolBytes() { return s_options.m_texturePoolBytes; }
+
+    static void InitBenchmarkOptions(std::wstring const& syntheticLayout, bool useWarp, bool benchmark, bool selfTest, uint32_t iterations, std::wstring const& benchmarkCsvPath);
+
+    static std::wstring const& SyntheticLayout() { return s_options.m_syntheticLayout; }
+    static bool UseWarp() { return s_options.m_useWarp; }
+    static bool Benchmark() { return s_options.m_benchmark; }
+    // Check the SIMD paths against scalar instead of taking a screenshot.
+    static bool SelfTest() { return s_options.m_selfTest; }
+    static uint32_t BenchmarkIterations() { return s_options.m_benchmarkIterations; }
+    static std::wstring const& BenchmarkCsvPath() { return s_options.m_benchmarkCsvPath; }
+
+    static void InitIntervalOptions(uint32_t count, std::chrono::milliseconds interval, uint32_t bufferCount, bool dirtyTiles, uint32_t queueDepth);
+
+    static uint32_t CaptureCount() { return s_options.m_captureCount; }
+    static std::chrono::milliseconds CaptureInterval() { return s_options.m_captureInterval; }
+    static uint32_t CaptureBufferCount() { return s_options.m_captureBufferCount; }
+    static bool DirtyTiles() { return s_options.m_dirtyTiles; }
+    static uint32_t QueueDepth() { return s_options.m_queueDepth; }
+
+    static void InitOutputOptions(bool sparse, bool perDisplay, bool strips, FileWriteMode fileMode, ImageFormat format, ExrCompressionMode exrCompression, bool grayscale);
+
+    static bool Sparse() { return s_options.m_sparse; }
+    // Save each display to its own file instead of composing them.
+    static bool PerDisplay() { return s_options.m_perDisplay; }
+    // Compose and encode a band of rows at a time, see StripComposer. Also
+    // done whenever the desktop doesn't fit in a texture.
+    static bool Strips() { return s_options.m_strips; }
+    static FileWriteMode FileMode() { return s_options.m_fileMode; }
+    static ImageFormat Format() { return s_options.m_format; }
+    static ExrCompressionMode ExrCompression() { return s_options.m_exrCompression; }
+    static bool Grayscale() { return s_options.m_grayscale; }
+
+    static void InitScaleOptions(float scale, std::vector<uint32_t> const& thumbnailSizes, ResampleFilter filter);
+
+    static float Scale() { return s_options.m_scale; }
+    // Longest edge of each thumbnail, in pixels.
+    static std::vector<uint32_t> const& ThumbnailSizes() { return s_options.m_thumbnailSizes; }
+    static ResampleFilter Filter() { return s_options.m_filter; }
+
+    static void InitRegionOptions(std::optional<RECT> const& region);
+
+    // Only capture this part of the desktop, in desktop coordinates.
+    static std::optional<RECT> const& Region() { return s_options.m_region; }
+
+    static void InitServiceOptions(std::wstring const& servePipeName, std::wstring const& connectPipeName, bool stopService, bool inlineOutput);
+
+    // Run as a service on this pipe instead of taking one screenshot.
+    static std::wstring const& ServePipeName() { return s_options.m_servePipeName; }
+    // Ask the service on this pipe for the screenshot instead.
+    static std::wstring const& ConnectPipeName() { return s_options.m_connectPipeName; }
+    static bool StopService() { return s_options.m_stopService; }
+    // Have the service send the file back rather than write it.
+    static bool InlineOutput() { return s_options.m_inlineOutput; }
+
+    static void InitTileStoreOptions(std::wstring const& tileStorePath, std::wstring const& reconstructPath);
+
+    // The TileStore directory, set whenever one is used.
+    static std::wstring const& TileStorePath() { return s_options.m_tileStorePath; }
+    // Rebuild this manifest's image instead of taking a screenshot.
+    static std::wstring const& ReconstructPath() { return s_options.m_reconstructPath; }
+
+    static void InitTimelapseOptions(std::wstring const& timelapsePath, std::chrono::milliseconds frameDelay);
+
+    // Append every shot of -count to this animated PNG instead.
+    static std::wstring const& TimelapsePath() { return s_options.m_timelapsePath; }
+    // How long each shot is shown when the timelapse is played.
+    static std::chrono::milliseconds FrameDelay() { return s_options.m_frameDelay; }
+
+    static void InitFileOptions(std::wstring const& outputDirectory, std::wstring const& namePattern, bool asyncWrite);
+
+    // Where files go, the current directory if empty.
+    static std::wstring const& OutputDirectory() { return s_options.m_outputDirectory; }
+    // What screenshots are called, see FormatFileName.
+    static std::wstring const& NamePattern() { return s_options.m_namePattern; }
+    // With -count, write files through an AsyncFileWriter.
+    static bool AsyncWrite() { return s_options.m_asyncWrite; }
+
+    static void InitProfileOptions(std::wstring const& profilePath);
+
+    static std::wstring const& ProfilePath() { return s_options.m_profilePath; }
 
 private:
     static Options s_options;
@@ -15,4 +125,54 @@ private:
     bool m_dxDebug = false;
     bool m_forceHDR = false;
     bool m_clipHDR = false;
+    bool m_keepHDR = false;
+    ToneMapperType m_toneMapper = ToneMapperType::D2D;
+    bool m_measurePeak = false;
+    PngCompressionPreset m_compression = PngCompressionPreset::Balanced;
+
+    uint64_t m_texturePoolBytes = 512ull * 1024 * 1024;
+
+    std::wstring m_syntheticLayout;
+    bool m_useWarp = false;
+    bool m_benchmark = false;
+    bool m_selfTest = false;
+    uint32_t m_benchmarkIterations = 5;
+    std::wstring m_benchmarkCsvPath;
+
+    uint32_t m_captureCount = 1;
+    std::chrono::milliseconds m_captureInterval{ 0 };
+    uint32_t m_captureBufferCount = 2;
+    bool m_dirtyTiles = false;
+    uint32_t m_queueDepth = 2;
+
+    bool m_sparse = false;
+    bool m_perDisplay = false;
+    bool m_strips = false;
+    FileWriteMode m_fileMode = FileWriteMode::Plain;
+    ImageFormat m_format = ImageFormat::Png;
+    ExrCompressionMode m_exrCompression = ExrCompressionMode::Zip;
+    bool m_grayscale = false;
+
+    float m_scale = 1.0f;
+    std::vector<uint32_t> m_thumbnailSizes;
+    ResampleFilter m_filter = ResampleFilter::Lanczos;
+
+    std::optional<RECT> m_region;
+
+    std::wstring m_servePipeName;
+    std::wstring m_connectPipeName;
+    bool m_stopService = false;
+    bool m_inlineOutput = false;
+
+    std::wstring m_tileStorePath;
+    std::wstring m_reconstructPath;
+
+    std::wstring m_timelapsePath;
+    std::chrono::milliseconds m_frameDelay{ 100 };
+
+    std::wstring m_outputDirectory;
+    std::wstring m_namePattern = L"screenshot";
+    bool m_asyncWrite = false;
+
+    std::wstring m_profilePath;
 };
@@ -0,0 +1,255 @@
+#include "pch.h"
+#include "Output.h"
+#include "Trace.h"
+#include "Options.h"
+
+namespace util
+{
+    using namespace robmikh::common::uwp;
+}
+
+// Feeds the encoder from a texture through a pooled staging texture
+// that only holds one band of rows.
+class TextureRowSource : public ImageRowSource
+{
+public:
+    TextureRowSource(TexturePool& texturePool, winrt::com_ptr<ID3D11Texture2D> const& texture) : m_texturePool(texturePool)
+    {
+        m_texture = texture;
+        m_texture->GetDevice(m_d3dDevice.put());
+        m_d3dDevice->GetImmediateContext(m_d3dContext.put());
+        m_d3dMultithread = m_d3dDevice.as<ID3D11Multithread>();
+        m_texture->GetDesc(&m_desc);
+    }
+
+    ~TextureRowSource() override
+    {
+        Unmap();
+        m_texturePool.Recycle(m_stagingTexture);
+    }
+
+    void PrepareRows(uint32_t startRow, uint32_t endRow) override
+    {
+        TraceScope trace("ReadbackBand");
+        Unmap();
+
+        // The row above the band is needed to filter the band's first row.
+        auto copyStartRow = startRow > 0 ? startRow - 1 : 0;
+        auto rowCount = endRow - copyStartRow;
+        if (!m_stagingTexture || m_stagingRowCount < rowCount)
+        {
+            auto stagingDesc = m_desc;
+            stagingDesc.Height = rowCount;
+            stagingDesc.MipLevels = 1;
+            stagingDesc.ArraySize = 1;
+            stagingDesc.Usage = D3D11_USAGE_STAGING;
+            stagingDesc.BindFlags = 0;
+            stagingDesc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+            stagingDesc.MiscFlags = 0;
+            m_texturePool.Recycle(m_stagingTexture);
+            m_stagingTexture = m_texturePool.Acquire(stagingDesc);
+            m_stagingRowCount = rowCount;
+        }
+
+        D3D11_BOX box = {};
+        box.left = 0;
+        box.right = m_desc.Width;
+        box.top = copyStartRow;
+        box.bottom = endRow;
+        box.back = 1;
+        auto multithreadLock = util::D3D11DeviceLock(m_d3dMultithread.get());
+        m_d3dContext->CopySubresourceRegion(m_stagingTexture.get(), 0, 0, 0, 0, m_texture.get(), 0, &box);
+        winrt::check_hresult(m_d3dContext->Map(m_stagingTexture.get(), 0, D3D11_MAP_READ, 0, &m_mapped));
+        m_isMapped = true;
+        m_firstRow = copyStartRow;
+    }
+
+    uint8_t const* GetRow(uint32_t row) override
+    {
+        return static_cast<uint8_t const*>(m_mapped.pData) + static_cast<size_t>(row - m_firstRow) * m_mapped.RowPitch;
+    }
+
+private:
+    void Unmap()
+    {
+        if (m_isMapped)
+        {
+            auto multithreadLock = util::D3D11DeviceLock(m_d3dMultithread.get());
+            m_d3dContext->Unmap(m_stagingTexture.get(), 0);
+            m_isMapped = false;
+        }
+    }
+
+private:
+    TexturePool& m_texturePool;
+    winrt::com_ptr<ID3D11Texture2D> m_texture;
+    winrt::com_ptr<ID3D11Device> m_d3dDevice;
+    winrt::com_ptr<ID3D11DeviceContext> m_d3dContext;
+    winrt::com_ptr<ID3D11Multithread> m_d3dMultithread;
+    D3D11_TEXTURE2D_DESC m_desc = {};
+
+    winrt::com_ptr<ID3D11Texture2D> m_stagingTexture;
+    uint32_t m_stagingRowCount = 0;
+    D3D11_MAPPED_SUBRESOURCE m_mapped = {};
+    bool m_isMapped = false;
+    uint32_t m_firstRow = 0;
+};
+
+std::wstring GetLocalFilePath(std::wstring const& fileName)
+{
+    auto&& outputDirectory = Options::OutputDirectory();
+    auto directory = outputDirectory.empty() ? std::filesystem::current_path() : std::filesystem::absolute(outputDirectory);
+    return (directory / fileName).wstring();
+}
+
+std::wstring FormatFileName(std::wstring const& pattern, uint32_t index)
+{
+    SYSTEMTIME time = {};
+    GetLocalTime(&time);
+    wchar_t indexText[16] = {};
+    swprintf_s(indexText, L"%04u", index);
+    wchar_t dateText[16] = {};
+    swprintf_s(dateText, L"%04u-%02u-%02u", time.wYear, time.wMonth, time.wDay);
+    // Windows doesn't allow colons in file names.
+    wchar_t timeText[16] = {};
+    swprintf_s(timeText, L"%02u-%02u-%02u", time.wHour, time.wMinute, time.wSecond);
+    std::pair<std::wstring_view, wchar_t const*> const fields[] =
+    {
+        { L"{index}", indexText },
+        { L"{date}", dateText },
+        { L"{time}", timeText },
+    };
+
+    std::wstring fileName;
+    size_t position = 0;
+    while (position < pattern.size())
+    {
+        auto field = std::find_if(std::begin(fields), std::end(fields), [&](auto&& candidate) { return pattern.compare(position, candidate.first.size(), candidate.first) == 0; });
+        if (field != std::end(fields))
+        {
+            fileName += field->second;
+            position += field->first.size();
+        }
+        else
+        {
+            fileName += pattern[position++];
+        }
+    }
+    return fileName;
+}
+
+void WriteBytesToFile(std::wstring const& fileName, std::vector<uint8_t> const& bytes, FileWriteMode mode)
+{
+    TraceScope trace("WriteFile");
+    FileWriter writer(GetLocalFilePath(fileName), mode, bytes.size());
+    writer.Write(bytes.data(), bytes.size());
+    writer.Close();
+}
+
+void SaveTextureToFile(
+    winrt::com_ptr<ID3D11Texture2D> const& texture,
+    std::wstring const& fileName,
+    std::shared_ptr<ImageEncoder> const& encoder,
+    TexturePool& texturePool,
+    FileWriteMode mode)
+{
+    TraceScope trace("SaveTextureToFile");
+    D3D11_TEXTURE2D_DESC desc = {};
+    texture->GetDesc(&desc);
+    if (desc.Format != encoder->InputFormat())
+    {
+        throw winrt::hresult_invalid_argument(L"The texture's format doesn't match what the encoder takes!");
+    }
+
+    TextureRowSource source(texturePool, texture);
+    SaveRowsToFile(desc.Width, desc.Height, source, fileName, encoder, mode);
+}
+
+void SaveRowsToFile(
+    uint32_t width,
+    uint32_t height,
+    ImageRowSource& source,
+    std::wstring const& fileName,
+    std::shared_ptr<ImageEncoder> const& encoder,
+    FileWriteMode mode)
+{
+    FileWriter writer(GetLocalFilePath(fileName), mode, encoder->EstimateSize(width, height));
+    encoder->EncodeStreaming(width, height, source, [&](uint8_t const* data, size_t size)
+        {
+            TraceScope trace("WriteFile");
+            writer.Write(data, size);
+        });
+    writer.Close();
+}
+
+std::vector<uint8_t> EncodeTexture(
+    winrt::com_ptr<ID3D11Texture2D> const& texture,
+    std::shared_ptr<ImageEncoder> const& encoder,
+    TexturePool& texturePool)
+{
+    TraceScope trace("EncodeTexture");
+    D3D11_TEXTURE2D_DESC desc = {};
+    texture->GetDesc(&desc);
+    if (desc.Format != encoder->InputFormat())
+    {
+        throw winrt::hresult_invalid_argument(L"The texture's format doesn't match what the encoder takes!");
+    }
+
+    std::vector<uint8_t> bytes;
+    bytes.reserve(static_cast<size_t>(encoder->EstimateSize(desc.Width, desc.Height)));
+    TextureRowSource source(texturePool, texture);
+    encoder->EncodeStreaming(desc.Width, desc.Height, source, [&](uint8_t const* data, size_t size)
+        {
+            bytes.insert(bytes.end(), data, data + size);
+        });
+    return bytes;
+}
+
+void SaveResampledTextureToFiles(
+    winrt::com_ptr<ID3D11Texture2D> const& texture,
+    std::vector<ResampledOutput> const& outputs,
+    Resampler& resampler,
+    ResampleFilter filter,
+    std::shared_ptr<ThreadPool> const& threadPool,
+    TexturePool& texturePool,
+    PixelBufferPool& bufferPool,
+    FileWriteMode mode)
+{
+    TraceScope trace("SaveResampledTextureToFiles");
+    D3D11_TEXTURE2D_DESC desc = {};
+    texture->GetDesc(&desc);
+    if (desc.Format != DXGI_FORMAT_B8G8R8A8_UNORM)
+    {
+        throw winrt::hresult_invalid_argument(L"Only BGRA8 textures can be resampled!");
+    }
+
+    MappedTexture pixels;
+    {
+        TraceScope trace("CopyBytesFromTexture");
+        pixels = texturePool.MapTexture(texture);
+    }
+
+    threadPool->ParallelFor(static_cast<uint32_t>(outputs.size()), [&](uint32_t index)
+        {
+            auto&& output = outputs[index];
+            PixelBuffer resampled;
+            auto outputPixels = pixels.Data();
+            auto outputStride = pixels.RowPitch();
+            if (output.Width != desc.Width || output.Height != desc.Height)
+            {
+                resampled = bufferPool.Acquire(output.Width, output.Height, 4);
+                resampler.Resize(pixels.Data(), pixels.RowPitch(), desc.Width, desc.Height, resampled.Data(), resampled.Stride(), output.Width, output.Height, filter);
+                outputPixels = resampled.Data();
+                outputStride = resampled.Stride();
+            }
+
+            FileWriter writer(GetLocalFilePath(output.FileName), mode, output.Encoder->EstimateSize(output.Width, output.Height));
+            MemoryRowSource source(outputPixels, outputStride);
+            output.Encoder->EncodeStreaming(output.Width, output.Height, source, [&](uint8_t const* data, size_t size)
+                {
+                    TraceScope trace("WriteFile");
+                    writer.Write(data, size);
+                });
+            writer.Close();
+        });
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include "ImageEncoder.h"
+#include "FileWriter.h"
+#include "Resampler.h"
+#include "TexturePool.h"
+#include "PixelBuffer.h"
+
+// Files go in -outDir, or the current directory.
+std::wstring GetLocalFilePath(std::wstring const& fileName);
+
+// Fills {index}, {date} and {time} into an -name pattern. The extension
+// isn't included.
+std::wstring FormatFileName(std::wstring const& pattern, uint32_t index);
+
+// Writes the file synchronously, for callers that are
+// already on their own thread.
+void WriteBytesToFile(std::wstring const& fileName, std::vector<uint8_t> const& bytes, FileWriteMode mode = FileWriteMode::Plain);
+
+// Encodes a texture in the encoder's InputFormat straight into a file. Rows are read back through a
+// staging texture a band at a time, and the encoded file is written out in
+// pieces as they're produced, so neither the pixels nor the file are ever
+// fully in memory.
+void SaveTextureToFile(
+    winrt::com_ptr<ID3D11Texture2D> const& texture,
+    std::wstring const& fileName,
+    std::shared_ptr<ImageEncoder> const& encoder,
+    TexturePool& texturePool,
+    FileWriteMode mode);
+
+// Encodes rows straight into a file, like SaveTextureToFile, from any source.
+void SaveRowsToFile(
+    uint32_t width,
+    uint32_t height,
+    ImageRowSource& source,
+    std::wstring const& fileName,
+    std::shared_ptr<ImageEncoder> const& encoder,
+    FileWriteMode mode);
+
+// Like SaveTextureToFile, but the file ends up in memory.
+std::vector<uint8_t> EncodeTexture(
+    winrt::com_ptr<ID3D11Texture2D> const& texture,
+    std::shared_ptr<ImageEncoder> const& encoder,
+    TexturePool& texturePool);
+
+// One size of a BGRA8 image to save. Encoders only do one image at a time,
+// so every output gets its own.
+struct ResampledOutput
+{
+    std::wstring FileName;
+    uint32_t Width = 0;
+    uint32_t Height = 0;
+    std::shared_ptr<ImageEncoder> Encoder;
+};
+
+// Reads a BGRA8 texture back once, then resamples, encodes and writes every
+// output at the same time. Outputs the size of the texture are encoded
+// straight from the mapped staging texture, the rest are resampled into
+// pooled buffers.
+void SaveResampledTextureToFiles(
+    winrt::com_ptr<ID3D11Texture2D> const& texture,
+    std::vector<ResampledOutput> const& outputs,
+    Resampler& resampler,
+    ResampleFilter filter,
+    std::shared_ptr<ThreadPool> const& threadPool,
+    TexturePool& texturePool,
+    PixelBufferPool& bufferPool,
+    FileWriteMode mode);
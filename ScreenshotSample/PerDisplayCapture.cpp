@@ -0,0 +1,107 @@
+#include "pch.h"
+#include "PerDisplayCapture.h"
+#include "Options.h"
+#include "Output.h"
+#include "SparseImage.h"
+#include "Trace.h"
+
+wil::task<DisplayFile> SaveDisplayToFileAsync(
+    Display display,
+    uint32_t index,
+    std::optional<RECT> cropRect,
+    std::shared_ptr<CaptureSource> captureSource,
+    std::shared_ptr<ToneMapper> toneMapper,
+    std::shared_ptr<ImageEncoder> encoder,
+    std::wstring baseName,
+    FileWriteMode mode)
+{
+    // Everything is taken by value, the caller's references
+    // may not survive our coroutine.
+    auto start = std::chrono::steady_clock::now();
+    auto snapshot = co_await Snapshot::TakeAsync(display, captureSource, toneMapper, cropRect);
+
+    // Get off the capture thread so the other displays' encodes
+    // don't wait for this one.
+    co_await winrt::resume_background();
+    TraceScope trace("SaveDisplayToFile", display.Handle());
+    DisplayFile file = {};
+    file.FileName = baseName + L"_display" + std::to_wstring(index) + L"." + GetImageFormatInfo(encoder->Format()).Extension;
+    file.Index = index;
+    file.DisplayRect = snapshot.DisplayRect;
+    file.Parameters = CaptureParameters::ForDisplay(display);
+    auto& texturePool = *toneMapper->Pool();
+    SaveTextureToFile(snapshot.Texture, file.FileName, encoder, texturePool, mode);
+    texturePool.Recycle(snapshot.Texture);
+    file.Milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    co_return file;
+}
+
+wil::task<std::vector<DisplayFile>> SaveDisplaysToFilesAsync(
+    std::vector<Display> const& displays,
+    std::shared_ptr<CaptureSource> const& captureSource,
+    std::shared_ptr<ToneMapper> const& toneMapper,
+    std::shared_ptr<ThreadPool> const& threadPool,
+    ImageFormat format,
+    ImageEncoderSettings const& encoderSettings,
+    std::wstring const& baseName,
+    FileWriteMode mode,
+    std::optional<RECT> region)
+{
+    // Start every display before waiting on any of them. Encoders only do
+    // one image at a time, so each display gets its own.
+    std::vector<wil::task<DisplayFile>> futures;
+    for (uint32_t i = 0; i < displays.size(); i++)
+    {
+        auto&& display = displays[i];
+        std::optional<RECT> cropRect;
+        if (region.has_value())
+        {
+            RECT intersection = {};
+            if (!IntersectRect(&intersection, &display.Rect(), &region.value()))
+            {
+                continue;
+            }
+            cropRect = intersection;
+        }
+        auto encoder = CreateImageEncoder(format, Options::KeepHDR(), threadPool, encoderSettings);
+        futures.push_back(SaveDisplayToFileAsync(display, i, cropRect, captureSource, toneMapper, encoder, baseName, mode));
+    }
+    if (region.has_value() && futures.empty())
+    {
+        throw winrt::hresult_invalid_argument(L"The region doesn't overlap any display!");
+    }
+
+    std::vector<DisplayFile> files;
+    for (auto&& future : futures)
+    {
+        files.push_back(co_await std::move(future));
+    }
+    co_return files;
+}
+
+std::string CreateDisplayManifest(std::vector<DisplayFile> const& files)
+{
+    std::ostringstream stream;
+    stream << "{\n";
+    stream << "  \"displays\": [\n";
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        auto& file = files[i];
+        auto& rect = file.DisplayRect;
+        stream << "    { ";
+        stream << "\"index\": " << file.Index << ", ";
+        stream << "\"image\": \"" << EscapeJsonString(file.FileName) << "\", ";
+        stream << "\"desktopX\": " << rect.left << ", \"desktopY\": " << rect.top << ", ";
+        stream << "\"width\": " << rect.right - rect.left << ", \"height\": " << rect.bottom - rect.top << ", ";
+        stream << "\"hdr\": " << (file.Parameters.IsHDR ? "true" : "false");
+        if (file.Parameters.IsHDR)
+        {
+            stream << ", \"sdrWhiteLevel\": " << file.Parameters.SDRWhiteLevelInNits;
+            stream << ", \"maxLuminance\": " << file.Parameters.MaxLuminance;
+        }
+        stream << " }" << (i + 1 < files.size() ? "," : "") << "\n";
+    }
+    stream << "  ]\n";
+    stream << "}\n";
+    return stream.str();
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include "Snapshot.h"
+#include "ImageFormats.h"
+#include "FileWriter.h"
+
+// Where one display's screenshot went.
+struct DisplayFile
+{
+    std::wstring FileName;
+    // The display's position in the list it was captured from.
+    uint32_t Index = 0;
+    // The part of the desktop in the file.
+    RECT DisplayRect = {};
+    CaptureParameters Parameters;
+    double Milliseconds = 0.0;
+};
+
+// Captures every display and saves each one to a file of its own, named by
+// the display's index, instead of composing them. Each display is encoded
+// on its own thread, with its own encoder, as soon as its capture is done,
+// so the largest display sets the pace rather than the sum of all of them.
+// With a region, only the displays overlapping it are captured, cropped to
+// the region.
+wil::task<std::vector<DisplayFile>> SaveDisplaysToFilesAsync(
+    std::vector<Display> const& displays,
+    std::shared_ptr<CaptureSource> const& captureSource,
+    std::shared_ptr<ToneMapper> const& toneMapper,
+    std::shared_ptr<ThreadPool> const& threadPool,
+    ImageFormat format,
+    ImageEncoderSettings const& encoderSettings,
+    std::wstring const& baseName,
+    FileWriteMode mode,
+    std::optional<RECT> region = std::nullopt);
+
+// A JSON description of each display's file, rect and HDR metadata.
+std::string CreateDisplayManifest(std::vector<DisplayFile> const& files);
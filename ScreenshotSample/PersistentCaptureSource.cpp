@@ -0,0 +1,51 @@
+#include "pch.h"
+#include "PersistentCaptureSource.h"
+#include "Trace.h"
+
+namespace winrt
+{
+    using namespace Windows::Graphics::DirectX;
+    using namespace Windows::Graphics::DirectX::Direct3D11;
+}
+
+PersistentCaptureSource::PersistentCaptureSource(winrt::IDirect3DDevice const& device, uint32_t bufferCount)
+{
+    m_device = device;
+    m_bufferCount = bufferCount;
+}
+
+wil::task<winrt::com_ptr<ID3D11Texture2D>> PersistentCaptureSource::CaptureAsync(
+    Display const& display,
+    winrt::DirectXPixelFormat pixelFormat)
+{
+    // Keep the session alive for as long as we're using it.
+    auto session = GetOrCreateSession(display, pixelFormat);
+    TraceScope trace("WaitForFrameArrived", display.Handle());
+    auto frame = co_await session->CaptureAsync();
+    co_return frame.Texture;
+}
+
+wil::task<CaptureFrame> PersistentCaptureSource::CaptureFrameAsync(
+    Display const& display,
+    winrt::DirectXPixelFormat pixelFormat)
+{
+    auto session = GetOrCreateSession(display, pixelFormat);
+    TraceScope trace("WaitForFrameArrived", display.Handle());
+    co_return co_await session->CaptureAsync();
+}
+
+std::shared_ptr<CaptureSession> PersistentCaptureSource::GetOrCreateSession(
+    Display const& display,
+    winrt::DirectXPixelFormat pixelFormat)
+{
+    std::scoped_lock lock(m_lock);
+    auto key = std::make_pair(display.Handle(), pixelFormat);
+    auto search = m_sessions.find(key);
+    if (search != m_sessions.end())
+    {
+        return search->second;
+    }
+    auto session = CaptureSession::Create(m_device, display, pixelFormat, m_bufferCount);
+    m_sessions.insert({ key, session });
+    return session;
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include "CaptureSource.h"
+#include "CaptureSession.h"
+
+// Keeps one CaptureSession per display alive across captures, so that
+// repeated captures don't pay for session setup every time.
+class PersistentCaptureSource : public CaptureSource
+{
+public:
+    PersistentCaptureSource(winrt::Windows::Graphics::DirectX::Direct3D11::IDirect3DDevice const& device, uint32_t bufferCount);
+    ~PersistentCaptureSource() override {}
+
+    wil::task<winrt::com_ptr<ID3D11Texture2D>> CaptureAsync(
+        Display const& display,
+        winrt::Windows::Graphics::DirectX::DirectXPixelFormat pixelFormat) override;
+    wil::task<CaptureFrame> CaptureFrameAsync(
+        Display const& display,
+        winrt::Windows::Graphics::DirectX::DirectXPixelFormat pixelFormat) override;
+
+private:
+    std::shared_ptr<CaptureSession> GetOrCreateSession(
+        Display const& display,
+        winrt::Windows::Graphics::DirectX::DirectXPixelFormat pixelFormat);
+
+private:
+    winrt::Windows::Graphics::DirectX::Direct3D11::IDirect3DDevice m_device{ nullptr };
+    uint32_t m_bufferCount = 0;
+    std::mutex m_lock;
+    std::map<std::pair<HMONITOR, winrt::Windows::Graphics::DirectX::DirectXPixelFormat>, std::shared_ptr<CaptureSession>> m_sessions;
+};
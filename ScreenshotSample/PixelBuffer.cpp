@@ -0,0 +1,107 @@
+#include "pch.h"
+#include "PixelBuffer.h"
+#include "Trace.h"
+
+PixelBuffer& PixelBuffer::operator=(PixelBuffer&& other) noexcept
+{
+    if (this != &other)
+    {
+        Release();
+        m_pool = std::move(other.m_pool);
+        m_data = std::exchange(other.m_data, nullptr);
+        m_capacity = std::exchange(other.m_capacity, 0);
+        m_stride = std::exchange(other.m_stride, 0);
+        m_width = std::exchange(other.m_width, 0);
+        m_height = std::exchange(other.m_height, 0);
+    }
+    return *this;
+}
+
+void PixelBuffer::Release()
+{
+    if (m_data != nullptr)
+    {
+        m_pool->Return(m_data, m_capacity);
+        m_data = nullptr;
+        m_pool = nullptr;
+    }
+}
+
+PixelBufferPool::PixelBufferPool(uint64_t maxIdleBytes)
+{
+    m_maxIdleBytes = maxIdleBytes;
+}
+
+PixelBufferPool::~PixelBufferPool()
+{
+    for (auto&& block : m_idleBlocks)
+    {
+        _aligned_free(block.Data);
+    }
+}
+
+PixelBuffer PixelBufferPool::Acquire(uint32_t width, uint32_t height, uint32_t bytesPerPixel)
+{
+    auto stride = (width * bytesPerPixel + Alignment - 1) / Alignment * Alignment;
+    auto size = std::max(static_cast<size_t>(stride) * height, static_cast<size_t>(Alignment));
+
+    PixelBuffer buffer;
+    buffer.m_pool = shared_from_this();
+    buffer.m_stride = stride;
+    buffer.m_width = width;
+    buffer.m_height = height;
+    {
+        // Take the smallest block that fits, as long as it
+        // doesn't waste more than it holds.
+        std::scoped_lock lock(m_lock);
+        auto match = m_idleBlocks.end();
+        for (auto block = m_idleBlocks.begin(); block != m_idleBlocks.end(); block++)
+        {
+            if (block->Capacity >= size && block->Capacity / 2 <= size && (match == m_idleBlocks.end() || block->Capacity < match->Capacity))
+            {
+                match = block;
+            }
+        }
+        if (match != m_idleBlocks.end())
+        {
+            buffer.m_data = match->Data;
+            buffer.m_capacity = match->Capacity;
+            m_idleBytes -= match->Capacity;
+            m_idleBlocks.erase(match);
+            m_hits++;
+            return buffer;
+        }
+    }
+
+    TraceScope trace("AllocatePixelBuffer");
+    m_misses++;
+    buffer.m_data = static_cast<uint8_t*>(_aligned_malloc(size, Alignment));
+    if (buffer.m_data == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    buffer.m_capacity = size;
+    return buffer;
+}
+
+void PixelBufferPool::Return(uint8_t* data, size_t capacity)
+{
+    std::vector<uint8_t*> freed;
+    {
+        std::scoped_lock lock(m_lock);
+        m_idleBlocks.push_back({ data, capacity });
+        m_idleBytes += capacity;
+        while (m_idleBytes > m_maxIdleBytes)
+        {
+            auto& oldest = m_idleBlocks.front();
+            freed.push_back(oldest.Data);
+            m_idleBytes -= oldest.Capacity;
+            m_idleBlocks.pop_front();
+        }
+    }
+    // Freeing a few hundred MB can take a while, don't hold everyone up.
+    for (auto block : freed)
+    {
+        _aligned_free(block);
+    }
+}
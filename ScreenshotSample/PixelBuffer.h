@@ -0,0 +1,72 @@
+#pragma once
+
+class PixelBufferPool;
+
+// Rows of pixels in memory from a PixelBufferPool. The buffer and every row
+// start on a 64 byte boundary, so Stride may be more than the width needs.
+// Buffers can only be moved, and their memory goes back to the pool when
+// they're destroyed.
+class PixelBuffer
+{
+public:
+    PixelBuffer() {}
+    PixelBuffer(PixelBuffer&& other) noexcept { *this = std::move(other); }
+    PixelBuffer& operator=(PixelBuffer&& other) noexcept;
+    PixelBuffer(PixelBuffer const&) = delete;
+    PixelBuffer& operator=(PixelBuffer const&) = delete;
+    ~PixelBuffer() { Release(); }
+
+    uint8_t* Data() const { return m_data; }
+    uint8_t* Row(uint32_t row) const { return m_data + static_cast<size_t>(row) * m_stride; }
+    uint32_t Stride() const { return m_stride; }
+    uint32_t Width() const { return m_width; }
+    uint32_t Height() const { return m_height; }
+
+private:
+    friend class PixelBufferPool;
+    void Release();
+
+private:
+    std::shared_ptr<PixelBufferPool> m_pool;
+    uint8_t* m_data = nullptr;
+    size_t m_capacity = 0;
+    uint32_t m_stride = 0;
+    uint32_t m_width = 0;
+    uint32_t m_height = 0;
+};
+
+// Keeps the memory of released PixelBuffers around for the next ones, so
+// repeated shots don't allocate and fault in a few hundred MB every time.
+// At most maxIdleBytes are kept, the oldest released memory is freed first.
+class PixelBufferPool : public std::enable_shared_from_this<PixelBufferPool>
+{
+public:
+    PixelBufferPool(uint64_t maxIdleBytes);
+    ~PixelBufferPool();
+
+    static constexpr uint32_t Alignment = 64;
+
+    PixelBuffer Acquire(uint32_t width, uint32_t height, uint32_t bytesPerPixel);
+
+    uint64_t Hits() const { return m_hits; }
+    uint64_t Misses() const { return m_misses; }
+
+private:
+    friend class PixelBuffer;
+    void Return(uint8_t* data, size_t capacity);
+
+private:
+    struct Block
+    {
+        uint8_t* Data = nullptr;
+        size_t Capacity = 0;
+    };
+
+    uint64_t m_maxIdleBytes = 0;
+    std::mutex m_lock;
+    // Oldest first
+    std::deque<Block> m_idleBlocks;
+    uint64_t m_idleBytes = 0;
+    std::atomic<uint64_t> m_hits = 0;
+    std::atomic<uint64_t> m_misses = 0;
+};
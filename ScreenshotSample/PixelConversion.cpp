@@ -0,0 +1,362 @@
+#include "pch.h"
+#include "PixelConversion.h"
+#include "CpuFeatures.h"
+
+// Luma weights out of 128, small enough for _mm_maddubs_epi16's signed
+// bytes: 27/128, 92/128 and 9/128 for red, green and blue.
+constexpr uint32_t GrayWeightRed = 27;
+constexpr uint32_t GrayWeightGreen = 92;
+constexpr uint32_t GrayWeightBlue = 9;
+constexpr uint32_t GrayShift = 7;
+
+using RowConverter = void (*)(uint8_t const*, uint8_t*, uint32_t);
+
+void ConvertBgraToRgbScalar(uint8_t const* source, uint8_t* destination, uint32_t width)
+{
+    for (uint32_t x = 0; x < width; x++)
+    {
+        destination[x * 3 + 0] = source[x * 4 + 2];
+        destination[x * 3 + 1] = source[x * 4 + 1];
+        destination[x * 3 + 2] = source[x * 4 + 0];
+    }
+}
+
+void ConvertBgraToBgrScalar(uint8_t const* source, uint8_t* destination, uint32_t width)
+{
+    for (uint32_t x = 0; x < width; x++)
+    {
+        destination[x * 3 + 0] = source[x * 4 + 0];
+        destination[x * 3 + 1] = source[x * 4 + 1];
+        destination[x * 3 + 2] = source[x * 4 + 2];
+    }
+}
+
+void ConvertBgraToRgbaScalar(uint8_t const* source, uint8_t* destination, uint32_t width)
+{
+    for (uint32_t x = 0; x < width; x++)
+    {
+        destination[x * 4 + 0] = source[x * 4 + 2];
+        destination[x * 4 + 1] = source[x * 4 + 1];
+        destination[x * 4 + 2] = source[x * 4 + 0];
+        destination[x * 4 + 3] = source[x * 4 + 3];
+    }
+}
+
+void ConvertBgraToGrayScalar(uint8_t const* source, uint8_t* destination, uint32_t width)
+{
+    for (uint32_t x = 0; x < width; x++)
+    {
+        auto pixel = source + x * 4;
+        auto luma = pixel[0] * GrayWeightBlue + pixel[1] * GrayWeightGreen + pixel[2] * GrayWeightRed;
+        destination[x] = static_cast<uint8_t>((luma + (1u << (GrayShift - 1))) >> GrayShift);
+    }
+}
+
+#if defined(_M_X64) || defined(_M_IX86)
+// Byte shuffles that pack each 16 byte lane's 4 pixels into its first 12
+// bytes and zero the rest.
+#define PACK_RGB_SHUFFLE 2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1
+#define PACK_BGR_SHUFFLE 0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1
+#define SWIZZLE_RGBA_SHUFFLE 2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15
+#define GRAY_WEIGHTS GrayWeightBlue, GrayWeightGreen, GrayWeightRed, 0
+
+// 16 pixels at a time, as three full stores.
+void PackPixels24Ssse3(uint8_t const* source, uint8_t* destination, uint32_t& x, uint32_t width, __m128i shuffle)
+{
+    for (; x + 16 <= width; x += 16)
+    {
+        auto input = reinterpret_cast<__m128i const*>(source + x * 4);
+        auto packed0 = _mm_shuffle_epi8(_mm_loadu_si128(input + 0), shuffle);
+        auto packed1 = _mm_shuffle_epi8(_mm_loadu_si128(input + 1), shuffle);
+        auto packed2 = _mm_shuffle_epi8(_mm_loadu_si128(input + 2), shuffle);
+        auto packed3 = _mm_shuffle_epi8(_mm_loadu_si128(input + 3), shuffle);
+        auto output = reinterpret_cast<__m128i*>(destination + x * 3);
+        _mm_storeu_si128(output + 0, _mm_or_si128(packed0, _mm_slli_si128(packed1, 12)));
+        _mm_storeu_si128(output + 1, _mm_or_si128(_mm_srli_si128(packed1, 4), _mm_slli_si128(packed2, 8)));
+        _mm_storeu_si128(output + 2, _mm_or_si128(_mm_srli_si128(packed2, 8), _mm_slli_si128(packed3, 4)));
+    }
+}
+
+void ConvertBgraToRgbSsse3(uint8_t const* source, uint8_t* destination, uint32_t width)
+{
+    uint32_t x = 0;
+    PackPixels24Ssse3(source, destination, x, width, _mm_setr_epi8(PACK_RGB_SHUFFLE));
+    ConvertBgraToRgbScalar(source + x * 4, destination + x * 3, width - x);
+}
+
+void ConvertBgraToBgrSsse3(uint8_t const* source, uint8_t* destination, uint32_t width)
+{
+    uint32_t x = 0;
+    PackPixels24Ssse3(source, destination, x, width, _mm_setr_epi8(PACK_BGR_SHUFFLE));
+    ConvertBgraToBgrScalar(source + x * 4, destination + x * 3, width - x);
+}
+
+void ConvertBgraToRgbaSsse3(uint8_t const* source, uint8_t* destination, uint32_t width)
+{
+    auto shuffle = _mm_setr_epi8(SWIZZLE_RGBA_SHUFFLE);
+    uint32_t x = 0;
+    for (; x + 4 <= width; x += 4)
+    {
+        auto pixels = _mm_loadu_si128(reinterpret_cast<__m128i const*>(source + x * 4));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + x * 4), _mm_shuffle_epi8(pixels, shuffle));
+    }
+    ConvertBgraToRgbaScalar(source + x * 4, destination + x * 4, width - x);
+}
+
+void ConvertBgraToGraySsse3(uint8_t const* source, uint8_t* destination, uint32_t width)
+{
+    auto weights = _mm_setr_epi8(GRAY_WEIGHTS, GRAY_WEIGHTS, GRAY_WEIGHTS, GRAY_WEIGHTS);
+    auto ones = _mm_set1_epi16(1);
+    auto rounding = _mm_set1_epi32(1 << (GrayShift - 1));
+    auto luma = [&](__m128i const* input)
+    {
+        auto sums = _mm_madd_epi16(_mm_maddubs_epi16(_mm_loadu_si128(input), weights), ones);
+        return _mm_srli_epi32(_mm_add_epi32(sums, rounding), GrayShift);
+    };
+    uint32_t x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        auto input = reinterpret_cast<__m128i const*>(source + x * 4);
+        auto low = _mm_packs_epi32(luma(input + 0), luma(input + 1));
+        auto high = _mm_packs_epi32(luma(input + 2), luma(input + 3));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + x), _mm_packus_epi16(low, high));
+    }
+    ConvertBgraToGrayScalar(source + x * 4, destination + x, width - x);
+}
+
+// 8 pixels at a time. Each lane is packed on its own, then the lanes'
+// 12 bytes are moved next to each other.
+void PackPixels24Avx2(uint8_t const* source, uint8_t* destination, uint32_t& x, uint32_t width, __m256i shuffle)
+{
+    auto gather = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+    for (; x + 8 <= width; x += 8)
+    {
+        auto pixels = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(source + x * 4));
+        auto packed = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(pixels, shuffle), gather);
+        auto output = destination + x * 3;
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(output), _mm256_castsi256_si128(packed));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(output + 16), _mm256_extracti128_si256(packed, 1));
+    }
+}
+
+void ConvertBgraToRgbAvx2(uint8_t const* source, uint8_t* destination, uint32_t width)
+{
+    uint32_t x = 0;
+    PackPixels24Avx2(source, destination, x, width, _mm256_setr_epi8(PACK_RGB_SHUFFLE, PACK_RGB_SHUFFLE));
+    ConvertBgraToRgbScalar(source + x * 4, destination + x * 3, width - x);
+}
+
+void ConvertBgraToBgrAvx2(uint8_t const* source, uint8_t* destination, uint32_t width)
+{
+    uint32_t x = 0;
+    PackPixels24Avx2(source, destination, x, width, _mm256_setr_epi8(PACK_BGR_SHUFFLE, PACK_BGR_SHUFFLE));
+    ConvertBgraToBgrScalar(source + x * 4, destination + x * 3, width - x);
+}
+
+void ConvertBgraToRgbaAvx2(uint8_t const* source, uint8_t* destination, uint32_t width)
+{
+    auto shuffle = _mm256_setr_epi8(SWIZZLE_RGBA_SHUFFLE, SWIZZLE_RGBA_SHUFFLE);
+    uint32_t x = 0;
+    for (; x + 8 <= width; x += 8)
+    {
+        auto pixels = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(source + x * 4));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(destination + x * 4), _mm256_shuffle_epi8(pixels, shuffle));
+    }
+    ConvertBgraToRgbaScalar(source + x * 4, destination + x * 4, width - x);
+}
+
+void ConvertBgraToGrayAvx2(uint8_t const* source, uint8_t* destination, uint32_t width)
+{
+    auto weights = _mm256_setr_epi8(GRAY_WEIGHTS, GRAY_WEIGHTS, GRAY_WEIGHTS, GRAY_WEIGHTS, GRAY_WEIGHTS, GRAY_WEIGHTS, GRAY_WEIGHTS, GRAY_WEIGHTS);
+    auto ones = _mm256_set1_epi16(1);
+    auto rounding = _mm256_set1_epi32(1 << (GrayShift - 1));
+    // The packs work within lanes, this puts the four groups of 4 pixels
+    // back in order.
+    auto order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    auto luma = [&](__m256i const* input)
+    {
+        auto sums = _mm256_madd_epi16(_mm256_maddubs_epi16(_mm256_loadu_si256(input), weights), ones);
+        return _mm256_srli_epi32(_mm256_add_epi32(sums, rounding), GrayShift);
+    };
+    uint32_t x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        auto input = reinterpret_cast<__m256i const*>(source + x * 4);
+        auto words = _mm256_packs_epi32(luma(input + 0), luma(input + 1));
+        auto bytes = _mm256_permutevar8x32_epi32(_mm256_packus_epi16(words, words), order);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + x), _mm256_castsi256_si128(bytes));
+    }
+    ConvertBgraToGrayScalar(source + x * 4, destination + x, width - x);
+}
+
+// 16 pixels at a time, stored with a 48 byte mask.
+void PackPixels24Avx512(uint8_t const* source, uint8_t* destination, uint32_t& x, uint32_t width, __m512i shuffle)
+{
+    auto gather = _mm512_setr_epi32(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, 3, 7, 11, 15);
+    constexpr __mmask64 storeMask = (1ull << 48) - 1;
+    for (; x + 16 <= width; x += 16)
+    {
+        auto pixels = _mm512_loadu_si512(source + x * 4);
+        auto packed = _mm512_permutexvar_epi32(gather, _mm512_shuffle_epi8(pixels, shuffle));
+        _mm512_mask_storeu_epi8(destination + x * 3, storeMask, packed);
+    }
+}
+
+void ConvertBgraToRgbAvx512(uint8_t const* source, uint8_t* destination, uint32_t width)
+{
+    uint32_t x = 0;
+    auto shuffle = _mm512_broadcast_i32x4(_mm_setr_epi8(PACK_RGB_SHUFFLE));
+    PackPixels24Avx512(source, destination, x, width, shuffle);
+    ConvertBgraToRgbScalar(source + x * 4, destination + x * 3, width - x);
+}
+
+void ConvertBgraToBgrAvx512(uint8_t const* source, uint8_t* destination, uint32_t width)
+{
+    uint32_t x = 0;
+    auto shuffle = _mm512_broadcast_i32x4(_mm_setr_epi8(PACK_BGR_SHUFFLE));
+    PackPixels24Avx512(source, destination, x, width, shuffle);
+    ConvertBgraToBgrScalar(source + x * 4, destination + x * 3, width - x);
+}
+
+void ConvertBgraToRgbaAvx512(uint8_t const* source, uint8_t* destination, uint32_t width)
+{
+    auto shuffle = _mm512_broadcast_i32x4(_mm_setr_epi8(SWIZZLE_RGBA_SHUFFLE));
+    uint32_t x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        auto pixels = _mm512_loadu_si512(source + x * 4);
+        _mm512_storeu_si512(destination + x * 4, _mm512_shuffle_epi8(pixels, shuffle));
+    }
+    ConvertBgraToRgbaScalar(source + x * 4, destination + x * 4, width - x);
+}
+
+void ConvertBgraToGrayAvx512(uint8_t const* source, uint8_t* destination, uint32_t width)
+{
+    auto weights = _mm512_broadcast_i32x4(_mm_setr_epi8(GRAY_WEIGHTS, GRAY_WEIGHTS, GRAY_WEIGHTS, GRAY_WEIGHTS));
+    auto ones = _mm512_set1_epi16(1);
+    auto rounding = _mm512_set1_epi32(1 << (GrayShift - 1));
+    uint32_t x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        auto pixels = _mm512_loadu_si512(source + x * 4);
+        auto sums = _mm512_madd_epi16(_mm512_maddubs_epi16(pixels, weights), ones);
+        auto luma = _mm512_srli_epi32(_mm512_add_epi32(sums, rounding), GrayShift);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + x), _mm512_cvtepi32_epi8(luma));
+    }
+    ConvertBgraToGrayScalar(source + x * 4, destination + x, width - x);
+}
+#endif
+
+struct RowConverters
+{
+    PixelConversionPath Path = PixelConversionPath::Scalar;
+    RowConverter BgraToRgb = ConvertBgraToRgbScalar;
+    RowConverter BgraToBgr = ConvertBgraToBgrScalar;
+    RowConverter BgraToRgba = ConvertBgraToRgbaScalar;
+    RowConverter BgraToGray = ConvertBgraToGrayScalar;
+};
+
+RowConverters GetRowConvertersForPath(PixelConversionPath path)
+{
+    switch (path)
+    {
+#if defined(_M_X64) || defined(_M_IX86)
+    case PixelConversionPath::Avx512:
+        return { PixelConversionPath::Avx512, ConvertBgraToRgbAvx512, ConvertBgraToBgrAvx512, ConvertBgraToRgbaAvx512, ConvertBgraToGrayAvx512 };
+    case PixelConversionPath::Avx2:
+        return { PixelConversionPath::Avx2, ConvertBgraToRgbAvx2, ConvertBgraToBgrAvx2, ConvertBgraToRgbaAvx2, ConvertBgraToGrayAvx2 };
+    case PixelConversionPath::Ssse3:
+        return { PixelConversionPath::Ssse3, ConvertBgraToRgbSsse3, ConvertBgraToBgrSsse3, ConvertBgraToRgbaSsse3, ConvertBgraToGraySsse3 };
+#endif
+    default:
+        return {};
+    }
+}
+
+RowConverters SelectRowConverters()
+{
+    for (auto path : { PixelConversionPath::Avx512, PixelConversionPath::Avx2, PixelConversionPath::Ssse3 })
+    {
+        if (IsPixelConversionPathSupported(path))
+        {
+            return GetRowConvertersForPath(path);
+        }
+    }
+    return {};
+}
+
+RowConverters const& GetRowConverters()
+{
+    static RowConverters const converters = SelectRowConverters();
+    return converters;
+}
+
+void ConvertBgraToRgb(uint8_t const* bgraRow, uint8_t* rgbRow, uint32_t width)
+{
+    GetRowConverters().BgraToRgb(bgraRow, rgbRow, width);
+}
+
+void ConvertBgraToBgr(uint8_t const* bgraRow, uint8_t* bgrRow, uint32_t width)
+{
+    GetRowConverters().BgraToBgr(bgraRow, bgrRow, width);
+}
+
+void ConvertBgraToRgba(uint8_t const* bgraRow, uint8_t* rgbaRow, uint32_t width)
+{
+    GetRowConverters().BgraToRgba(bgraRow, rgbaRow, width);
+}
+
+void ConvertBgraToGray(uint8_t const* bgraRow, uint8_t* grayRow, uint32_t width)
+{
+    GetRowConverters().BgraToGray(bgraRow, grayRow, width);
+}
+
+PixelConversionPath GetPixelConversionPath()
+{
+    return GetRowConverters().Path;
+}
+
+bool IsPixelConversionPathSupported(PixelConversionPath path)
+{
+#if defined(_M_X64) || defined(_M_IX86)
+    auto&& features = CpuFeatures::Get();
+    switch (path)
+    {
+    case PixelConversionPath::Avx512:
+        return features.AVX512;
+    case PixelConversionPath::Avx2:
+        return features.AVX2;
+    case PixelConversionPath::Ssse3:
+        return features.SSSE3;
+    default:
+        break;
+    }
+#endif
+    return path == PixelConversionPath::Scalar;
+}
+
+void ConvertRowWithPath(PixelConversionPath path, RowConversion conversion, uint8_t const* bgraRow, uint8_t* row, uint32_t width)
+{
+    if (!IsPixelConversionPathSupported(path))
+    {
+        throw winrt::hresult_invalid_argument(L"This CPU doesn't support that pixel conversion path!");
+    }
+    auto converters = GetRowConvertersForPath(path);
+    RowConverter converter = nullptr;
+    switch (conversion)
+    {
+    case RowConversion::BgraToRgb:
+        converter = converters.BgraToRgb;
+        break;
+    case RowConversion::BgraToBgr:
+        converter = converters.BgraToBgr;
+        break;
+    case RowConversion::BgraToRgba:
+        converter = converters.BgraToRgba;
+        break;
+    case RowConversion::BgraToGray:
+        converter = converters.BgraToGray;
+        break;
+    }
+    converter(bgraRow, row, width);
+}
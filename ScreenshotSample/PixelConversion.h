@@ -0,0 +1,38 @@
+#pragma once
+
+// Row conversions from the BGRA8 our textures hold to the layouts encoders
+// write. Each has scalar, SSSE3, AVX2 and AVX-512 versions, the widest one
+// the CPU supports is picked the first time any of them is called, and all
+// of them produce identical output. Rows can't overlap.
+
+// RGB, alpha dropped. Our screenshots are opaque.
+void ConvertBgraToRgb(uint8_t const* bgraRow, uint8_t* rgbRow, uint32_t width);
+// BGR, alpha dropped, for 24bpp bitmaps.
+void ConvertBgraToBgr(uint8_t const* bgraRow, uint8_t* bgrRow, uint32_t width);
+void ConvertBgraToRgba(uint8_t const* bgraRow, uint8_t* rgbaRow, uint32_t width);
+// BT.709 luma of the sRGB values, with 7-bit weights.
+void ConvertBgraToGray(uint8_t const* bgraRow, uint8_t* grayRow, uint32_t width);
+
+enum class PixelConversionPath
+{
+    Scalar,
+    Ssse3,
+    Avx2,
+    Avx512,
+};
+
+// Which versions the conversions above use.
+PixelConversionPath GetPixelConversionPath();
+
+enum class RowConversion
+{
+    BgraToRgb,
+    BgraToBgr,
+    BgraToRgba,
+    BgraToGray,
+};
+
+// For -selfTest, which checks every path the CPU supports against the
+// scalar one. ConvertRowWithPath throws for paths it doesn't support.
+bool IsPixelConversionPathSupported(PixelConversionPath path);
+void ConvertRowWithPath(PixelConversionPath path, RowConversion conversion, uint8_t const* bgraRow, uint8_t* row, uint32_t width);
@@ -0,0 +1,476 @@
+#include "pch.h"
+#include "PngEncoder.h"
+#include "Trace.h"
+#include "PngFilter.h"
+#include "Checksum.h"
+#include "ScRgb.h"
+#include "PixelConversion.h"
+
+// Roughly how much filtered data goes into each strip. Big enough that
+// the per strip overhead doesn't matter, small enough that even a 1080p
+// frame gets split across all of our threads.
+constexpr size_t TargetStripSize = 256 * 1024;
+// Deflate can't reference anything further back than this.
+constexpr size_t DictionarySize = 32 * 1024;
+
+constexpr uint8_t PngSignature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+
+DeflateSettings GetDeflateSettings(PngCompressionPreset preset)
+{
+    DeflateSettings settings = {};
+    switch (preset)
+    {
+    case PngCompressionPreset::Fast:
+        settings.MaxChainLength = 4;
+        settings.NiceLength = 32;
+        settings.LazyMatching = false;
+        break;
+    case PngCompressionPreset::Small:
+        settings.MaxChainLength = 128;
+        settings.NiceLength = 258;
+        settings.LazyMatching = true;
+        break;
+    case PngCompressionPreset::Balanced:
+    default:
+        settings.MaxChainLength = 32;
+        settings.NiceLength = 128;
+        settings.LazyMatching = true;
+        break;
+    }
+    return settings;
+}
+
+void AppendUInt32(std::vector<uint8_t>& output, uint32_t value)
+{
+    output.push_back(static_cast<uint8_t>(value >> 24));
+    output.push_back(static_cast<uint8_t>(value >> 16));
+    output.push_back(static_cast<uint8_t>(value >> 8));
+    output.push_back(static_cast<uint8_t>(value));
+}
+
+void AppendChunk(std::vector<uint8_t>& output, char const* type, uint8_t const* data, size_t size)
+{
+    AppendUInt32(output, static_cast<uint32_t>(size));
+    auto typeStart = output.size();
+    output.insert(output.end(), type, type + 4);
+    output.insert(output.end(), data, data + size);
+    AppendUInt32(output, Crc32(output.data() + typeStart, output.size() - typeStart));
+}
+
+// Signature, IHDR and the color space
+void AppendHeader(std::vector<uint8_t>& output, uint32_t width, uint32_t height, PngPixelFormat pixelFormat)
+{
+    output.insert(output.end(), std::begin(PngSignature), std::end(PngSignature));
+
+    std::vector<uint8_t> header;
+    AppendUInt32(header, width);
+    AppendUInt32(header, height);
+    if (pixelFormat == PngPixelFormat::Pq16)
+    {
+        // 16 bits per channel, RGB, deflate, adaptive filtering, no interlacing
+        header.insert(header.end(), { 16, 2, 0, 0, 0 });
+        AppendChunk(output, "IHDR", header.data(), header.size());
+        // BT.2020 primaries, PQ transfer, RGB, full range
+        uint8_t const codingPoints[] = { 9, 16, 0, 1 };
+        AppendChunk(output, "cICP", codingPoints, sizeof(codingPoints));
+    }
+    else
+    {
+        // 8 bits per channel, RGB or grayscale, deflate, adaptive filtering, no interlacing
+        uint8_t colorType = pixelFormat == PngPixelFormat::Gray8 ? 0 : 2;
+        header.insert(header.end(), { 8, colorType, 0, 0, 0 });
+        AppendChunk(output, "IHDR", header.data(), header.size());
+        // Our pixels are sRGB, perceptual rendering intent
+        uint8_t const renderingIntent = 0;
+        AppendChunk(output, "sRGB", &renderingIntent, 1);
+    }
+}
+
+// The zlib trailer goes in its own IDAT since we only know it at the end.
+void AppendTrailer(std::vector<uint8_t>& output, uint32_t adler)
+{
+    std::vector<uint8_t> trailer;
+    AppendUInt32(trailer, adler);
+    AppendChunk(output, "IDAT", trailer.data(), trailer.size());
+    AppendChunk(output, "IEND", nullptr, 0);
+}
+
+// Filters rows [startRow, endRow) into output. The first row is filtered
+// against the row above it, which is read again from the source.
+void FilterRows(
+    std::function<void(uint32_t, uint8_t*)> const& readRow,
+    uint32_t width,
+    uint32_t bytesPerPixel,
+    uint32_t startRow,
+    uint32_t endRow,
+    std::vector<uint8_t> const* emptyRows,
+    uint8_t* output)
+{
+    TraceScope trace("FilterStrip");
+    auto rowSize = width * bytesPerPixel;
+    size_t filteredRowSize = static_cast<size_t>(rowSize) + 1;
+    auto paddedRowSize = rowSize + PngRowPadding * 2;
+    std::vector<uint8_t> rows(static_cast<size_t>(paddedRowSize) * 2, 0);
+    std::vector<uint8_t> scratch(PngFilterScratchSize(rowSize));
+    auto current = rows.data() + PngRowPadding;
+    auto previous = current + paddedRowSize;
+
+    if (startRow > 0)
+    {
+        readRow(startRow - 1, previous);
+    }
+    for (auto row = startRow; row < endRow; row++)
+    {
+        auto filteredRow = output + filteredRowSize * (row - startRow);
+        // An empty row under another empty row is identical to it, and
+        // the Up filter turns it into zeros. previous already holds it.
+        if (emptyRows != nullptr && row > 0 && (*emptyRows)[row] && (*emptyRows)[row - 1])
+        {
+            filteredRow[0] = 2;
+            memset(filteredRow + 1, 0, rowSize);
+            continue;
+        }
+        readRow(row, current);
+        FilterPngRow(current, previous, rowSize, bytesPerPixel, filteredRow, scratch.data());
+        std::swap(current, previous);
+    }
+}
+
+// Deflates size bytes of filtered data into an IDAT chunk, using the
+// dictionarySize bytes that come before it as the dictionary.
+void DeflateStrip(
+    DeflateSettings const& settings,
+    uint8_t const* data,
+    size_t dictionarySize,
+    size_t size,
+    bool isFirst,
+    bool isFinal,
+    std::vector<uint8_t>& chunk)
+{
+    TraceScope trace("DeflateStrip");
+    chunk.clear();
+    chunk.reserve(size / 2);
+    AppendUInt32(chunk, 0);
+    chunk.insert(chunk.end(), { 'I', 'D', 'A', 'T' });
+    if (isFirst)
+    {
+        // zlib header: deflate with a 32KB window, no preset dictionary
+        chunk.insert(chunk.end(), { 0x78, 0x9c });
+    }
+
+    Deflater deflater(settings);
+    deflater.Compress(data - dictionarySize, dictionarySize, size + dictionarySize, isFinal, chunk);
+
+    auto dataSize = static_cast<uint32_t>(chunk.size() - 8);
+    chunk[0] = static_cast<uint8_t>(dataSize >> 24);
+    chunk[1] = static_cast<uint8_t>(dataSize >> 16);
+    chunk[2] = static_cast<uint8_t>(dataSize >> 8);
+    chunk[3] = static_cast<uint8_t>(dataSize);
+    AppendUInt32(chunk, Crc32(chunk.data() + 4, chunk.size() - 4));
+}
+
+PngEncoder::PngEncoder(std::shared_ptr<ThreadPool> const& threadPool, PngCompressionPreset preset, PngPixelFormat pixelFormat)
+{
+    m_threadPool = threadPool;
+    m_preset = preset;
+    m_pixelFormat = pixelFormat;
+    switch (pixelFormat)
+    {
+    case PngPixelFormat::Gray8:
+        m_bytesPerPixel = 1;
+        break;
+    case PngPixelFormat::Pq16:
+        m_bytesPerPixel = 6;
+        break;
+    case PngPixelFormat::Srgb8:
+    default:
+        m_bytesPerPixel = 3;
+        break;
+    }
+}
+
+DXGI_FORMAT PngEncoder::InputFormat() const
+{
+    return m_pixelFormat == PngPixelFormat::Pq16 ? DXGI_FORMAT_R16G16B16A16_FLOAT : DXGI_FORMAT_B8G8R8A8_UNORM;
+}
+
+void PngEncoder::ConvertRow(uint8_t const* source, uint8_t* destination, uint32_t width) const
+{
+    switch (m_pixelFormat)
+    {
+    case PngPixelFormat::Gray8:
+        ConvertBgraToGray(source, destination, width);
+        break;
+    case PngPixelFormat::Pq16:
+        ConvertScRgbRowToPq(reinterpret_cast<uint16_t const*>(source), destination, width, true);
+        break;
+    case PngPixelFormat::Srgb8:
+    default:
+        ConvertBgraToRgb(source, destination, width);
+        break;
+    }
+}
+
+void PngEncoder::ThrowIfNotBgra8() const
+{
+    if (m_pixelFormat == PngPixelFormat::Pq16)
+    {
+        throw winrt::hresult_invalid_argument(L"Only 8-bit PNGs can be encoded incrementally or sparsely!");
+    }
+}
+
+std::vector<uint8_t> PngEncoder::Encode(uint8_t const* pixels, uint32_t stride, uint32_t width, uint32_t height)
+{
+    PngStripCache cache;
+    return EncodeWithCache(cache, width, height, [&](uint32_t row, uint8_t* pngRow)
+        {
+            ConvertRow(pixels + static_cast<size_t>(row) * stride, pngRow, width);
+        }, nullptr);
+}
+
+std::vector<uint8_t> PngEncoder::EncodeIncremental(
+    PngStripCache& cache,
+    uint8_t const* bgraPixels,
+    uint32_t stride,
+    uint32_t width,
+    uint32_t height,
+    std::vector<uint8_t> const& dirtyRows)
+{
+    ThrowIfNotBgra8();
+    if (dirtyRows.size() != height)
+    {
+        throw winrt::hresult_invalid_argument(L"Expected one dirty flag per row!");
+    }
+    return EncodeWithCache(cache, width, height, [this, bgraPixels, stride, width](uint32_t row, uint8_t* pngRow)
+        {
+            ConvertRow(bgraPixels + static_cast<size_t>(row) * stride, pngRow, width);
+        }, &dirtyRows);
+}
+
+void PngEncoder::EncodeSparse(SparseImage const& image, std::function<void(uint8_t const*, size_t)> const& write)
+{
+    ThrowIfNotBgra8();
+    uint8_t background[4] = {};
+    ConvertRow(image.Background.data(), background, 1);
+    auto emptyRows = image.EmptyRows();
+
+    // The regions are already in memory, there's nothing to prepare.
+    EncodeBands(image.Width, image.Height, [](uint32_t, uint32_t) {}, [&](uint32_t row, uint8_t* pngRow)
+        {
+            for (uint32_t x = 0; x < image.Width; x++)
+            {
+                memcpy(pngRow + x * m_bytesPerPixel, background, m_bytesPerPixel);
+            }
+            for (auto&& region : image.Regions)
+            {
+                auto regionRow = static_cast<int64_t>(row) - region.Y;
+                if (regionRow < 0 || regionRow >= region.Height)
+                {
+                    continue;
+                }
+                auto left = std::clamp<int64_t>(region.X, 0, image.Width);
+                auto right = std::clamp<int64_t>(static_cast<int64_t>(region.X) + region.Width, 0, image.Width);
+                if (left >= right)
+                {
+                    continue;
+                }
+                auto source = region.Pixels.data() + static_cast<size_t>(regionRow) * region.Width * 4 + (left - region.X) * 4;
+                ConvertRow(source, pngRow + left * m_bytesPerPixel, static_cast<uint32_t>(right - left));
+            }
+        }, &emptyRows, write);
+}
+
+std::vector<uint8_t> PngEncoder::EncodeWithCache(
+    PngStripCache& cache,
+    uint32_t width,
+    uint32_t height,
+    std::function<void(uint32_t, uint8_t*)> const& readRow,
+    std::vector<uint8_t> const* dirtyRows)
+{
+    TraceScope trace("EncodePng");
+    auto rowSize = width * m_bytesPerPixel;
+    size_t filteredRowSize = static_cast<size_t>(rowSize) + 1;
+    auto rowsPerStrip = static_cast<uint32_t>(std::max<size_t>(TargetStripSize / filteredRowSize, 1));
+    auto stripCount = (height + rowsPerStrip - 1) / rowsPerStrip;
+
+    // Anything we remember from a different size of image is useless.
+    auto isCacheValid = dirtyRows != nullptr && cache.Width == width && cache.Height == height;
+    if (!isCacheValid)
+    {
+        cache.Width = width;
+        cache.Height = height;
+        cache.Filtered.assign(filteredRowSize * height, 0);
+        cache.Chunks.assign(stripCount, {});
+        cache.Adlers.assign(stripCount, 0);
+        cache.StripSizes.assign(stripCount, 0);
+    }
+
+    // dirtyRowsBefore[row] is the number of dirty rows above row, which
+    // makes checking a range of rows cheap.
+    std::vector<uint32_t> dirtyRowsBefore(height + 1, 0);
+    for (uint32_t row = 0; row < height; row++)
+    {
+        auto isDirty = !isCacheValid || (*dirtyRows)[row] != 0;
+        dirtyRowsBefore[row + 1] = dirtyRowsBefore[row] + (isDirty ? 1 : 0);
+    }
+    auto isRangeDirty = [&](uint32_t startRow, uint32_t endRow)
+    {
+        return dirtyRowsBefore[endRow] != dirtyRowsBefore[startRow];
+    };
+
+    // A strip's filtered rows depend on its own rows and the row above it.
+    // Its compressed data also depends on the filtered rows in its dictionary.
+    auto dictionaryRows = static_cast<uint32_t>((DictionarySize + filteredRowSize - 1) / filteredRowSize);
+    std::vector<uint32_t> stripsToFilter;
+    std::vector<uint32_t> stripsToDeflate;
+    for (uint32_t strip = 0; strip < stripCount; strip++)
+    {
+        auto startRow = strip * rowsPerStrip;
+        auto endRow = std::min(startRow + rowsPerStrip, height);
+        if (isRangeDirty(startRow > 0 ? startRow - 1 : 0, endRow))
+        {
+            stripsToFilter.push_back(strip);
+        }
+        auto dictionaryStartRow = startRow > dictionaryRows ? startRow - dictionaryRows : 0;
+        if (isRangeDirty(dictionaryStartRow > 0 ? dictionaryStartRow - 1 : 0, endRow))
+        {
+            stripsToDeflate.push_back(strip);
+        }
+    }
+    cache.StripCount = stripCount;
+    cache.StripsEncoded = static_cast<uint32_t>(stripsToDeflate.size());
+
+    // Filter every strip.
+    auto& filtered = cache.Filtered;
+    m_threadPool->ParallelFor(static_cast<uint32_t>(stripsToFilter.size()), [&](uint32_t index)
+        {
+            auto strip = stripsToFilter[index];
+            auto startRow = strip * rowsPerStrip;
+            auto endRow = std::min(startRow + rowsPerStrip, height);
+            FilterRows(readRow, width, m_bytesPerPixel, startRow, endRow, nullptr, filtered.data() + filteredRowSize * startRow);
+        });
+
+    // Deflate every strip, each one primed with the 32KB that came before it.
+    // Each strip becomes its own IDAT chunk.
+    auto settings = GetDeflateSettings(m_preset);
+    m_threadPool->ParallelFor(static_cast<uint32_t>(stripsToDeflate.size()), [&](uint32_t index)
+        {
+            auto strip = stripsToDeflate[index];
+            auto start = filteredRowSize * (strip * rowsPerStrip);
+            auto end = filteredRowSize * std::min((strip + 1) * rowsPerStrip, height);
+            auto dictionary = std::min(start, DictionarySize);
+            DeflateStrip(settings, filtered.data() + start, dictionary, end - start, strip == 0, strip == stripCount - 1, cache.Chunks[strip]);
+            cache.Adlers[strip] = Adler32(filtered.data() + start, end - start);
+            cache.StripSizes[strip] = end - start;
+        });
+
+    // Put the file together
+    std::vector<uint8_t> output;
+    size_t totalSize = sizeof(PngSignature) + 64;
+    for (auto&& chunk : cache.Chunks)
+    {
+        totalSize += chunk.size();
+    }
+    output.reserve(totalSize);
+    AppendHeader(output, width, height, m_pixelFormat);
+    uint32_t adler = 1;
+    for (uint32_t strip = 0; strip < stripCount; strip++)
+    {
+        output.insert(output.end(), cache.Chunks[strip].begin(), cache.Chunks[strip].end());
+        adler = Adler32Combine(adler, cache.Adlers[strip], cache.StripSizes[strip]);
+    }
+    AppendTrailer(output, adler);
+
+    return output;
+}
+
+void PngEncoder::EncodeStreaming(
+    uint32_t width,
+    uint32_t height,
+    ImageRowSource& source,
+    std::function<void(uint8_t const*, size_t)> const& write)
+{
+    EncodeBands(width, height, [&](uint32_t startRow, uint32_t endRow)
+        {
+            source.PrepareRows(startRow, endRow);
+        }, [&](uint32_t row, uint8_t* pngRow)
+        {
+            ConvertRow(source.GetRow(row), pngRow, width);
+        }, nullptr, write);
+}
+
+void PngEncoder::EncodeBands(
+    uint32_t width,
+    uint32_t height,
+    std::function<void(uint32_t, uint32_t)> const& prepareRows,
+    std::function<void(uint32_t, uint8_t*)> const& readRow,
+    std::vector<uint8_t> const* emptyRows,
+    std::function<void(uint8_t const*, size_t)> const& write)
+{
+    TraceScope trace("EncodePngStreaming");
+    auto rowSize = width * m_bytesPerPixel;
+    size_t filteredRowSize = static_cast<size_t>(rowSize) + 1;
+    auto rowsPerStrip = static_cast<uint32_t>(std::max<size_t>(TargetStripSize / filteredRowSize, 1));
+    auto stripCount = (height + rowsPerStrip - 1) / rowsPerStrip;
+    // Enough strips at a time to keep every thread busy, and no more.
+    auto stripsPerBand = m_threadPool->ThreadCount() * 2;
+    auto rowsPerBand = stripsPerBand * rowsPerStrip;
+
+    std::vector<uint8_t> output;
+    AppendHeader(output, width, height, m_pixelFormat);
+    write(output.data(), output.size());
+
+    // The filtered band goes after the tail of the previous band, which
+    // the first strips of the band use as their dictionary.
+    auto settings = GetDeflateSettings(m_preset);
+    std::vector<uint8_t> filtered;
+    size_t dictionarySize = 0;
+    std::vector<std::vector<uint8_t>> chunks(stripsPerBand);
+    std::vector<uint32_t> adlers(stripsPerBand);
+    uint32_t adler = 1;
+    for (uint32_t bandStartRow = 0; bandStartRow < height; bandStartRow += rowsPerBand)
+    {
+        auto bandEndRow = std::min(bandStartRow + rowsPerBand, height);
+        auto firstStrip = bandStartRow / rowsPerStrip;
+        auto bandStripCount = (bandEndRow - bandStartRow + rowsPerStrip - 1) / rowsPerStrip;
+        prepareRows(bandStartRow, bandEndRow);
+
+        // Keep the last 32KB of the previous band.
+        if (!filtered.empty())
+        {
+            auto tail = std::min(filtered.size(), DictionarySize);
+            memmove(filtered.data(), filtered.data() + filtered.size() - tail, tail);
+            dictionarySize = tail;
+        }
+        filtered.resize(dictionarySize + filteredRowSize * (bandEndRow - bandStartRow));
+        auto bandData = filtered.data() + dictionarySize;
+
+        m_threadPool->ParallelFor(bandStripCount, [&](uint32_t index)
+            {
+                auto startRow = bandStartRow + index * rowsPerStrip;
+                auto endRow = std::min(startRow + rowsPerStrip, bandEndRow);
+                FilterRows(readRow, width, m_bytesPerPixel, startRow, endRow, emptyRows, bandData + filteredRowSize * (startRow - bandStartRow));
+            });
+        m_threadPool->ParallelFor(bandStripCount, [&](uint32_t index)
+            {
+                auto strip = firstStrip + index;
+                auto start = filteredRowSize * (index * rowsPerStrip);
+                auto end = filteredRowSize * std::min((index + 1) * rowsPerStrip, bandEndRow - bandStartRow);
+                auto dictionary = std::min(start + dictionarySize, DictionarySize);
+                DeflateStrip(settings, bandData + start, dictionary, end - start, strip == 0, strip == stripCount - 1, chunks[index]);
+                adlers[index] = Adler32(bandData + start, end - start);
+            });
+
+        for (uint32_t index = 0; index < bandStripCount; index++)
+        {
+            auto start = filteredRowSize * (index * rowsPerStrip);
+            auto end = filteredRowSize * std::min((index + 1) * rowsPerStrip, bandEndRow - bandStartRow);
+            write(chunks[index].data(), chunks[index].size());
+            adler = Adler32Combine(adler, adlers[index], end - start);
+        }
+    }
+
+    output.clear();
+    AppendTrailer(output, adler);
+    write(output.data(), output.size());
+}
@@ -0,0 +1,119 @@
+#pragma once
+#include "ThreadPool.h"
+#include "SparseImage.h"
+#include "ImageEncoder.h"
+#include "Deflate.h"
+
+enum class PngCompressionPreset
+{
+    Fast,
+    Balanced,
+    Small,
+};
+
+// The EXR encoder's zip compression uses the same presets.
+DeflateSettings GetDeflateSettings(PngCompressionPreset preset);
+
+enum class PngPixelFormat
+{
+    // 8-bit sRGB RGB, from BGRA8. Alpha is dropped, screenshots are opaque.
+    Srgb8,
+    // 8-bit grayscale, from BGRA8, for -grayscale
+    Gray8,
+    // 16-bit BT.2100 PQ RGB with a cICP chunk, from FP16 scRGB
+    Pq16,
+};
+
+// The pieces of a PNG file, for writers of formats built on it like
+// TimelapseWriter. Integers are big endian.
+void AppendUInt32(std::vector<uint8_t>& output, uint32_t value);
+void AppendChunk(std::vector<uint8_t>& output, char const* type, uint8_t const* data, size_t size);
+// Signature, IHDR and the color space
+void AppendHeader(std::vector<uint8_t>& output, uint32_t width, uint32_t height, PngPixelFormat pixelFormat);
+
+// What PngEncoder::EncodeIncremental remembers between images: the filtered
+// rows and the compressed strips.
+struct PngStripCache
+{
+    uint32_t Width = 0;
+    uint32_t Height = 0;
+    std::vector<uint8_t> Filtered;
+    std::vector<std::vector<uint8_t>> Chunks;
+    std::vector<uint32_t> Adlers;
+    std::vector<size_t> StripSizes;
+
+    // How many strips the last encode had, and how many it had to redo.
+    uint32_t StripCount = 0;
+    uint32_t StripsEncoded = 0;
+};
+
+// Encodes BGRA8 pixels to PNG on a thread pool, or FP16 pixels to 16-bit PQ
+// PNG for -keepHDR. The image is split into row strips, and each strip is
+// filtered and deflated independently with the previous strip's tail as its
+// dictionary before the streams are joined.
+class PngEncoder : public ImageEncoder
+{
+public:
+    PngEncoder(std::shared_ptr<ThreadPool> const& threadPool, PngCompressionPreset preset, PngPixelFormat pixelFormat = PngPixelFormat::Srgb8);
+    ~PngEncoder() override {}
+
+    ImageFormat Format() const override { return ImageFormat::Png; }
+    DXGI_FORMAT InputFormat() const override;
+    std::vector<uint8_t> Encode(uint8_t const* pixels, uint32_t stride, uint32_t width, uint32_t height) override;
+
+    // Encodes an image that only differs from the previous one encoded with
+    // the same cache in the rows marked in dirtyRows (one entry per row).
+    // Only the strips those rows touch are filtered and deflated again.
+    // EncodeIncremental and EncodeSparse only take BGRA8.
+    std::vector<uint8_t> EncodeIncremental(
+        PngStripCache& cache,
+        uint8_t const* bgraPixels,
+        uint32_t stride,
+        uint32_t width,
+        uint32_t height,
+        std::vector<uint8_t> const& dirtyRows);
+
+    // Encodes a sparse image without ever building the full bitmap, and
+    // hands the file to write in pieces like EncodeStreaming. Rows nobody
+    // covers are filtered to zeros without trying every filter.
+    void EncodeSparse(SparseImage const& image, std::function<void(uint8_t const*, size_t)> const& write);
+
+    // Encodes a band of strips at a time and hands the file to write in
+    // pieces as they're done, so only a few strips are ever in memory. The
+    // output is identical to Encode's.
+    void EncodeStreaming(
+        uint32_t width,
+        uint32_t height,
+        ImageRowSource& source,
+        std::function<void(uint8_t const*, size_t)> const& write) override;
+
+    // Screenshots usually compress to well under half their raw size.
+    uint64_t EstimateSize(uint32_t width, uint32_t height) const override { return static_cast<uint64_t>(width) * height * m_bytesPerPixel / 2; }
+
+private:
+    // Converts one row of input pixels to PNG pixels.
+    void ConvertRow(uint8_t const* source, uint8_t* destination, uint32_t width) const;
+    void ThrowIfNotBgra8() const;
+
+    // readRow converts one row of the image to PNG pixels.
+    std::vector<uint8_t> EncodeWithCache(
+        PngStripCache& cache,
+        uint32_t width,
+        uint32_t height,
+        std::function<void(uint32_t, uint8_t*)> const& readRow,
+        std::vector<uint8_t> const* dirtyRows);
+    // prepareRows is called with each band before readRow reads its rows.
+    void EncodeBands(
+        uint32_t width,
+        uint32_t height,
+        std::function<void(uint32_t, uint32_t)> const& prepareRows,
+        std::function<void(uint32_t, uint8_t*)> const& readRow,
+        std::vector<uint8_t> const* emptyRows,
+        std::function<void(uint8_t const*, size_t)> const& write);
+
+private:
+    std::shared_ptr<ThreadPool> m_threadPool;
+    PngCompressionPreset m_preset = PngCompressionPreset::Balanced;
+    PngPixelFormat m_pixelFormat = PngPixelFormat::Srgb8;
+    uint32_t m_bytesPerPixel = 4;
+};
@@ -0,0 +1,142 @@
+#include "pch.h"
+#include "PngFilter.h"
+
+constexpr uint32_t FilterCount = 5;
+
+uint8_t PaethPredictor(uint8_t a, uint8_t b, uint8_t c)
+{
+    int32_t p = static_cast<int32_t>(a) + b - c;
+    auto pa = std::abs(p - a);
+    auto pb = std::abs(p - b);
+    auto pc = std::abs(p - c);
+    if (pa <= pb && pa <= pc)
+    {
+        return a;
+    }
+    return pb <= pc ? b : c;
+}
+
+uint32_t AbsoluteSum(uint8_t value)
+{
+    return value < 128 ? value : 256 - value;
+}
+
+size_t PngFilterScratchSize(uint32_t rowSize)
+{
+    return static_cast<size_t>(rowSize) * (FilterCount - 1);
+}
+
+#if defined(_M_X64) || defined(_M_IX86)
+__m128i Select(__m128i mask, __m128i a, __m128i b)
+{
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+__m128i Abs16(__m128i value)
+{
+    return _mm_max_epi16(value, _mm_sub_epi16(_mm_setzero_si128(), value));
+}
+
+__m128i PaethPredictor16(__m128i a, __m128i b, __m128i c)
+{
+    auto pa = Abs16(_mm_sub_epi16(b, c));
+    auto pb = Abs16(_mm_sub_epi16(a, c));
+    auto pc = Abs16(_mm_add_epi16(_mm_sub_epi16(b, c), _mm_sub_epi16(a, c)));
+    auto notA = _mm_or_si128(_mm_cmpgt_epi16(pa, pb), _mm_cmpgt_epi16(pa, pc));
+    auto notB = _mm_cmpgt_epi16(pb, pc);
+    return Select(notA, Select(notB, c, b), a);
+}
+
+__m128i AbsoluteSum16(__m128i value)
+{
+    // |v| for v as a signed byte, summed into two 64-bit lanes.
+    auto absolute = _mm_min_epu8(value, _mm_sub_epi8(_mm_setzero_si128(), value));
+    return _mm_sad_epu8(absolute, _mm_setzero_si128());
+}
+
+uint64_t HorizontalSum(__m128i sums)
+{
+    return static_cast<uint64_t>(_mm_cvtsi128_si32(sums)) + static_cast<uint64_t>(_mm_cvtsi128_si32(_mm_srli_si128(sums, 8)));
+}
+#endif
+
+void FilterPngRow(uint8_t const* row, uint8_t const* previousRow, uint32_t rowSize, uint32_t bytesPerPixel, uint8_t* output, uint8_t* scratch)
+{
+    // None is written straight to the output, the rest go to scratch.
+    uint8_t* filtered[FilterCount] = {
+        output + 1,
+        scratch,
+        scratch + rowSize,
+        scratch + static_cast<size_t>(rowSize) * 2,
+        scratch + static_cast<size_t>(rowSize) * 3 };
+    uint64_t sums[FilterCount] = {};
+
+    uint32_t i = 0;
+#if defined(_M_X64) || defined(_M_IX86)
+    __m128i vectorSums[FilterCount] = {};
+    auto zero = _mm_setzero_si128();
+    auto one = _mm_set1_epi8(1);
+    for (; i + 16 <= rowSize; i += 16)
+    {
+        auto x = _mm_loadu_si128(reinterpret_cast<__m128i const*>(row + i));
+        auto a = _mm_loadu_si128(reinterpret_cast<__m128i const*>(row + i - bytesPerPixel));
+        auto b = _mm_loadu_si128(reinterpret_cast<__m128i const*>(previousRow + i));
+        auto c = _mm_loadu_si128(reinterpret_cast<__m128i const*>(previousRow + i - bytesPerPixel));
+
+        auto average = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+        auto paethLow = PaethPredictor16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero), _mm_unpacklo_epi8(c, zero));
+        auto paethHigh = PaethPredictor16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero), _mm_unpackhi_epi8(c, zero));
+        auto paeth = _mm_packus_epi16(paethLow, paethHigh);
+
+        __m128i values[FilterCount] = {
+            x,
+            _mm_sub_epi8(x, a),
+            _mm_sub_epi8(x, b),
+            _mm_sub_epi8(x, average),
+            _mm_sub_epi8(x, paeth) };
+        for (uint32_t filter = 0; filter < FilterCount; filter++)
+        {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(filtered[filter] + i), values[filter]);
+            vectorSums[filter] = _mm_add_epi64(vectorSums[filter], AbsoluteSum16(values[filter]));
+        }
+    }
+    for (uint32_t filter = 0; filter < FilterCount; filter++)
+    {
+        sums[filter] = HorizontalSum(vectorSums[filter]);
+    }
+#endif
+    for (; i < rowSize; i++)
+    {
+        // Left of the first pixel is the zeroed padding. Offsetting the
+        // pointer keeps i - bytesPerPixel from wrapping around.
+        auto x = row[i];
+        auto a = *(row + i - bytesPerPixel);
+        auto b = previousRow[i];
+        auto c = *(previousRow + i - bytesPerPixel);
+        uint8_t values[FilterCount] = {
+            x,
+            static_cast<uint8_t>(x - a),
+            static_cast<uint8_t>(x - b),
+            static_cast<uint8_t>(x - ((a + b) >> 1)),
+            static_cast<uint8_t>(x - PaethPredictor(a, b, c)) };
+        for (uint32_t filter = 0; filter < FilterCount; filter++)
+        {
+            filtered[filter][i] = values[filter];
+            sums[filter] += AbsoluteSum(values[filter]);
+        }
+    }
+
+    uint32_t best = 0;
+    for (uint32_t filter = 1; filter < FilterCount; filter++)
+    {
+        if (sums[filter] < sums[best])
+        {
+            best = filter;
+        }
+    }
+    output[0] = static_cast<uint8_t>(best);
+    if (best != 0)
+    {
+        memcpy(output + 1, filtered[best], rowSize);
+    }
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+// Rows passed to FilterPngRow need this many zeroed bytes
+// before the first pixel.
+constexpr uint32_t PngRowPadding = 16;
+
+// Filters one row of pixels, bytesPerPixel is at most PngRowPadding. All five
+// filters are tried and the one with the smallest sum of absolute
+// differences wins. Writes the filter type byte followed by the filtered row
+// to output. previousRow is the unfiltered row above, or all zeros for the
+// first row. scratch needs to be PngFilterScratchSize(rowSize) bytes.
+void FilterPngRow(uint8_t const* row, uint8_t const* previousRow, uint32_t rowSize, uint32_t bytesPerPixel, uint8_t* output, uint8_t* scratch);
+size_t PngFilterScratchSize(uint32_t rowSize);
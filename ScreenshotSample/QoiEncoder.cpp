@@ -0,0 +1,220 @@
+#include "pch.h"
+#include "QoiEncoder.h"
+#include "Trace.h"
+
+constexpr uint8_t QoiOpIndex = 0x00;
+constexpr uint8_t QoiOpDiff = 0x40;
+constexpr uint8_t QoiOpLuma = 0x80;
+constexpr uint8_t QoiOpRun = 0xc0;
+constexpr uint8_t QoiOpRgb = 0xfe;
+constexpr uint8_t QoiOpRgba = 0xff;
+constexpr uint32_t QoiMaxRun = 62;
+constexpr uint32_t QoiSlotCount = 64;
+constexpr uint8_t QoiEndMarker[] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+
+// Roughly how many pixels go in a strip.
+constexpr uint32_t TargetStripPixels = 256 * 1024;
+
+// Pixels are handled as the BGRA8 bytes loaded into a uint32_t.
+constexpr uint32_t QoiStartPixel = 0xff000000;
+
+struct QoiState
+{
+    std::array<uint32_t, QoiSlotCount> Index = {};
+    uint32_t Previous = QoiStartPixel;
+};
+
+inline uint32_t QoiHash(uint32_t pixel)
+{
+    auto b = pixel & 0xff;
+    auto g = (pixel >> 8) & 0xff;
+    auto r = (pixel >> 16) & 0xff;
+    auto a = pixel >> 24;
+    return (r * 3 + g * 5 + b * 7 + a * 11) % QoiSlotCount;
+}
+
+inline uint32_t LoadPixel(uint8_t const* row, uint32_t x)
+{
+    uint32_t pixel = 0;
+    memcpy(&pixel, row + x * 4, sizeof(pixel));
+    return pixel;
+}
+
+// Records the last pixel seen in each slot, which slots were seen, and the
+// strip's last pixel.
+void ScanStripSlots(ImageRowSource& source, uint32_t width, uint32_t startRow, uint32_t endRow, QoiState& lastSeen, uint64_t& seenSlots)
+{
+    seenSlots = 0;
+    auto previous = ~LoadPixel(source.GetRow(startRow), 0);
+    for (auto row = startRow; row < endRow; row++)
+    {
+        auto rowPixels = source.GetRow(row);
+        for (uint32_t x = 0; x < width; x++)
+        {
+            auto pixel = LoadPixel(rowPixels, x);
+            // Runs land in the same slot over and over.
+            if (pixel != previous)
+            {
+                auto slot = QoiHash(pixel);
+                lastSeen.Index[slot] = pixel;
+                seenSlots |= 1ull << slot;
+                previous = pixel;
+            }
+        }
+    }
+    lastSeen.Previous = previous;
+}
+
+void EncodeStrip(ImageRowSource& source, uint32_t width, uint32_t startRow, uint32_t endRow, QoiState state, std::vector<uint8_t>& output)
+{
+    TraceScope trace("EncodeQoiStrip");
+    output.clear();
+    output.reserve(static_cast<size_t>(width) * (endRow - startRow) * 2);
+    auto& index = state.Index;
+    auto previous = state.Previous;
+    uint32_t run = 0;
+    for (auto row = startRow; row < endRow; row++)
+    {
+        auto rowPixels = source.GetRow(row);
+        for (uint32_t x = 0; x < width; x++)
+        {
+            auto pixel = LoadPixel(rowPixels, x);
+            if (pixel == previous)
+            {
+                run++;
+                if (run == QoiMaxRun)
+                {
+                    output.push_back(static_cast<uint8_t>(QoiOpRun | (run - 1)));
+                    run = 0;
+                }
+                continue;
+            }
+            if (run > 0)
+            {
+                output.push_back(static_cast<uint8_t>(QoiOpRun | (run - 1)));
+                run = 0;
+            }
+
+            auto slot = QoiHash(pixel);
+            if (index[slot] == pixel)
+            {
+                output.push_back(static_cast<uint8_t>(QoiOpIndex | slot));
+            }
+            else
+            {
+                index[slot] = pixel;
+                auto b = static_cast<uint8_t>(pixel);
+                auto g = static_cast<uint8_t>(pixel >> 8);
+                auto r = static_cast<uint8_t>(pixel >> 16);
+                auto a = static_cast<uint8_t>(pixel >> 24);
+                if ((pixel >> 24) == (previous >> 24))
+                {
+                    // Differences wrap around, like the decoder's additions.
+                    auto vr = static_cast<int8_t>(r - static_cast<uint8_t>(previous >> 16));
+                    auto vg = static_cast<int8_t>(g - static_cast<uint8_t>(previous >> 8));
+                    auto vb = static_cast<int8_t>(b - static_cast<uint8_t>(previous));
+                    auto vgr = static_cast<int8_t>(vr - vg);
+                    auto vgb = static_cast<int8_t>(vb - vg);
+                    if (vr >= -2 && vr <= 1 && vg >= -2 && vg <= 1 && vb >= -2 && vb <= 1)
+                    {
+                        output.push_back(static_cast<uint8_t>(QoiOpDiff | ((vr + 2) << 4) | ((vg + 2) << 2) | (vb + 2)));
+                    }
+                    else if (vgr >= -8 && vgr <= 7 && vg >= -32 && vg <= 31 && vgb >= -8 && vgb <= 7)
+                    {
+                        output.push_back(static_cast<uint8_t>(QoiOpLuma | (vg + 32)));
+                        output.push_back(static_cast<uint8_t>(((vgr + 8) << 4) | (vgb + 8)));
+                    }
+                    else
+                    {
+                        output.insert(output.end(), { QoiOpRgb, r, g, b });
+                    }
+                }
+                else
+                {
+                    output.insert(output.end(), { QoiOpRgba, r, g, b, a });
+                }
+            }
+            previous = pixel;
+        }
+    }
+    if (run > 0)
+    {
+        output.push_back(static_cast<uint8_t>(QoiOpRun | (run - 1)));
+    }
+}
+
+QoiEncoder::QoiEncoder(std::shared_ptr<ThreadPool> const& threadPool)
+{
+    m_threadPool = threadPool;
+}
+
+void QoiEncoder::EncodeStreaming(
+    uint32_t width,
+    uint32_t height,
+    ImageRowSource& source,
+    std::function<void(uint8_t const*, size_t)> const& write)
+{
+    TraceScope trace("EncodeQoi");
+    uint8_t header[14] = { 'q', 'o', 'i', 'f' };
+    for (uint32_t i = 0; i < 4; i++)
+    {
+        header[4 + i] = static_cast<uint8_t>(width >> (24 - i * 8));
+        header[8 + i] = static_cast<uint8_t>(height >> (24 - i * 8));
+    }
+    // RGBA, sRGB with linear alpha
+    header[12] = 4;
+    header[13] = 0;
+    write(header, sizeof(header));
+
+    auto rowsPerStrip = std::max(TargetStripPixels / std::max(width, 1u), 1u);
+    auto stripsPerBand = m_threadPool->ThreadCount() * 2;
+    auto rowsPerBand = stripsPerBand * rowsPerStrip;
+
+    QoiState state;
+    std::vector<QoiState> lastSeen(stripsPerBand);
+    std::vector<uint64_t> seenSlots(stripsPerBand);
+    std::vector<QoiState> startStates(stripsPerBand);
+    std::vector<std::vector<uint8_t>> chunks(stripsPerBand);
+    for (uint32_t bandStartRow = 0; bandStartRow < height; bandStartRow += rowsPerBand)
+    {
+        auto bandEndRow = std::min(bandStartRow + rowsPerBand, height);
+        auto bandStripCount = (bandEndRow - bandStartRow + rowsPerStrip - 1) / rowsPerStrip;
+        source.PrepareRows(bandStartRow, bandEndRow);
+
+        m_threadPool->ParallelFor(bandStripCount, [&](uint32_t index)
+            {
+                auto startRow = bandStartRow + index * rowsPerStrip;
+                auto endRow = std::min(startRow + rowsPerStrip, bandEndRow);
+                ScanStripSlots(source, width, startRow, endRow, lastSeen[index], seenSlots[index]);
+            });
+        // Each strip starts where the one before it left off, and the last
+        // one's end state carries on into the next band.
+        startStates[0] = state;
+        for (uint32_t index = 1; index <= bandStripCount; index++)
+        {
+            auto& start = index < bandStripCount ? startStates[index] : state;
+            start = startStates[index - 1];
+            for (uint32_t slot = 0; slot < QoiSlotCount; slot++)
+            {
+                if (seenSlots[index - 1] & (1ull << slot))
+                {
+                    start.Index[slot] = lastSeen[index - 1].Index[slot];
+                }
+            }
+            start.Previous = lastSeen[index - 1].Previous;
+        }
+
+        m_threadPool->ParallelFor(bandStripCount, [&](uint32_t index)
+            {
+                auto startRow = bandStartRow + index * rowsPerStrip;
+                auto endRow = std::min(startRow + rowsPerStrip, bandEndRow);
+                EncodeStrip(source, width, startRow, endRow, startStates[index], chunks[index]);
+            });
+        for (uint32_t index = 0; index < bandStripCount; index++)
+        {
+            write(chunks[index].data(), chunks[index].size());
+        }
+    }
+
+    write(QoiEndMarker, sizeof(QoiEndMarker));
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include "ImageEncoder.h"
+#include "ThreadPool.h"
+
+// Encodes to QOI (https://qoiformat.org), which is lossless and a single
+// pass with no entropy coding, so it's an order of magnitude faster than PNG.
+//
+// QOI is a sequential format, but the decoder's state at any pixel only
+// depends on the previous pixel and the last pixel seen for each of the 64
+// hash slots. So strips are encoded in parallel: a first pass records the
+// last pixel per slot in every strip, those are folded together to get the
+// state each strip starts from, and then the strips are encoded. Runs end at
+// strip boundaries, which is still a valid stream.
+class QoiEncoder : public ImageEncoder
+{
+public:
+    QoiEncoder(std::shared_ptr<ThreadPool> const& threadPool);
+    ~QoiEncoder() override {}
+
+    ImageFormat Format() const override { return ImageFormat::Qoi; }
+    void EncodeStreaming(
+        uint32_t width,
+        uint32_t height,
+        ImageRowSource& source,
+        std::function<void(uint8_t const*, size_t)> const& write) override;
+    uint64_t EstimateSize(uint32_t width, uint32_t height) const override { return static_cast<uint64_t>(width) * height * 2; }
+
+private:
+    std::shared_ptr<ThreadPool> m_threadPool;
+};
@@ -0,0 +1,35 @@
+#include "pch.h"
+#include "RawEncoder.h"
+#include "Trace.h"
+
+// How many rows are prepared at a time.
+constexpr uint32_t BandRowCount = 256;
+
+void RawEncoder::EncodeStreaming(
+    uint32_t width,
+    uint32_t height,
+    ImageRowSource& source,
+    std::function<void(uint8_t const*, size_t)> const& write)
+{
+    TraceScope trace("EncodeRaw");
+    RawImageHeader header;
+    header.Width = width;
+    header.Height = height;
+    write(reinterpret_cast<uint8_t const*>(&header), sizeof(header));
+
+    auto rowSize = static_cast<size_t>(width) * 4;
+    for (uint32_t bandStartRow = 0; bandStartRow < height; bandStartRow += BandRowCount)
+    {
+        auto bandEndRow = std::min(bandStartRow + BandRowCount, height);
+        source.PrepareRows(bandStartRow, bandEndRow);
+        for (auto row = bandStartRow; row < bandEndRow; row++)
+        {
+            write(source.GetRow(row), rowSize);
+        }
+    }
+}
+
+uint64_t RawEncoder::EstimateSize(uint32_t width, uint32_t height) const
+{
+    return sizeof(RawImageHeader) + static_cast<uint64_t>(width) * height * 4;
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include "ImageEncoder.h"
+
+// Written in front of the rows of ImageFormat::Raw files, little endian.
+// The rows follow top down, tightly packed BGRA8.
+struct RawImageHeader
+{
+    // "BGRA" in the file
+    static constexpr uint32_t ExpectedMagic = 'ARGB';
+    static constexpr uint32_t CurrentVersion = 1;
+
+    uint32_t Magic = ExpectedMagic;
+    uint32_t Version = CurrentVersion;
+    uint32_t Width = 0;
+    uint32_t Height = 0;
+};
+
+// Copies the pixels out as they are, for when the capture is going straight
+// into another program and any encoding would be wasted time.
+class RawEncoder : public ImageEncoder
+{
+public:
+    RawEncoder() {}
+    ~RawEncoder() override {}
+
+    ImageFormat Format() const override { return ImageFormat::Raw; }
+    void EncodeStreaming(
+        uint32_t width,
+        uint32_t height,
+        ImageRowSource& source,
+        std::function<void(uint8_t const*, size_t)> const& write) override;
+    uint64_t EstimateSize(uint32_t width, uint32_t height) const override;
+};
@@ -0,0 +1,347 @@
+#include "pch.h"
+#include "Resampler.h"
+#include "CpuFeatures.h"
+#include "Trace.h"
+
+constexpr int32_t WeightBits = 14;
+constexpr int32_t WeightOne = 1 << WeightBits;
+constexpr int32_t WeightRounding = 1 << (WeightBits - 1);
+constexpr double Pi = 3.14159265358979323846;
+
+// Which source pixels each destination pixel is made of, and how much of
+// each. Every destination pixel has MaxTaps weights, only the first Counts[i]
+// are used.
+struct ResampleKernel
+{
+    uint32_t MaxTaps = 0;
+    std::vector<uint32_t> Starts;
+    std::vector<uint32_t> Counts;
+    std::vector<int16_t> Weights;
+};
+
+double FilterSupport(ResampleFilter filter)
+{
+    switch (filter)
+    {
+    case ResampleFilter::Box:
+        return 0.5;
+    case ResampleFilter::Bilinear:
+        return 1.0;
+    case ResampleFilter::Lanczos:
+    default:
+        return 3.0;
+    }
+}
+
+double Sinc(double x)
+{
+    if (x == 0.0)
+    {
+        return 1.0;
+    }
+    x *= Pi;
+    return std::sin(x) / x;
+}
+
+double EvaluateFilter(ResampleFilter filter, double x)
+{
+    switch (filter)
+    {
+    case ResampleFilter::Box:
+        return x > -0.5 && x <= 0.5 ? 1.0 : 0.0;
+    case ResampleFilter::Bilinear:
+        return std::max(1.0 - std::abs(x), 0.0);
+    case ResampleFilter::Lanczos:
+    default:
+        return std::abs(x) < 3.0 ? Sinc(x) * Sinc(x / 3.0) : 0.0;
+    }
+}
+
+// Pixel centers line up, and when shrinking the filter is stretched to cover
+// every source pixel that lands in a destination pixel.
+ResampleKernel BuildKernel(uint32_t sourceSize, uint32_t destinationSize, ResampleFilter filter)
+{
+    auto scale = static_cast<double>(sourceSize) / static_cast<double>(destinationSize);
+    auto filterScale = std::max(scale, 1.0);
+    auto support = FilterSupport(filter) * filterScale;
+
+    ResampleKernel kernel;
+    kernel.MaxTaps = static_cast<uint32_t>(std::ceil(support)) * 2 + 1;
+    kernel.Starts.resize(destinationSize);
+    kernel.Counts.resize(destinationSize);
+    kernel.Weights.assign(static_cast<size_t>(destinationSize) * kernel.MaxTaps, 0);
+    std::vector<double> weights(kernel.MaxTaps);
+    for (uint32_t i = 0; i < destinationSize; i++)
+    {
+        auto center = (i + 0.5) * scale;
+        auto start = static_cast<int64_t>(std::max(std::floor(center - support), 0.0));
+        auto end = std::min(static_cast<int64_t>(std::ceil(center + support)), static_cast<int64_t>(sourceSize));
+        end = std::min(end, start + kernel.MaxTaps);
+
+        double total = 0.0;
+        uint32_t count = 0;
+        for (auto x = start; x < end; x++)
+        {
+            auto weight = EvaluateFilter(filter, (x + 0.5 - center) / filterScale);
+            weights[count++] = weight;
+            total += weight;
+        }
+        // Drop taps that don't contribute from both ends.
+        uint32_t first = 0;
+        while (first + 1 < count && weights[first] == 0.0)
+        {
+            first++;
+        }
+        while (count > first + 1 && weights[count - 1] == 0.0)
+        {
+            count--;
+        }
+
+        // Round to fixed point, and give whatever rounding lost to the
+        // biggest weight so that flat areas stay exactly flat.
+        auto fixedWeights = kernel.Weights.data() + static_cast<size_t>(i) * kernel.MaxTaps;
+        int32_t fixedTotal = 0;
+        uint32_t biggest = 0;
+        for (auto tap = first; tap < count; tap++)
+        {
+            auto weight = total != 0.0 ? weights[tap] / total : 1.0 / (count - first);
+            auto fixedWeight = static_cast<int32_t>(std::lround(weight * WeightOne));
+            fixedWeights[tap - first] = static_cast<int16_t>(fixedWeight);
+            fixedTotal += fixedWeight;
+            if (fixedWeight > fixedWeights[biggest])
+            {
+                biggest = tap - first;
+            }
+        }
+        fixedWeights[biggest] = static_cast<int16_t>(fixedWeights[biggest] + WeightOne - fixedTotal);
+        kernel.Starts[i] = static_cast<uint32_t>(start) + first;
+        kernel.Counts[i] = count - first;
+    }
+    return kernel;
+}
+
+inline uint8_t ClampToByte(int32_t sum)
+{
+    return static_cast<uint8_t>(std::clamp((sum + WeightRounding) >> WeightBits, 0, 255));
+}
+
+void ResampleRowHorizontalScalar(uint8_t const* source, uint8_t* destination, uint32_t destinationWidth, ResampleKernel const& kernel)
+{
+    for (uint32_t x = 0; x < destinationWidth; x++)
+    {
+        auto pixels = source + static_cast<size_t>(kernel.Starts[x]) * 4;
+        auto weights = kernel.Weights.data() + static_cast<size_t>(x) * kernel.MaxTaps;
+        int32_t sums[4] = {};
+        for (uint32_t tap = 0; tap < kernel.Counts[x]; tap++)
+        {
+            for (uint32_t channel = 0; channel < 4; channel++)
+            {
+                sums[channel] += pixels[tap * 4 + channel] * weights[tap];
+            }
+        }
+        for (uint32_t channel = 0; channel < 4; channel++)
+        {
+            destination[x * 4 + channel] = ClampToByte(sums[channel]);
+        }
+    }
+}
+
+void ResampleRowVerticalScalar(uint8_t const* const* rows, int16_t const* weights, uint32_t count, uint8_t* destination, size_t rowSize)
+{
+    for (size_t i = 0; i < rowSize; i++)
+    {
+        int32_t sum = 0;
+        for (uint32_t tap = 0; tap < count; tap++)
+        {
+            sum += rows[tap][i] * weights[tap];
+        }
+        destination[i] = ClampToByte(sum);
+    }
+}
+
+#if defined(_M_X64) || defined(_M_IX86)
+// Two taps at a time: the pixels are interleaved by channel so that
+// _mm_madd_epi16 multiplies and adds both taps for every channel at once.
+void ResampleRowHorizontalSse41(uint8_t const* source, uint8_t* destination, uint32_t destinationWidth, ResampleKernel const& kernel)
+{
+    auto interleave = _mm_setr_epi8(0, 4, 1, 5, 2, 6, 3, 7, -1, -1, -1, -1, -1, -1, -1, -1);
+    auto rounding = _mm_set1_epi32(WeightRounding);
+    for (uint32_t x = 0; x < destinationWidth; x++)
+    {
+        auto pixels = source + static_cast<size_t>(kernel.Starts[x]) * 4;
+        auto weights = kernel.Weights.data() + static_cast<size_t>(x) * kernel.MaxTaps;
+        auto count = kernel.Counts[x];
+        auto sums = _mm_setzero_si128();
+        uint32_t tap = 0;
+        for (; tap + 2 <= count; tap += 2)
+        {
+            auto pair = _mm_loadl_epi64(reinterpret_cast<__m128i const*>(pixels + tap * 4));
+            auto values = _mm_cvtepu8_epi16(_mm_shuffle_epi8(pair, interleave));
+            auto weightPair = _mm_set1_epi32(static_cast<uint16_t>(weights[tap]) | (static_cast<uint32_t>(static_cast<uint16_t>(weights[tap + 1])) << 16));
+            sums = _mm_add_epi32(sums, _mm_madd_epi16(values, weightPair));
+        }
+        if (tap < count)
+        {
+            int32_t pixel = 0;
+            memcpy(&pixel, pixels + tap * 4, sizeof(pixel));
+            auto values = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(pixel));
+            sums = _mm_add_epi32(sums, _mm_mullo_epi32(values, _mm_set1_epi32(weights[tap])));
+        }
+        auto shifted = _mm_srai_epi32(_mm_add_epi32(sums, rounding), WeightBits);
+        auto packed = _mm_packus_epi16(_mm_packs_epi32(shifted, shifted), _mm_setzero_si128());
+        auto result = _mm_cvtsi128_si32(packed);
+        memcpy(destination + x * 4, &result, sizeof(result));
+    }
+}
+
+// 16 bytes of every row at a time, two rows per _mm256_madd_epi16.
+void ResampleRowVerticalAvx2(uint8_t const* const* rows, int16_t const* weights, uint32_t count, uint8_t* destination, size_t rowSize)
+{
+    auto rounding = _mm256_set1_epi32(WeightRounding);
+    size_t i = 0;
+    for (; i + 16 <= rowSize; i += 16)
+    {
+        auto sumsLow = _mm256_setzero_si256();
+        auto sumsHigh = _mm256_setzero_si256();
+        uint32_t tap = 0;
+        for (; tap + 2 <= count; tap += 2)
+        {
+            auto first = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<__m128i const*>(rows[tap] + i)));
+            auto second = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<__m128i const*>(rows[tap + 1] + i)));
+            auto weightPair = _mm256_set1_epi32(static_cast<uint16_t>(weights[tap]) | (static_cast<uint32_t>(static_cast<uint16_t>(weights[tap + 1])) << 16));
+            sumsLow = _mm256_add_epi32(sumsLow, _mm256_madd_epi16(_mm256_unpacklo_epi16(first, second), weightPair));
+            sumsHigh = _mm256_add_epi32(sumsHigh, _mm256_madd_epi16(_mm256_unpackhi_epi16(first, second), weightPair));
+        }
+        if (tap < count)
+        {
+            auto last = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<__m128i const*>(rows[tap] + i)));
+            // Pair the last row with zeros.
+            auto weight = _mm256_set1_epi32(static_cast<uint16_t>(weights[tap]));
+            auto zero = _mm256_setzero_si256();
+            sumsLow = _mm256_add_epi32(sumsLow, _mm256_madd_epi16(_mm256_unpacklo_epi16(last, zero), weight));
+            sumsHigh = _mm256_add_epi32(sumsHigh, _mm256_madd_epi16(_mm256_unpackhi_epi16(last, zero), weight));
+        }
+        // unpacklo/hi work within 128-bit lanes, and so does packs, which
+        // puts the bytes back in order within each lane.
+        auto shiftedLow = _mm256_srai_epi32(_mm256_add_epi32(sumsLow, rounding), WeightBits);
+        auto shiftedHigh = _mm256_srai_epi32(_mm256_add_epi32(sumsHigh, rounding), WeightBits);
+        auto words = _mm256_packs_epi32(shiftedLow, shiftedHigh);
+        auto bytes = _mm256_packus_epi16(words, words);
+        auto result = _mm256_castsi256_si128(_mm256_permute4x64_epi64(bytes, 0b1000));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + i), result);
+    }
+    for (; i < rowSize; i++)
+    {
+        int32_t sum = 0;
+        for (uint32_t tap = 0; tap < count; tap++)
+        {
+            sum += rows[tap][i] * weights[tap];
+        }
+        destination[i] = ClampToByte(sum);
+    }
+}
+#endif
+
+Resampler::Resampler(std::shared_ptr<ThreadPool> const& threadPool, std::shared_ptr<PixelBufferPool> const& bufferPool, bool useSimd)
+{
+    m_threadPool = threadPool;
+    m_bufferPool = bufferPool;
+    auto&& features = CpuFeatures::Get();
+    m_useSimd = useSimd && features.AVX2 && features.SSE41;
+}
+
+void Resampler::Resize(
+    uint8_t const* source,
+    uint32_t sourceStride,
+    uint32_t sourceWidth,
+    uint32_t sourceHeight,
+    uint8_t* destination,
+    uint32_t destinationStride,
+    uint32_t destinationWidth,
+    uint32_t destinationHeight,
+    ResampleFilter filter)
+{
+    TraceScope trace("Resize");
+    auto useSimd = m_useSimd;
+
+    // Hand out a few bands per thread so that uneven scheduling
+    // doesn't leave us waiting on one slow band.
+    auto forEachBand = [&](uint32_t rowCount, std::function<void(uint32_t, uint32_t)> const& func)
+    {
+        auto bandCount = std::min(rowCount, m_threadPool->ThreadCount() * 4);
+        auto rowsPerBand = (rowCount + bandCount - 1) / std::max(bandCount, 1u);
+        m_threadPool->ParallelFor(bandCount, [&](uint32_t band)
+            {
+                auto startRow = band * rowsPerBand;
+                auto endRow = std::min(startRow + rowsPerBand, rowCount);
+                func(startRow, endRow);
+            });
+    };
+
+    // Horizontal pass, skipped if the width doesn't change.
+    PixelBuffer intermediate;
+    auto intermediatePixels = source;
+    auto intermediateStride = sourceStride;
+    if (destinationWidth != sourceWidth)
+    {
+        auto kernel = BuildKernel(sourceWidth, destinationWidth, filter);
+        intermediate = m_bufferPool->Acquire(destinationWidth, sourceHeight, 4);
+        intermediateStride = intermediate.Stride();
+        forEachBand(sourceHeight, [&](uint32_t startRow, uint32_t endRow)
+            {
+                TraceScope trace("ResampleHorizontal");
+                for (auto row = startRow; row < endRow; row++)
+                {
+                    auto sourceRow = source + static_cast<size_t>(row) * sourceStride;
+                    auto destinationRow = intermediate.Row(row);
+#if defined(_M_X64) || defined(_M_IX86)
+                    if (useSimd)
+                    {
+                        ResampleRowHorizontalSse41(sourceRow, destinationRow, destinationWidth, kernel);
+                        continue;
+                    }
+#endif
+                    ResampleRowHorizontalScalar(sourceRow, destinationRow, destinationWidth, kernel);
+                }
+            });
+        intermediatePixels = intermediate.Data();
+    }
+
+    // Vertical pass, which is just a copy if the height doesn't change.
+    auto rowSize = static_cast<size_t>(destinationWidth) * 4;
+    if (destinationHeight == sourceHeight)
+    {
+        forEachBand(destinationHeight, [&](uint32_t startRow, uint32_t endRow)
+            {
+                for (auto row = startRow; row < endRow; row++)
+                {
+                    memcpy(destination + static_cast<size_t>(row) * destinationStride, intermediatePixels + static_cast<size_t>(row) * intermediateStride, rowSize);
+                }
+            });
+        return;
+    }
+    auto kernel = BuildKernel(sourceHeight, destinationHeight, filter);
+    forEachBand(destinationHeight, [&](uint32_t startRow, uint32_t endRow)
+        {
+            TraceScope trace("ResampleVertical");
+            std::vector<uint8_t const*> rows(kernel.MaxTaps);
+            for (auto row = startRow; row < endRow; row++)
+            {
+                auto count = kernel.Counts[row];
+                for (uint32_t tap = 0; tap < count; tap++)
+                {
+                    rows[tap] = intermediatePixels + static_cast<size_t>(kernel.Starts[row] + tap) * intermediateStride;
+                }
+                auto weights = kernel.Weights.data() + static_cast<size_t>(row) * kernel.MaxTaps;
+                auto destinationRow = destination + static_cast<size_t>(row) * destinationStride;
+#if defined(_M_X64) || defined(_M_IX86)
+                if (useSimd)
+                {
+                    ResampleRowVerticalAvx2(rows.data(), weights, count, destinationRow, rowSize);
+                    continue;
+                }
+#endif
+                ResampleRowVerticalScalar(rows.data(), weights, count, destinationRow, rowSize);
+            }
+        });
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include "ThreadPool.h"
+#include "PixelBuffer.h"
+
+enum class ResampleFilter
+{
+    Box,
+    Bilinear,
+    // Lanczos with 3 lobes
+    Lanczos,
+};
+
+// Resizes BGRA8 images with a separable filter: rows are resampled
+// horizontally into an intermediate image, which is then resampled
+// vertically. Both passes are split into bands of rows on the thread pool.
+// Weights are 14-bit fixed point, and the scalar and SSE4.1/AVX2 paths
+// produce bit-identical output. Alpha isn't premultiplied, our captures are
+// opaque. The intermediate image comes from the buffer pool.
+class Resampler
+{
+public:
+    Resampler(std::shared_ptr<ThreadPool> const& threadPool, std::shared_ptr<PixelBufferPool> const& bufferPool, bool useSimd);
+    ~Resampler() {}
+
+    // Strides are in bytes.
+    void Resize(
+        uint8_t const* source,
+        uint32_t sourceStride,
+        uint32_t sourceWidth,
+        uint32_t sourceHeight,
+        uint8_t* destination,
+        uint32_t destinationStride,
+        uint32_t destinationWidth,
+        uint32_t destinationHeight,
+        ResampleFilter filter);
+
+    bool UsesSimd() const { return m_useSimd; }
+
+private:
+    std::shared_ptr<ThreadPool> m_threadPool;
+    std::shared_ptr<PixelBufferPool> m_bufferPool;
+    bool m_useSimd = false;
+};
@@ -0,0 +1,142 @@
+#include "pch.h"
+#include "ScRgb.h"
+#include "HalfFloat.h"
+#include "CpuFeatures.h"
+
+constexpr double ScRgbWhiteInNits = 80.0;
+constexpr double PqPeakInNits = 10000.0;
+
+// SMPTE ST 2084 constants
+constexpr double PqM1 = 2610.0 / 16384.0;
+constexpr double PqM2 = 2523.0 / 4096.0 * 128.0;
+constexpr double PqC1 = 3424.0 / 4096.0;
+constexpr double PqC2 = 2413.0 / 4096.0 * 32.0;
+constexpr double PqC3 = 2392.0 / 4096.0 * 32.0;
+
+// BT.709 to BT.2020 primaries, from BT.2087.
+constexpr float Bt709ToBt2020[3][3] =
+{
+    { 0.6274040f, 0.3292820f, 0.0433136f },
+    { 0.0690970f, 0.9195400f, 0.0113612f },
+    { 0.0163916f, 0.0880132f, 0.8955950f },
+};
+
+std::array<uint16_t, 256> BuildSrgbToHalfLut()
+{
+    std::array<uint16_t, 256> lut = {};
+    for (uint32_t i = 0; i < lut.size(); i++)
+    {
+        auto value = static_cast<double>(i) / 255.0;
+        auto linear = value <= 0.04045 ? value / 12.92 : std::pow((value + 0.055) / 1.055, 2.4);
+        lut[i] = FloatToHalf(static_cast<float>(linear));
+    }
+    return lut;
+}
+
+// Indexed by the bits of a half, so the curve is only evaluated once per
+// representable value.
+std::vector<uint16_t> BuildHalfToPqLut()
+{
+    std::vector<uint16_t> lut(65536, 0);
+    for (uint32_t i = 0; i < lut.size(); i++)
+    {
+        auto value = static_cast<double>(HalfToFloat(static_cast<uint16_t>(i)));
+        // Negative (out of gamut) and NaN values end up black.
+        if (!(value > 0.0))
+        {
+            continue;
+        }
+        auto y = std::min(value * ScRgbWhiteInNits / PqPeakInNits, 1.0);
+        auto p = std::pow(y, PqM1);
+        auto encoded = std::pow((PqC1 + PqC2 * p) / (1.0 + PqC3 * p), PqM2);
+        lut[i] = static_cast<uint16_t>(std::lround(encoded * 65535.0));
+    }
+    return lut;
+}
+
+void ConvertSrgbRowToScRgb(uint8_t const* bgraRow, uint16_t* halfRgbaRow, uint32_t width)
+{
+    static auto const lut = BuildSrgbToHalfLut();
+    // 1.0 as a half
+    constexpr uint16_t HalfOne = 0x3c00;
+    for (uint32_t x = 0; x < width; x++)
+    {
+        auto pixel = bgraRow + x * 4;
+        auto output = halfRgbaRow + x * 4;
+        output[0] = lut[pixel[2]];
+        output[1] = lut[pixel[1]];
+        output[2] = lut[pixel[0]];
+        output[3] = HalfOne;
+    }
+}
+
+void ConvertScRgbRowToPqScalar(uint16_t const* halfRgbaRow, uint8_t* rgb16Row, uint32_t width, std::vector<uint16_t> const& lut)
+{
+    for (uint32_t x = 0; x < width; x++)
+    {
+        auto pixel = halfRgbaRow + x * 4;
+        float const rgb[3] = { HalfToFloat(pixel[0]), HalfToFloat(pixel[1]), HalfToFloat(pixel[2]) };
+        auto output = rgb16Row + x * 6;
+        for (uint32_t channel = 0; channel < 3; channel++)
+        {
+            auto& row = Bt709ToBt2020[channel];
+            auto value = row[0] * rgb[0] + row[1] * rgb[1] + row[2] * rgb[2];
+            auto encoded = lut[FloatToHalf(value)];
+            output[channel * 2] = static_cast<uint8_t>(encoded >> 8);
+            output[channel * 2 + 1] = static_cast<uint8_t>(encoded);
+        }
+    }
+}
+
+#if defined(_M_X64) || defined(_M_IX86)
+// Two pixels at a time, one per lane. The sums are added up in the same
+// order as the scalar version, so the same halves are looked up.
+void ConvertScRgbRowToPqF16c(uint16_t const* halfRgbaRow, uint8_t* rgb16Row, uint32_t width, std::vector<uint16_t> const& lut)
+{
+    auto column = [](uint32_t index)
+    {
+        auto& m = Bt709ToBt2020;
+        return _mm256_setr_ps(m[0][index], m[1][index], m[2][index], 0.0f, m[0][index], m[1][index], m[2][index], 0.0f);
+    };
+    auto redColumn = column(0);
+    auto greenColumn = column(1);
+    auto blueColumn = column(2);
+    uint16_t halves[8] = {};
+    uint32_t x = 0;
+    for (; x + 2 <= width; x += 2)
+    {
+        auto pixels = _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<__m128i const*>(halfRgbaRow + x * 4)));
+        auto red = _mm256_permute_ps(pixels, 0x00);
+        auto green = _mm256_permute_ps(pixels, 0x55);
+        auto blue = _mm256_permute_ps(pixels, 0xaa);
+        auto values = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(redColumn, red), _mm256_mul_ps(greenColumn, green)), _mm256_mul_ps(blueColumn, blue));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(halves), _mm256_cvtps_ph(values, _MM_FROUND_TO_NEAREST_INT));
+
+        auto output = rgb16Row + x * 6;
+        for (uint32_t pixel = 0; pixel < 2; pixel++)
+        {
+            for (uint32_t channel = 0; channel < 3; channel++)
+            {
+                auto encoded = lut[halves[pixel * 4 + channel]];
+                output[pixel * 6 + channel * 2] = static_cast<uint8_t>(encoded >> 8);
+                output[pixel * 6 + channel * 2 + 1] = static_cast<uint8_t>(encoded);
+            }
+        }
+    }
+    ConvertScRgbRowToPqScalar(halfRgbaRow + x * 4, rgb16Row + x * 6, width - x, lut);
+}
+#endif
+
+void ConvertScRgbRowToPq(uint16_t const* halfRgbaRow, uint8_t* rgb16Row, uint32_t width, bool useSimd)
+{
+    static auto const lut = BuildHalfToPqLut();
+#if defined(_M_X64) || defined(_M_IX86)
+    auto&& features = CpuFeatures::Get();
+    if (useSimd && features.AVX && features.F16C)
+    {
+        ConvertScRgbRowToPqF16c(halfRgbaRow, rgb16Row, width, lut);
+        return;
+    }
+#endif
+    ConvertScRgbRowToPqScalar(halfRgbaRow, rgb16Row, width, lut);
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+// Conversions for -keepHDR, which keeps everything in FP16 scRGB: linear,
+// BT.709 primaries, 1.0 is 80 nits.
+
+// Expands 8-bit sRGB to scRGB, so that SDR displays can be composed with HDR
+// ones. SDR white ends up at 1.0.
+void ConvertSrgbRowToScRgb(uint8_t const* bgraRow, uint16_t* halfRgbaRow, uint32_t width);
+
+// Converts scRGB to BT.2100 PQ: BT.2020 primaries and the PQ curve, as
+// 16-bit big endian RGB ready to go in a PNG. Alpha is dropped. Without
+// useSimd, or without F16C, pixels are converted one at a time.
+void ConvertScRgbRowToPq(uint16_t const* halfRgbaRow, uint8_t* rgb16Row, uint32_t width, bool useSimd);
@@ -0,0 +1,177 @@
+#include "pch.h"
+#include "ScreenshotService.h"
+#include "Options.h"
+#include "Output.h"
+#include "Trace.h"
+
+namespace winrt
+{
+    using namespace Windows::Foundation;
+    using namespace Windows::Graphics::DirectX::Direct3D11;
+}
+
+// Waits for the next client, however long that takes.
+void ConnectServiceClient(HANDLE pipe)
+{
+    wil::unique_event connected(wil::EventOptions::ManualReset);
+    OVERLAPPED overlapped = {};
+    overlapped.hEvent = connected.get();
+    if (ConnectNamedPipe(pipe, &overlapped))
+    {
+        return;
+    }
+    auto error = GetLastError();
+    if (error == ERROR_IO_PENDING)
+    {
+        DWORD unused = 0;
+        winrt::check_bool(GetOverlappedResult(pipe, &overlapped, &unused, TRUE));
+    }
+    else if (error != ERROR_PIPE_CONNECTED)
+    {
+        winrt::throw_hresult(HRESULT_FROM_WIN32(error));
+    }
+}
+
+winrt::IAsyncAction RunScreenshotServiceAsync(
+    winrt::IDirect3DDevice const& device,
+    std::shared_ptr<DisplayTopology> const& topology,
+    std::shared_ptr<CaptureSource> const& captureSource,
+    std::shared_ptr<ToneMapper> const& toneMapper,
+    std::shared_ptr<ThreadPool> const& threadPool,
+    ImageEncoderSettings const& encoderSettings,
+    std::wstring const& pipeName)
+{
+    // Copy everything we need, the caller's references
+    // may not survive our coroutine.
+    auto d3dDevice = device;
+    auto displayTopology = topology;
+    auto source = captureSource;
+    auto hdrToneMapper = toneMapper;
+    auto pool = threadPool;
+    auto settings = encoderSettings;
+    auto pipePath = GetServicePipePath(pipeName);
+    std::map<ImageFormat, std::shared_ptr<ImageEncoder>> encoders;
+
+    // Everything below blocks on the pipe.
+    co_await winrt::resume_background();
+
+    // One instance, reused for every client. Clients that show up while
+    // we're busy get ERROR_PIPE_BUSY and wait for it. Overlapped, so a
+    // client that stops talking can be dropped.
+    wil::unique_hfile pipe(CreateNamedPipeW(
+        pipePath.c_str(),
+        PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED,
+        PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+        1,
+        64 * 1024,
+        64 * 1024,
+        0,
+        nullptr));
+    if (!pipe)
+    {
+        winrt::throw_last_error();
+    }
+    wprintf(L"Listening on %s...\n", pipePath.c_str());
+
+    auto running = true;
+    while (running)
+    {
+        ConnectServiceClient(pipe.get());
+
+        auto start = std::chrono::steady_clock::now();
+        ServiceResponse response = {};
+        try
+        {
+            auto request = ReadServiceRequest(pipe.get(), ServiceClientTimeout);
+            if (request.Command == ServiceCommand::Stop)
+            {
+                running = false;
+            }
+            else
+            {
+                auto format = request.Format.value_or(Options::Format());
+                auto search = encoders.find(format);
+                if (search == encoders.end())
+                {
+                    search = encoders.insert({ format, CreateImageEncoder(format, Options::KeepHDR(), pool, settings) }).first;
+                }
+                auto encoder = search->second;
+
+                // Only asks the OS again if the displays changed.
+                auto displays = displayTopology->Displays();
+                auto& texturePool = *hdrToneMapper->Pool();
+                auto composedTexture = co_await ComposeSnapshotsAsync(d3dDevice, displays, source, hdrToneMapper, request.Region);
+                auto recycle = wil::scope_exit([&]() { texturePool.Recycle(composedTexture); });
+                D3D11_TEXTURE2D_DESC desc = {};
+                composedTexture->GetDesc(&desc);
+                response.Width = desc.Width;
+                response.Height = desc.Height;
+                if (request.OutputPath.empty())
+                {
+                    response.Bytes = EncodeTexture(composedTexture, encoder, texturePool);
+                }
+                else
+                {
+                    SaveTextureToFile(composedTexture, request.OutputPath, encoder, texturePool, Options::FileMode());
+                }
+            }
+        }
+        catch (...)
+        {
+            // Whatever went wrong, only this request fails.
+            response.Result = winrt::to_hresult();
+            auto message = winrt::to_string(winrt::to_message());
+            response.Bytes = std::vector<uint8_t>(message.begin(), message.end());
+        }
+
+        // A client that went away shouldn't take the service down with it.
+        try
+        {
+            WriteServiceResponse(pipe.get(), response, ServiceClientTimeout);
+            WaitForServiceClientToClose(pipe.get(), ServiceClientTimeout);
+        }
+        catch (winrt::hresult_error const& error)
+        {
+            wprintf(L"Couldn't send response: 0x%08x - %s\n", error.code().value, error.message().c_str());
+        }
+        DisconnectNamedPipe(pipe.get());
+
+        auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+        if (response.Result >= 0)
+        {
+            wprintf(L"Served %ux%u in %.1f ms\n", response.Width, response.Height, elapsed.count());
+        }
+        else
+        {
+            wprintf(L"Request failed: 0x%08x\n", response.Result.value);
+        }
+    }
+    wprintf(L"Stopping...\n");
+}
+
+ServiceResponse SendServiceRequest(std::wstring const& pipeName, ServiceRequest const& request)
+{
+    auto pipePath = GetServicePipePath(pipeName);
+    wil::unique_hfile pipe;
+    while (true)
+    {
+        pipe.reset(CreateFileW(pipePath.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, 0, nullptr));
+        if (pipe)
+        {
+            break;
+        }
+        auto error = GetLastError();
+        if (error == ERROR_FILE_NOT_FOUND)
+        {
+            throw winrt::hresult_error(HRESULT_FROM_WIN32(error), L"The service isn't running!");
+        }
+        if (error != ERROR_PIPE_BUSY)
+        {
+            winrt::throw_hresult(HRESULT_FROM_WIN32(error));
+        }
+        winrt::check_bool(WaitNamedPipeW(pipePath.c_str(), NMPWAIT_WAIT_FOREVER));
+    }
+
+    WriteServiceRequest(pipe.get(), request);
+    return ReadServiceResponse(pipe.get());
+}
@@ -0,0 +1,22 @@
+#pragma once
+#include "Compose.h"
+#include "DisplayTopology.h"
+#include "ImageFormats.h"
+#include "ServiceProtocol.h"
+
+// Takes screenshots for clients of a named pipe, one request at a time,
+// until one of them asks it to stop. The D3D device, tone mapper, capture
+// sessions, display topology and encoders stay around between requests, so
+// each one only pays for the capture itself.
+winrt::Windows::Foundation::IAsyncAction RunScreenshotServiceAsync(
+    winrt::Windows::Graphics::DirectX::Direct3D11::IDirect3DDevice const& device,
+    std::shared_ptr<DisplayTopology> const& topology,
+    std::shared_ptr<CaptureSource> const& captureSource,
+    std::shared_ptr<ToneMapper> const& toneMapper,
+    std::shared_ptr<ThreadPool> const& threadPool,
+    ImageEncoderSettings const& encoderSettings,
+    std::wstring const& pipeName);
+
+// Sends one request to a running service and waits for the response,
+// waiting for our turn if the service is busy with another client.
+ServiceResponse SendServiceRequest(std::wstring const& pipeName, ServiceRequest const& request);
@@ -0,0 +1,275 @@
+#include "pch.h"
+#include "SelfTest.h"
+#include "CpuFeatures.h"
+#include "CpuToneMapper.h"
+#include "ToneMapLut.h"
+#include "ScRgb.h"
+#include "Resampler.h"
+#include "PixelConversion.h"
+#include "TileHash.h"
+#include "HalfFloat.h"
+
+// Covers rows shorter than one vector, one pixel either side of every
+// vector width up to AVX-512, and a long row with a tail.
+constexpr uint32_t TestWidths[] = { 1, 2, 3, 4, 5, 7, 8, 9, 15, 16, 17, 31, 32, 33, 63, 64, 65, 127, 1021 };
+// Written past every output, nothing may touch it.
+constexpr size_t GuardSize = 64;
+constexpr uint8_t GuardByte = 0xcd;
+
+struct TestResults
+{
+    uint32_t Passed = 0;
+    uint32_t Failed = 0;
+};
+
+std::vector<uint8_t> CreateOutput(size_t size)
+{
+    return std::vector<uint8_t>(size + GuardSize, GuardByte);
+}
+
+std::vector<uint8_t> CreateBgraPixels(std::mt19937& random, size_t pixelCount)
+{
+    std::vector<uint8_t> pixels(pixelCount * 4);
+    for (auto& value : pixels)
+    {
+        value = static_cast<uint8_t>(random());
+    }
+    return pixels;
+}
+
+// Half of the values are in the range screenshots actually have, the rest
+// are any finite half, negative, denormal or huge.
+std::vector<uint16_t> CreateHalfPixels(std::mt19937& random, size_t pixelCount)
+{
+    std::uniform_real_distribution<float> typical(0.0f, 16.0f);
+    std::vector<uint16_t> pixels(pixelCount * 4);
+    for (auto& value : pixels)
+    {
+        auto bits = static_cast<uint16_t>(random());
+        if (bits & 1)
+        {
+            value = FloatToHalf(typical(random));
+        }
+        else
+        {
+            // An all ones exponent is infinity or NaN.
+            value = (bits & 0x7c00) == 0x7c00 ? static_cast<uint16_t>(bits & ~0x4000) : bits;
+        }
+    }
+    return pixels;
+}
+
+void CheckBytes(TestResults& results, wchar_t const* name, uint32_t width, std::vector<uint8_t> const& expected, std::vector<uint8_t> const& actual)
+{
+    auto mismatch = std::mismatch(expected.begin(), expected.end(), actual.begin());
+    if (mismatch.first == expected.end())
+    {
+        results.Passed++;
+        return;
+    }
+    results.Failed++;
+    auto offset = static_cast<size_t>(mismatch.first - expected.begin());
+    wprintf(L"  %s, width %u: byte %zu is %u instead of %u%s\n",
+        name,
+        width,
+        offset,
+        static_cast<uint32_t>(*mismatch.second),
+        static_cast<uint32_t>(*mismatch.first),
+        offset >= expected.size() - GuardSize ? L", written past the row" : L"");
+}
+
+void PrintSkipped(wchar_t const* name, wchar_t const* reason)
+{
+    wprintf(L"  %s skipped, %s\n", name, reason);
+}
+
+void TestToneMapper(TestResults& results, std::mt19937& random)
+{
+    auto&& features = CpuFeatures::Get();
+    if (!features.AVX2 || !features.F16C)
+    {
+        PrintSkipped(L"tone mapper", L"no AVX2 or F16C");
+        return;
+    }
+
+    // Tone mapped, and scaled for content that fits under SDR white.
+    CpuToneMapper::Params const curves[] = {
+        CpuToneMapper::ComputeParams(240.0f, 1000.0f),
+        CpuToneMapper::ComputeParams(80.0f, 1600.0f) };
+    auto scale = CpuToneMapper::ComputeParams(240.0f, 200.0f);
+    for (auto width : TestWidths)
+    {
+        auto hdrRow = CreateHalfPixels(random, width);
+        for (auto&& params : curves)
+        {
+            auto expected = CreateOutput(static_cast<size_t>(width) * 4);
+            auto actual = expected;
+            CpuToneMapper::ProcessRow(hdrRow.data(), expected.data(), width, params, false);
+            CpuToneMapper::ProcessRow(hdrRow.data(), actual.data(), width, params, true);
+            CheckBytes(results, L"tone mapper", width, expected, actual);
+        }
+
+        auto expected = CreateOutput(static_cast<size_t>(width) * 4);
+        auto actual = expected;
+        CpuToneMapper::ScaleRow(hdrRow.data(), expected.data(), width, scale, false);
+        CpuToneMapper::ScaleRow(hdrRow.data(), actual.data(), width, scale, true);
+        CheckBytes(results, L"tone mapper scale", width, expected, actual);
+    }
+
+    auto lut = ToneMapLut::Get(240.0f, 1000.0f);
+    for (auto width : TestWidths)
+    {
+        auto hdrRow = CreateHalfPixels(random, width);
+        auto expected = CreateOutput(static_cast<size_t>(width) * 4);
+        auto actual = expected;
+        lut->ProcessRow(hdrRow.data(), expected.data(), width, false);
+        lut->ProcessRow(hdrRow.data(), actual.data(), width, true);
+        CheckBytes(results, L"tone map lut", width, expected, actual);
+    }
+}
+
+void TestScRgbToPq(TestResults& results, std::mt19937& random)
+{
+    auto&& features = CpuFeatures::Get();
+    if (!features.AVX || !features.F16C)
+    {
+        PrintSkipped(L"scRGB to PQ", L"no AVX or F16C");
+        return;
+    }
+
+    for (auto width : TestWidths)
+    {
+        auto hdrRow = CreateHalfPixels(random, width);
+        auto expected = CreateOutput(static_cast<size_t>(width) * 6);
+        auto actual = expected;
+        ConvertScRgbRowToPq(hdrRow.data(), expected.data(), width, false);
+        ConvertScRgbRowToPq(hdrRow.data(), actual.data(), width, true);
+        CheckBytes(results, L"scRGB to PQ", width, expected, actual);
+    }
+}
+
+void TestResampler(TestResults& results, std::mt19937& random)
+{
+    auto threadPool = std::make_shared<ThreadPool>();
+    auto bufferPool = std::make_shared<PixelBufferPool>(64ull * 1024 * 1024);
+    Resampler scalar(threadPool, bufferPool, false);
+    Resampler simd(threadPool, bufferPool, true);
+    if (!simd.UsesSimd())
+    {
+        PrintSkipped(L"resampler", L"no AVX2 or SSE4.1");
+        return;
+    }
+
+    // Downscales and upscales, each axis on its own.
+    struct ResizeCase
+    {
+        uint32_t SourceWidth;
+        uint32_t SourceHeight;
+        uint32_t Width;
+        uint32_t Height;
+    };
+    ResizeCase const cases[] = {
+        { 1021, 37, 333, 13 },
+        { 37, 23, 19, 41 },
+        { 101, 7, 33, 5 },
+        { 7, 9, 1, 1 },
+        { 3, 2, 17, 5 },
+        { 64, 64, 65, 63 } };
+    for (auto&& resize : cases)
+    {
+        auto source = CreateBgraPixels(random, static_cast<size_t>(resize.SourceWidth) * resize.SourceHeight);
+        for (auto filter : { ResampleFilter::Box, ResampleFilter::Bilinear, ResampleFilter::Lanczos })
+        {
+            auto stride = resize.Width * 4;
+            auto expected = CreateOutput(static_cast<size_t>(stride) * resize.Height);
+            auto actual = expected;
+            scalar.Resize(source.data(), resize.SourceWidth * 4, resize.SourceWidth, resize.SourceHeight, expected.data(), stride, resize.Width, resize.Height, filter);
+            simd.Resize(source.data(), resize.SourceWidth * 4, resize.SourceWidth, resize.SourceHeight, actual.data(), stride, resize.Width, resize.Height, filter);
+            CheckBytes(results, L"resampler", resize.Width, expected, actual);
+        }
+    }
+}
+
+void TestPixelConversions(TestResults& results, std::mt19937& random)
+{
+    struct ConversionCase
+    {
+        RowConversion Conversion;
+        uint32_t BytesPerPixel;
+        wchar_t const* Name;
+    };
+    ConversionCase const conversions[] = {
+        { RowConversion::BgraToRgb, 3, L"bgra to rgb" },
+        { RowConversion::BgraToBgr, 3, L"bgra to bgr" },
+        { RowConversion::BgraToRgba, 4, L"bgra to rgba" },
+        { RowConversion::BgraToGray, 1, L"bgra to gray" } };
+    auto tested = false;
+    for (auto path : { PixelConversionPath::Ssse3, PixelConversionPath::Avx2, PixelConversionPath::Avx512 })
+    {
+        if (!IsPixelConversionPathSupported(path))
+        {
+            continue;
+        }
+        tested = true;
+        for (auto width : TestWidths)
+        {
+            auto source = CreateBgraPixels(random, width);
+            for (auto&& conversion : conversions)
+            {
+                auto expected = CreateOutput(static_cast<size_t>(width) * conversion.BytesPerPixel);
+                auto actual = expected;
+                ConvertRowWithPath(PixelConversionPath::Scalar, conversion.Conversion, source.data(), expected.data(), width);
+                ConvertRowWithPath(path, conversion.Conversion, source.data(), actual.data(), width);
+                CheckBytes(results, conversion.Name, width, expected, actual);
+            }
+        }
+    }
+    if (!tested)
+    {
+        PrintSkipped(L"pixel conversions", L"no SSSE3");
+    }
+}
+
+void TestTileHash(TestResults& results, std::mt19937& random)
+{
+    // Every row size up to a few vectors, including the ones that aren't a
+    // whole number of pixels, with a stride that isn't the row size.
+    for (uint32_t rowSize = 1; rowSize <= 80; rowSize++)
+    {
+        for (uint32_t rowCount = 1; rowCount <= 3; rowCount++)
+        {
+            auto stride = rowSize + 5;
+            auto pixels = CreateBgraPixels(random, static_cast<size_t>(stride) * rowCount);
+            auto expected = HashPixelsScalar(pixels.data(), stride, rowSize, rowCount);
+            auto actual = HashPixels(pixels.data(), stride, rowSize, rowCount);
+            if (expected == actual)
+            {
+                results.Passed++;
+            }
+            else
+            {
+                results.Failed++;
+                wprintf(L"  tile hash, %u bytes by %u rows: 0x%016llx instead of 0x%016llx\n",
+                    rowSize,
+                    rowCount,
+                    static_cast<unsigned long long>(actual),
+                    static_cast<unsigned long long>(expected));
+            }
+        }
+    }
+}
+
+bool RunSelfTest()
+{
+    wprintf(L"Checking SIMD paths against scalar:\n");
+    // Seeded, so a failure can be reproduced.
+    std::mt19937 random(1);
+    TestResults results;
+    TestToneMapper(results, random);
+    TestScRgbToPq(results, random);
+    TestResampler(results, random);
+    TestPixelConversions(results, random);
+    TestTileHash(results, random);
+    wprintf(L"  %u passed, %u failed\n", results.Passed, results.Failed);
+    return results.Failed == 0;
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+// Checks every SIMD path this CPU supports against its scalar reference.
+// Rows are odd widths with short tails, and the bytes past every output row
+// have to be left alone. Prints each mismatch and returns whether
+// everything matched.
+bool RunSelfTest();
@@ -0,0 +1,234 @@
+#include "pch.h"
+#include "ServiceProtocol.h"
+#include "ImageFormats.h"
+
+using PipeDeadline = std::optional<std::chrono::steady_clock::time_point>;
+
+// Finishes a ReadFile or WriteFile that was given an OVERLAPPED. The
+// service's end of the pipe is overlapped so it can give up on a client,
+// the client's end isn't and has already finished by the time we get here.
+DWORD CompletePipeIo(HANDLE pipe, OVERLAPPED& overlapped, bool finished, PipeDeadline const& deadline)
+{
+    if (!finished)
+    {
+        auto error = GetLastError();
+        if (error != ERROR_IO_PENDING)
+        {
+            winrt::throw_hresult(HRESULT_FROM_WIN32(error));
+        }
+
+        DWORD timeout = INFINITE;
+        if (deadline.has_value())
+        {
+            auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline.value() - std::chrono::steady_clock::now());
+            timeout = static_cast<DWORD>(std::max<int64_t>(remaining.count(), 0));
+        }
+        if (WaitForSingleObject(overlapped.hEvent, timeout) == WAIT_TIMEOUT)
+        {
+            // The buffer has to outlive the I/O, so wait for the cancel.
+            CancelIoEx(pipe, &overlapped);
+            DWORD transferred = 0;
+            GetOverlappedResult(pipe, &overlapped, &transferred, TRUE);
+            throw winrt::hresult_error(HRESULT_FROM_WIN32(ERROR_TIMEOUT), L"The other end of the pipe stopped responding!");
+        }
+    }
+
+    DWORD transferred = 0;
+    winrt::check_bool(GetOverlappedResult(pipe, &overlapped, &transferred, FALSE));
+    return transferred;
+}
+
+// With a chunk timeout, every MB has to go through within it.
+void WritePipe(HANDLE pipe, void const* data, size_t size, std::optional<std::chrono::milliseconds> chunkTimeout = std::nullopt)
+{
+    wil::unique_event completed(wil::EventOptions::ManualReset);
+    auto bytes = static_cast<uint8_t const*>(data);
+    while (size > 0)
+    {
+        PipeDeadline deadline;
+        if (chunkTimeout.has_value())
+        {
+            deadline = std::chrono::steady_clock::now() + chunkTimeout.value();
+        }
+        auto chunkSize = static_cast<DWORD>(std::min<size_t>(size, 1024 * 1024));
+        OVERLAPPED overlapped = {};
+        overlapped.hEvent = completed.get();
+        auto finished = WriteFile(pipe, bytes, chunkSize, nullptr, &overlapped) != FALSE;
+        auto written = CompletePipeIo(pipe, overlapped, finished, deadline);
+        bytes += written;
+        size -= written;
+    }
+}
+
+// With a deadline, everything has to be read by then.
+void ReadPipe(HANDLE pipe, void* data, size_t size, PipeDeadline const& deadline = std::nullopt)
+{
+    wil::unique_event completed(wil::EventOptions::ManualReset);
+    auto bytes = static_cast<uint8_t*>(data);
+    while (size > 0)
+    {
+        auto chunkSize = static_cast<DWORD>(std::min<size_t>(size, 1024 * 1024));
+        OVERLAPPED overlapped = {};
+        overlapped.hEvent = completed.get();
+        auto finished = ReadFile(pipe, bytes, chunkSize, nullptr, &overlapped) != FALSE;
+        auto read = CompletePipeIo(pipe, overlapped, finished, deadline);
+        if (read == 0)
+        {
+            winrt::throw_hresult(HRESULT_FROM_WIN32(ERROR_BROKEN_PIPE));
+        }
+        bytes += read;
+        size -= read;
+    }
+}
+
+std::wstring GetServicePipePath(std::wstring const& name)
+{
+    return L"\\\\.\\pipe\\" + name;
+}
+
+void WriteServiceRequest(HANDLE pipe, ServiceRequest const& request)
+{
+    std::string text;
+    text += request.Command == ServiceCommand::Stop ? "command=stop\n" : "command=screenshot\n";
+    if (request.Region.has_value())
+    {
+        auto& region = request.Region.value();
+        char line[128] = {};
+        sprintf_s(line, "rect=%ld,%ld,%ld,%ld\n", region.left, region.top, region.right - region.left, region.bottom - region.top);
+        text += line;
+    }
+    if (request.Format.has_value())
+    {
+        text += "format=" + winrt::to_string(GetImageFormatInfo(request.Format.value()).Name) + "\n";
+    }
+    if (!request.OutputPath.empty())
+    {
+        text += "output=" + winrt::to_string(request.OutputPath) + "\n";
+    }
+
+    ServiceRequestHeader header = {};
+    header.Size = static_cast<uint32_t>(text.size());
+    WritePipe(pipe, &header, sizeof(header));
+    WritePipe(pipe, text.data(), text.size());
+}
+
+ServiceRequest ReadServiceRequest(HANDLE pipe, std::chrono::milliseconds timeout)
+{
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    ServiceRequestHeader header = {};
+    ReadPipe(pipe, &header, sizeof(header), deadline);
+    if (header.Magic != ServiceRequestMagic || header.Size > MaxServiceRequestSize)
+    {
+        throw winrt::hresult_invalid_argument(L"Malformed request!");
+    }
+    std::string text(header.Size, '\0');
+    ReadPipe(pipe, text.data(), text.size(), deadline);
+
+    ServiceRequest request = {};
+    std::istringstream stream(text);
+    std::string line;
+    while (std::getline(stream, line))
+    {
+        if (line.empty())
+        {
+            continue;
+        }
+        auto separator = line.find('=');
+        if (separator == std::string::npos)
+        {
+            throw winrt::hresult_invalid_argument(L"Request lines need to look like key=value!");
+        }
+        auto key = line.substr(0, separator);
+        auto value = line.substr(separator + 1);
+        if (key == "command")
+        {
+            if (value == "stop")
+            {
+                request.Command = ServiceCommand::Stop;
+            }
+            else if (value != "screenshot")
+            {
+                throw winrt::hresult_invalid_argument(L"Unknown command!");
+            }
+        }
+        else if (key == "rect")
+        {
+            long x = 0;
+            long y = 0;
+            long width = 0;
+            long height = 0;
+            if (sscanf_s(value.c_str(), "%ld,%ld,%ld,%ld", &x, &y, &width, &height) != 4 || width <= 0 || height <= 0)
+            {
+                throw winrt::hresult_invalid_argument(L"Invalid rect!");
+            }
+            request.Region = RECT{ x, y, x + width, y + height };
+        }
+        else if (key == "format")
+        {
+            request.Format = ParseImageFormat(std::wstring(winrt::to_hstring(value)));
+            if (!request.Format.has_value())
+            {
+                throw winrt::hresult_invalid_argument(L"Unknown format!");
+            }
+        }
+        else if (key == "output")
+        {
+            std::filesystem::path path(std::wstring(winrt::to_hstring(value)));
+            auto escapes = path.empty() || path.has_root_path() ||
+                std::any_of(path.begin(), path.end(), [](auto&& part) { return part == L".."; });
+            if (escapes)
+            {
+                throw winrt::hresult_invalid_argument(L"Output must be a relative path under the service's -outDir!");
+            }
+            request.OutputPath = path.wstring();
+        }
+        else
+        {
+            throw winrt::hresult_invalid_argument(L"Unknown request key!");
+        }
+    }
+    return request;
+}
+
+void WriteServiceResponse(HANDLE pipe, ServiceResponse const& response, std::chrono::milliseconds timeout)
+{
+    ServiceResponseHeader header = {};
+    header.Result = response.Result;
+    header.Width = response.Width;
+    header.Height = response.Height;
+    header.Size = response.Bytes.size();
+    WritePipe(pipe, &header, sizeof(header), timeout);
+    WritePipe(pipe, response.Bytes.data(), response.Bytes.size(), timeout);
+}
+
+void WaitForServiceClientToClose(HANDLE pipe, std::chrono::milliseconds timeout)
+{
+    // Clients never send anything after their request, so this read only
+    // ends when they close their end.
+    uint8_t unused = 0;
+    try
+    {
+        ReadPipe(pipe, &unused, sizeof(unused), std::chrono::steady_clock::now() + timeout);
+    }
+    catch (winrt::hresult_error const&)
+    {
+    }
+}
+
+ServiceResponse ReadServiceResponse(HANDLE pipe)
+{
+    ServiceResponseHeader header = {};
+    ReadPipe(pipe, &header, sizeof(header));
+    if (header.Magic != ServiceResponseMagic)
+    {
+        throw winrt::hresult_invalid_argument(L"Malformed response!");
+    }
+
+    ServiceResponse response = {};
+    response.Result = header.Result;
+    response.Width = header.Width;
+    response.Height = header.Height;
+    response.Bytes.resize(static_cast<size_t>(header.Size));
+    ReadPipe(pipe, response.Bytes.data(), response.Bytes.size());
+    return response;
+}
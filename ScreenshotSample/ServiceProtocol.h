@@ -0,0 +1,84 @@
+#pragma once
+#include "ImageEncoder.h"
+
+// What goes over the -serve named pipe. A client connects, sends one
+// request, reads one response and disconnects.
+//
+// Requests are a ServiceRequestHeader followed by UTF-8 "key=value" lines:
+//   command=screenshot|stop   Defaults to screenshot.
+//   rect=x,y,width,height     Only capture this part of the desktop.
+//   format=<name>             One of the -format names. Defaults to the
+//                             service's -format.
+//   output=<name>             File name to write, under the service's
+//                             -outDir. Absolute paths and .. are refused so
+//                             a client can't write anywhere else. If left
+//                             out, the file comes back in the response.
+//
+// The pipe rejects remote clients, so only programs on this machine can
+// send requests.
+//
+// Responses are a ServiceResponseHeader followed by Size bytes: the file if
+// it was asked for, or a UTF-8 error message if Result is a failure.
+// "SSRQ" and "SSRS" read as big-endian ASCII.
+constexpr uint32_t ServiceRequestMagic = 0x53535251;
+constexpr uint32_t ServiceResponseMagic = 0x53535253;
+// Requests are a few lines, anything bigger is garbage.
+constexpr uint32_t MaxServiceRequestSize = 64 * 1024;
+// The service only has one pipe instance. A client that takes longer than
+// this to send its request, or stops reading the response, is dropped so
+// it can't keep everyone else waiting.
+constexpr std::chrono::milliseconds ServiceClientTimeout{ 5000 };
+
+struct ServiceRequestHeader
+{
+    uint32_t Magic = ServiceRequestMagic;
+    uint32_t Size = 0;
+};
+
+struct ServiceResponseHeader
+{
+    uint32_t Magic = ServiceResponseMagic;
+    int32_t Result = 0;
+    uint32_t Width = 0;
+    uint32_t Height = 0;
+    uint64_t Size = 0;
+};
+
+enum class ServiceCommand
+{
+    Screenshot,
+    // Shut the service down
+    Stop,
+};
+
+struct ServiceRequest
+{
+    ServiceCommand Command = ServiceCommand::Screenshot;
+    std::optional<RECT> Region;
+    std::optional<ImageFormat> Format;
+    std::wstring OutputPath;
+};
+
+struct ServiceResponse
+{
+    winrt::hresult Result;
+    uint32_t Width = 0;
+    uint32_t Height = 0;
+    // The file, or the error message on failure.
+    std::vector<uint8_t> Bytes;
+};
+
+// \\.\pipe\<name>
+std::wstring GetServicePipePath(std::wstring const& name);
+
+// These block until the whole message has gone through, and throw if the
+// pipe breaks or the message is malformed. The service's end of the pipe is
+// overlapped, and its side gives up after a timeout: the whole request has
+// to arrive within it, and each MB of the response has to be read within it.
+void WriteServiceRequest(HANDLE pipe, ServiceRequest const& request);
+ServiceRequest ReadServiceRequest(HANDLE pipe, std::chrono::milliseconds timeout);
+void WriteServiceResponse(HANDLE pipe, ServiceResponse const& response, std::chrono::milliseconds timeout);
+ServiceResponse ReadServiceResponse(HANDLE pipe);
+// Waits for the client to read the whole response and close its end, so
+// disconnecting doesn't throw away what it hasn't read yet.
+void WaitForServiceClientToClose(HANDLE pipe, std::chrono::milliseconds timeout);
@@ -1,33 +1,17 @@
 #include "pch.h"
 #include "Snapshot.h"
+#include "Trace.h"
 #include "Options.h"
 
 namespace winrt
 {
     using namespace Windows::Foundation;
-    using namespace Windows::Graphics::Capture;
     using namespace Windows::Graphics::DirectX;
-    using namespace Windows::Graphics::DirectX::Direct3D11;
 }
 
-namespace util
-{
-    using namespace robmikh::common::desktop;
-    using namespace robmikh::common::uwp;
-}
-
-wil::task<Snapshot> Snapshot::TakeAsync(
-    winrt::IDirect3DDevice const& device, 
-    Display const& display,
-    std::shared_ptr<ToneMapper> const& toneMapper)
+CaptureParameters CaptureParameters::ForDisplay(Display const& display)
 {
-    auto d3dDevice = GetDXGIInterfaceFromObject<ID3D11Device>(device);
-    winrt::com_ptr<ID3D11DeviceContext> d3dContext;
-    d3dDevice->GetImmediateContext(d3dContext.put());
-
     // Get the information we need from the display
-    auto displayHandle = display.Handle();
-    auto displayRect = display.Rect();
     auto isHDR = display.IsHDR();
     auto sdrWhiteLevel = display.SDRWhiteLevelInNits();
     auto maxLuminance = display.MaxLuminance();
@@ -45,52 +29,96 @@ wil::task<Snapshot> Snapshot::TakeAsync(
         sdrWhiteLevel = 0.0f;
     }
 
-    // Grab a reference to the tone mapper so that it
-    // survives the comming coroutines.
-    auto hdrToneMapper = toneMapper;
-
     // HDR captures use an FP16 pixel format, SDR uses BGRA8
-    auto capturePixelFormat = isHDR ? winrt::DirectXPixelFormat::R16G16B16A16Float : winrt::DirectXPixelFormat::B8G8R8A8UIntNormalized;
-
-    // Setup our capture objects. If you want, this is where you 
-    // should adjust any properties of the GraphicsCaptureSession
-    // (e.g. IsCursorCaptureEnabled, IsBorderRequired).
-    // The CreateCaptureItemForMonitor helper can be found here: https://github.com/robmikh/robmikh.common/blob/f2311df8de56f31410d14f55de7307464d9a673d/robmikh.common/include/robmikh.common/capture.desktop.interop.h#L16-L23
-    auto item = util::CreateCaptureItemForMonitor(displayHandle);
-    auto framePool = winrt::Direct3D11CaptureFramePool::CreateFreeThreaded(
-        device,
-        capturePixelFormat,
-        1,
-        item.Size());
-    auto session = framePool.CreateCaptureSession(item);
-
-    // Get one frame and then end the capture.
-    winrt::com_ptr<ID3D11Texture2D> captureTexture;
-    wil::shared_event captureEvent(wil::EventOptions::ManualReset);
-    framePool.FrameArrived([session, d3dDevice, d3dContext, captureEvent, &captureTexture](auto&& framePool, auto&&) -> void
-        {
-            auto frame = framePool.TryGetNextFrame();
-            auto surface = frame.Surface();
-            auto frameTexture = GetDXGIInterfaceFromObject<ID3D11Texture2D>(surface);
+    auto pixelFormat = isHDR ? winrt::DirectXPixelFormat::R16G16B16A16Float : winrt::DirectXPixelFormat::B8G8R8A8UIntNormalized;
 
-            framePool.Close();
-            session.Close();
+    return CaptureParameters{ isHDR, sdrWhiteLevel, maxLuminance, pixelFormat };
+}
 
-            captureTexture.copy_from(frameTexture.get());
-            captureEvent.SetEvent();
-        });
-    session.StartCapture();
+namespace util
+{
+    using namespace robmikh::common::uwp;
+}
 
-    // Wait for the next frame to show up.
-    co_await winrt::resume_on_signal(captureEvent.get());
+// Copies part of a texture into a texture of its own.
+winrt::com_ptr<ID3D11Texture2D> CropTexture(TexturePool& texturePool, winrt::com_ptr<ID3D11Texture2D> const& texture, D3D11_BOX const& box)
+{
+    TraceScope trace("CropTexture");
+    winrt::com_ptr<ID3D11Device> d3dDevice;
+    texture->GetDevice(d3dDevice.put());
+    winrt::com_ptr<ID3D11DeviceContext> d3dContext;
+    d3dDevice->GetImmediateContext(d3dContext.put());
+
+    D3D11_TEXTURE2D_DESC desc = {};
+    texture->GetDesc(&desc);
+    desc.Width = box.right - box.left;
+    desc.Height = box.bottom - box.top;
+    desc.MipLevels = 1;
+    desc.ArraySize = 1;
+    desc.Usage = D3D11_USAGE_DEFAULT;
+    desc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_RENDER_TARGET;
+    desc.CPUAccessFlags = 0;
+    desc.MiscFlags = 0;
+    auto croppedTexture = texturePool.Acquire(desc);
+
+    auto multithreadLock = util::D3D11DeviceLock(d3dDevice.as<ID3D11Multithread>().get());
+    d3dContext->CopySubresourceRegion(croppedTexture.get(), 0, 0, 0, 0, texture.get(), 0, &box);
+    return croppedTexture;
+}
+
+wil::task<Snapshot> Snapshot::TakeAsync(
+    Display const& display,
+    std::shared_ptr<CaptureSource> const& captureSource,
+    std::shared_ptr<ToneMapper> const& toneMapper,
+    std::optional<RECT> cropRect)
+{
+    auto displayRect = display.Rect();
+    auto displayHandle = display.Handle();
+    auto parameters = CaptureParameters::ForDisplay(display);
+
+    // Grab a reference to the capture source and tone mapper
+    // so that they survive the comming coroutines.
+    auto source = captureSource;
+    auto hdrToneMapper = toneMapper;
+
+    // Wait for the frame to show up.
+    auto captureTexture = co_await source->CaptureAsync(display, parameters.PixelFormat);
+
+    // Throw away what we don't need before doing any work on it.
+    if (cropRect.has_value() && !EqualRect(&cropRect.value(), &displayRect))
+    {
+        auto& crop = cropRect.value();
+        D3D11_BOX box = {};
+        box.left = static_cast<uint32_t>(crop.left - displayRect.left);
+        box.top = static_cast<uint32_t>(crop.top - displayRect.top);
+        box.right = static_cast<uint32_t>(crop.right - displayRect.left);
+        box.bottom = static_cast<uint32_t>(crop.bottom - displayRect.top);
+        box.back = 1;
+        captureTexture = CropTexture(*hdrToneMapper->Pool(), captureTexture, box);
+        displayRect = crop;
+    }
 
     // The caller is expecting a BGRA8 texture. If we captured in HDR,
-    // tone map the texture and give the result back.
+    // tone map the texture and give the result back. With -keepHDR it's
+    // the other way around, everything ends up as FP16 scRGB.
     winrt::com_ptr<ID3D11Texture2D> resultTexture;
-    if (isHDR)
+    if (Options::KeepHDR())
+    {
+        if (parameters.IsHDR)
+        {
+            resultTexture.copy_from(captureTexture.get());
+        }
+        else
+        {
+            TraceScope trace("ExpandSdrTexture", displayHandle);
+            resultTexture.copy_from(hdrToneMapper->ExpandSdrTexture(captureTexture).get());
+        }
+    }
+    else if (parameters.IsHDR)
     {
         // Tonemap the texture
-        resultTexture.copy_from(hdrToneMapper->ProcessTexture(captureTexture, sdrWhiteLevel, maxLuminance).get());
+        TraceScope trace("ToneMapTexture", displayHandle);
+        resultTexture.copy_from(hdrToneMapper->ProcessTexture(captureTexture, parameters.SDRWhiteLevelInNits, parameters.MaxLuminance).get());
     }
     else
     {
@@ -98,5 +126,11 @@ wil::task<Snapshot> Snapshot::TakeAsync(
         resultTexture.copy_from(captureTexture.get());
     }
 
+    // Our crop of the capture isn't needed once it's been converted.
+    if (resultTexture.get() != captureTexture.get())
+    {
+        hdrToneMapper->Pool()->Recycle(captureTexture);
+    }
+
     co_return Snapshot{ resultTexture, displayRect };
 }
@@ -1,14 +1,32 @@
 #pragma once
 #include "Display.h"
 #include "ToneMapper.h"
+#include "CaptureSource.h"
 
+// How a display gets captured, after applying the debug options.
+struct CaptureParameters
+{
+    static CaptureParameters ForDisplay(Display const& display);
+
+    bool IsHDR = false;
+    float SDRWhiteLevelInNits = 0.0f;
+    float MaxLuminance = 0.0f;
+    winrt::Windows::Graphics::DirectX::DirectXPixelFormat PixelFormat = winrt::Windows::Graphics::DirectX::DirectXPixelFormat::B8G8R8A8UIntNormalized;
+};
+
+// A display's capture, BGRA8 or, with -keepHDR, FP16 scRGB.
 struct Snapshot
 {
+    // With a crop rect, in desktop coordinates, only that part of the display
+    // is kept, and it's cut out before tone mapping.
     static wil::task<Snapshot> TakeAsync(
-        winrt::Windows::Graphics::DirectX::Direct3D11::IDirect3DDevice const& device,
         Display const& display,
-        std::shared_ptr<ToneMapper> const& toneMapper);
+        std::shared_ptr<CaptureSource> const& captureSource,
+        std::shared_ptr<ToneMapper> const& toneMapper,
+        std::optional<RECT> cropRect = std::nullopt);
 
     winrt::com_ptr<ID3D11Texture2D> Texture;
+    // Where the texture goes on the desktop, which is only part of the
+    // display if it was cropped.
     RECT DisplayRect = {};
 };
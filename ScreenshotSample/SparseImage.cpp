@@ -0,0 +1,115 @@
+#include "pch.h"
+#include "SparseImage.h"
+
+std::vector<uint8_t> SparseImage::EmptyRows() const
+{
+    std::vector<uint8_t> emptyRows(Height, 1);
+    for (auto&& region : Regions)
+    {
+        auto top = std::clamp<int64_t>(region.Y, 0, Height);
+        auto bottom = std::clamp<int64_t>(static_cast<int64_t>(region.Y) + region.Height, 0, Height);
+        auto left = std::clamp<int64_t>(region.X, 0, Width);
+        auto right = std::clamp<int64_t>(static_cast<int64_t>(region.X) + region.Width, 0, Width);
+        if (left >= right)
+        {
+            continue;
+        }
+        for (auto row = top; row < bottom; row++)
+        {
+            emptyRows[static_cast<size_t>(row)] = 0;
+        }
+    }
+    return emptyRows;
+}
+
+uint64_t SparseImage::CoveredPixels() const
+{
+    // Count row by row so overlapping regions aren't counted twice.
+    uint64_t coveredPixels = 0;
+    std::vector<std::pair<int64_t, int64_t>> spans;
+    for (uint32_t row = 0; row < Height; row++)
+    {
+        spans.clear();
+        for (auto&& region : Regions)
+        {
+            if (static_cast<int64_t>(row) >= region.Y && static_cast<int64_t>(row) < static_cast<int64_t>(region.Y) + region.Height)
+            {
+                auto left = std::clamp<int64_t>(region.X, 0, Width);
+                auto right = std::clamp<int64_t>(static_cast<int64_t>(region.X) + region.Width, 0, Width);
+                if (left < right)
+                {
+                    spans.push_back({ left, right });
+                }
+            }
+        }
+        std::sort(spans.begin(), spans.end());
+        int64_t coveredUntil = 0;
+        for (auto&& [left, right] : spans)
+        {
+            auto start = std::max(left, coveredUntil);
+            if (right > start)
+            {
+                coveredPixels += static_cast<uint64_t>(right - start);
+                coveredUntil = right;
+            }
+        }
+    }
+    return coveredPixels;
+}
+
+std::string EscapeJsonString(std::wstring const& value)
+{
+    std::string result;
+    for (auto character : winrt::to_string(value))
+    {
+        if (character == '"' || character == '\\')
+        {
+            result.push_back('\\');
+            result.push_back(character);
+        }
+        else if (static_cast<uint8_t>(character) < 0x20)
+        {
+            // JSON doesn't allow control characters in strings.
+            char escaped[7] = {};
+            snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<uint32_t>(character));
+            result += escaped;
+        }
+        else
+        {
+            result.push_back(character);
+        }
+    }
+    return result;
+}
+
+std::string SparseImage::CreateManifest(std::wstring const& imageFileName) const
+{
+    auto totalPixels = static_cast<uint64_t>(Width) * Height;
+    auto coveredPixels = CoveredPixels();
+
+    std::ostringstream stream;
+    stream << "{\n";
+    stream << "  \"image\": \"" << EscapeJsonString(imageFileName) << "\",\n";
+    stream << "  \"width\": " << Width << ",\n";
+    stream << "  \"height\": " << Height << ",\n";
+    stream << "  \"origin\": { \"x\": " << Origin.x << ", \"y\": " << Origin.y << " },\n";
+    char background[16] = {};
+    sprintf_s(background, "#%02x%02x%02x", Background[2], Background[1], Background[0]);
+    stream << "  \"background\": \"" << background << "\",\n";
+    stream << "  \"coveredPixels\": " << coveredPixels << ",\n";
+    stream << "  \"emptyPixels\": " << totalPixels - coveredPixels << ",\n";
+    stream << "  \"displays\": [\n";
+    for (size_t i = 0; i < Regions.size(); i++)
+    {
+        auto& region = Regions[i];
+        stream << "    { ";
+        stream << "\"x\": " << region.X << ", \"y\": " << region.Y << ", ";
+        stream << "\"width\": " << region.Width << ", \"height\": " << region.Height << ", ";
+        stream << "\"desktopX\": " << region.DisplayRect.left << ", \"desktopY\": " << region.DisplayRect.top << ", ";
+        stream << "\"hdr\": " << (region.IsHDR ? "true" : "false");
+        stream << " }" << (i + 1 < Regions.size() ? "," : "") << "\n";
+    }
+    stream << "  ]\n";
+    stream << "}\n";
+    return stream.str();
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+// A display's pixels within a SparseImage.
+struct SparseRegion
+{
+    // Where the region goes in the image.
+    int32_t X = 0;
+    int32_t Y = 0;
+    uint32_t Width = 0;
+    uint32_t Height = 0;
+    // BGRA8, Width * 4 bytes per row.
+    std::vector<uint8_t> Pixels;
+
+    // Where the display is on the desktop.
+    RECT DisplayRect = {};
+    bool IsHDR = false;
+};
+
+// A composed screenshot kept as the displays' own pixels and offsets instead
+// of one bitmap covering the union of all displays. Anything no region
+// covers is Background, so the empty parts of L-shaped or offset layouts are
+// never allocated, cleared or read back. Later regions win where they overlap.
+struct SparseImage
+{
+    uint32_t Width = 0;
+    uint32_t Height = 0;
+    // The desktop coordinates of the image's top left corner.
+    POINT Origin = {};
+    // BGRA8
+    std::array<uint8_t, 4> Background = { 0, 0, 0, 255 };
+    std::vector<SparseRegion> Regions;
+
+    // One entry per row, non zero if no region covers the row.
+    std::vector<uint8_t> EmptyRows() const;
+    uint64_t CoveredPixels() const;
+
+    // A JSON description of where each display ended up in the image.
+    std::string CreateManifest(std::wstring const& imageFileName) const;
+};
+
+// Escapes a string for the JSON manifests.
+std::string EscapeJsonString(std::wstring const& value);
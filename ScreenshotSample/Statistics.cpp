@@ -0,0 +1,56 @@
+#include "pch.h"
+#include "Statistics.h"
+
+double Statistics::Min() const
+{
+    return m_values.empty() ? 0.0 : *std::min_element(m_values.begin(), m_values.end());
+}
+
+double Statistics::Max() const
+{
+    return m_values.empty() ? 0.0 : *std::max_element(m_values.begin(), m_values.end());
+}
+
+double Statistics::Average() const
+{
+    if (m_values.empty())
+    {
+        return 0.0;
+    }
+    double total = 0.0;
+    for (auto value : m_values)
+    {
+        total += value;
+    }
+    return total / static_cast<double>(m_values.size());
+}
+
+double Statistics::Percentile(double percentile) const
+{
+    if (m_values.empty())
+    {
+        return 0.0;
+    }
+    auto sorted = m_values;
+    std::sort(sorted.begin(), sorted.end());
+    // Nearest rank
+    auto rank = static_cast<size_t>(std::ceil(percentile / 100.0 * static_cast<double>(sorted.size())));
+    return sorted[std::clamp<size_t>(rank, 1, sorted.size()) - 1];
+}
+
+double MillisecondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void PrintStatistics(wchar_t const* name, Statistics const& statistics)
+{
+    wprintf(L"  %-16s min %8.2f  avg %8.2f  p50 %8.2f  p95 %8.2f  p99 %8.2f  max %8.2f ms\n",
+        name,
+        statistics.Min(),
+        statistics.Average(),
+        statistics.Percentile(50.0),
+        statistics.Percentile(95.0),
+        statistics.Percentile(99.0),
+        statistics.Max());
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+// Collects samples (usually milliseconds) and summarizes them.
+class Statistics
+{
+public:
+    void Add(double value) { m_values.push_back(value); }
+
+    size_t Count() const { return m_values.size(); }
+    double Min() const;
+    double Max() const;
+    double Average() const;
+    // percentile is in [0, 100]
+    double Percentile(double percentile) const;
+
+private:
+    std::vector<double> m_values;
+};
+
+double MillisecondsSince(std::chrono::steady_clock::time_point start);
+
+// Prints one line of min/avg/percentiles/max, in milliseconds.
+void PrintStatistics(wchar_t const* name, Statistics const& statistics);
@@ -0,0 +1,311 @@
+#include "pch.h"
+#include "SyntheticCaptureSource.h"
+#include "HalfFloat.h"
+
+namespace winrt
+{
+    using namespace Windows::Graphics::DirectX;
+}
+
+namespace util
+{
+    using namespace robmikh::common::uwp;
+}
+
+// Default HDR values, similar to what a typical HDR monitor reports.
+constexpr float DefaultSDRWhiteLevelInNits = 240.0f;
+constexpr float DefaultMaxLuminance = 1000.0f;
+constexpr float ScRGBWhiteLevelInNits = 80.0f;
+
+struct LayoutPreset
+{
+    std::wstring Name;
+    std::wstring Layout;
+};
+
+std::vector<LayoutPreset> const& GetLayoutPresets()
+{
+    static std::vector<LayoutPreset> const presets =
+    {
+        { L"1080p", L"1920x1080@0,0" },
+        { L"4K", L"3840x2160@0,0" },
+        { L"8K", L"7680x4320@0,0" },
+        { L"4K-HDR", L"3840x2160@0,0:hdr" },
+        { L"8K-HDR", L"7680x4320@0,0:hdr" },
+        { L"3x4K", L"3840x2160@0,0;3840x2160@3840,0;3840x2160@7680,0" },
+        // A landscape 4K display next to a portrait 1080p display
+        { L"L-shape", L"3840x2160@0,0;1080x1920@3840,-600" },
+        // A 4K HDR display next to two 1080p SDR displays, vertically offset
+        { L"mixed", L"3840x2160@0,0:hdr;1920x1080@-1920,540;1920x1080@3840,200" },
+    };
+    return presets;
+}
+
+std::vector<std::wstring> const& SyntheticCaptureSource::LayoutPresets()
+{
+    static auto const names = []()
+    {
+        std::vector<std::wstring> names;
+        for (auto&& preset : GetLayoutPresets())
+        {
+            names.push_back(preset.Name);
+        }
+        return names;
+    }();
+    return names;
+}
+
+std::vector<Display> SyntheticCaptureSource::ParseLayout(std::wstring const& layout)
+{
+    for (auto&& preset : GetLayoutPresets())
+    {
+        if (_wcsicmp(preset.Name.c_str(), layout.c_str()) == 0)
+        {
+            return ParseLayout(preset.Layout);
+        }
+    }
+
+    std::vector<Display> displays;
+    std::wstringstream layoutStream(layout);
+    std::wstring displayText;
+    while (std::getline(layoutStream, displayText, L';'))
+    {
+        if (displayText.empty())
+        {
+            continue;
+        }
+
+        int32_t width = 0;
+        int32_t height = 0;
+        int32_t x = 0;
+        int32_t y = 0;
+        if (swscanf_s(displayText.c_str(), L"%dx%d@%d,%d", &width, &height, &x, &y) != 4 || width <= 0 || height <= 0)
+        {
+            throw winrt::hresult_invalid_argument(L"Invalid synthetic display: " + displayText);
+        }
+
+        auto isHDR = false;
+        auto sdrWhiteLevel = 0.0f;
+        auto maxLuminance = DefaultMaxLuminance;
+        auto hdrStart = displayText.find(L":hdr");
+        if (hdrStart != std::wstring::npos)
+        {
+            isHDR = true;
+            sdrWhiteLevel = DefaultSDRWhiteLevelInNits;
+            auto valuesStart = displayText.find(L'=', hdrStart);
+            if (valuesStart != std::wstring::npos &&
+                swscanf_s(displayText.c_str() + valuesStart, L"=%f/%f", &sdrWhiteLevel, &maxLuminance) != 2)
+            {
+                throw winrt::hresult_invalid_argument(L"Invalid synthetic HDR values: " + displayText);
+            }
+        }
+
+        // Synthetic displays don't have real handles, but each one
+        // still needs a unique one.
+        auto handle = reinterpret_cast<HMONITOR>(static_cast<uintptr_t>(displays.size() + 1));
+        RECT rect = { x, y, x + width, y + height };
+        displays.push_back(Display(handle, rect, isHDR, sdrWhiteLevel, maxLuminance));
+    }
+
+    if (displays.empty())
+    {
+        throw winrt::hresult_invalid_argument(L"Empty synthetic layout!");
+    }
+    return displays;
+}
+
+SyntheticCaptureSource::SyntheticCaptureSource(winrt::com_ptr<ID3D11Device> const& d3dDevice)
+{
+    m_d3dDevice = d3dDevice;
+    m_d3dDevice->GetImmediateContext(m_d3dContext.put());
+    m_d3dMultithread = m_d3dDevice.as<ID3D11Multithread>();
+}
+
+wil::task<winrt::com_ptr<ID3D11Texture2D>> SyntheticCaptureSource::CaptureAsync(
+    Display const& display,
+    winrt::DirectXPixelFormat pixelFormat)
+{
+    auto frame = co_await CaptureFrameAsync(display, pixelFormat);
+    co_return frame.Texture;
+}
+
+wil::task<CaptureFrame> SyntheticCaptureSource::CaptureFrameAsync(
+    Display const& display,
+    winrt::DirectXPixelFormat pixelFormat)
+{
+    auto isHDR = pixelFormat == winrt::DirectXPixelFormat::R16G16B16A16Float;
+    auto& rect = display.Rect();
+    auto width = static_cast<uint32_t>(rect.right - rect.left);
+    auto height = static_cast<uint32_t>(rect.bottom - rect.top);
+
+    // The static part of each display is only generated once.
+    winrt::com_ptr<ID3D11Texture2D> baseTexture;
+    uint32_t frameIndex = 0;
+    {
+        std::scoped_lock lock(m_lock);
+        auto& frame = m_frames[{ display.Handle(), isHDR }];
+        if (!frame.BaseTexture)
+        {
+            frame.BaseTexture = CreateBaseTexture(display, isHDR, width, height);
+        }
+        baseTexture = frame.BaseTexture;
+        frameIndex = frame.FrameIndex++;
+    }
+
+    // Hand out a new texture for every frame, like a frame pool would.
+    D3D11_TEXTURE2D_DESC desc = {};
+    baseTexture->GetDesc(&desc);
+    winrt::com_ptr<ID3D11Texture2D> frameTexture;
+    winrt::check_hresult(m_d3dDevice->CreateTexture2D(&desc, nullptr, frameTexture.put()));
+
+    auto regionSize = std::min({ AnimatedRegionSize, width, height });
+    auto region = CreateAnimatedRegion(display, isHDR, frameIndex);
+    D3D11_BOX box = {};
+    box.left = width - regionSize;
+    box.top = height - regionSize;
+    box.right = width;
+    box.bottom = height;
+    box.back = 1;
+    {
+        auto multithreadLock = util::D3D11DeviceLock(m_d3dMultithread.get());
+        m_d3dContext->CopyResource(frameTexture.get(), baseTexture.get());
+        m_d3dContext->UpdateSubresource(frameTexture.get(), 0, &box, region.data(), AnimatedRegionSize * (isHDR ? 8 : 4), 0);
+    }
+
+    // The first frame has nothing to compare against.
+    std::optional<std::vector<RECT>> dirtyRects;
+    if (frameIndex > 0)
+    {
+        RECT dirtyRect = { static_cast<LONG>(box.left), static_cast<LONG>(box.top), static_cast<LONG>(box.right), static_cast<LONG>(box.bottom) };
+        dirtyRects.emplace(1, dirtyRect);
+    }
+    co_return CaptureFrame{ frameTexture, std::move(dirtyRects) };
+}
+
+// A cheap deterministic hash so frames don't depend on any RNG state.
+uint32_t HashPixel(uint32_t x, uint32_t y, uint32_t seed)
+{
+    auto value = x * 0x9E3779B1u ^ y * 0x85EBCA77u ^ seed * 0xC2B2AE3Du;
+    value ^= value >> 15;
+    value *= 0x2C1B3C6Du;
+    value ^= value >> 12;
+    return value;
+}
+
+winrt::com_ptr<ID3D11Texture2D> SyntheticCaptureSource::CreateBaseTexture(Display const& display, bool isHDR, uint32_t width, uint32_t height)
+{
+    auto& rect = display.Rect();
+    auto seed = static_cast<uint32_t>(rect.left * 31 + rect.top * 17 + width * 7 + height);
+    auto bytesPerPixel = isHDR ? 8u : 4u;
+    std::vector<uint8_t> pixels(static_cast<size_t>(width) * height * bytesPerPixel);
+
+    // HDR displays get highlights up to the display's peak.
+    auto peak = isHDR ? std::max(display.MaxLuminance(), ScRGBWhiteLevelInNits) / ScRGBWhiteLevelInNits : 1.0f;
+    auto paperWhite = isHDR ? std::max(display.SDRWhiteLevelInNits(), ScRGBWhiteLevelInNits) / ScRGBWhiteLevelInNits : 1.0f;
+
+    // The layout is a desktop gradient, a taskbar, a few "windows" with
+    // lines of "text", and on HDR displays a bright "video" window.
+    for (uint32_t y = 0; y < height; y++)
+    {
+        for (uint32_t x = 0; x < width; x++)
+        {
+            float color[3] = {};
+            auto windowX = (x / 640) * 640;
+            auto windowY = (y / 400) * 400;
+            auto inTaskbar = y + 48 >= height;
+            auto inWindow = ((HashPixel(windowX, windowY, seed) & 3) == 0) && (x - windowX) >= 16 && (y - windowY) >= 16;
+            auto inVideo = isHDR && x >= width / 2 && x < width / 2 + width / 4 && y >= height / 4 && y < height / 2;
+            if (inTaskbar)
+            {
+                color[0] = color[1] = color[2] = 0.12f;
+            }
+            else if (inVideo)
+            {
+                auto t = static_cast<float>(x - width / 2) / static_cast<float>(width / 4);
+                color[0] = peak * t;
+                color[1] = peak * t * 0.8f;
+                color[2] = peak * (1.0f - t);
+            }
+            else if (inWindow)
+            {
+                auto isText = ((y - windowY) % 20) < 12 && (HashPixel(x / 6, y / 20, seed) & 7) != 0 && (x - windowX) > 40;
+                auto value = isText ? 0.05f : 0.95f;
+                color[0] = color[1] = color[2] = value;
+            }
+            else
+            {
+                color[0] = 0.05f + 0.3f * static_cast<float>(y) / static_cast<float>(height);
+                color[1] = 0.10f + 0.2f * static_cast<float>(x) / static_cast<float>(width);
+                color[2] = 0.45f;
+            }
+
+            auto pixel = pixels.data() + (static_cast<size_t>(y) * width + x) * bytesPerPixel;
+            if (isHDR)
+            {
+                auto halfs = reinterpret_cast<uint16_t*>(pixel);
+                // SDR content sits at the display's SDR white level
+                auto scale = inVideo ? 1.0f : paperWhite;
+                halfs[0] = FloatToHalf(color[0] * scale);
+                halfs[1] = FloatToHalf(color[1] * scale);
+                halfs[2] = FloatToHalf(color[2] * scale);
+                halfs[3] = FloatToHalf(1.0f);
+            }
+            else
+            {
+                pixel[0] = static_cast<uint8_t>(std::clamp(color[2], 0.0f, 1.0f) * 255.0f);
+                pixel[1] = static_cast<uint8_t>(std::clamp(color[1], 0.0f, 1.0f) * 255.0f);
+                pixel[2] = static_cast<uint8_t>(std::clamp(color[0], 0.0f, 1.0f) * 255.0f);
+                pixel[3] = 255;
+            }
+        }
+    }
+
+    D3D11_TEXTURE2D_DESC desc = {};
+    desc.Width = width;
+    desc.Height = height;
+    desc.MipLevels = 1;
+    desc.ArraySize = 1;
+    desc.Format = isHDR ? DXGI_FORMAT_R16G16B16A16_FLOAT : DXGI_FORMAT_B8G8R8A8_UNORM;
+    desc.SampleDesc.Count = 1;
+    desc.Usage = D3D11_USAGE_DEFAULT;
+    desc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_RENDER_TARGET;
+    D3D11_SUBRESOURCE_DATA initialData = {};
+    initialData.pSysMem = pixels.data();
+    initialData.SysMemPitch = width * bytesPerPixel;
+    winrt::com_ptr<ID3D11Texture2D> texture;
+    winrt::check_hresult(m_d3dDevice->CreateTexture2D(&desc, &initialData, texture.put()));
+    return texture;
+}
+
+std::vector<uint8_t> SyntheticCaptureSource::CreateAnimatedRegion(Display const& display, bool isHDR, uint32_t frameIndex)
+{
+    // A bar that fills up a bit more every frame, like a clock or a progress bar.
+    auto bytesPerPixel = isHDR ? 8u : 4u;
+    auto paperWhite = isHDR ? std::max(display.SDRWhiteLevelInNits(), ScRGBWhiteLevelInNits) / ScRGBWhiteLevelInNits : 1.0f;
+    std::vector<uint8_t> pixels(AnimatedRegionSize * AnimatedRegionSize * bytesPerPixel);
+    auto filled = frameIndex % AnimatedRegionSize;
+    for (uint32_t y = 0; y < AnimatedRegionSize; y++)
+    {
+        for (uint32_t x = 0; x < AnimatedRegionSize; x++)
+        {
+            auto value = x <= filled ? 0.9f : 0.1f;
+            if ((HashPixel(x, y, frameIndex) & 15) == 0)
+            {
+                value = 0.5f;
+            }
+            auto pixel = pixels.data() + (static_cast<size_t>(y) * AnimatedRegionSize + x) * bytesPerPixel;
+            if (isHDR)
+            {
+                auto halfs = reinterpret_cast<uint16_t*>(pixel);
+                halfs[0] = halfs[1] = halfs[2] = FloatToHalf(value * paperWhite);
+                halfs[3] = FloatToHalf(1.0f);
+            }
+            else
+            {
+                pixel[0] = pixel[1] = pixel[2] = static_cast<uint8_t>(value * 255.0f);
+                pixel[3] = 255;
+            }
+        }
+    }
+    return pixels;
+}
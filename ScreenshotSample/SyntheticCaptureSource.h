@@ -0,0 +1,48 @@
+#pragma once
+#include "CaptureSource.h"
+
+// Produces deterministic desktop-like frames without capturing anything, so
+// the rest of the pipeline can be timed and tested on machines without a
+// desktop or a GPU (together with WARP). Every capture of a display advances
+// a small animated region in its bottom right corner.
+class SyntheticCaptureSource : public CaptureSource
+{
+public:
+    SyntheticCaptureSource(winrt::com_ptr<ID3D11Device> const& d3dDevice);
+    ~SyntheticCaptureSource() override {}
+
+    // Builds a display layout from a preset name (see LayoutPresets) or a
+    // list of displays separated by ';', each written as
+    //   <width>x<height>@<x>,<y>[:hdr[=<sdrWhiteLevelInNits>/<maxLuminance>]]
+    // e.g. "3840x2160@0,0:hdr=240/1000;1920x1080@3840,540"
+    static std::vector<Display> ParseLayout(std::wstring const& layout);
+    static std::vector<std::wstring> const& LayoutPresets();
+
+    wil::task<winrt::com_ptr<ID3D11Texture2D>> CaptureAsync(
+        Display const& display,
+        winrt::Windows::Graphics::DirectX::DirectXPixelFormat pixelFormat) override;
+    // Only the animated region is ever reported as dirty.
+    wil::task<CaptureFrame> CaptureFrameAsync(
+        Display const& display,
+        winrt::Windows::Graphics::DirectX::DirectXPixelFormat pixelFormat) override;
+
+    // The animated region is this big, in pixels.
+    static constexpr uint32_t AnimatedRegionSize = 64;
+
+private:
+    struct Frame
+    {
+        winrt::com_ptr<ID3D11Texture2D> BaseTexture;
+        uint32_t FrameIndex = 0;
+    };
+
+    winrt::com_ptr<ID3D11Texture2D> CreateBaseTexture(Display const& display, bool isHDR, uint32_t width, uint32_t height);
+    std::vector<uint8_t> CreateAnimatedRegion(Display const& display, bool isHDR, uint32_t frameIndex);
+
+private:
+    winrt::com_ptr<ID3D11Device> m_d3dDevice;
+    winrt::com_ptr<ID3D11DeviceContext> m_d3dContext;
+    winrt::com_ptr<ID3D11Multithread> m_d3dMultithread;
+    std::mutex m_lock;
+    std::map<std::pair<HMONITOR, bool>, Frame> m_frames;
+};
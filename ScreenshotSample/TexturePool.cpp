@@ -0,0 +1,208 @@
+#include "pch.h"
+#include "TexturePool.h"
+#include "ImageEncoder.h"
+#include "Trace.h"
+
+namespace util
+{
+    using namespace robmikh::common::uwp;
+}
+
+bool AreSameDescs(D3D11_TEXTURE2D_DESC const& first, D3D11_TEXTURE2D_DESC const& second)
+{
+    return first.Width == second.Width &&
+        first.Height == second.Height &&
+        first.MipLevels == second.MipLevels &&
+        first.ArraySize == second.ArraySize &&
+        first.Format == second.Format &&
+        first.SampleDesc.Count == second.SampleDesc.Count &&
+        first.SampleDesc.Quality == second.SampleDesc.Quality &&
+        first.Usage == second.Usage &&
+        first.BindFlags == second.BindFlags &&
+        first.CPUAccessFlags == second.CPUAccessFlags &&
+        first.MiscFlags == second.MiscFlags;
+}
+
+TexturePool::TexturePool(winrt::com_ptr<ID3D11Device> const& d3dDevice, uint64_t maxBytes)
+{
+    m_d3dDevice = d3dDevice;
+    m_d3dDevice->GetImmediateContext(m_d3dContext.put());
+    m_d3dMultithread = m_d3dDevice.as<ID3D11Multithread>();
+    m_maxBytes = maxBytes;
+}
+
+winrt::com_ptr<ID3D11Texture2D> TexturePool::Acquire(D3D11_TEXTURE2D_DESC const& desc)
+{
+    {
+        std::scoped_lock lock(m_lock);
+        // Take the most recently used match, it's the most likely to
+        // still be resident.
+        Entry* match = nullptr;
+        for (auto&& entry : m_entries)
+        {
+            if (entry.IsFree && AreSameDescs(entry.Desc, desc) && (match == nullptr || entry.LastUsed > match->LastUsed))
+            {
+                match = &entry;
+            }
+        }
+        if (match != nullptr)
+        {
+            match->IsFree = false;
+            match->LastUsed = ++m_clock;
+            m_hits++;
+            return match->Texture;
+        }
+    }
+
+    TraceScope trace("CreatePooledTexture");
+    m_misses++;
+    winrt::com_ptr<ID3D11Texture2D> texture;
+    winrt::check_hresult(m_d3dDevice->CreateTexture2D(&desc, nullptr, texture.put()));
+
+    std::scoped_lock lock(m_lock);
+    Entry entry = {};
+    entry.Desc = desc;
+    entry.Texture = texture;
+    entry.Size = static_cast<uint64_t>(desc.Width) * desc.Height * desc.ArraySize * GetBytesPerPixel(desc.Format);
+    entry.LastUsed = ++m_clock;
+    m_bytes += entry.Size;
+    m_entries.push_back(std::move(entry));
+    Trim();
+    return texture;
+}
+
+void TexturePool::Recycle(winrt::com_ptr<ID3D11Texture2D> const& texture)
+{
+    std::scoped_lock lock(m_lock);
+    if (auto entry = FindEntry(texture.get()))
+    {
+        entry->IsFree = true;
+        entry->LastUsed = ++m_clock;
+    }
+}
+
+winrt::com_ptr<ID3D11RenderTargetView> TexturePool::GetRenderTargetView(winrt::com_ptr<ID3D11Texture2D> const& texture)
+{
+    std::scoped_lock lock(m_lock);
+    auto entry = FindEntry(texture.get());
+    if (entry != nullptr && entry->RenderTargetView)
+    {
+        return entry->RenderTargetView;
+    }
+    winrt::com_ptr<ID3D11RenderTargetView> renderTargetView;
+    winrt::check_hresult(m_d3dDevice->CreateRenderTargetView(texture.get(), nullptr, renderTargetView.put()));
+    if (entry != nullptr)
+    {
+        entry->RenderTargetView = renderTargetView;
+    }
+    return renderTargetView;
+}
+
+winrt::com_ptr<ID2D1Bitmap1> TexturePool::GetTargetBitmap(ID2D1DeviceContext* d2dContext, winrt::com_ptr<ID3D11Texture2D> const& texture)
+{
+    std::scoped_lock lock(m_lock);
+    auto entry = FindEntry(texture.get());
+    if (entry != nullptr && entry->TargetBitmap)
+    {
+        return entry->TargetBitmap;
+    }
+    auto dxgiSurface = texture.as<IDXGISurface>();
+    winrt::com_ptr<ID2D1Bitmap1> targetBitmap;
+    winrt::check_hresult(d2dContext->CreateBitmapFromDxgiSurface(dxgiSurface.get(), nullptr, targetBitmap.put()));
+    if (entry != nullptr)
+    {
+        entry->TargetBitmap = targetBitmap;
+    }
+    return targetBitmap;
+}
+
+MappedTexture& MappedTexture::operator=(MappedTexture&& other) noexcept
+{
+    if (this != &other)
+    {
+        Unmap();
+        m_texturePool = std::exchange(other.m_texturePool, nullptr);
+        m_stagingTexture = std::move(other.m_stagingTexture);
+        m_mapped = std::exchange(other.m_mapped, {});
+        m_desc = other.m_desc;
+    }
+    return *this;
+}
+
+void MappedTexture::Unmap()
+{
+    if (m_stagingTexture)
+    {
+        {
+            auto multithreadLock = util::D3D11DeviceLock(m_texturePool->m_d3dMultithread.get());
+            m_texturePool->m_d3dContext->Unmap(m_stagingTexture.get(), 0);
+        }
+        m_texturePool->Recycle(m_stagingTexture);
+        m_stagingTexture = nullptr;
+    }
+}
+
+MappedTexture TexturePool::MapTexture(winrt::com_ptr<ID3D11Texture2D> const& texture)
+{
+    MappedTexture mappedTexture;
+    texture->GetDesc(&mappedTexture.m_desc);
+    auto stagingDesc = mappedTexture.m_desc;
+    stagingDesc.MipLevels = 1;
+    stagingDesc.ArraySize = 1;
+    stagingDesc.Usage = D3D11_USAGE_STAGING;
+    stagingDesc.BindFlags = 0;
+    stagingDesc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+    stagingDesc.MiscFlags = 0;
+    auto stagingTexture = Acquire(stagingDesc);
+
+    auto multithreadLock = util::D3D11DeviceLock(m_d3dMultithread.get());
+    m_d3dContext->CopySubresourceRegion(stagingTexture.get(), 0, 0, 0, 0, texture.get(), 0, nullptr);
+    winrt::check_hresult(m_d3dContext->Map(stagingTexture.get(), 0, D3D11_MAP_READ, 0, &mappedTexture.m_mapped));
+    mappedTexture.m_texturePool = this;
+    mappedTexture.m_stagingTexture = stagingTexture;
+    return mappedTexture;
+}
+
+std::vector<uint8_t> TexturePool::ReadTextureBytes(winrt::com_ptr<ID3D11Texture2D> const& texture)
+{
+    auto mappedTexture = MapTexture(texture);
+    auto& desc = mappedTexture.Desc();
+    auto rowSize = static_cast<size_t>(desc.Width) * GetBytesPerPixel(desc.Format);
+    std::vector<uint8_t> bytes(rowSize * desc.Height);
+    for (uint32_t row = 0; row < desc.Height; row++)
+    {
+        memcpy(bytes.data() + rowSize * row, mappedTexture.Row(row), rowSize);
+    }
+    return bytes;
+}
+
+uint64_t TexturePool::PooledBytes()
+{
+    std::scoped_lock lock(m_lock);
+    return m_bytes;
+}
+
+TexturePool::Entry* TexturePool::FindEntry(ID3D11Texture2D* texture)
+{
+    for (auto&& entry : m_entries)
+    {
+        if (entry.Texture.get() == texture)
+        {
+            return &entry;
+        }
+    }
+    return nullptr;
+}
+
+void TexturePool::Trim()
+{
+    while (m_bytes > m_maxBytes && !m_entries.empty())
+    {
+        auto oldest = std::min_element(m_entries.begin(), m_entries.end(), [](Entry const& first, Entry const& second)
+            {
+                return first.LastUsed < second.LastUsed;
+            });
+        m_bytes -= oldest->Size;
+        m_entries.erase(oldest);
+    }
+}
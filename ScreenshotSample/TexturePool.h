@@ -0,0 +1,98 @@
+#pragma once
+
+class TexturePool;
+
+// A texture copied into a pooled staging texture and mapped, so its pixels
+// can be read in place. Unmapped and recycled when destroyed, so keep it
+// only as long as the pixels are needed. Can only be moved.
+class MappedTexture
+{
+public:
+    MappedTexture() {}
+    MappedTexture(MappedTexture&& other) noexcept { *this = std::move(other); }
+    MappedTexture& operator=(MappedTexture&& other) noexcept;
+    MappedTexture(MappedTexture const&) = delete;
+    MappedTexture& operator=(MappedTexture const&) = delete;
+    ~MappedTexture() { Unmap(); }
+
+    uint8_t const* Data() const { return static_cast<uint8_t const*>(m_mapped.pData); }
+    uint8_t const* Row(uint32_t row) const { return Data() + static_cast<size_t>(row) * m_mapped.RowPitch; }
+    uint32_t RowPitch() const { return m_mapped.RowPitch; }
+    D3D11_TEXTURE2D_DESC const& Desc() const { return m_desc; }
+
+private:
+    friend class TexturePool;
+    void Unmap();
+
+private:
+    TexturePool* m_texturePool = nullptr;
+    winrt::com_ptr<ID3D11Texture2D> m_stagingTexture;
+    D3D11_MAPPED_SUBRESOURCE m_mapped = {};
+    D3D11_TEXTURE2D_DESC m_desc = {};
+};
+
+// Recycles textures, and the views made for them, across captures so
+// repeated shots don't allocate hundreds of MB from the driver every time.
+// Textures are matched on their whole D3D11_TEXTURE2D_DESC. Once nothing
+// uses a texture from Acquire anymore, Recycle makes it available to the
+// next Acquire with the same desc.
+//
+// The pool keeps track of every texture it made, handed out or not, along
+// with its views, and holds at most maxBytes of them. Past that, the least
+// recently used ones are forgotten, so textures that are never recycled
+// don't stick around forever.
+class TexturePool
+{
+public:
+    TexturePool(winrt::com_ptr<ID3D11Device> const& d3dDevice, uint64_t maxBytes);
+    ~TexturePool() {}
+
+    winrt::com_ptr<ID3D11Texture2D> Acquire(D3D11_TEXTURE2D_DESC const& desc);
+    // Does nothing for textures that didn't come from the pool.
+    void Recycle(winrt::com_ptr<ID3D11Texture2D> const& texture);
+
+    // Made once per pooled texture, and kept with it. Textures that didn't
+    // come from the pool get a new one every time.
+    winrt::com_ptr<ID3D11RenderTargetView> GetRenderTargetView(winrt::com_ptr<ID3D11Texture2D> const& texture);
+    winrt::com_ptr<ID2D1Bitmap1> GetTargetBitmap(ID2D1DeviceContext* d2dContext, winrt::com_ptr<ID3D11Texture2D> const& texture);
+
+    // Reads a texture back through a pooled staging texture. Takes the
+    // device lock while it uses the context.
+    MappedTexture MapTexture(winrt::com_ptr<ID3D11Texture2D> const& texture);
+    // Same, copied out with tightly packed rows.
+    std::vector<uint8_t> ReadTextureBytes(winrt::com_ptr<ID3D11Texture2D> const& texture);
+
+    uint64_t PooledBytes();
+    uint64_t Hits() const { return m_hits; }
+    uint64_t Misses() const { return m_misses; }
+
+private:
+    friend class MappedTexture;
+
+    struct Entry
+    {
+        D3D11_TEXTURE2D_DESC Desc = {};
+        winrt::com_ptr<ID3D11Texture2D> Texture;
+        winrt::com_ptr<ID3D11RenderTargetView> RenderTargetView;
+        winrt::com_ptr<ID2D1Bitmap1> TargetBitmap;
+        uint64_t Size = 0;
+        uint64_t LastUsed = 0;
+        bool IsFree = false;
+    };
+
+    Entry* FindEntry(ID3D11Texture2D* texture);
+    void Trim();
+
+private:
+    winrt::com_ptr<ID3D11Device> m_d3dDevice;
+    winrt::com_ptr<ID3D11DeviceContext> m_d3dContext;
+    winrt::com_ptr<ID3D11Multithread> m_d3dMultithread;
+    uint64_t m_maxBytes = 0;
+
+    std::mutex m_lock;
+    std::vector<Entry> m_entries;
+    uint64_t m_bytes = 0;
+    uint64_t m_clock = 0;
+    std::atomic<uint64_t> m_hits = 0;
+    std::atomic<uint64_t> m_misses = 0;
+};
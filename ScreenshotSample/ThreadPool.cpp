@@ -0,0 +1,136 @@
+#include "pch.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+
+struct ThreadPool::Job
+{
+    std::function<void(uint32_t)> const* Func = nullptr;
+    uint32_t Count = 0;
+    std::atomic<uint32_t> NextIndex = 0;
+    std::atomic<uint32_t> Remaining = 0;
+    std::mutex Lock;
+    std::condition_variable Completed;
+    std::exception_ptr Error;
+};
+
+ThreadPool::ThreadPool(uint32_t threadCount)
+{
+    if (threadCount == 0)
+    {
+        threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    // The thread calling ParallelFor counts as one of our threads.
+    for (uint32_t i = 1; i < threadCount; i++)
+    {
+        m_threads.emplace_back([this]()
+            {
+                Trace::SetThreadName("ThreadPool");
+                WorkerLoop();
+            });
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::scoped_lock lock(m_lock);
+        m_stopping = true;
+    }
+    m_workAvailable.notify_all();
+    for (auto&& thread : m_threads)
+    {
+        thread.join();
+    }
+}
+
+void ThreadPool::ParallelFor(uint32_t count, std::function<void(uint32_t)> const& func)
+{
+    if (count == 0)
+    {
+        return;
+    }
+    if (count == 1 || m_threads.empty())
+    {
+        for (uint32_t i = 0; i < count; i++)
+        {
+            func(i);
+        }
+        return;
+    }
+
+    auto job = std::make_shared<Job>();
+    job->Func = &func;
+    job->Count = count;
+    job->Remaining = count;
+
+    // Workers that pick the job up after it has been drained
+    // simply find no indices left and drop it.
+    auto helpers = std::min(count - 1, static_cast<uint32_t>(m_threads.size()));
+    {
+        std::scoped_lock lock(m_lock);
+        for (uint32_t i = 0; i < helpers; i++)
+        {
+            m_jobs.push_back(job);
+        }
+    }
+    m_workAvailable.notify_all();
+
+    RunJob(job);
+
+    std::unique_lock lock(job->Lock);
+    job->Completed.wait(lock, [&job]() { return job->Remaining.load() == 0; });
+    if (job->Error)
+    {
+        std::rethrow_exception(job->Error);
+    }
+}
+
+void ThreadPool::RunJob(std::shared_ptr<Job> const& job)
+{
+    while (true)
+    {
+        auto index = job->NextIndex++;
+        if (index >= job->Count)
+        {
+            return;
+        }
+
+        try
+        {
+            (*job->Func)(index);
+        }
+        catch (...)
+        {
+            std::scoped_lock lock(job->Lock);
+            if (!job->Error)
+            {
+                job->Error = std::current_exception();
+            }
+        }
+
+        if (--job->Remaining == 0)
+        {
+            std::scoped_lock lock(job->Lock);
+            job->Completed.notify_all();
+        }
+    }
+}
+
+void ThreadPool::WorkerLoop()
+{
+    while (true)
+    {
+        std::shared_ptr<Job> job;
+        {
+            std::unique_lock lock(m_lock);
+            m_workAvailable.wait(lock, [this]() { return m_stopping || !m_jobs.empty(); });
+            if (m_stopping && m_jobs.empty())
+            {
+                return;
+            }
+            job = std::move(m_jobs.front());
+            m_jobs.pop_front();
+        }
+        RunJob(job);
+    }
+}
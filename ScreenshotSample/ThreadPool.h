@@ -0,0 +1,29 @@
+#pragma once
+
+class ThreadPool
+{
+public:
+    // A thread count of 0 means one thread per logical processor.
+    ThreadPool(uint32_t threadCount = 0);
+    ~ThreadPool();
+
+    // Includes the calling thread, which always helps out in ParallelFor.
+    uint32_t ThreadCount() const { return static_cast<uint32_t>(m_threads.size()) + 1; }
+
+    // Runs func(index) for every index in [0, count) and returns once all
+    // of them have completed. The first exception thrown is rethrown here.
+    // It is safe to call ParallelFor from inside another ParallelFor.
+    void ParallelFor(uint32_t count, std::function<void(uint32_t)> const& func);
+
+private:
+    struct Job;
+    static void RunJob(std::shared_ptr<Job> const& job);
+    void WorkerLoop();
+
+private:
+    std::vector<std::thread> m_threads;
+    std::mutex m_lock;
+    std::condition_variable m_workAvailable;
+    std::deque<std::shared_ptr<Job>> m_jobs;
+    bool m_stopping = false;
+};
@@ -0,0 +1,104 @@
+#include "pch.h"
+#include "TileHash.h"
+
+// Every 16 bytes are mixed into two 64-bit accumulators with a 32x32->64
+// multiply of the data xor'd with a per position key (the same construction
+// xxHash3 uses), so that moved content doesn't hash the same.
+constexpr uint64_t AccumulatorStart0 = 0x243F6A8885A308D3ull;
+constexpr uint64_t AccumulatorStart1 = 0x13198A2E03707344ull;
+constexpr uint64_t KeyStart0 = 0x9E3779B97F4A7C15ull;
+constexpr uint64_t KeyStart1 = 0xC2B2AE3D27D4EB4Full;
+constexpr uint64_t KeyStep0 = 0x165667B19E3779F9ull;
+constexpr uint64_t KeyStep1 = 0x27D4EB2F165667C5ull;
+
+uint64_t FinalizeHash(uint64_t value)
+{
+    value ^= value >> 33;
+    value *= 0xFF51AFD7ED558CCDull;
+    value ^= value >> 33;
+    value *= 0xC4CEB9FE1A85EC53ull;
+    value ^= value >> 33;
+    return value;
+}
+
+void AccumulateScalar(uint64_t (&accumulators)[2], uint64_t (&keys)[2], uint8_t const* data)
+{
+    uint64_t words[2] = {};
+    memcpy(words, data, sizeof(words));
+    for (uint32_t lane = 0; lane < 2; lane++)
+    {
+        auto dataKey = words[lane] ^ keys[lane];
+        accumulators[lane] += words[lane ^ 1] + (dataKey & 0xffffffffull) * (dataKey >> 32);
+    }
+    keys[0] += KeyStep0;
+    keys[1] += KeyStep1;
+}
+
+uint64_t HashPixels(uint8_t const* pixels, uint32_t stride, uint32_t rowSize, uint32_t rowCount)
+{
+#if defined(_M_X64) || defined(_M_IX86)
+    uint64_t accumulators[2] = { AccumulatorStart0, AccumulatorStart1 };
+    uint64_t keys[2] = { KeyStart0, KeyStart1 };
+    auto vectorSize = rowSize & ~15u;
+    auto accumulator = _mm_set_epi64x(static_cast<int64_t>(accumulators[1]), static_cast<int64_t>(accumulators[0]));
+    auto key = _mm_set_epi64x(static_cast<int64_t>(keys[1]), static_cast<int64_t>(keys[0]));
+    auto keyStep = _mm_set_epi64x(static_cast<int64_t>(KeyStep1), static_cast<int64_t>(KeyStep0));
+
+    for (uint32_t row = 0; row < rowCount; row++)
+    {
+        auto rowData = pixels + static_cast<size_t>(row) * stride;
+        uint32_t offset = 0;
+        for (; offset < vectorSize; offset += 16)
+        {
+            auto data = _mm_loadu_si128(reinterpret_cast<__m128i const*>(rowData + offset));
+            auto dataKey = _mm_xor_si128(data, key);
+            auto product = _mm_mul_epu32(dataKey, _mm_srli_epi64(dataKey, 32));
+            auto swapped = _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+            accumulator = _mm_add_epi64(accumulator, _mm_add_epi64(swapped, product));
+            key = _mm_add_epi64(key, keyStep);
+        }
+        if (offset < rowSize)
+        {
+            // Move the state back to scalar for the tail.
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(accumulators), accumulator);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(keys), key);
+            uint8_t tail[16] = {};
+            memcpy(tail, rowData + offset, rowSize - offset);
+            AccumulateScalar(accumulators, keys, tail);
+            accumulator = _mm_loadu_si128(reinterpret_cast<__m128i const*>(accumulators));
+            key = _mm_loadu_si128(reinterpret_cast<__m128i const*>(keys));
+        }
+    }
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(accumulators), accumulator);
+    auto size = static_cast<uint64_t>(rowSize) * rowCount;
+    return FinalizeHash(accumulators[0] ^ std::rotl(accumulators[1], 29) ^ size);
+#else
+    return HashPixelsScalar(pixels, stride, rowSize, rowCount);
+#endif
+}
+
+uint64_t HashPixelsScalar(uint8_t const* pixels, uint32_t stride, uint32_t rowSize, uint32_t rowCount)
+{
+    uint64_t accumulators[2] = { AccumulatorStart0, AccumulatorStart1 };
+    uint64_t keys[2] = { KeyStart0, KeyStart1 };
+    auto vectorSize = rowSize & ~15u;
+    for (uint32_t row = 0; row < rowCount; row++)
+    {
+        auto rowData = pixels + static_cast<size_t>(row) * stride;
+        uint32_t offset = 0;
+        for (; offset < vectorSize; offset += 16)
+        {
+            AccumulateScalar(accumulators, keys, rowData + offset);
+        }
+        if (offset < rowSize)
+        {
+            uint8_t tail[16] = {};
+            memcpy(tail, rowData + offset, rowSize - offset);
+            AccumulateScalar(accumulators, keys, tail);
+        }
+    }
+
+    auto size = static_cast<uint64_t>(rowSize) * rowCount;
+    return FinalizeHash(accumulators[0] ^ std::rotl(accumulators[1], 29) ^ size);
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+// A fast 64-bit hash of a rectangle of pixels, used to find tiles that
+// changed between captures. Results are stable across runs and machines,
+// and the SSE2 and scalar paths produce identical values.
+uint64_t HashPixels(uint8_t const* pixels, uint32_t stride, uint32_t rowSize, uint32_t rowCount);
+// The scalar path on its own, which -selfTest checks HashPixels against.
+uint64_t HashPixelsScalar(uint8_t const* pixels, uint32_t stride, uint32_t rowSize, uint32_t rowCount);
@@ -0,0 +1,23 @@
+#include "pch.h"
+#include "TileManifestEncoder.h"
+
+TileManifestEncoder::TileManifestEncoder(std::shared_ptr<TileStore> const& store)
+{
+    m_store = store;
+}
+
+void TileManifestEncoder::EncodeStreaming(
+    uint32_t width,
+    uint32_t height,
+    ImageRowSource& source,
+    std::function<void(uint8_t const*, size_t)> const& write)
+{
+    m_store->AddImage(width, height, source, write);
+}
+
+uint64_t TileManifestEncoder::EstimateSize(uint32_t width, uint32_t height) const
+{
+    auto columnCount = (static_cast<uint64_t>(width) + TileStore::TileSize - 1) / TileStore::TileSize;
+    auto rowCount = (static_cast<uint64_t>(height) + TileStore::TileSize - 1) / TileStore::TileSize;
+    return sizeof(TileManifestHeader) + columnCount * rowCount * sizeof(uint64_t);
+}
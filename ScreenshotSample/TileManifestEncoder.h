@@ -0,0 +1,23 @@
+#pragma once
+#include "ImageEncoder.h"
+#include "TileStore.h"
+
+// Adds the image's tiles to a TileStore and writes the manifest that points
+// at them instead of the pixels. ReadStoredImage turns it back into pixels.
+class TileManifestEncoder : public ImageEncoder
+{
+public:
+    TileManifestEncoder(std::shared_ptr<TileStore> const& store);
+    ~TileManifestEncoder() override {}
+
+    ImageFormat Format() const override { return ImageFormat::Tiles; }
+    void EncodeStreaming(
+        uint32_t width,
+        uint32_t height,
+        ImageRowSource& source,
+        std::function<void(uint8_t const*, size_t)> const& write) override;
+    uint64_t EstimateSize(uint32_t width, uint32_t height) const override;
+
+private:
+    std::shared_ptr<TileStore> m_store;
+};
@@ -0,0 +1,621 @@
+#include "pch.h"
+#include "TileStore.h"
+#include "TileHash.h"
+#include "Checksum.h"
+#include "QoiEncoder.h"
+#include "FileWriter.h"
+#include "Trace.h"
+
+// What tiles.pack starts with, the tile records follow it.
+struct TilePackHeader
+{
+    // "SSTP" in the file
+    static constexpr uint32_t ExpectedMagic = 'PTSS';
+    static constexpr uint32_t CurrentVersion = 1;
+
+    uint32_t Magic = ExpectedMagic;
+    uint32_t Version = CurrentVersion;
+};
+
+// What tiles.index starts with, the slots follow it.
+struct TileStore::IndexHeader
+{
+    // "SSTI" in the file
+    static constexpr uint32_t ExpectedMagic = 'ITSS';
+    static constexpr uint32_t CurrentVersion = 1;
+
+    uint32_t Magic = ExpectedMagic;
+    uint32_t Version = CurrentVersion;
+    // Always a power of two
+    uint64_t SlotCount = 0;
+    uint64_t TileCount = 0;
+    // How much of the pack has been indexed.
+    uint64_t PackSize = 0;
+};
+
+// Open addressing with linear probing, starting at Hash % SlotCount.
+struct TileStore::IndexSlot
+{
+    uint64_t Hash = 0;
+    // Where the tile's record is in the pack, 0 for empty slots.
+    uint64_t Offset = 0;
+    uint32_t Check = 0;
+    uint16_t Width = 0;
+    uint16_t Height = 0;
+};
+
+// The index doubles once it's 70% full.
+constexpr uint64_t InitialIndexSlotCount = 16 * 1024;
+
+constexpr size_t QoiTileHeaderSize = 14;
+
+// Probing went through every slot, which only happens if the index file
+// was changed behind our back.
+[[noreturn]] void ThrowIndexDamaged()
+{
+    throw winrt::hresult_error(HRESULT_FROM_WIN32(ERROR_FILE_CORRUPT), L"The tile store's index is damaged!");
+}
+
+TileKey ComputeTileKey(uint8_t const* pixels, uint32_t stride, uint32_t width, uint32_t height)
+{
+    TileKey key = {};
+    key.Hash = HashPixels(pixels, stride, width * 4, height);
+    for (uint32_t row = 0; row < height; row++)
+    {
+        key.Check = Crc32(pixels + static_cast<size_t>(row) * stride, static_cast<size_t>(width) * 4, key.Check);
+    }
+    key.Width = static_cast<uint16_t>(width);
+    key.Height = static_cast<uint16_t>(height);
+    return key;
+}
+
+// Decodes a tile that QoiEncoder wrote into BGRA8 rows. Throws if it isn't
+// the size we expect or runs past the end of the data.
+void DecodeQoiTile(uint8_t const* data, size_t size, uint8_t* destination, size_t stride, uint32_t width, uint32_t height)
+{
+    auto readBigEndian = [](uint8_t const* bytes)
+    {
+        return (static_cast<uint32_t>(bytes[0]) << 24) | (static_cast<uint32_t>(bytes[1]) << 16) | (static_cast<uint32_t>(bytes[2]) << 8) | bytes[3];
+    };
+    if (size < QoiTileHeaderSize || memcmp(data, "qoif", 4) != 0 || readBigEndian(data + 4) != width || readBigEndian(data + 8) != height)
+    {
+        throw winrt::hresult_invalid_argument(L"A tile in the pack is damaged!");
+    }
+
+    // BGRA, like the pixels themselves.
+    std::array<std::array<uint8_t, 4>, 64> index = {};
+    std::array<uint8_t, 4> pixel = { 0, 0, 0, 255 };
+    uint32_t run = 0;
+    auto position = QoiTileHeaderSize;
+    auto need = [&](size_t count)
+    {
+        if (size - position < count)
+        {
+            throw winrt::hresult_invalid_argument(L"A tile in the pack is damaged!");
+        }
+    };
+    for (uint32_t row = 0; row < height; row++)
+    {
+        auto destinationRow = destination + static_cast<size_t>(row) * stride;
+        for (uint32_t x = 0; x < width; x++)
+        {
+            if (run > 0)
+            {
+                run--;
+            }
+            else
+            {
+                need(1);
+                auto op = data[position++];
+                if (op == 0xfe)
+                {
+                    need(3);
+                    pixel[2] = data[position];
+                    pixel[1] = data[position + 1];
+                    pixel[0] = data[position + 2];
+                    position += 3;
+                }
+                else if (op == 0xff)
+                {
+                    need(4);
+                    pixel[2] = data[position];
+                    pixel[1] = data[position + 1];
+                    pixel[0] = data[position + 2];
+                    pixel[3] = data[position + 3];
+                    position += 4;
+                }
+                else if ((op & 0xc0) == 0x00)
+                {
+                    pixel = index[op];
+                }
+                else if ((op & 0xc0) == 0x40)
+                {
+                    pixel[2] = static_cast<uint8_t>(pixel[2] + ((op >> 4) & 3) - 2);
+                    pixel[1] = static_cast<uint8_t>(pixel[1] + ((op >> 2) & 3) - 2);
+                    pixel[0] = static_cast<uint8_t>(pixel[0] + (op & 3) - 2);
+                }
+                else if ((op & 0xc0) == 0x80)
+                {
+                    need(1);
+                    auto greenDifference = (op & 0x3f) - 32;
+                    auto next = data[position++];
+                    pixel[2] = static_cast<uint8_t>(pixel[2] + greenDifference + (next >> 4) - 8);
+                    pixel[1] = static_cast<uint8_t>(pixel[1] + greenDifference);
+                    pixel[0] = static_cast<uint8_t>(pixel[0] + greenDifference + (next & 0xf) - 8);
+                }
+                else
+                {
+                    run = op & 0x3f;
+                }
+                index[(pixel[2] * 3 + pixel[1] * 5 + pixel[0] * 7 + pixel[3] * 11) % 64] = pixel;
+            }
+            memcpy(destinationRow + static_cast<size_t>(x) * 4, pixel.data(), 4);
+        }
+    }
+}
+
+TileStore::TileStore(std::wstring const& directory, std::shared_ptr<ThreadPool> const& threadPool)
+{
+    m_threadPool = threadPool;
+    std::filesystem::create_directories(directory);
+    m_packPath = (std::filesystem::path(directory) / L"tiles.pack").wstring();
+    m_indexPath = (std::filesystem::path(directory) / L"tiles.index").wstring();
+
+    // One writer at a time, but anyone can read the pack.
+    m_pack.reset(CreateFileW(m_packPath.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr));
+    if (!m_pack)
+    {
+        winrt::throw_last_error();
+    }
+    auto packFileSize = QueryFileSize(m_pack.get());
+    TilePackHeader packHeader = {};
+    if (packFileSize == 0)
+    {
+        WriteFileAt(m_pack.get(), 0, reinterpret_cast<uint8_t const*>(&packHeader), sizeof(packHeader));
+        packFileSize = sizeof(packHeader);
+    }
+    else if (!ReadFileAt(m_pack.get(), 0, &packHeader, sizeof(packHeader)) ||
+        packHeader.Magic != TilePackHeader::ExpectedMagic ||
+        packHeader.Version != TilePackHeader::CurrentVersion)
+    {
+        throw winrt::hresult_invalid_argument(L"The tile store's pack is damaged or from a newer version!");
+    }
+
+    // Index whatever the index doesn't cover yet, or everything
+    // if it can't be trusted.
+    auto indexed = false;
+    if (MapIndex() && GetIndexHeader()->PackSize >= sizeof(TilePackHeader) && GetIndexHeader()->PackSize <= packFileSize)
+    {
+        auto tiles = ScanPack(GetIndexHeader()->PackSize, packFileSize);
+        try
+        {
+            for (auto&& [key, offset] : tiles)
+            {
+                if (FindTile(key) == 0)
+                {
+                    InsertTile(key, offset);
+                }
+            }
+            GetIndexHeader()->PackSize = m_packSize;
+            indexed = true;
+        }
+        catch (winrt::hresult_error const& error)
+        {
+            if (error.code() != HRESULT_FROM_WIN32(ERROR_FILE_CORRUPT))
+            {
+                throw;
+            }
+        }
+    }
+    if (!indexed)
+    {
+        packFileSize = QueryFileSize(m_pack.get());
+        auto tiles = ScanPack(sizeof(TilePackHeader), packFileSize);
+        auto slotCount = InitialIndexSlotCount;
+        while ((tiles.size() + 1) * 10 > slotCount * 7)
+        {
+            slotCount *= 2;
+        }
+        CreateIndex(slotCount, tiles);
+    }
+}
+
+void TileStore::AddImage(
+    uint32_t width,
+    uint32_t height,
+    ImageRowSource& source,
+    std::function<void(uint8_t const*, size_t)> const& write)
+{
+    TraceScope trace("AddImageToTileStore");
+    TileManifestHeader header = {};
+    header.Width = width;
+    header.Height = height;
+    header.TileSize = TileSize;
+    write(reinterpret_cast<uint8_t const*>(&header), sizeof(header));
+
+    auto columnCount = (width + TileSize - 1) / TileSize;
+    auto tileBytes = static_cast<size_t>(TileSize) * TileSize * 4;
+    std::vector<uint8_t> tiles(tileBytes * columnCount);
+    std::vector<TileKey> keys(columnCount);
+    std::vector<uint64_t> offsets(columnCount);
+    // Tiles that are the same as one further left in the row are only added once.
+    std::vector<uint32_t> sameAs(columnCount);
+    std::vector<std::vector<uint8_t>> encodedTiles(columnCount);
+    std::vector<uint32_t> newColumns;
+    std::vector<uint32_t> addedColumns;
+    std::vector<uint8_t> records;
+    for (uint32_t startRow = 0; startRow < height; startRow += TileSize)
+    {
+        auto tileHeight = std::min(TileSize, height - startRow);
+        source.PrepareRows(startRow, startRow + tileHeight);
+
+        // Gather each tile into one block, so it can be hashed and encoded
+        // without caring how the source lays out its rows.
+        TraceScope bandTrace("AddTileRow");
+        m_threadPool->ParallelFor(columnCount, [&](uint32_t column)
+            {
+                auto x = column * TileSize;
+                auto rowSize = std::min(TileSize, width - x) * 4;
+                auto tile = tiles.data() + tileBytes * column;
+                for (uint32_t row = 0; row < tileHeight; row++)
+                {
+                    memcpy(tile + static_cast<size_t>(row) * rowSize, source.GetRow(startRow + row) + static_cast<size_t>(x) * 4, rowSize);
+                }
+                keys[column] = ComputeTileKey(tile, rowSize, rowSize / 4, tileHeight);
+            });
+
+        newColumns.clear();
+        {
+            std::scoped_lock lock(m_lock);
+            for (uint32_t column = 0; column < columnCount; column++)
+            {
+                offsets[column] = FindTile(keys[column]);
+                sameAs[column] = column;
+                if (offsets[column] == 0)
+                {
+                    // Empty space repeats a lot within a row of tiles.
+                    for (auto newColumn : newColumns)
+                    {
+                        if (keys[newColumn] == keys[column])
+                        {
+                            sameAs[column] = newColumn;
+                            break;
+                        }
+                    }
+                    if (sameAs[column] == column)
+                    {
+                        newColumns.push_back(column);
+                    }
+                }
+            }
+        }
+
+        // Encoding is the slow part, other images can use the store meanwhile.
+        m_threadPool->ParallelFor(static_cast<uint32_t>(newColumns.size()), [&](uint32_t index)
+            {
+                auto column = newColumns[index];
+                auto& key = keys[column];
+                auto& encodedTile = encodedTiles[column];
+                encodedTile.clear();
+                QoiEncoder encoder(m_threadPool);
+                MemoryRowSource tileSource(tiles.data() + tileBytes * column, key.Width * 4u);
+                encoder.EncodeStreaming(key.Width, key.Height, tileSource, [&](uint8_t const* data, size_t size)
+                    {
+                        encodedTile.insert(encodedTile.end(), data, data + size);
+                    });
+            });
+
+        {
+            std::scoped_lock lock(m_lock);
+            // Append the new tiles in one write, then index them. Another
+            // image may have added some of them while we were encoding.
+            addedColumns.clear();
+            records.clear();
+            for (auto column : newColumns)
+            {
+                offsets[column] = FindTile(keys[column]);
+                if (offsets[column] != 0)
+                {
+                    continue;
+                }
+                addedColumns.push_back(column);
+                auto& key = keys[column];
+                auto& encodedTile = encodedTiles[column];
+                TileRecordHeader record = {};
+                record.Size = static_cast<uint32_t>(encodedTile.size());
+                record.Hash = key.Hash;
+                record.Check = key.Check;
+                record.Width = key.Width;
+                record.Height = key.Height;
+                offsets[column] = m_packSize + records.size();
+                records.insert(records.end(), reinterpret_cast<uint8_t const*>(&record), reinterpret_cast<uint8_t const*>(&record) + sizeof(record));
+                records.insert(records.end(), encodedTile.begin(), encodedTile.end());
+            }
+            if (!records.empty())
+            {
+                TraceScope trace("WriteTiles");
+                WriteFileAt(m_pack.get(), m_packSize, records.data(), records.size());
+                for (auto column : addedColumns)
+                {
+                    InsertTile(keys[column], offsets[column]);
+                }
+                m_packSize += records.size();
+                GetIndexHeader()->PackSize = m_packSize;
+            }
+        }
+
+        for (uint32_t column = 0; column < columnCount; column++)
+        {
+            offsets[column] = offsets[sameAs[column]];
+        }
+        m_newTiles += addedColumns.size();
+        m_reusedTiles += columnCount - addedColumns.size();
+        write(reinterpret_cast<uint8_t const*>(offsets.data()), offsets.size() * sizeof(uint64_t));
+    }
+}
+
+uint64_t TileStore::PackBytes()
+{
+    std::scoped_lock lock(m_lock);
+    return m_packSize;
+}
+
+TileStore::IndexHeader* TileStore::GetIndexHeader() const
+{
+    return reinterpret_cast<IndexHeader*>(m_indexView.get());
+}
+
+TileStore::IndexSlot* TileStore::GetIndexSlots() const
+{
+    return reinterpret_cast<IndexSlot*>(m_indexView.get() + sizeof(IndexHeader));
+}
+
+uint64_t TileStore::FindTile(TileKey const& key) const
+{
+    auto slotCount = GetIndexHeader()->SlotCount;
+    auto slots = GetIndexSlots();
+    auto slot = key.Hash & (slotCount - 1);
+    for (uint64_t probe = 0; probe < slotCount; probe++, slot = (slot + 1) & (slotCount - 1))
+    {
+        auto& entry = slots[slot];
+        if (entry.Offset == 0)
+        {
+            return 0;
+        }
+        if (entry.Hash == key.Hash && entry.Check == key.Check && entry.Width == key.Width && entry.Height == key.Height)
+        {
+            return entry.Offset;
+        }
+    }
+    ThrowIndexDamaged();
+}
+
+void TileStore::InsertTile(TileKey const& key, uint64_t offset)
+{
+    auto header = GetIndexHeader();
+    if ((header->TileCount + 1) * 10 > header->SlotCount * 7)
+    {
+        std::vector<std::pair<TileKey, uint64_t>> tiles;
+        tiles.reserve(header->TileCount + 1);
+        auto slots = GetIndexSlots();
+        for (uint64_t slot = 0; slot < header->SlotCount; slot++)
+        {
+            auto& entry = slots[slot];
+            if (entry.Offset != 0)
+            {
+                tiles.push_back({ TileKey{ entry.Hash, entry.Check, entry.Width, entry.Height }, entry.Offset });
+            }
+        }
+        tiles.push_back({ key, offset });
+        CreateIndex(header->SlotCount * 2, tiles);
+        return;
+    }
+
+    auto mask = header->SlotCount - 1;
+    auto slots = GetIndexSlots();
+    auto slot = key.Hash & mask;
+    for (uint64_t probe = 0; slots[slot].Offset != 0; probe++, slot = (slot + 1) & mask)
+    {
+        if (probe == header->SlotCount)
+        {
+            ThrowIndexDamaged();
+        }
+    }
+    slots[slot] = { key.Hash, offset, key.Check, key.Width, key.Height };
+    header->TileCount++;
+}
+
+std::vector<std::pair<TileKey, uint64_t>> TileStore::ScanPack(uint64_t offset, uint64_t size)
+{
+    TraceScope trace("ScanTilePack");
+    std::vector<std::pair<TileKey, uint64_t>> tiles;
+    while (offset < size)
+    {
+        // Only the last record can run past the end, if writing it never
+        // finished. Anything else wrong is damage, and cutting the pack
+        // there would lose tiles that manifests still point at.
+        TileRecordHeader record = {};
+        if (offset + sizeof(record) > size ||
+            !ReadFileAt(m_pack.get(), offset, &record, sizeof(record)))
+        {
+            break;
+        }
+        if (record.Magic != TileRecordHeader::ExpectedMagic)
+        {
+            throw winrt::hresult_error(HRESULT_FROM_WIN32(ERROR_FILE_CORRUPT), L"The tile store's pack is damaged at offset " + std::to_wstring(offset) + L"!");
+        }
+        if (record.Size > size - offset - sizeof(record))
+        {
+            break;
+        }
+        tiles.push_back({ TileKey{ record.Hash, record.Check, record.Width, record.Height }, offset });
+        offset += sizeof(record) + record.Size;
+    }
+
+    // Cut off the torn record, the next one goes where it started.
+    if (offset < size)
+    {
+        LARGE_INTEGER position = {};
+        position.QuadPart = static_cast<LONGLONG>(offset);
+        winrt::check_bool(SetFilePointerEx(m_pack.get(), position, nullptr, FILE_BEGIN));
+        winrt::check_bool(SetEndOfFile(m_pack.get()));
+    }
+    m_packSize = offset;
+    return tiles;
+}
+
+void TileStore::CreateIndex(uint64_t slotCount, std::vector<std::pair<TileKey, uint64_t>> const& tiles)
+{
+    TraceScope trace("CreateTileIndex");
+    std::vector<uint8_t> bytes(sizeof(IndexHeader) + slotCount * sizeof(IndexSlot));
+    IndexHeader header = {};
+    header.SlotCount = slotCount;
+    header.TileCount = tiles.size();
+    header.PackSize = m_packSize;
+    memcpy(bytes.data(), &header, sizeof(header));
+    auto slots = reinterpret_cast<IndexSlot*>(bytes.data() + sizeof(IndexHeader));
+    for (auto&& [key, offset] : tiles)
+    {
+        auto slot = key.Hash & (slotCount - 1);
+        while (slots[slot].Offset != 0)
+        {
+            slot = (slot + 1) & (slotCount - 1);
+        }
+        slots[slot] = { key.Hash, offset, key.Check, key.Width, key.Height };
+    }
+
+    // Write the new index next to the old one and swap it in,
+    // so there's always a whole index on disk.
+    auto newIndexPath = m_indexPath + L".new";
+    FileWriter writer(newIndexPath, FileWriteMode::Plain, bytes.size());
+    writer.Write(bytes.data(), bytes.size());
+    writer.Close();
+    m_indexView.reset();
+    m_indexMapping.reset();
+    m_index.reset();
+    winrt::check_bool(MoveFileExW(newIndexPath.c_str(), m_indexPath.c_str(), MOVEFILE_REPLACE_EXISTING));
+    if (!MapIndex())
+    {
+        throw winrt::hresult_invalid_argument(L"The tile store's index couldn't be created!");
+    }
+}
+
+bool TileStore::MapIndex()
+{
+    m_indexView.reset();
+    m_indexMapping.reset();
+    m_index.reset(CreateFileW(m_indexPath.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr));
+    if (!m_index)
+    {
+        return false;
+    }
+    m_indexSize = QueryFileSize(m_index.get());
+    if (m_indexSize < sizeof(IndexHeader) + sizeof(IndexSlot))
+    {
+        return false;
+    }
+    m_indexMapping.reset(CreateFileMappingW(m_index.get(), nullptr, PAGE_READWRITE, 0, 0, nullptr));
+    winrt::check_bool(static_cast<bool>(m_indexMapping));
+    m_indexView.reset(static_cast<uint8_t*>(MapViewOfFile(m_indexMapping.get(), FILE_MAP_WRITE, 0, 0, 0)));
+    winrt::check_bool(static_cast<bool>(m_indexView));
+
+    auto header = GetIndexHeader();
+    auto slotsSize = m_indexSize - sizeof(IndexHeader);
+    if (header->Magic != IndexHeader::ExpectedMagic ||
+        header->Version != IndexHeader::CurrentVersion ||
+        slotsSize % sizeof(IndexSlot) != 0 ||
+        header->SlotCount != slotsSize / sizeof(IndexSlot) ||
+        (header->SlotCount & (header->SlotCount - 1)) != 0 ||
+        header->TileCount >= header->SlotCount)
+    {
+        return false;
+    }
+
+    // Probing relies on there being an empty slot, so the tile count
+    // has to match the slots actually in use.
+    auto slots = GetIndexSlots();
+    uint64_t usedSlots = 0;
+    for (uint64_t slot = 0; slot < header->SlotCount; slot++)
+    {
+        usedSlots += slots[slot].Offset != 0 ? 1 : 0;
+    }
+    return usedSlots == header->TileCount;
+}
+
+StoredImage ReadStoredImage(std::wstring const& directory, std::vector<uint8_t> const& manifest, std::shared_ptr<ThreadPool> const& threadPool)
+{
+    TraceScope trace("ReadStoredImage");
+    TileManifestHeader header = {};
+    if (manifest.size() < sizeof(header))
+    {
+        throw winrt::hresult_invalid_argument(L"Malformed tile manifest!");
+    }
+    memcpy(&header, manifest.data(), sizeof(header));
+    if (header.Magic != TileManifestHeader::ExpectedMagic || header.Version != TileManifestHeader::CurrentVersion ||
+        header.TileSize == 0 || header.TileSize > UINT16_MAX || header.Width > UINT32_MAX / 4)
+    {
+        throw winrt::hresult_invalid_argument(L"Malformed tile manifest!");
+    }
+    auto columnCount = (static_cast<uint64_t>(header.Width) + header.TileSize - 1) / header.TileSize;
+    auto rowCount = (static_cast<uint64_t>(header.Height) + header.TileSize - 1) / header.TileSize;
+    auto tileCount = columnCount * rowCount;
+    if (tileCount > UINT32_MAX || manifest.size() != sizeof(header) + tileCount * sizeof(uint64_t))
+    {
+        throw winrt::hresult_invalid_argument(L"Malformed tile manifest!");
+    }
+
+    // Map the whole pack, there may be someone appending to it.
+    auto packPath = (std::filesystem::path(directory) / L"tiles.pack").wstring();
+    wil::unique_hfile pack(CreateFileW(packPath.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr));
+    if (!pack)
+    {
+        winrt::throw_last_error();
+    }
+    auto packSize = QueryFileSize(pack.get());
+    if (packSize < sizeof(TilePackHeader))
+    {
+        throw winrt::hresult_invalid_argument(L"The tile store's pack is damaged!");
+    }
+    wil::unique_handle mapping(CreateFileMappingW(pack.get(), nullptr, PAGE_READONLY, 0, 0, nullptr));
+    winrt::check_bool(static_cast<bool>(mapping));
+    wil::unique_mapview_ptr<uint8_t> view(static_cast<uint8_t*>(MapViewOfFile(mapping.get(), FILE_MAP_READ, 0, 0, 0)));
+    winrt::check_bool(static_cast<bool>(view));
+    auto packData = view.get();
+
+    StoredImage image = {};
+    image.Width = header.Width;
+    image.Height = header.Height;
+    auto stride = static_cast<size_t>(header.Width) * 4;
+    image.Pixels.resize(stride * header.Height);
+    threadPool->ParallelFor(static_cast<uint32_t>(tileCount), [&](uint32_t index)
+        {
+            uint64_t offset = 0;
+            memcpy(&offset, manifest.data() + sizeof(header) + static_cast<size_t>(index) * sizeof(offset), sizeof(offset));
+            auto x = static_cast<uint32_t>(index % columnCount) * header.TileSize;
+            auto y = static_cast<uint32_t>(index / columnCount) * header.TileSize;
+            auto width = std::min(header.TileSize, header.Width - x);
+            auto height = std::min(header.TileSize, header.Height - y);
+
+            TileRecordHeader record = {};
+            if (offset < sizeof(TilePackHeader) || offset > packSize || packSize - offset < sizeof(record))
+            {
+                throw winrt::hresult_invalid_argument(L"The manifest points outside of the tile store!");
+            }
+            memcpy(&record, packData + offset, sizeof(record));
+            if (record.Magic != TileRecordHeader::ExpectedMagic ||
+                record.Width != width ||
+                record.Height != height ||
+                record.Size > packSize - offset - sizeof(record))
+            {
+                throw winrt::hresult_invalid_argument(L"A tile in the pack is damaged!");
+            }
+
+            auto destination = image.Pixels.data() + static_cast<size_t>(y) * stride + static_cast<size_t>(x) * 4;
+            DecodeQoiTile(packData + offset + sizeof(record), record.Size, destination, stride, width, height);
+            if (!(ComputeTileKey(destination, static_cast<uint32_t>(stride), width, height) == TileKey{ record.Hash, record.Check, record.Width, record.Height }))
+            {
+                throw winrt::hresult_invalid_argument(L"A tile in the pack doesn't match its key!");
+            }
+        });
+    return image;
+}
@@ -0,0 +1,121 @@
+#pragma once
+#include "ImageEncoder.h"
+#include "ThreadPool.h"
+
+// What a tile is stored under: its hash, a CRC-32 of its pixels as a second
+// opinion, and its size, since tiles on the right and bottom edges are
+// smaller.
+struct TileKey
+{
+    uint64_t Hash = 0;
+    uint32_t Check = 0;
+    uint16_t Width = 0;
+    uint16_t Height = 0;
+
+    bool operator==(TileKey const& other) const { return Hash == other.Hash && Check == other.Check && Width == other.Width && Height == other.Height; }
+};
+
+// Written at the start of every tile in the pack file, little endian. The
+// tile follows as a QOI image of Size bytes.
+struct TileRecordHeader
+{
+    // "TILE" in the file
+    static constexpr uint32_t ExpectedMagic = 'ELIT';
+
+    uint32_t Magic = ExpectedMagic;
+    uint32_t Size = 0;
+    uint64_t Hash = 0;
+    uint32_t Check = 0;
+    uint16_t Width = 0;
+    uint16_t Height = 0;
+};
+
+// What ImageFormat::Tiles files start with, little endian. It's followed by
+// the pack offset of every tile's record, left to right and top to bottom.
+struct TileManifestHeader
+{
+    // "SSTM" in the file
+    static constexpr uint32_t ExpectedMagic = 'MTSS';
+    static constexpr uint32_t CurrentVersion = 1;
+
+    uint32_t Magic = ExpectedMagic;
+    uint32_t Version = CurrentVersion;
+    uint32_t Width = 0;
+    uint32_t Height = 0;
+    uint32_t TileSize = 0;
+    uint32_t Reserved = 0;
+};
+
+// A content addressed store for screenshots that are mostly the same as
+// earlier ones. Images are split into 64x64 tiles, and only tiles the store
+// hasn't seen before are written, QOI encoded, to tiles.pack, which is only
+// ever appended to. tiles.index is a memory mapped hash table from TileKey
+// to where the tile is in the pack. It's only a cache: anything in the pack
+// it doesn't cover, say after a crash, is indexed again when the store is
+// opened, and it's rebuilt from scratch if it's missing or damaged.
+//
+// Several images may be added at once, from different threads.
+class TileStore
+{
+public:
+    static constexpr uint32_t TileSize = 64;
+
+    TileStore(std::wstring const& directory, std::shared_ptr<ThreadPool> const& threadPool);
+    ~TileStore() {}
+
+    // Adds a BGRA8 image's tiles and writes its manifest, a TileManifestHeader
+    // and the tiles' offsets. Rows are read one row of tiles at a time.
+    void AddImage(
+        uint32_t width,
+        uint32_t height,
+        ImageRowSource& source,
+        std::function<void(uint8_t const*, size_t)> const& write);
+
+    uint64_t NewTiles() const { return m_newTiles; }
+    uint64_t ReusedTiles() const { return m_reusedTiles; }
+    uint64_t PackBytes();
+
+private:
+    // The layout of tiles.index, see TileStore.cpp.
+    struct IndexHeader;
+    struct IndexSlot;
+
+    IndexHeader* GetIndexHeader() const;
+    IndexSlot* GetIndexSlots() const;
+    uint64_t FindTile(TileKey const& key) const;
+    void InsertTile(TileKey const& key, uint64_t offset);
+    std::vector<std::pair<TileKey, uint64_t>> ScanPack(uint64_t offset, uint64_t size);
+    void CreateIndex(uint64_t slotCount, std::vector<std::pair<TileKey, uint64_t>> const& tiles);
+    bool MapIndex();
+
+private:
+    std::shared_ptr<ThreadPool> m_threadPool;
+    std::wstring m_packPath;
+    std::wstring m_indexPath;
+
+    std::mutex m_lock;
+    wil::unique_hfile m_pack;
+    uint64_t m_packSize = 0;
+    wil::unique_hfile m_index;
+    wil::unique_handle m_indexMapping;
+    wil::unique_mapview_ptr<uint8_t> m_indexView;
+    uint64_t m_indexSize = 0;
+
+    std::atomic<uint64_t> m_newTiles = 0;
+    std::atomic<uint64_t> m_reusedTiles = 0;
+};
+
+// A BGRA8 image rebuilt from a TileStore, with tightly packed rows.
+struct StoredImage
+{
+    uint32_t Width = 0;
+    uint32_t Height = 0;
+    std::vector<uint8_t> Pixels;
+};
+
+// Rebuilds the image a manifest describes from the store in directory. Every
+// tile is checked against its key on the way.
+StoredImage ReadStoredImage(std::wstring const& directory, std::vector<uint8_t> const& manifest, std::shared_ptr<ThreadPool> const& threadPool);
+
+// The key a tile is stored under.
+TileKey ComputeTileKey(uint8_t const* pixels, uint32_t stride, uint32_t width, uint32_t height);
@@ -0,0 +1,266 @@
+#include "pch.h"
+#include "TimelapseWriter.h"
+#include "FileWriter.h"
+#include "Checksum.h"
+#include "Trace.h"
+
+constexpr size_t PngSignatureSize = 8;
+// Length, type and CRC
+constexpr size_t ChunkOverhead = 12;
+// Where the delay is in fcTL's data.
+constexpr size_t FrameDelayOffset = 20;
+// Delays are in milliseconds.
+constexpr uint16_t FrameDelayDenominator = 1000;
+// Rows compared with the previous frame per job.
+constexpr uint32_t RowsPerCompareBand = 64;
+
+uint32_t ReadBigEndianUInt32(uint8_t const* data)
+{
+    return (static_cast<uint32_t>(data[0]) << 24) | (static_cast<uint32_t>(data[1]) << 16) | (static_cast<uint32_t>(data[2]) << 8) | data[3];
+}
+
+TimelapseWriter::TimelapseWriter(
+    std::wstring const& fileName,
+    std::shared_ptr<ThreadPool> const& threadPool,
+    PngCompressionPreset preset,
+    std::chrono::milliseconds frameDelay) :
+    m_encoder(threadPool, preset)
+{
+    m_fileName = fileName;
+    m_threadPool = threadPool;
+    m_frameDelay = static_cast<uint16_t>(std::clamp<int64_t>(frameDelay.count(), 0, UINT16_MAX));
+}
+
+void TimelapseWriter::AddFrame(uint8_t const* pixels, uint32_t stride, uint32_t width, uint32_t height)
+{
+    TraceScope trace("AddTimelapseFrame");
+    m_framesAdded++;
+    if (!m_file || width != m_width || height != m_height)
+    {
+        StartFile(width, height);
+    }
+    // Still true if writing the first frame failed.
+    auto isFirstFrame = m_fileFrameCount == 0;
+
+    auto rect = UpdatePreviousFrame(pixels, stride);
+    auto changedPixels = rect.IsEmpty() ? 0 : static_cast<uint64_t>(rect.Right - rect.Left) * (rect.Bottom - rect.Top);
+    m_changedArea.Add(100.0 * changedPixels / (static_cast<uint64_t>(width) * height));
+
+    // The first frame is also the image non-animated viewers show, so it
+    // has to cover everything.
+    if (isFirstFrame)
+    {
+        rect = { 0, 0, width, height };
+    }
+    else if (rect.IsEmpty())
+    {
+        if (ExtendLastFrame())
+        {
+            return;
+        }
+        // The delay can't get any longer, repeat a pixel instead.
+        rect = { 0, 0, 1, 1 };
+    }
+    AppendFrame(pixels, stride, rect);
+}
+
+uint64_t TimelapseWriter::BytesWritten() const
+{
+    return m_finishedFilesSize + (m_fileFrameCount > 0 ? m_endOffset + ChunkOverhead : 0);
+}
+
+void TimelapseWriter::StartFile(uint32_t width, uint32_t height)
+{
+    auto fileName = m_fileName;
+    if (m_file)
+    {
+        m_finishedFilesSize += m_fileFrameCount > 0 ? m_endOffset + ChunkOverhead : 0;
+        std::filesystem::path path(m_fileName);
+        auto newFileName = path.stem().wstring() + L"_" + std::to_wstring(m_fileIndex) + path.extension().wstring();
+        fileName = (path.parent_path() / newFileName).wstring();
+    }
+    m_fileIndex++;
+    m_file.reset(CreateFileW(fileName.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr));
+    winrt::check_bool(static_cast<bool>(m_file));
+
+    m_width = width;
+    m_height = height;
+    // Everything is different from this, UpdatePreviousFrame copies it all.
+    m_previousFrame.assign(static_cast<size_t>(width) * height * 4, 0);
+
+    m_header.clear();
+    AppendHeader(m_header, width, height, PngPixelFormat::Srgb8);
+    m_animationControlOffset = m_header.size();
+    m_fileFrameCount = 0;
+    m_sequenceNumber = 0;
+    std::vector<uint8_t> animationControl;
+    AppendUInt32(animationControl, 1);
+    // Loop forever
+    AppendUInt32(animationControl, 0);
+    AppendChunk(m_header, "acTL", animationControl.data(), animationControl.size());
+    m_endOffset = m_header.size();
+    m_lastFrameControl.clear();
+}
+
+TimelapseWriter::ChangedRect TimelapseWriter::UpdatePreviousFrame(uint8_t const* pixels, uint32_t stride)
+{
+    TraceScope trace("DiffFrame");
+    auto rowSize = static_cast<size_t>(m_width) * 4;
+    auto bandCount = (m_height + RowsPerCompareBand - 1) / RowsPerCompareBand;
+    std::vector<ChangedRect> bandRects(bandCount);
+    m_threadPool->ParallelFor(bandCount, [&](uint32_t band)
+        {
+            auto startRow = band * RowsPerCompareBand;
+            auto endRow = std::min(startRow + RowsPerCompareBand, m_height);
+            auto& bandRect = bandRects[band];
+            for (auto row = startRow; row < endRow; row++)
+            {
+                auto current = pixels + static_cast<size_t>(row) * stride;
+                auto previous = m_previousFrame.data() + row * rowSize;
+                if (memcmp(current, previous, rowSize) == 0)
+                {
+                    continue;
+                }
+                uint32_t left = 0;
+                while (memcmp(current + left * 4, previous + left * 4, 4) == 0)
+                {
+                    left++;
+                }
+                auto right = m_width;
+                while (memcmp(current + (right - 1) * 4, previous + (right - 1) * 4, 4) == 0)
+                {
+                    right--;
+                }
+                memcpy(previous + left * 4, current + left * 4, (right - left) * 4);
+
+                bandRect.Left = std::min(bandRect.Left, left);
+                bandRect.Top = std::min(bandRect.Top, row);
+                bandRect.Right = std::max(bandRect.Right, right);
+                bandRect.Bottom = std::max(bandRect.Bottom, row + 1);
+            }
+        });
+
+    ChangedRect rect;
+    for (auto&& bandRect : bandRects)
+    {
+        if (!bandRect.IsEmpty())
+        {
+            rect.Left = std::min(rect.Left, bandRect.Left);
+            rect.Top = std::min(rect.Top, bandRect.Top);
+            rect.Right = std::max(rect.Right, bandRect.Right);
+            rect.Bottom = std::max(rect.Bottom, bandRect.Bottom);
+        }
+    }
+    return rect;
+}
+
+void TimelapseWriter::AppendFrame(uint8_t const* pixels, uint32_t stride, ChangedRect const& rect)
+{
+    auto width = rect.Right - rect.Left;
+    auto height = rect.Bottom - rect.Top;
+    auto png = m_encoder.Encode(pixels + static_cast<size_t>(rect.Top) * stride + rect.Left * 4, stride, width, height);
+
+    std::vector<uint8_t> output;
+    output.reserve(png.size() + 64);
+    WriteFrameControl(output, rect);
+
+    // All we want from the encoder is its IDAT chunks. The first frame is
+    // the default image and keeps them, later frames put the same data in
+    // fdAT chunks, which start with a sequence number.
+    auto isDefaultImage = m_fileFrameCount == 0;
+    auto offset = PngSignatureSize;
+    while (offset + ChunkOverhead <= png.size())
+    {
+        auto size = ReadBigEndianUInt32(png.data() + offset);
+        auto type = png.data() + offset + 4;
+        auto data = type + 4;
+        if (memcmp(type, "IDAT", 4) == 0)
+        {
+            if (isDefaultImage)
+            {
+                output.insert(output.end(), png.data() + offset, data + size + 4);
+            }
+            else
+            {
+                AppendUInt32(output, size + 4);
+                auto typeStart = output.size();
+                output.insert(output.end(), { 'f', 'd', 'A', 'T' });
+                AppendUInt32(output, m_sequenceNumber++);
+                output.insert(output.end(), data, data + size);
+                AppendUInt32(output, Crc32(output.data() + typeStart, output.size() - typeStart));
+            }
+        }
+        offset += ChunkOverhead + size;
+    }
+
+    // The frame replaces IEND, which goes after it again. The frame count
+    // is updated last, until then readers stop at the previous frame.
+    auto frameSize = output.size();
+    AppendChunk(output, "IEND", nullptr, 0);
+    if (isDefaultImage)
+    {
+        // The header already counts this frame.
+        output.insert(output.begin(), m_header.begin(), m_header.end());
+        WriteFileAt(m_file.get(), 0, output.data(), output.size());
+    }
+    else
+    {
+        WriteFileAt(m_file.get(), m_endOffset, output.data(), output.size());
+    }
+    m_endOffset += frameSize;
+    m_fileFrameCount++;
+    m_framesWritten++;
+    if (!isDefaultImage)
+    {
+        WriteFrameCount();
+    }
+}
+
+bool TimelapseWriter::ExtendLastFrame()
+{
+    auto delay = (static_cast<uint32_t>(m_lastFrameControl[FrameDelayOffset]) << 8) | m_lastFrameControl[FrameDelayOffset + 1];
+    delay += m_frameDelay;
+    if (delay > UINT16_MAX)
+    {
+        return false;
+    }
+    m_lastFrameControl[FrameDelayOffset] = static_cast<uint8_t>(delay >> 8);
+    m_lastFrameControl[FrameDelayOffset + 1] = static_cast<uint8_t>(delay);
+
+    std::vector<uint8_t> chunk;
+    AppendChunk(chunk, "fcTL", m_lastFrameControl.data(), m_lastFrameControl.size());
+    WriteFileAt(m_file.get(), m_lastFrameControlOffset, chunk.data(), chunk.size());
+    return true;
+}
+
+void TimelapseWriter::WriteFrameControl(std::vector<uint8_t>& output, ChangedRect const& rect)
+{
+    std::vector<uint8_t> frameControl;
+    AppendUInt32(frameControl, m_sequenceNumber++);
+    AppendUInt32(frameControl, rect.Right - rect.Left);
+    AppendUInt32(frameControl, rect.Bottom - rect.Top);
+    AppendUInt32(frameControl, rect.Left);
+    AppendUInt32(frameControl, rect.Top);
+    frameControl.push_back(static_cast<uint8_t>(m_frameDelay >> 8));
+    frameControl.push_back(static_cast<uint8_t>(m_frameDelay));
+    frameControl.push_back(static_cast<uint8_t>(FrameDelayDenominator >> 8));
+    frameControl.push_back(static_cast<uint8_t>(FrameDelayDenominator));
+    // Leave the frame in place for the next one to draw over
+    frameControl.push_back(0);
+    // Replace what's under the frame rather than blending, ours are opaque
+    frameControl.push_back(0);
+
+    m_lastFrameControlOffset = m_endOffset + output.size();
+    m_lastFrameControl = frameControl;
+    AppendChunk(output, "fcTL", frameControl.data(), frameControl.size());
+}
+
+void TimelapseWriter::WriteFrameCount()
+{
+    std::vector<uint8_t> animationControl;
+    AppendUInt32(animationControl, m_fileFrameCount);
+    AppendUInt32(animationControl, 0);
+    std::vector<uint8_t> chunk;
+    AppendChunk(chunk, "acTL", animationControl.data(), animationControl.size());
+    WriteFileAt(m_file.get(), m_animationControlOffset, chunk.data(), chunk.size());
+}
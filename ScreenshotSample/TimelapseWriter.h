@@ -0,0 +1,83 @@
+#pragma once
+#include "PngEncoder.h"
+#include "Statistics.h"
+
+// Appends BGRA8 frames to one animated PNG (APNG). Every frame after the
+// first only holds the rectangle that changed since the frame before it,
+// drawn over it, so only that rectangle is filtered and deflated. Frames
+// that didn't change at all make the previous frame last longer instead.
+// Only the previous frame is kept in memory.
+//
+// The file is a complete APNG after every frame: the header goes out with
+// the first frame, then each new frame goes where IEND was, IEND is written
+// after it, and the frame count in acTL is updated last. A crash loses at
+// most the frame being written. If the frames change size, say because a
+// display was added, the timelapse carries on in a new file with _1, _2
+// and so on added to its name.
+class TimelapseWriter
+{
+public:
+    // frameDelay is how long each frame is shown when played back.
+    TimelapseWriter(
+        std::wstring const& fileName,
+        std::shared_ptr<ThreadPool> const& threadPool,
+        PngCompressionPreset preset,
+        std::chrono::milliseconds frameDelay);
+    ~TimelapseWriter() {}
+
+    void AddFrame(uint8_t const* pixels, uint32_t stride, uint32_t width, uint32_t height);
+
+    // Frames added, and how many of them had changed.
+    uint32_t FrameCount() const { return m_framesAdded; }
+    uint32_t FramesWritten() const { return m_framesWritten; }
+    // The percentage of each frame that changed.
+    Statistics const& ChangedArea() const { return m_changedArea; }
+    // The size of every file so far together.
+    uint64_t BytesWritten() const;
+
+private:
+    struct ChangedRect
+    {
+        uint32_t Left = UINT32_MAX;
+        uint32_t Top = UINT32_MAX;
+        uint32_t Right = 0;
+        uint32_t Bottom = 0;
+
+        bool IsEmpty() const { return Left >= Right; }
+    };
+
+    void StartFile(uint32_t width, uint32_t height);
+    ChangedRect UpdatePreviousFrame(uint8_t const* pixels, uint32_t stride);
+    void AppendFrame(uint8_t const* pixels, uint32_t stride, ChangedRect const& rect);
+    bool ExtendLastFrame();
+    void WriteFrameControl(std::vector<uint8_t>& output, ChangedRect const& rect);
+    void WriteFrameCount();
+
+private:
+    std::wstring m_fileName;
+    std::shared_ptr<ThreadPool> m_threadPool;
+    PngEncoder m_encoder;
+    uint16_t m_frameDelay = 0;
+
+    wil::unique_hfile m_file;
+    uint32_t m_fileIndex = 0;
+    uint32_t m_width = 0;
+    uint32_t m_height = 0;
+    std::vector<uint8_t> m_previousFrame;
+
+    // Written with the first frame, acTL can't say there are no frames.
+    std::vector<uint8_t> m_header;
+    // Where things are in the current file. IEND goes at m_endOffset.
+    uint64_t m_animationControlOffset = 0;
+    uint64_t m_endOffset = 0;
+    uint32_t m_fileFrameCount = 0;
+    uint32_t m_sequenceNumber = 0;
+    // The last fcTL chunk, so its delay can be extended.
+    uint64_t m_lastFrameControlOffset = 0;
+    std::vector<uint8_t> m_lastFrameControl;
+
+    uint32_t m_framesAdded = 0;
+    uint32_t m_framesWritten = 0;
+    uint64_t m_finishedFilesSize = 0;
+    Statistics m_changedArea;
+};
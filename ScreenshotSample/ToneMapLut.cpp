@@ -0,0 +1,395 @@
+#include "pch.h"
+#include "ToneMapLut.h"
+#include "CpuToneMapper.h"
+#include "HalfFloat.h"
+#include "Trace.h"
+
+// scRGB 1.0 is 80 nits, and PQ tops out at 10000 nits.
+constexpr double ScRgbWhiteInNits = 80.0;
+constexpr double PqPeakInNits = 10000.0;
+
+// SMPTE ST 2084 constants
+constexpr double PqM1 = 2610.0 / 16384.0;
+constexpr double PqM2 = 2523.0 / 4096.0 * 128.0;
+constexpr double PqC1 = 3424.0 / 4096.0;
+constexpr double PqC2 = 2413.0 / 4096.0 * 32.0;
+constexpr double PqC3 = 2392.0 / 4096.0 * 32.0;
+
+// Grid coordinates and weights are in 8.8 fixed point.
+constexpr uint32_t FractionBits = 8;
+constexpr uint32_t FractionOne = 1 << FractionBits;
+constexpr uint32_t MaxCoordinate = (ToneMapLut::GridSize - 1) << FractionBits;
+constexpr uint32_t StrideR = ToneMapLut::GridSize * ToneMapLut::GridSize;
+constexpr uint32_t StrideG = ToneMapLut::GridSize;
+constexpr uint32_t StrideB = 1;
+constexpr uint32_t EntryCount = ToneMapLut::GridSize * ToneMapLut::GridSize * ToneMapLut::GridSize;
+constexpr uint32_t ShaperSize = 65536 + 1;
+// Entries hold B, G and R in 8.2 fixed point, 10 bits each.
+constexpr uint32_t EntryChannelBits = 10;
+constexpr uint32_t EntryChannelMask = (1 << EntryChannelBits) - 1;
+constexpr uint32_t MaxEntryValue = 255 << 2;
+// Scaling the entries by weights of up to 1.0 in 8.8 fixed point
+// takes 18 bits, so the scalar path gives each channel 21.
+constexpr uint32_t WideChannelBits = 21;
+constexpr uint32_t ResultShift = FractionBits + 2;
+
+constexpr uint32_t LutFileMagic = 0x544c4d54; // 'TMLT'
+
+struct LutFileHeader
+{
+    uint32_t Magic;
+    uint32_t Version;
+    uint32_t GridSize;
+    float SdrWhiteLevelInNits;
+    float MaxLuminance;
+};
+
+double PqEncode(double nits)
+{
+    auto y = std::clamp(nits / PqPeakInNits, 0.0, 1.0);
+    auto p = std::pow(y, PqM1);
+    return std::pow((PqC1 + PqC2 * p) / (1.0 + PqC3 * p), PqM2);
+}
+
+double PqDecode(double value)
+{
+    auto p = std::pow(value, 1.0 / PqM2);
+    auto y = std::pow(std::max(p - PqC1, 0.0) / (PqC2 - PqC3 * p), 1.0 / PqM1);
+    return y * PqPeakInNits;
+}
+
+std::filesystem::path GetLutCachePath(float sdrWhiteLevelInNits, float maxLuminance)
+{
+    std::error_code error;
+    auto directory = std::filesystem::temp_directory_path(error);
+    if (error)
+    {
+        return {};
+    }
+    wchar_t name[64] = {};
+    swprintf_s(name, L"tonemap-v%u-%08x-%08x.lut",
+        ToneMapLut::Version,
+        std::bit_cast<uint32_t>(sdrWhiteLevelInNits),
+        std::bit_cast<uint32_t>(maxLuminance));
+    return directory / L"ScreenshotSample" / name;
+}
+
+std::shared_ptr<ToneMapLut const> ToneMapLut::Get(float sdrWhiteLevelInNits, float maxLuminance)
+{
+    static std::mutex lock;
+    static std::map<std::pair<uint32_t, uint32_t>, std::shared_ptr<ToneMapLut const>> luts;
+
+    auto key = std::make_pair(std::bit_cast<uint32_t>(sdrWhiteLevelInNits), std::bit_cast<uint32_t>(maxLuminance));
+    std::lock_guard guard(lock);
+    auto found = luts.find(key);
+    if (found != luts.end())
+    {
+        return found->second;
+    }
+
+    // The disk cache is only an optimization, so anything going wrong
+    // with it just means we build the table ourselves.
+    std::shared_ptr<ToneMapLut> lut(new ToneMapLut());
+    auto path = GetLutCachePath(sdrWhiteLevelInNits, maxLuminance);
+    if (path.empty() || !lut->Load(path, sdrWhiteLevelInNits, maxLuminance))
+    {
+        lut->Build(sdrWhiteLevelInNits, maxLuminance);
+        if (!path.empty())
+        {
+            lut->Save(path, sdrWhiteLevelInNits, maxLuminance);
+        }
+    }
+    luts.emplace(key, lut);
+    return lut;
+}
+
+void ToneMapLut::Build(float sdrWhiteLevelInNits, float maxLuminance)
+{
+    TraceScope trace("BuildToneMapLut");
+    // Negative channels (colors outside of sRGB) and NaNs land on zero,
+    // anything past 10000 nits on the last grid point.
+    m_shaper.assign(ShaperSize, 0);
+    for (uint32_t bits = 0; bits < 65536; bits++)
+    {
+        auto value = static_cast<double>(HalfToFloat(static_cast<uint16_t>(bits)));
+        if (std::isnan(value) || value <= 0.0)
+        {
+            continue;
+        }
+        auto coordinate = PqEncode(value * ScRgbWhiteInNits) * static_cast<double>(MaxCoordinate);
+        m_shaper[bits] = static_cast<uint16_t>(std::min(coordinate + 0.5, static_cast<double>(MaxCoordinate)));
+    }
+
+    std::array<float, GridSize> gridValues = {};
+    for (uint32_t i = 0; i < GridSize; i++)
+    {
+        auto nits = PqDecode(static_cast<double>(i) / static_cast<double>(GridSize - 1));
+        gridValues[i] = static_cast<float>(nits / ScRgbWhiteInNits);
+    }
+
+    auto params = CpuToneMapper::ComputeParams(sdrWhiteLevelInNits, maxLuminance);
+    m_entries.assign(EntryCount, 0);
+    auto entry = m_entries.data();
+    for (uint32_t r = 0; r < GridSize; r++)
+    {
+        for (uint32_t g = 0; g < GridSize; g++)
+        {
+            for (uint32_t b = 0; b < GridSize; b++)
+            {
+                auto channels = CpuToneMapper::MapPixel(gridValues[r], gridValues[g], gridValues[b], params);
+                uint32_t packed = 0;
+                for (uint32_t i = 0; i < 3; i++)
+                {
+                    auto linear = static_cast<double>(channels[i]);
+                    auto encoded = linear <= 0.0031308 ? linear * 12.92 : 1.055 * std::pow(linear, 1.0 / 2.4) - 0.055;
+                    auto value = static_cast<uint32_t>(std::clamp(encoded * MaxEntryValue + 0.5, 0.0, static_cast<double>(MaxEntryValue)));
+                    packed |= value << (i * EntryChannelBits);
+                }
+                *entry++ = packed;
+            }
+        }
+    }
+}
+
+bool ToneMapLut::Load(std::filesystem::path const& path, float sdrWhiteLevelInNits, float maxLuminance)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+        return false;
+    }
+
+    LutFileHeader header = {};
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!file ||
+        header.Magic != LutFileMagic ||
+        header.Version != Version ||
+        header.GridSize != GridSize ||
+        std::bit_cast<uint32_t>(header.SdrWhiteLevelInNits) != std::bit_cast<uint32_t>(sdrWhiteLevelInNits) ||
+        std::bit_cast<uint32_t>(header.MaxLuminance) != std::bit_cast<uint32_t>(maxLuminance))
+    {
+        return false;
+    }
+
+    std::vector<uint16_t> shaper(ShaperSize);
+    std::vector<uint32_t> entries(EntryCount);
+    file.read(reinterpret_cast<char*>(shaper.data()), shaper.size() * sizeof(uint16_t));
+    file.read(reinterpret_cast<char*>(entries.data()), entries.size() * sizeof(uint32_t));
+    if (!file)
+    {
+        return false;
+    }
+    // Coordinates past the end of the grid would read outside the table.
+    if (std::any_of(shaper.begin(), shaper.end(), [](auto value) { return value > MaxCoordinate; }))
+    {
+        return false;
+    }
+
+    m_shaper = std::move(shaper);
+    m_entries = std::move(entries);
+    return true;
+}
+
+void ToneMapLut::Save(std::filesystem::path const& path, float sdrWhiteLevelInNits, float maxLuminance) const
+{
+    std::error_code error;
+    std::filesystem::create_directories(path.parent_path(), error);
+    if (error)
+    {
+        return;
+    }
+
+    // Write somewhere else first so that another process never
+    // sees a half written table.
+    auto tempPath = path;
+    tempPath += L"." + std::to_wstring(GetCurrentProcessId()) + L".tmp";
+    {
+        std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+        LutFileHeader header = { LutFileMagic, Version, GridSize, sdrWhiteLevelInNits, maxLuminance };
+        file.write(reinterpret_cast<char const*>(&header), sizeof(header));
+        file.write(reinterpret_cast<char const*>(m_shaper.data()), m_shaper.size() * sizeof(uint16_t));
+        file.write(reinterpret_cast<char const*>(m_entries.data()), m_entries.size() * sizeof(uint32_t));
+        if (!file)
+        {
+            file.close();
+            std::filesystem::remove(tempPath, error);
+            return;
+        }
+    }
+    std::filesystem::rename(tempPath, path, error);
+    if (error)
+    {
+        std::filesystem::remove(tempPath, error);
+    }
+}
+
+void ToneMapLut::ProcessRow(uint16_t const* hdrRow, uint8_t* sdrRow, uint32_t width, bool useSimd) const
+{
+#if defined(_M_X64) || defined(_M_IX86)
+    if (useSimd)
+    {
+        ProcessRowAvx2(hdrRow, sdrRow, width);
+        return;
+    }
+#else
+    UNREFERENCED_PARAMETER(useSimd);
+#endif
+    ProcessRowScalar(hdrRow, sdrRow, width);
+}
+
+// Per pixel we look up the grid coordinate of each channel, split it into a
+// cell and a fraction, and sort the fractions to find the tetrahedron:
+//   v0 = cell, v1 = v0 + step(largest), v2 = v3 - step(smallest), v3 = v0 + all steps
+//   out = v0 * (1 - max) + v1 * (max - mid) + v2 * (mid - min) + v3 * min
+// Ties pick R before G before B for the largest fraction and B before G
+// before R for the smallest, so the two steps are never the same axis.
+void ToneMapLut::ProcessRowScalar(uint16_t const* hdrRow, uint8_t* sdrRow, uint32_t width) const
+{
+    auto shaper = m_shaper.data();
+    auto entries = m_entries.data();
+    for (uint32_t x = 0; x < width; x++)
+    {
+        uint32_t cells[3] = {};
+        int32_t fractions[3] = {};
+        for (uint32_t i = 0; i < 3; i++)
+        {
+            uint32_t coordinate = shaper[hdrRow[x * 4 + i]];
+            auto cell = std::min(coordinate >> FractionBits, GridSize - 2);
+            cells[i] = cell;
+            fractions[i] = static_cast<int32_t>(coordinate - (cell << FractionBits));
+        }
+        auto fr = fractions[0];
+        auto fg = fractions[1];
+        auto fb = fractions[2];
+
+        auto maxFraction = std::max(std::max(fr, fg), fb);
+        auto minFraction = std::min(std::min(fr, fg), fb);
+        auto midFraction = ((fr + fg) + fb) - maxFraction - minFraction;
+        auto stepMax = (fr >= fg && fr >= fb) ? StrideR : (fg >= fb ? StrideG : StrideB);
+        auto stepMin = (fb <= fg && fb <= fr) ? StrideB : (fg <= fr ? StrideG : StrideR);
+
+        auto v0 = cells[0] * StrideR + cells[1] * StrideG + cells[2] * StrideB;
+        auto v3 = v0 + StrideR + StrideG + StrideB;
+        uint32_t vertices[4] = { v0, v0 + stepMax, v3 - stepMin, v3 };
+        int32_t weights[4] = { static_cast<int32_t>(FractionOne) - maxFraction, maxFraction - midFraction, midFraction - minFraction, minFraction };
+
+        // Spread the channels out so one multiply scales all three.
+        uint64_t sum = 0;
+        for (uint32_t corner = 0; corner < 4; corner++)
+        {
+            auto entry = entries[vertices[corner]];
+            auto wide =
+                static_cast<uint64_t>(entry & EntryChannelMask) |
+                (static_cast<uint64_t>((entry >> EntryChannelBits) & EntryChannelMask) << WideChannelBits) |
+                (static_cast<uint64_t>(entry >> (EntryChannelBits * 2)) << (WideChannelBits * 2));
+            sum += wide * static_cast<uint64_t>(weights[corner]);
+        }
+
+        auto pixel = sdrRow + x * 4;
+        for (uint32_t i = 0; i < 3; i++)
+        {
+            auto channel = static_cast<uint32_t>((sum >> (i * WideChannelBits)) & ((1u << WideChannelBits) - 1));
+            pixel[i] = static_cast<uint8_t>((channel + (1 << (ResultShift - 1))) >> ResultShift);
+        }
+        pixel[3] = 255;
+    }
+}
+
+#if defined(_M_X64) || defined(_M_IX86)
+void ToneMapLut::ProcessRowAvx2(uint16_t const* hdrRow, uint8_t* sdrRow, uint32_t width) const
+{
+    auto shaper = reinterpret_cast<int const*>(m_shaper.data());
+    auto entries = reinterpret_cast<int const*>(m_entries.data());
+    auto lowMask = _mm256_set1_epi32(0xffff);
+    auto fractionOne = _mm256_set1_epi32(FractionOne);
+    auto lastCell = _mm256_set1_epi32(GridSize - 2);
+    auto strideR = _mm256_set1_epi32(StrideR);
+    auto strideG = _mm256_set1_epi32(StrideG);
+    auto strideB = _mm256_set1_epi32(StrideB);
+    auto strideAll = _mm256_set1_epi32(StrideR + StrideG + StrideB);
+    auto channelMask = _mm256_set1_epi32(EntryChannelMask);
+    auto rounding = _mm256_set1_epi32(1 << (ResultShift - 1));
+    auto alpha = _mm256_set1_epi32(static_cast<int>(0xff000000));
+    // After the transpose below, lane i holds pixel { 0, 2, 4, 6, 1, 3, 5, 7 }[i].
+    auto toPixelOrder = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+
+    auto splitCoordinate = [&](__m256i coordinate, __m256i& cell, __m256i& fraction)
+    {
+        cell = _mm256_min_epi32(_mm256_srli_epi32(coordinate, FractionBits), lastCell);
+        fraction = _mm256_sub_epi32(coordinate, _mm256_slli_epi32(cell, FractionBits));
+    };
+
+    uint32_t x = 0;
+    for (; x + 8 <= width; x += 8)
+    {
+        // Widen two RGBA pixels at a time to 32 bits per channel.
+        auto source = reinterpret_cast<__m128i const*>(hdrRow + x * 4);
+        auto p01 = _mm256_castsi256_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128(source + 0)));
+        auto p23 = _mm256_castsi256_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128(source + 1)));
+        auto p45 = _mm256_castsi256_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128(source + 2)));
+        auto p67 = _mm256_castsi256_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128(source + 3)));
+
+        // Transpose to one register per channel.
+        auto rg0 = _mm256_unpacklo_ps(p01, p23);
+        auto ba0 = _mm256_unpackhi_ps(p01, p23);
+        auto rg1 = _mm256_unpacklo_ps(p45, p67);
+        auto ba1 = _mm256_unpackhi_ps(p45, p67);
+        auto r = _mm256_castps_si256(_mm256_shuffle_ps(rg0, rg1, _MM_SHUFFLE(1, 0, 1, 0)));
+        auto g = _mm256_castps_si256(_mm256_shuffle_ps(rg0, rg1, _MM_SHUFFLE(3, 2, 3, 2)));
+        auto b = _mm256_castps_si256(_mm256_shuffle_ps(ba0, ba1, _MM_SHUFFLE(1, 0, 1, 0)));
+
+        // The shaper has a padding entry, so the 32-bit gather of the last
+        // 16-bit value stays inside the table.
+        __m256i cellR, cellG, cellB, fr, fg, fb;
+        splitCoordinate(_mm256_and_si256(_mm256_i32gather_epi32(shaper, r, 2), lowMask), cellR, fr);
+        splitCoordinate(_mm256_and_si256(_mm256_i32gather_epi32(shaper, g, 2), lowMask), cellG, fg);
+        splitCoordinate(_mm256_and_si256(_mm256_i32gather_epi32(shaper, b, 2), lowMask), cellB, fb);
+
+        auto maxFraction = _mm256_max_epi32(_mm256_max_epi32(fr, fg), fb);
+        auto minFraction = _mm256_min_epi32(_mm256_min_epi32(fr, fg), fb);
+        auto midFraction = _mm256_sub_epi32(_mm256_sub_epi32(_mm256_add_epi32(_mm256_add_epi32(fr, fg), fb), maxFraction), minFraction);
+
+        // Masks are all ones where the comparison holds.
+        auto gGreaterR = _mm256_cmpgt_epi32(fg, fr);
+        auto bGreaterR = _mm256_cmpgt_epi32(fb, fr);
+        auto bGreaterG = _mm256_cmpgt_epi32(fb, fg);
+        auto rIsMax = _mm256_andnot_si256(_mm256_or_si256(gGreaterR, bGreaterR), _mm256_set1_epi32(-1));
+        auto stepMax = _mm256_blendv_epi8(_mm256_blendv_epi8(strideG, strideB, bGreaterG), strideR, rIsMax);
+        auto bIsMin = _mm256_andnot_si256(_mm256_or_si256(bGreaterG, bGreaterR), _mm256_set1_epi32(-1));
+        auto stepMin = _mm256_blendv_epi8(_mm256_blendv_epi8(strideG, strideR, gGreaterR), strideB, bIsMin);
+
+        auto v0 = _mm256_add_epi32(_mm256_add_epi32(_mm256_mullo_epi32(cellR, strideR), _mm256_mullo_epi32(cellG, strideG)), cellB);
+        auto v3 = _mm256_add_epi32(v0, strideAll);
+        __m256i vertices[4] = { v0, _mm256_add_epi32(v0, stepMax), _mm256_sub_epi32(v3, stepMin), v3 };
+        __m256i weights[4] =
+        {
+            _mm256_sub_epi32(fractionOne, maxFraction),
+            _mm256_sub_epi32(maxFraction, midFraction),
+            _mm256_sub_epi32(midFraction, minFraction),
+            minFraction,
+        };
+
+        auto sumB = _mm256_setzero_si256();
+        auto sumG = _mm256_setzero_si256();
+        auto sumR = _mm256_setzero_si256();
+        for (uint32_t corner = 0; corner < 4; corner++)
+        {
+            auto entry = _mm256_i32gather_epi32(entries, vertices[corner], 4);
+            sumB = _mm256_add_epi32(sumB, _mm256_mullo_epi32(_mm256_and_si256(entry, channelMask), weights[corner]));
+            sumG = _mm256_add_epi32(sumG, _mm256_mullo_epi32(_mm256_and_si256(_mm256_srli_epi32(entry, EntryChannelBits), channelMask), weights[corner]));
+            sumR = _mm256_add_epi32(sumR, _mm256_mullo_epi32(_mm256_srli_epi32(entry, EntryChannelBits * 2), weights[corner]));
+        }
+        auto outB = _mm256_srli_epi32(_mm256_add_epi32(sumB, rounding), ResultShift);
+        auto outG = _mm256_srli_epi32(_mm256_add_epi32(sumG, rounding), ResultShift);
+        auto outR = _mm256_srli_epi32(_mm256_add_epi32(sumR, rounding), ResultShift);
+        auto pixels = _mm256_or_si256(_mm256_or_si256(outB, _mm256_slli_epi32(outG, 8)), _mm256_or_si256(_mm256_slli_epi32(outR, 16), alpha));
+        pixels = _mm256_permutevar8x32_epi32(pixels, toPixelOrder);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(sdrRow + x * 4), pixels);
+    }
+
+    if (x < width)
+    {
+        ProcessRowScalar(hdrRow + x * 4, sdrRow + x * 4, width - x);
+    }
+}
+#endif
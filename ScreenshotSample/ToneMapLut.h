@@ -0,0 +1,41 @@
+#pragma once
+
+// The whole CpuToneMapper transform baked into a 3D table for one pair of
+// display luminance values. Each FP16 channel goes through a 1D shaper that
+// places it on a PQ shaped grid, and the output is interpolated between the
+// four corners of the tetrahedron the pixel falls into. The scalar and AVX2
+// paths use the same integer math and produce bit-identical output.
+class ToneMapLut
+{
+public:
+    // Grid points per axis.
+    static constexpr uint32_t GridSize = 65;
+    // Bump this whenever CpuToneMapper or the way the table is built changes,
+    // so stale tables on disk are ignored.
+    static constexpr uint32_t Version = 1;
+
+    // Returns the table for these luminance values, building it only if it
+    // isn't in memory or in the disk cache already.
+    static std::shared_ptr<ToneMapLut const> Get(float sdrWhiteLevelInNits, float maxLuminance);
+
+    void ProcessRow(uint16_t const* hdrRow, uint8_t* sdrRow, uint32_t width, bool useSimd) const;
+
+private:
+    ToneMapLut() {}
+
+    void Build(float sdrWhiteLevelInNits, float maxLuminance);
+    bool Load(std::filesystem::path const& path, float sdrWhiteLevelInNits, float maxLuminance);
+    void Save(std::filesystem::path const& path, float sdrWhiteLevelInNits, float maxLuminance) const;
+
+    void ProcessRowScalar(uint16_t const* hdrRow, uint8_t* sdrRow, uint32_t width) const;
+#if defined(_M_X64) || defined(_M_IX86)
+    void ProcessRowAvx2(uint16_t const* hdrRow, uint8_t* sdrRow, uint32_t width) const;
+#endif
+
+private:
+    // Grid coordinate for every half float bit pattern in 8.8 fixed point,
+    // plus one entry of padding for 32-bit gathers.
+    std::vector<uint16_t> m_shaper;
+    // sRGB encoded B, G and R per grid point, packed into 10 bits each.
+    std::vector<uint32_t> m_entries;
+};
@@ -1,13 +1,21 @@
 #include "pch.h"
 #include "ToneMapper.h"
 #include "Options.h"
+#include "Trace.h"
+#include "ScRgb.h"
+#include "CpuFeatures.h"
+#include "LuminanceHistogram.h"
 
 namespace util
 {
     using namespace robmikh::common::uwp;
 }
 
-ToneMapper::ToneMapper(winrt::com_ptr<ID3D11Device> const& d3dDevice)
+ToneMapper::ToneMapper(
+    winrt::com_ptr<ID3D11Device> const& d3dDevice,
+    std::shared_ptr<ThreadPool> const& threadPool,
+    std::shared_ptr<TexturePool> const& texturePool,
+    std::shared_ptr<PixelBufferPool> const& bufferPool)
 {
     auto d2dDebugFlag = D2D1_DEBUG_LEVEL_NONE;
     if (Options::DxDebug())
@@ -19,6 +27,9 @@ ToneMapper::ToneMapper(winrt::com_ptr<ID3D11Device> const& d3dDevice)
     // CreateD2DFactory: https://github.com/robmikh/robmikh.common/blob/f2311df8de56f31410d14f55de7307464d9a673d/robmikh.common/include/robmikh.common/d3dHelpers.h#L81-L89
     // CreateD2DDevice: https://github.com/robmikh/robmikh.common/blob/f2311df8de56f31410d14f55de7307464d9a673d/robmikh.common/include/robmikh.common/d3dHelpers.h#L53-L58
     m_d3dDevice = d3dDevice;
+    m_threadPool = threadPool;
+    m_texturePool = texturePool;
+    m_bufferPool = bufferPool;
     m_d3dDevice->GetImmediateContext(m_d3dContext.put());
     m_d3dMultithread = m_d3dDevice.as<ID3D11Multithread>();
     m_d2dFactory = util::CreateD2DFactory(d2dDebugFlag);
@@ -52,12 +63,39 @@ ToneMapper::ToneMapper(winrt::com_ptr<ID3D11Device> const& d3dDevice)
         winrt::check_hresult(m_d2dContext->CreateColorContextFromDxgiColorSpace(DXGI_COLOR_SPACE_RGB_FULL_G22_NONE_P709, outputColorContext.put()));
         winrt::check_hresult(m_colorManagementEffect->SetValue(D2D1_COLORMANAGEMENT_PROP_DESTINATION_COLOR_CONTEXT, outputColorContext.get()));
     }
+
+    // Setup the CPU tone mapper if it was asked for
+    auto toneMapperType = Options::ToneMapper();
+    if (toneMapperType != ToneMapperType::D2D)
+    {
+        auto useSimd = toneMapperType == ToneMapperType::Cpu || toneMapperType == ToneMapperType::Lut;
+        auto useLut = toneMapperType == ToneMapperType::Lut || toneMapperType == ToneMapperType::LutScalar;
+        m_cpuToneMapper = std::make_unique<CpuToneMapper>(threadPool, useSimd, useLut);
+    }
+
+    m_measurePeak = Options::MeasurePeak();
+    auto&& features = CpuFeatures::Get();
+    m_scaleWithSimd = m_cpuToneMapper ? m_cpuToneMapper->UsesSimd() : features.AVX2 && features.F16C;
 }
 
 winrt::com_ptr<ID3D11Texture2D> ToneMapper::ProcessTexture(winrt::com_ptr<ID3D11Texture2D> const& hdrTexture, float sdrWhiteLevelInNits, float maxLuminance)
+{
+    if (m_measurePeak)
+    {
+        return ProcessTextureMeasured(hdrTexture, sdrWhiteLevelInNits, maxLuminance);
+    }
+    if (m_cpuToneMapper)
+    {
+        return ProcessTextureWithCpu(hdrTexture, sdrWhiteLevelInNits, maxLuminance);
+    }
+    return ProcessTextureWithD2D(hdrTexture, sdrWhiteLevelInNits, maxLuminance);
+}
+
+winrt::com_ptr<ID3D11Texture2D> ToneMapper::ProcessTextureWithD2D(winrt::com_ptr<ID3D11Texture2D> const& hdrTexture, float sdrWhiteLevelInNits, float maxLuminance)
 {
     // The D3D11DeviceLock RAII wrapper can be found here:
     // https://github.com/robmikh/robmikh.common/blob/f2311df8de56f31410d14f55de7307464d9a673d/robmikh.common/include/robmikh.common/d3dHelpers.h#L30-L46
+    TraceScope trace("ToneMapD2D");
     auto multithreadLock = util::D3D11DeviceLock(m_d3dMultithread.get());
 
     D3D11_TEXTURE2D_DESC desc = {};
@@ -93,19 +131,14 @@ winrt::com_ptr<ID3D11Texture2D> ToneMapper::ProcessTexture(winrt::com_ptr<ID3D11
     winrt::com_ptr<ID2D1Image> effectImage;
     m_colorManagementEffect->GetOutput(effectImage.put());
 
-    // Create our output texture
-    winrt::com_ptr<ID3D11Texture2D> outputTexture;
+    // Get our output texture, and a render target for it
     desc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
     desc.Usage = D3D11_USAGE_DEFAULT;
     desc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_RENDER_TARGET;
     desc.CPUAccessFlags = 0;
     desc.MiscFlags = 0;
-    winrt::check_hresult(m_d3dDevice->CreateTexture2D(&desc, nullptr, outputTexture.put()));
-
-    // Create a render target
-    auto outputDxgiSurface = outputTexture.as<IDXGISurface>();
-    winrt::com_ptr<ID2D1Bitmap1> d2dTargetBitmap;
-    winrt::check_hresult(m_d2dContext->CreateBitmapFromDxgiSurface(outputDxgiSurface.get(), nullptr, d2dTargetBitmap.put()));
+    auto outputTexture = m_texturePool->Acquire(desc);
+    auto d2dTargetBitmap = m_texturePool->GetTargetBitmap(m_d2dContext.get(), outputTexture);
 
     // Set the render target as our current target
     m_d2dContext->SetTarget(d2dTargetBitmap.get());
@@ -120,3 +153,135 @@ winrt::com_ptr<ID3D11Texture2D> ToneMapper::ProcessTexture(winrt::com_ptr<ID3D11
 
     return outputTexture;
 }
+
+winrt::com_ptr<ID3D11Texture2D> ToneMapper::ProcessTextureWithCpu(winrt::com_ptr<ID3D11Texture2D> const& hdrTexture, float sdrWhiteLevelInNits, float maxLuminance)
+{
+    // Tone map straight out of the mapped staging texture. The conversion
+    // itself doesn't touch D3D, so it doesn't need the device lock.
+    MappedTexture hdrPixels;
+    {
+        TraceScope trace("CopyBytesFromTexture");
+        hdrPixels = m_texturePool->MapTexture(hdrTexture);
+    }
+    return ProcessPixelsWithCpu(hdrPixels, sdrWhiteLevelInNits, maxLuminance);
+}
+
+winrt::com_ptr<ID3D11Texture2D> ToneMapper::ProcessPixelsWithCpu(MappedTexture const& hdrPixels, float sdrWhiteLevelInNits, float maxLuminance)
+{
+    auto&& desc = hdrPixels.Desc();
+    auto sdrPixels = m_bufferPool->Acquire(desc.Width, desc.Height, 4);
+    {
+        TraceScope trace("ToneMapCpu");
+        m_cpuToneMapper->Process(
+            reinterpret_cast<uint16_t const*>(hdrPixels.Data()),
+            hdrPixels.RowPitch(),
+            sdrPixels.Data(),
+            sdrPixels.Stride(),
+            desc.Width,
+            desc.Height,
+            sdrWhiteLevelInNits,
+            maxLuminance);
+    }
+    return UploadSdrPixels(desc, sdrPixels);
+}
+
+winrt::com_ptr<ID3D11Texture2D> ToneMapper::ProcessTextureMeasured(winrt::com_ptr<ID3D11Texture2D> const& hdrTexture, float sdrWhiteLevelInNits, float maxLuminance)
+{
+    MappedTexture hdrPixels;
+    {
+        TraceScope trace("CopyBytesFromTexture");
+        hdrPixels = m_texturePool->MapTexture(hdrTexture);
+    }
+    auto&& desc = hdrPixels.Desc();
+
+    LuminanceHistogram histogram;
+    {
+        TraceScope trace("MeasureLuminance");
+        histogram = LuminanceHistogram::Measure(*m_threadPool, reinterpret_cast<uint16_t const*>(hdrPixels.Data()), hdrPixels.RowPitch(), desc.Width, desc.Height);
+    }
+
+    // Usually nothing on screen is brighter than SDR white, and the curve
+    // would pass every pixel through anyway. All that's left to do then is
+    // the white level scale and the sRGB encoding.
+    auto params = CpuToneMapper::ComputeParams(sdrWhiteLevelInNits, histogram.MaxInNits());
+    if (params.CurveInputScale == 0.0f)
+    {
+        m_scaledFrames++;
+        auto sdrPixels = m_bufferPool->Acquire(desc.Width, desc.Height, 4);
+        {
+            TraceScope trace("ScaleCpu");
+            m_threadPool->ParallelFor(desc.Height, [&](uint32_t row)
+                {
+                    CpuToneMapper::ScaleRow(reinterpret_cast<uint16_t const*>(hdrPixels.Row(row)), sdrPixels.Row(row), desc.Width, params, m_scaleWithSimd);
+                });
+        }
+        return UploadSdrPixels(desc, sdrPixels);
+    }
+
+    // Otherwise map what's actually there rather than everything the
+    // display could show. Anything brighter than that gets clipped by
+    // the display, so it's still the limit.
+    m_toneMappedFrames++;
+    auto peak = histogram.PeakInNits();
+    if (maxLuminance > 0.0f)
+    {
+        peak = std::min(peak, maxLuminance);
+    }
+    if (m_cpuToneMapper)
+    {
+        return ProcessPixelsWithCpu(hdrPixels, sdrWhiteLevelInNits, peak);
+    }
+    return ProcessTextureWithD2D(hdrTexture, sdrWhiteLevelInNits, peak);
+}
+
+winrt::com_ptr<ID3D11Texture2D> ToneMapper::UploadSdrPixels(D3D11_TEXTURE2D_DESC desc, PixelBuffer const& sdrPixels)
+{
+    // Get our output texture and upload the pixels
+    desc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
+    desc.Usage = D3D11_USAGE_DEFAULT;
+    desc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_RENDER_TARGET;
+    desc.CPUAccessFlags = 0;
+    desc.MiscFlags = 0;
+    auto outputTexture = m_texturePool->Acquire(desc);
+    {
+        auto multithreadLock = util::D3D11DeviceLock(m_d3dMultithread.get());
+        m_d3dContext->UpdateSubresource(outputTexture.get(), 0, nullptr, sdrPixels.Data(), sdrPixels.Stride(), 0);
+    }
+
+    return outputTexture;
+}
+
+winrt::com_ptr<ID3D11Texture2D> ToneMapper::ExpandSdrTexture(winrt::com_ptr<ID3D11Texture2D> const& sdrTexture)
+{
+    D3D11_TEXTURE2D_DESC desc = {};
+    sdrTexture->GetDesc(&desc);
+
+    MappedTexture sdrPixels;
+    {
+        TraceScope trace("CopyBytesFromTexture");
+        sdrPixels = m_texturePool->MapTexture(sdrTexture);
+    }
+
+    auto hdrPixels = m_bufferPool->Acquire(desc.Width, desc.Height, 8);
+    {
+        TraceScope trace("ExpandSdr");
+        m_threadPool->ParallelFor(desc.Height, [&](uint32_t row)
+            {
+                ConvertSrgbRowToScRgb(sdrPixels.Row(row), reinterpret_cast<uint16_t*>(hdrPixels.Row(row)), desc.Width);
+            });
+    }
+
+    // Get our output texture and upload the pixels
+    desc.Format = DXGI_FORMAT_R16G16B16A16_FLOAT;
+    desc.Usage = D3D11_USAGE_DEFAULT;
+    desc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_RENDER_TARGET;
+    desc.CPUAccessFlags = 0;
+    desc.MiscFlags = 0;
+    auto outputTexture = m_texturePool->Acquire(desc);
+    {
+        auto multithreadLock = util::D3D11DeviceLock(m_d3dMultithread.get());
+        m_d3dContext->UpdateSubresource(outputTexture.get(), 0, nullptr, hdrPixels.Data(), hdrPixels.Stride(), 0);
+    }
+
+    return outputTexture;
+}
@@ -1,13 +1,42 @@
 #pragma once
+#include "CpuToneMapper.h"
+#include "ThreadPool.h"
+#include "TexturePool.h"
+#include "PixelBuffer.h"
 
 class ToneMapper
 {
 public:
-    ToneMapper(winrt::com_ptr<ID3D11Device> const& d3dDevice);
+    ToneMapper(
+        winrt::com_ptr<ID3D11Device> const& d3dDevice,
+        std::shared_ptr<ThreadPool> const& threadPool,
+        std::shared_ptr<TexturePool> const& texturePool,
+        std::shared_ptr<PixelBufferPool> const& bufferPool);
     ~ToneMapper() {}
 
     winrt::com_ptr<ID3D11Texture2D> ProcessTexture(winrt::com_ptr<ID3D11Texture2D> const& hdrTexture, float sdrWhiteLevelInNits, float maxLuminance);
 
+    // The other way around for -keepHDR: converts a BGRA8 capture of an SDR
+    // display to FP16 scRGB, so it can be composed with the HDR ones.
+    winrt::com_ptr<ID3D11Texture2D> ExpandSdrTexture(winrt::com_ptr<ID3D11Texture2D> const& sdrTexture);
+
+    // Where our output textures come from. Hand them back once they've
+    // been composed.
+    std::shared_ptr<TexturePool> const& Pool() const { return m_texturePool; }
+
+    // With -measurePeak, how many captures fit under the SDR white level
+    // and were only scaled, and how many went through the curve.
+    uint64_t ScaledFrames() const { return m_scaledFrames; }
+    uint64_t ToneMappedFrames() const { return m_toneMappedFrames; }
+
+private:
+    winrt::com_ptr<ID3D11Texture2D> ProcessTextureWithD2D(winrt::com_ptr<ID3D11Texture2D> const& hdrTexture, float sdrWhiteLevelInNits, float maxLuminance);
+    winrt::com_ptr<ID3D11Texture2D> ProcessTextureWithCpu(winrt::com_ptr<ID3D11Texture2D> const& hdrTexture, float sdrWhiteLevelInNits, float maxLuminance);
+    winrt::com_ptr<ID3D11Texture2D> ProcessPixelsWithCpu(MappedTexture const& hdrPixels, float sdrWhiteLevelInNits, float maxLuminance);
+    // Measures the capture first, see LuminanceHistogram.
+    winrt::com_ptr<ID3D11Texture2D> ProcessTextureMeasured(winrt::com_ptr<ID3D11Texture2D> const& hdrTexture, float sdrWhiteLevelInNits, float maxLuminance);
+    winrt::com_ptr<ID3D11Texture2D> UploadSdrPixels(D3D11_TEXTURE2D_DESC desc, PixelBuffer const& sdrPixels);
+
 private:
     winrt::com_ptr<ID3D11Device> m_d3dDevice;
     winrt::com_ptr<ID3D11DeviceContext> m_d3dContext;
@@ -19,4 +48,13 @@ private:
     winrt::com_ptr<ID2D1Effect> m_sdrWhiteScaleEffect;
     winrt::com_ptr<ID2D1Effect> m_hdrTonemapEffect;
     winrt::com_ptr<ID2D1Effect> m_colorManagementEffect;
+
+    std::shared_ptr<ThreadPool> m_threadPool;
+    std::shared_ptr<TexturePool> m_texturePool;
+    std::shared_ptr<PixelBufferPool> m_bufferPool;
+    std::unique_ptr<CpuToneMapper> m_cpuToneMapper;
+    bool m_measurePeak = false;
+    bool m_scaleWithSimd = false;
+    std::atomic<uint64_t> m_scaledFrames = 0;
+    std::atomic<uint64_t> m_toneMappedFrames = 0;
 };
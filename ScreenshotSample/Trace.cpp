@@ -0,0 +1,158 @@
+#include "pch.h"
+#include "Trace.h"
+
+std::atomic<bool> Trace::s_enabled = false;
+
+struct TraceEvent
+{
+    char const* Name = nullptr;
+    HMONITOR Display = nullptr;
+    uint32_t ThreadId = 0;
+    std::chrono::steady_clock::time_point Start;
+    std::chrono::steady_clock::time_point End;
+};
+
+// Only the owning thread writes to a buffer. It fills the slot first and
+// then publishes it by bumping Count, so a reader that loads Count sees
+// complete events.
+struct TraceBuffer
+{
+    uint32_t ThreadId = 0;
+    std::string ThreadName;
+    std::vector<TraceEvent> Events;
+    std::atomic<uint64_t> Count = 0;
+};
+
+std::mutex& TraceBuffersLock()
+{
+    static std::mutex lock;
+    return lock;
+}
+
+// Buffers outlive their threads, a thread pool worker that exits
+// early still shows up in the trace.
+std::vector<std::shared_ptr<TraceBuffer>>& TraceBuffers()
+{
+    static std::vector<std::shared_ptr<TraceBuffer>> buffers;
+    return buffers;
+}
+
+TraceBuffer& GetThreadTraceBuffer()
+{
+    thread_local std::shared_ptr<TraceBuffer> buffer;
+    if (!buffer)
+    {
+        buffer = std::make_shared<TraceBuffer>();
+        buffer->ThreadId = GetCurrentThreadId();
+        buffer->Events.resize(Trace::BufferCapacity);
+        std::lock_guard lock(TraceBuffersLock());
+        TraceBuffers().push_back(buffer);
+    }
+    return *buffer;
+}
+
+void Trace::Enable()
+{
+    s_enabled.store(true);
+}
+
+void Trace::SetThreadName(char const* name)
+{
+    if (IsEnabled())
+    {
+        GetThreadTraceBuffer().ThreadName = name;
+    }
+}
+
+void Trace::Record(char const* name, HMONITOR display, uint32_t threadId, std::chrono::steady_clock::time_point start)
+{
+    auto end = std::chrono::steady_clock::now();
+    auto& buffer = GetThreadTraceBuffer();
+    auto count = buffer.Count.load(std::memory_order_relaxed);
+    auto& event = buffer.Events[count % BufferCapacity];
+    event.Name = name;
+    event.Display = display;
+    event.ThreadId = threadId;
+    event.Start = start;
+    event.End = end;
+    buffer.Count.store(count + 1, std::memory_order_release);
+}
+
+void Trace::WriteChromeJson(std::wstring const& path)
+{
+    std::vector<std::shared_ptr<TraceBuffer>> buffers;
+    {
+        std::lock_guard lock(TraceBuffersLock());
+        buffers = TraceBuffers();
+    }
+
+    // Gather the events that are still in the rings.
+    std::vector<TraceEvent> events;
+    uint64_t droppedCount = 0;
+    for (auto&& buffer : buffers)
+    {
+        auto count = buffer->Count.load(std::memory_order_acquire);
+        auto first = count > BufferCapacity ? count - BufferCapacity : 0;
+        droppedCount += first;
+        for (auto index = first; index < count; index++)
+        {
+            events.push_back(buffer->Events[index % BufferCapacity]);
+        }
+    }
+    std::sort(events.begin(), events.end(), [](auto&& a, auto&& b) { return a.Start < b.Start; });
+    auto origin = events.empty() ? std::chrono::steady_clock::time_point() : events.front().Start;
+
+    std::ostringstream json;
+    json << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    auto firstEvent = true;
+    auto separator = [&]()
+    {
+        if (!firstEvent)
+        {
+            json << ",\n";
+        }
+        firstEvent = false;
+    };
+    char line[512] = {};
+    for (auto&& buffer : buffers)
+    {
+        if (!buffer->ThreadName.empty())
+        {
+            separator();
+            sprintf_s(line, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                buffer->ThreadId, buffer->ThreadName.c_str());
+            json << line;
+        }
+    }
+    for (auto&& event : events)
+    {
+        auto start = std::chrono::duration<double, std::micro>(event.Start - origin).count();
+        auto duration = std::chrono::duration<double, std::micro>(event.End - event.Start).count();
+        separator();
+        if (event.Display != nullptr)
+        {
+            sprintf_s(line, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"display\":\"%p\"}}",
+                event.Name, event.ThreadId, start, duration, static_cast<void*>(event.Display));
+        }
+        else
+        {
+            sprintf_s(line, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                event.Name, event.ThreadId, start, duration);
+        }
+        json << line;
+    }
+    json << "\n]}\n";
+
+    std::ofstream file(std::filesystem::path(path), std::ios::binary | std::ios::trunc);
+    file << json.str();
+    if (!file)
+    {
+        wprintf(L"Failed to write the trace to %s\n", path.c_str());
+        return;
+    }
+    wprintf(L"Wrote %zu trace events to %s\n", events.size(), path.c_str());
+    if (droppedCount > 0)
+    {
+        wprintf(L"  %llu older events were overwritten\n", static_cast<unsigned long long>(droppedCount));
+    }
+}
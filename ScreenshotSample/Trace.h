@@ -0,0 +1,64 @@
+#pragma once
+
+// Scoped trace points for finding out where a screenshot's time went. Each
+// thread records into its own ring buffer, so recording never takes a lock.
+// While tracing is off, a TraceScope costs one relaxed atomic load.
+class Trace
+{
+public:
+    // Events recorded per thread before the oldest ones are overwritten.
+    static constexpr uint32_t BufferCapacity = 1 << 16;
+
+    static void Enable();
+    static bool IsEnabled() { return s_enabled.load(std::memory_order_relaxed); }
+
+    // Names the calling thread in the trace.
+    static void SetThreadName(char const* name);
+
+    // Writes everything recorded so far in the Chrome trace event format,
+    // which chrome://tracing and Perfetto can open. Call this once the
+    // traced work is done.
+    static void WriteChromeJson(std::wstring const& path);
+
+private:
+    friend class TraceScope;
+    static void Record(char const* name, HMONITOR display, uint32_t threadId, std::chrono::steady_clock::time_point start);
+
+private:
+    static std::atomic<bool> s_enabled;
+};
+
+// Records the time between construction and destruction. The name is kept as
+// a pointer, so it should be a string literal. Scopes that span a co_await
+// may end on another thread, and are shown on the one they started on.
+class TraceScope
+{
+public:
+    TraceScope(char const* name) : TraceScope(name, nullptr) {}
+    TraceScope(char const* name, HMONITOR display)
+    {
+        if (Trace::IsEnabled())
+        {
+            m_name = name;
+            m_display = display;
+            m_threadId = GetCurrentThreadId();
+            m_start = std::chrono::steady_clock::now();
+        }
+    }
+    ~TraceScope()
+    {
+        if (m_name != nullptr)
+        {
+            Trace::Record(m_name, m_display, m_threadId, m_start);
+        }
+    }
+
+    TraceScope(TraceScope const&) = delete;
+    TraceScope& operator=(TraceScope const&) = delete;
+
+private:
+    char const* m_name = nullptr;
+    HMONITOR m_display = nullptr;
+    uint32_t m_threadId = 0;
+    std::chrono::steady_clock::time_point m_start;
+};
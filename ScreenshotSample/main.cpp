@@ -1,8 +1,22 @@
 ﻿#include "pch.h"
 #include "Display.h"
+#include "DisplayTopology.h"
 #include "Snapshot.h"
 #include "ToneMapper.h"
 #include "Options.h"
+#include "ImageFormats.h"
+#include "Compose.h"
+#include "GraphicsCaptureSource.h"
+#include "SyntheticCaptureSource.h"
+#include "Benchmark.h"
+#include "Output.h"
+#include "PersistentCaptureSource.h"
+#include "IntervalCapture.h"
+#include "Trace.h"
+#include "ScreenshotService.h"
+#include "PerDisplayCapture.h"
+#include "TileStore.h"
+#include "SelfTest.h"
 
 namespace winrt
 {
@@ -20,17 +34,21 @@ namespace util
     using namespace robmikh::common::wcli;
 }
 
-float CLEARCOLOR[] = { 0.0f, 0.0f, 0.0f, 1.0f }; // RGBA
-
-wil::task<winrt::com_ptr<ID3D11Texture2D>> ComposeSnapshotsAsync(
-    winrt::IDirect3DDevice const& device,
-    std::vector<Display> const& displays,
-    std::shared_ptr<ToneMapper> const& toneMapper);
-winrt::IAsyncOperation<winrt::StorageFile> CreateLocalFileAsync(std::wstring const& fileName);
-winrt::IAsyncAction SaveTextureToFileAsync(
-    winrt::com_ptr<ID3D11Texture2D> const& texture,
-    winrt::StorageFile const& file);
 bool ParseOptions(int argc, wchar_t* argv[]);
+void RunServiceClient();
+void ReconstructImage();
+std::wstring GetFlagValue(std::vector<std::wstring> const& args, std::wstring const& flag, std::wstring const& alias);
+
+void PrintTileStoreStats(std::shared_ptr<TileStore> const& store)
+{
+    if (store)
+    {
+        wprintf(L"Tile store: %llu new tiles, %llu reused, %.1f MB packed\n",
+            static_cast<unsigned long long>(store->NewTiles()),
+            static_cast<unsigned long long>(store->ReusedTiles()),
+            store->PackBytes() / (1024.0 * 1024.0));
+    }
+}
 
 winrt::IAsyncAction MainAsync()
 {
@@ -43,14 +61,69 @@ winrt::IAsyncAction MainAsync()
     // These helpers can be found in the robmikh.common package:
     // CreateD3DDevice: https://github.com/robmikh/robmikh.common/blob/f2311df8de56f31410d14f55de7307464d9a673d/robmikh.common/include/robmikh.common/d3dHelpers.h#L68-L79
     // CreateDirect3DDevice: https://github.com/robmikh/robmikh.common/blob/f2311df8de56f31410d14f55de7307464d9a673d/robmikh.common/include/robmikh.common/direct3d11.interop.h#L19-L24
-    auto d3dDevice = util::CreateD3DDevice(d3dFlags);
+    winrt::com_ptr<ID3D11Device> d3dDevice;
+    if (Options::UseWarp())
+    {
+        winrt::check_hresult(D3D11CreateDevice(nullptr, D3D_DRIVER_TYPE_WARP, nullptr, d3dFlags, nullptr, 0, D3D11_SDK_VERSION, d3dDevice.put(), nullptr, nullptr));
+    }
+    else
+    {
+        d3dDevice = util::CreateD3DDevice(d3dFlags);
+    }
     auto device = CreateDirect3DDevice(d3dDevice.as<IDXGIDevice>().get());
 
+    // Create the thread pool used by our CPU paths
+    auto threadPool = std::make_shared<ThreadPool>();
+
+    // Create the pool our textures are recycled through
+    auto texturePool = std::make_shared<TexturePool>(d3dDevice, Options::TexturePoolBytes());
+
+    // And the one for pixels in system memory
+    auto bufferPool = std::make_shared<PixelBufferPool>(Options::TexturePoolBytes());
+
     // Create our tone mapper
-    auto toneMapper = std::make_shared<ToneMapper>(d3dDevice);
+    auto toneMapper = std::make_shared<ToneMapper>(d3dDevice, threadPool, texturePool, bufferPool);
+
+    // Create our encoder
+    ImageEncoderSettings encoderSettings = {};
+    encoderSettings.Compression = Options::Compression();
+    encoderSettings.ExrCompression = Options::ExrCompression();
+    encoderSettings.Grayscale = Options::Grayscale();
+    if (!Options::TileStorePath().empty())
+    {
+        encoderSettings.Store = std::make_shared<TileStore>(Options::TileStorePath(), threadPool);
+    }
+    auto encoder = CreateImageEncoder(Options::Format(), Options::KeepHDR(), threadPool, encoderSettings);
 
-    // Enumerate displays
-    auto displays = Display::GetAllDisplays();
+    if (Options::Benchmark())
+    {
+        co_await RunBenchmarkAsync(d3dDevice, toneMapper, encoder, Options::BenchmarkIterations(), Options::BenchmarkCsvPath());
+        co_return;
+    }
+
+    // Enumerate displays, or make some up
+    std::shared_ptr<DisplayTopology> topology;
+    std::shared_ptr<CaptureSource> captureSource;
+    if (!Options::SyntheticLayout().empty())
+    {
+        auto provider = std::make_unique<FakeDisplayTopologyProvider>(SyntheticCaptureSource::ParseLayout(Options::SyntheticLayout()));
+        topology = std::make_shared<DisplayTopology>(std::move(provider));
+        captureSource = std::make_shared<SyntheticCaptureSource>(d3dDevice);
+    }
+    else
+    {
+        topology = DisplayTopology::System();
+        // Repeated captures, and the service, keep their sessions around between shots.
+        if (Options::CaptureCount() > 1 || !Options::ServePipeName().empty())
+        {
+            captureSource = std::make_shared<PersistentCaptureSource>(device, Options::CaptureBufferCount());
+        }
+        else
+        {
+            captureSource = std::make_shared<GraphicsCaptureSource>(device);
+        }
+    }
+    auto displays = topology->Displays();
     for (auto&& display : displays)
     {
         if (display.IsHDR())
@@ -63,13 +136,112 @@ winrt::IAsyncAction MainAsync()
         }
     }
 
-    // Compose our displays
-    auto composedTexture = co_await ComposeSnapshotsAsync(device, displays, toneMapper);
+    if (!Options::ServePipeName().empty())
+    {
+        co_await RunScreenshotServiceAsync(device, topology, captureSource, toneMapper, threadPool, encoderSettings, Options::ServePipeName());
+        co_return;
+    }
+
+    if (Options::CaptureCount() > 1)
+    {
+        co_await RunIntervalCaptureAsync(device, topology, captureSource, toneMapper, encoder, threadPool, Options::CaptureCount(), Options::CaptureInterval());
+        PrintTileStoreStats(encoderSettings.Store);
+        wprintf(L"Done!\n");
+        co_return;
+    }
+
+    auto baseName = FormatFileName(Options::NamePattern(), 0);
+    std::wstring fileName = baseName + L"." + GetImageFormatInfo(Options::Format()).Extension;
+    if (Options::Sparse())
+    {
+        // Compose our displays, skipping the space between them
+        auto image = co_await ComposeSparseSnapshotsAsync(displays, captureSource, toneMapper);
+
+        // Save the image, and where each display went, to files. Only PNG
+        // can skip the gaps, ParseOptions makes sure that's what we have.
+        auto pngEncoder = std::dynamic_pointer_cast<PngEncoder>(encoder);
+        FileWriter writer(GetLocalFilePath(fileName), Options::FileMode(), pngEncoder->EstimateSize(image.Width, image.Height));
+        pngEncoder->EncodeSparse(image, [&](uint8_t const* data, size_t size)
+            {
+                TraceScope trace("WriteFile");
+                writer.Write(data, size);
+            });
+        writer.Close();
+        auto manifest = image.CreateManifest(fileName);
+        WriteBytesToFile(baseName + L".json", std::vector<uint8_t>(manifest.begin(), manifest.end()));
+    }
+    else if (Options::PerDisplay())
+    {
+        // Encode and save each display as soon as it's captured
+        auto files = co_await SaveDisplaysToFilesAsync(displays, captureSource, toneMapper, threadPool, Options::Format(), encoderSettings, baseName, Options::FileMode(), Options::Region());
+        for (auto&& file : files)
+        {
+            wprintf(L"Saved display %u to %s in %.1f ms\n", file.Index, file.FileName.c_str(), file.Milliseconds);
+        }
+        auto manifest = CreateDisplayManifest(files);
+        WriteBytesToFile(baseName + L".json", std::vector<uint8_t>(manifest.begin(), manifest.end()));
+        if (!files.empty())
+        {
+            fileName = files.front().FileName;
+        }
+    }
+    else if (Options::Strips() || !FitsInTexture(Options::Region().value_or(ComputeUnionRect(displays))))
+    {
+        // Compose and save a band of rows at a time, without a texture for
+        // the whole desktop
+        if (Options::Scale() != 1.0f || !Options::ThumbnailSizes().empty())
+        {
+            throw winrt::hresult_invalid_argument(L"The desktop is too big for one texture, it can't be scaled!");
+        }
+        auto snapshots = co_await TakeSnapshotsAsync(displays, captureSource, toneMapper, Options::Region());
+        {
+            StripComposer composer(*texturePool, snapshots.UnionRect, snapshots.Snapshots);
+            SaveRowsToFile(composer.Width(), composer.Height(), composer, fileName, encoder, Options::FileMode());
+        }
+        RecycleSnapshots(*texturePool, snapshots.Snapshots);
+    }
+    else
+    {
+        // Compose our displays
+        auto composedTexture = co_await ComposeSnapshotsAsync(device, displays, captureSource, toneMapper, Options::Region());
 
-    // Save the texture to a file
-    auto file = co_await CreateLocalFileAsync(L"screenshot.png");
-    co_await SaveTextureToFileAsync(composedTexture, file);
+        if (Options::Scale() == 1.0f && Options::ThumbnailSizes().empty())
+        {
+            // Save the texture to a file
+            SaveTextureToFile(composedTexture, fileName, encoder, *texturePool, Options::FileMode());
+        }
+        else
+        {
+            // Save the scaled image and each thumbnail from one readback
+            D3D11_TEXTURE2D_DESC desc = {};
+            composedTexture->GetDesc(&desc);
+            auto getScaledSize = [](uint32_t size, float scale)
+            {
+                return std::max(static_cast<uint32_t>(std::lround(size * scale)), 1u);
+            };
+            std::vector<ResampledOutput> outputs;
+            outputs.push_back({ fileName, getScaledSize(desc.Width, Options::Scale()), getScaledSize(desc.Height, Options::Scale()), encoder });
+            auto longestEdge = std::max(desc.Width, desc.Height);
+            for (auto&& thumbnailSize : Options::ThumbnailSizes())
+            {
+                // Thumbnails are never bigger than the screenshot.
+                auto scale = std::min(static_cast<float>(thumbnailSize) / static_cast<float>(longestEdge), 1.0f);
+                auto thumbnailFileName = baseName + L"_thumb" + std::to_wstring(thumbnailSize) + L"." + GetImageFormatInfo(Options::Format()).Extension;
+                auto thumbnailEncoder = CreateImageEncoder(Options::Format(), false, threadPool, encoderSettings);
+                outputs.push_back({ thumbnailFileName, getScaledSize(desc.Width, scale), getScaledSize(desc.Height, scale), thumbnailEncoder });
+            }
+            Resampler resampler(threadPool, bufferPool, true);
+            SaveResampledTextureToFiles(composedTexture, outputs, resampler, Options::Filter(), threadPool, *texturePool, *bufferPool, Options::FileMode());
+        }
+    }
+    PrintTileStoreStats(encoderSettings.Store);
     wprintf(L"Done!\n");
+    // Manifests are no use to anything else, -reconstruct them.
+    if (Options::Format() == ImageFormat::Tiles)
+    {
+        co_return;
+    }
+    auto file = co_await winrt::StorageFile::GetFileFromPathAsync(GetLocalFilePath(fileName));
     co_await winrt::Launcher::LaunchFileAsync(file);
 
     co_return;
@@ -88,6 +260,48 @@ int wmain(int argc, wchar_t* argv[])
         return 0;
     }
 
+    // Clients leave everything to the service.
+    if (!Options::ConnectPipeName().empty())
+    {
+        try
+        {
+            RunServiceClient();
+        }
+        catch (winrt::hresult_error const& error)
+        {
+            wprintf(L"Error:\n");
+            wprintf(L"  0x%08x - %s\n", error.code().value, error.message().c_str());
+        }
+        return 0;
+    }
+
+    // So does rebuilding an image from the tile store.
+    if (!Options::ReconstructPath().empty())
+    {
+        try
+        {
+            ReconstructImage();
+        }
+        catch (winrt::hresult_error const& error)
+        {
+            wprintf(L"Error:\n");
+            wprintf(L"  0x%08x - %s\n", error.code().value, error.message().c_str());
+        }
+        return 0;
+    }
+
+    // And checking the SIMD paths, which needs no device at all.
+    if (Options::SelfTest())
+    {
+        return RunSelfTest() ? 0 : 1;
+    }
+
+    if (!Options::ProfilePath().empty())
+    {
+        Trace::Enable();
+        Trace::SetThreadName("Main");
+    }
+
     // Run the sample synchronously
     try
     {
@@ -99,126 +313,75 @@ int wmain(int argc, wchar_t* argv[])
         wprintf(L"  0x%08x - %s\n", error.code().value, error.message().c_str());
     }
 
+    // Write the trace even if we failed, it may tell us why.
+    if (!Options::ProfilePath().empty())
+    {
+        Trace::WriteChromeJson(Options::ProfilePath());
+    }
+
     return 0;
 }
 
-wil::task<winrt::com_ptr<ID3D11Texture2D>> ComposeSnapshotsAsync(
-    winrt::IDirect3DDevice const& device,
-    std::vector<Display> const& displays,
-    std::shared_ptr<ToneMapper> const& toneMapper)
+void RunServiceClient()
 {
-    auto d3dDevice = GetDXGIInterfaceFromObject<ID3D11Device>(device);
-    winrt::com_ptr<ID3D11DeviceContext> d3dContext;
-    d3dDevice->GetImmediateContext(d3dContext.put());
-
-    // Determine the union of all displays
-    RECT unionRect = {};
-    unionRect.left = LONG_MAX;
-    unionRect.top = LONG_MAX;
-    unionRect.right = LONG_MIN;
-    unionRect.bottom = LONG_MIN;
-    for (auto&& display : displays)
+    std::wstring fileName = FormatFileName(Options::NamePattern(), 0) + L"." + GetImageFormatInfo(Options::Format()).Extension;
+    ServiceRequest request = {};
+    if (Options::StopService())
     {
-        auto& displayRect = display.Rect();
-
-        if (unionRect.left > displayRect.left)
-        {
-            unionRect.left = displayRect.left;
-        }
-        if (unionRect.top > displayRect.top)
-        {
-            unionRect.top = displayRect.top;
-        }
-        if (unionRect.right < displayRect.right)
-        {
-            unionRect.right = displayRect.right;
-        }
-        if (unionRect.bottom < displayRect.bottom)
+        request.Command = ServiceCommand::Stop;
+    }
+    else
+    {
+        request.Region = Options::Region();
+        request.Format = Options::Format();
+        if (!Options::InlineOutput())
         {
-            unionRect.bottom = displayRect.bottom;
+            // The service puts it under its own -outDir.
+            request.OutputPath = fileName;
         }
     }
 
-    // Capture each display
-    std::vector<wil::task<Snapshot>> futures;
-    for (auto&& display : displays)
+    auto response = SendServiceRequest(Options::ConnectPipeName(), request);
+    if (response.Result < 0)
     {
-        auto future = Snapshot::TakeAsync(device, display, toneMapper);
-        futures.push_back(std::move(future));
+        auto message = winrt::to_hstring(std::string(response.Bytes.begin(), response.Bytes.end()));
+        throw winrt::hresult_error(response.Result, message);
     }
-
-    // Create the texture we'll compose everything to
-    winrt::com_ptr<ID3D11Texture2D> composedTexture;
-    D3D11_TEXTURE2D_DESC textureDesc = {};
-    textureDesc.Width = static_cast<uint32_t>(unionRect.right - unionRect.left);
-    textureDesc.Height = static_cast<uint32_t>(unionRect.bottom - unionRect.top);
-    textureDesc.MipLevels = 1;
-    textureDesc.ArraySize = 1;
-    textureDesc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
-    textureDesc.SampleDesc.Count = 1;
-    textureDesc.Usage = D3D11_USAGE_DEFAULT;
-    textureDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_RENDER_TARGET;
-    winrt::check_hresult(d3dDevice->CreateTexture2D(&textureDesc, nullptr, composedTexture.put()));
-    // Clear to black
-    winrt::com_ptr<ID3D11RenderTargetView> composedRenderTargetView;
-    winrt::check_hresult(d3dDevice->CreateRenderTargetView(composedTexture.get(), nullptr, composedRenderTargetView.put()));
-    d3dContext->ClearRenderTargetView(composedRenderTargetView.get(), CLEARCOLOR);
-
-    // Compose our textures into one texture
-    for (auto&& future : futures)
+    if (request.Command == ServiceCommand::Stop)
     {
-        auto snapshot = co_await std::move(future);
-
-        D3D11_TEXTURE2D_DESC desc = {};
-        snapshot.Texture->GetDesc(&desc);
-
-        auto destX = snapshot.DisplayRect.left - unionRect.left;
-        auto destY = snapshot.DisplayRect.top - unionRect.top;
-
-        D3D11_BOX region = {};
-        region.left = 0;
-        region.right = desc.Width;
-        region.top = 0;
-        region.bottom = desc.Height;
-        region.back = 1;
-
-        d3dContext->CopySubresourceRegion(composedTexture.get(), 0, destX, destY, 0, snapshot.Texture.get(), 0, &region);
+        wprintf(L"Stopped the service.\n");
+        return;
     }
-
-    co_return composedTexture;
+    if (Options::InlineOutput())
+    {
+        WriteBytesToFile(fileName, response.Bytes, Options::FileMode());
+    }
+    wprintf(L"Saved %s (%ux%u)\n", fileName.c_str(), response.Width, response.Height);
 }
 
-winrt::IAsyncOperation<winrt::StorageFile> CreateLocalFileAsync(std::wstring const& fileName)
+void ReconstructImage()
 {
-    auto currentPath = std::filesystem::current_path();
-    auto folder = co_await winrt::StorageFolder::GetFolderFromPathAsync(currentPath.wstring());
-    auto file = co_await folder.CreateFileAsync(fileName, winrt::CreationCollisionOption::ReplaceExisting);
-    co_return file;
-}
+    std::filesystem::path manifestPath(Options::ReconstructPath());
+    std::ifstream file(manifestPath, std::ios::binary);
+    if (!file)
+    {
+        throw winrt::hresult_error(HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND), L"Couldn't open the manifest!");
+    }
+    std::vector<uint8_t> manifest((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
 
-winrt::IAsyncAction SaveTextureToFileAsync(
-    winrt::com_ptr<ID3D11Texture2D> const& texture,
-    winrt::StorageFile const& file)
-{
-    D3D11_TEXTURE2D_DESC desc = {};
-    texture->GetDesc(&desc);
-    // These helpers can be found in the robmikh.common package:
-    // CopyBytesFromTexture: https://github.com/robmikh/robmikh.common/blob/f2311df8de56f31410d14f55de7307464d9a673d/robmikh.common/include/robmikh.common/d3dHelpers.h#L250-L282
-    auto bytes = util::CopyBytesFromTexture(texture);
-
-    auto stream = co_await file.OpenAsync(winrt::FileAccessMode::ReadWrite);
-    auto encoder = co_await winrt::BitmapEncoder::CreateAsync(winrt::BitmapEncoder::PngEncoderId(), stream);
-    encoder.SetPixelData(
-        winrt::BitmapPixelFormat::Bgra8,
-        winrt::BitmapAlphaMode::Premultiplied,
-        desc.Width,
-        desc.Height,
-        1.0,
-        1.0,
-        bytes);
-    co_await encoder.FlushAsync();
+    auto threadPool = std::make_shared<ThreadPool>();
+    auto image = ReadStoredImage(Options::TileStorePath(), manifest, threadPool);
 
-    co_return;
+    auto fileName = manifestPath.replace_extension(L".png").wstring();
+    PngEncoder encoder(threadPool, Options::Compression());
+    MemoryRowSource source(image.Pixels.data(), image.Width * 4);
+    FileWriter writer(fileName, Options::FileMode(), encoder.EstimateSize(image.Width, image.Height));
+    encoder.EncodeStreaming(image.Width, image.Height, source, [&writer](uint8_t const* data, size_t size)
+    {
+        writer.Write(data, size);
+    });
+    writer.Close();
+    wprintf(L"Saved %s (%ux%u)\n", fileName.c_str(), image.Width, image.Height);
 }
 
 bool ParseOptions(int argc, wchar_t* argv[])
@@ -236,6 +399,66 @@ bool ParseOptions(int argc, wchar_t* argv[])
         wprintf(L"  -dxDebug     (optional) Use the D3D and D2D debug layers.\n");
         wprintf(L"  -forceHDR    (optional) Force all monitors to be captured as HDR, used for debugging.\n");
         wprintf(L"  -clipHDR     (optional) Clip HDR contnet instead of tone mapping.\n");
+        wprintf(L"  -keepHDR     (optional) Skip tone mapping, compose in FP16 and save scRGB as exr (default) or PQ png.\n");
+        wprintf(L"  -measurePeak (optional) Tone map HDR captures for their brightest pixel, and only scale those within SDR white.\n");
+        wprintf(L"  -warp        (optional) Use the WARP software rasterizer instead of a GPU.\n");
+        wprintf(L"  -benchmark   (optional) Time each pipeline stage on synthetic layouts instead of taking a screenshot.\n");
+        wprintf(L"  -selfTest    (optional) Check every SIMD path against its scalar version instead of taking a screenshot.\n");
+        wprintf(L"  -dirtyTiles  (optional) With -count, only process the 64x64 tiles that changed since the previous shot.\n");
+        wprintf(L"  -sparse      (optional) Don't allocate the space between displays, and write a .json manifest.\n");
+        wprintf(L"  -perDisplay  (optional) Save each display to its own file, and write a .json manifest.\n");
+        wprintf(L"  -strips      (optional) Compose and encode a band of rows at a time, always done past the 16384 pixel texture limit.\n");
+        wprintf(L"  -grayscale   (optional) Save 8-bit grayscale pngs.\n");
+        wprintf(L"  -asyncWrite  (optional) With -count, write many files at once with overlapped I/O instead of one at a time.\n");
+        wprintf(L"  -stopService (optional) With -connect, stop the service instead of taking a screenshot.\n");
+        wprintf(L"  -inline      (optional) With -connect, have the service send the file back instead of writing it.\n");
+        wprintf(L"\n");
+        wprintf(L"Options:\n");
+        wprintf(L"  -toneMapper <d2d|cpu|cpuScalar|lut|lutScalar>\n");
+        wprintf(L"                                   (optional) How HDR captures are tone mapped. Defaults to d2d.\n");
+        wprintf(L"                                   cpu uses F16C/AVX2 when available, cpuScalar is the reference.\n");
+        wprintf(L"                                   lut bakes the cpu curve into a 3D LUT per display, cached on disk.\n");
+        wprintf(L"  -compression <fast|balanced|small>  (optional) PNG compression preset. Defaults to balanced.\n");
+        wprintf(L"  -format <png|qoi|raw|bmp|exr|tiles> (optional) Output format. Defaults to png.\n");
+        for (auto&& format : GetImageFormats())
+        {
+            wprintf(L"                                      %-4s %s\n", format.Name, format.Description);
+        }
+        wprintf(L"  -synthetic <layout>                 (optional) Capture synthetic frames instead of the desktop. The layout is\n");
+        wprintf(L"                                      a preset or displays like \"3840x2160@0,0:hdr=240/1000;1920x1080@3840,0\".\n");
+        wprintf(L"                                      Presets:");
+        for (auto&& preset : SyntheticCaptureSource::LayoutPresets())
+        {
+            wprintf(L" %s", preset.c_str());
+        }
+        wprintf(L"\n");
+        wprintf(L"  -iterations <count>                 (optional) Benchmark iterations per layout. Defaults to 5.\n");
+        wprintf(L"  -benchmarkCsv <file>                (optional) Also write the benchmark results to a CSV file.\n");
+        wprintf(L"  -count <count>                      (optional) Take this many screenshots using persistent capture sessions.\n");
+        wprintf(L"  -interval <milliseconds>            (optional) Time between screenshots when using -count. Defaults to 0.\n");
+        wprintf(L"  -buffers <count>                    (optional) Frame pool buffers per persistent session. Defaults to 2.\n");
+        wprintf(L"  -fileMode <plain|preallocate|mmap|unbuffered>\n");
+        wprintf(L"                                      (optional) How files are written. Defaults to plain. unbuffered bypasses\n");
+        wprintf(L"                                      the file cache for large files, and needs -asyncWrite.\n");
+        wprintf(L"  -exrCompression <zip|none>          (optional) How exr files are compressed. Defaults to zip.\n");
+        wprintf(L"  -queueDepth <count>                 (optional) Shots queued between pipeline stages with -count. Defaults to 2.\n");
+        wprintf(L"  -timelapse <file>                   (optional) Append the shots of -count to one animated png, storing only what changed.\n");
+        wprintf(L"  -frameDelay <milliseconds>          (optional) How long each -timelapse shot is shown for. Defaults to 100.\n");
+        wprintf(L"  -profile <file>                     (optional) Trace each stage and write a Chrome/Perfetto JSON trace.\n");
+        wprintf(L"  -outDir <directory>                 (optional) Where files are written. Defaults to the current directory.\n");
+        wprintf(L"  -name <pattern>                     (optional) File name without the extension, {index}, {date} and {time} are\n");
+        wprintf(L"                                      filled in. Defaults to screenshot, or screenshot_{index} with -count.\n");
+        wprintf(L"  -rect <x,y,width,height>            (optional) Only capture this part of the desktop, in desktop coordinates.\n");
+        wprintf(L"  -serve <pipe>                       (optional) Stay running and take screenshots for -connect clients.\n");
+        wprintf(L"  -connect <pipe>                     (optional) Ask the service on this pipe for the screenshot. Takes\n");
+        wprintf(L"                                      -rect, -format, -fileMode and -name, the service's other options\n");
+        wprintf(L"                                      apply, and files are written under the service's -outDir.\n");
+        wprintf(L"  -poolSize <megabytes>               (optional) Most textures, and most pixel buffers, kept around for reuse. Defaults to 512.\n");
+        wprintf(L"  -scale <factor>                     (optional) Resize the screenshot by this factor. Defaults to 1.\n");
+        wprintf(L"  -thumbnails <size,size,...>         (optional) Also save thumbnails with these longest edges in pixels.\n");
+        wprintf(L"  -filter <box|bilinear|lanczos>      (optional) Filter used by -scale and -thumbnails. Defaults to lanczos.\n");
+        wprintf(L"  -store <directory>                  (optional) The tile store for -format tiles. Defaults to tilestore.\n");
+        wprintf(L"  -reconstruct <manifest>             (optional) Rebuild a tiles manifest from -store as a png next to it.\n");
         wprintf(L"\n");
         return false;
     }
@@ -247,7 +470,357 @@ bool ParseOptions(int argc, wchar_t* argv[])
         wprintf(L"Cannot simultaneously clip and force HDR!\n");
         return false;
     }
-    Options::InitOptions(dxDebug, forceHDR, clipHDR);
+    bool keepHDR = util::impl::GetFlag(args, L"-keepHDR") || util::impl::GetFlag(args, L"/keepHDR");
+    if (clipHDR && keepHDR)
+    {
+        wprintf(L"Cannot simultaneously clip and keep HDR!\n");
+        return false;
+    }
+    auto toneMapperValue = GetFlagValue(args, L"-toneMapper", L"/toneMapper");
+    auto toneMapper = ToneMapperType::D2D;
+    if (toneMapperValue == L"cpu")
+    {
+        toneMapper = ToneMapperType::Cpu;
+    }
+    else if (toneMapperValue == L"cpuScalar")
+    {
+        toneMapper = ToneMapperType::CpuScalar;
+    }
+    else if (toneMapperValue == L"lut")
+    {
+        toneMapper = ToneMapperType::Lut;
+    }
+    else if (toneMapperValue == L"lutScalar")
+    {
+        toneMapper = ToneMapperType::LutScalar;
+    }
+    else if (!toneMapperValue.empty() && toneMapperValue != L"d2d")
+    {
+        wprintf(L"Unknown tone mapper: %s\n", toneMapperValue.c_str());
+        return false;
+    }
+    bool measurePeak = util::impl::GetFlag(args, L"-measurePeak") || util::impl::GetFlag(args, L"/measurePeak");
+    if (measurePeak && (clipHDR || keepHDR))
+    {
+        wprintf(L"-measurePeak needs HDR captures to be tone mapped!\n");
+        return false;
+    }
+    auto compressionValue = GetFlagValue(args, L"-compression", L"/compression");
+    auto compression = PngCompressionPreset::Balanced;
+    if (compressionValue == L"fast")
+    {
+        compression = PngCompressionPreset::Fast;
+    }
+    else if (compressionValue == L"small")
+    {
+        compression = PngCompressionPreset::Small;
+    }
+    else if (!compressionValue.empty() && compressionValue != L"balanced")
+    {
+        wprintf(L"Unknown compression preset: %s\n", compressionValue.c_str());
+        return false;
+    }
+    Options::InitOptions(dxDebug, forceHDR, clipHDR, keepHDR, toneMapper, measurePeak, compression);
+
+    auto poolSizeValue = GetFlagValue(args, L"-poolSize", L"/poolSize");
+    uint64_t poolSize = poolSizeValue.empty() ? 512 : std::wcstoull(poolSizeValue.c_str(), nullptr, 10);
+    Options::InitPoolOptions(poolSize * 1024 * 1024);
+
+    bool useWarp = util::impl::GetFlag(args, L"-warp") || util::impl::GetFlag(args, L"/warp");
+    bool benchmark = util::impl::GetFlag(args, L"-benchmark") || util::impl::GetFlag(args, L"/benchmark");
+    auto syntheticLayout = GetFlagValue(args, L"-synthetic", L"/synthetic");
+    auto iterationsValue = GetFlagValue(args, L"-iterations", L"/iterations");
+    uint32_t iterations = iterationsValue.empty() ? 5 : static_cast<uint32_t>(std::wcstoul(iterationsValue.c_str(), nullptr, 10));
+    if (iterations == 0)
+    {
+        wprintf(L"Invalid iteration count: %s\n", iterationsValue.c_str());
+        return false;
+    }
+    auto benchmarkCsv = GetFlagValue(args, L"-benchmarkCsv", L"/benchmarkCsv");
+    bool selfTest = util::impl::GetFlag(args, L"-selfTest") || util::impl::GetFlag(args, L"/selfTest");
+    Options::InitBenchmarkOptions(syntheticLayout, useWarp, benchmark, selfTest, iterations, benchmarkCsv);
+
+    auto countValue = GetFlagValue(args, L"-count", L"/count");
+    auto intervalValue = GetFlagValue(args, L"-interval", L"/interval");
+    auto buffersValue = GetFlagValue(args, L"-buffers", L"/buffers");
+    uint32_t count = countValue.empty() ? 1 : static_cast<uint32_t>(std::wcstoul(countValue.c_str(), nullptr, 10));
+    auto interval = std::chrono::milliseconds(intervalValue.empty() ? 0 : std::wcstoul(intervalValue.c_str(), nullptr, 10));
+    uint32_t bufferCount = buffersValue.empty() ? 2 : static_cast<uint32_t>(std::wcstoul(buffersValue.c_str(), nullptr, 10));
+    if (count == 0)
+    {
+        wprintf(L"Invalid screenshot count: %s\n", countValue.c_str());
+        return false;
+    }
+    bool dirtyTiles = util::impl::GetFlag(args, L"-dirtyTiles") || util::impl::GetFlag(args, L"/dirtyTiles");
+    if (dirtyTiles && count < 2)
+    {
+        wprintf(L"-dirtyTiles needs -count!\n");
+        return false;
+    }
+    auto queueDepthValue = GetFlagValue(args, L"-queueDepth", L"/queueDepth");
+    uint32_t queueDepth = queueDepthValue.empty() ? 2 : static_cast<uint32_t>(std::wcstoul(queueDepthValue.c_str(), nullptr, 10));
+    if (queueDepth == 0)
+    {
+        wprintf(L"Invalid queue depth: %s\n", queueDepthValue.c_str());
+        return false;
+    }
+    Options::InitIntervalOptions(count, interval, bufferCount, dirtyTiles, queueDepth);
+
+    bool sparse = util::impl::GetFlag(args, L"-sparse") || util::impl::GetFlag(args, L"/sparse");
+    if (sparse && count > 1)
+    {
+        wprintf(L"-sparse can't be used with -count!\n");
+        return false;
+    }
+    bool perDisplay = util::impl::GetFlag(args, L"-perDisplay") || util::impl::GetFlag(args, L"/perDisplay");
+    bool strips = util::impl::GetFlag(args, L"-strips") || util::impl::GetFlag(args, L"/strips");
+    if (strips && (count > 1 || sparse || perDisplay || benchmark))
+    {
+        wprintf(L"-strips can't be used with -count, -sparse, -perDisplay or -benchmark!\n");
+        return false;
+    }
+    auto fileModeValue = GetFlagValue(args, L"-fileMode", L"/fileMode");
+    auto fileMode = FileWriteMode::Plain;
+    if (fileModeValue == L"preallocate")
+    {
+        fileMode = FileWriteMode::Preallocated;
+    }
+    else if (fileModeValue == L"mmap")
+    {
+        fileMode = FileWriteMode::MemoryMapped;
+    }
+    else if (fileModeValue == L"unbuffered")
+    {
+        fileMode = FileWriteMode::Unbuffered;
+    }
+    else if (!fileModeValue.empty() && fileModeValue != L"plain")
+    {
+        wprintf(L"Unknown file mode: %s\n", fileModeValue.c_str());
+        return false;
+    }
+    auto formatValue = GetFlagValue(args, L"-format", L"/format");
+    auto format = formatValue.empty() ? std::optional(keepHDR ? ImageFormat::Exr : ImageFormat::Png) : ParseImageFormat(formatValue);
+    if (!format.has_value())
+    {
+        wprintf(L"Unknown format: %s\n", formatValue.c_str());
+        return false;
+    }
+    auto& formatInfo = GetImageFormatInfo(format.value());
+    if (keepHDR && formatInfo.CreateHdrEncoder == nullptr)
+    {
+        wprintf(L"%s can't hold HDR, use exr or png with -keepHDR!\n", formatInfo.Name);
+        return false;
+    }
+    if (!keepHDR && formatInfo.CreateEncoder == nullptr)
+    {
+        wprintf(L"%s needs -keepHDR!\n", formatInfo.Name);
+        return false;
+    }
+    if (sparse && (keepHDR || format.value() != ImageFormat::Png))
+    {
+        wprintf(L"Only png without -keepHDR supports -sparse!\n");
+        return false;
+    }
+    if (perDisplay && (count > 1 || sparse || benchmark))
+    {
+        wprintf(L"-perDisplay can't be used with -count, -sparse or -benchmark!\n");
+        return false;
+    }
+    if (keepHDR && (dirtyTiles || benchmark))
+    {
+        wprintf(L"-keepHDR can't be used with -dirtyTiles or -benchmark!\n");
+        return false;
+    }
+    // Dirty tiles are always tone mapped on the CPU, for every pixel.
+    if (dirtyTiles && (measurePeak || toneMapperValue == L"d2d"))
+    {
+        wprintf(L"-dirtyTiles can't be used with -measurePeak or -toneMapper d2d!\n");
+        return false;
+    }
+    auto exrCompressionValue = GetFlagValue(args, L"-exrCompression", L"/exrCompression");
+    auto exrCompression = ExrCompressionMode::Zip;
+    if (exrCompressionValue == L"none")
+    {
+        exrCompression = ExrCompressionMode::None;
+    }
+    else if (!exrCompressionValue.empty() && exrCompressionValue != L"zip")
+    {
+        wprintf(L"Unknown exr compression: %s\n", exrCompressionValue.c_str());
+        return false;
+    }
+    bool grayscale = util::impl::GetFlag(args, L"-grayscale") || util::impl::GetFlag(args, L"/grayscale");
+    if (grayscale && (keepHDR || format.value() != ImageFormat::Png))
+    {
+        wprintf(L"Only png without -keepHDR supports -grayscale!\n");
+        return false;
+    }
+    Options::InitOutputOptions(sparse, perDisplay, strips, fileMode, format.value(), exrCompression, grayscale);
+
+    auto scaleValue = GetFlagValue(args, L"-scale", L"/scale");
+    auto scale = scaleValue.empty() ? 1.0f : std::wcstof(scaleValue.c_str(), nullptr);
+    if (!(scale > 0.0f && scale <= 16.0f))
+    {
+        wprintf(L"Invalid scale: %s\n", scaleValue.c_str());
+        return false;
+    }
+    auto thumbnailsValue = GetFlagValue(args, L"-thumbnails", L"/thumbnails");
+    std::vector<uint32_t> thumbnailSizes;
+    std::wstringstream thumbnailsStream(thumbnailsValue);
+    std::wstring thumbnailSizeValue;
+    while (std::getline(thumbnailsStream, thumbnailSizeValue, L','))
+    {
+        auto thumbnailSize = static_cast<uint32_t>(std::wcstoul(thumbnailSizeValue.c_str(), nullptr, 10));
+        if (thumbnailSize == 0)
+        {
+            wprintf(L"Invalid thumbnail size: %s\n", thumbnailSizeValue.c_str());
+            return false;
+        }
+        thumbnailSizes.push_back(thumbnailSize);
+    }
+    auto filterValue = GetFlagValue(args, L"-filter", L"/filter");
+    auto filter = ResampleFilter::Lanczos;
+    if (filterValue == L"box")
+    {
+        filter = ResampleFilter::Box;
+    }
+    else if (filterValue == L"bilinear")
+    {
+        filter = ResampleFilter::Bilinear;
+    }
+    else if (!filterValue.empty() && filterValue != L"lanczos")
+    {
+        wprintf(L"Unknown filter: %s\n", filterValue.c_str());
+        return false;
+    }
+    if ((scale != 1.0f || !thumbnailSizes.empty()) && (count > 1 || sparse || perDisplay || strips || keepHDR || benchmark))
+    {
+        wprintf(L"-scale and -thumbnails can't be used with -count, -sparse, -perDisplay, -strips, -keepHDR or -benchmark!\n");
+        return false;
+    }
+    Options::InitScaleOptions(scale, thumbnailSizes, filter);
+
+    auto rectValue = GetFlagValue(args, L"-rect", L"/rect");
+    std::optional<RECT> region;
+    if (!rectValue.empty())
+    {
+        long x = 0;
+        long y = 0;
+        long width = 0;
+        long height = 0;
+        if (swscanf_s(rectValue.c_str(), L"%ld,%ld,%ld,%ld", &x, &y, &width, &height) != 4 || width <= 0 || height <= 0)
+        {
+            wprintf(L"Invalid rect: %s\n", rectValue.c_str());
+            return false;
+        }
+        if (count > 1 || sparse || benchmark)
+        {
+            wprintf(L"-rect can't be used with -count, -sparse or -benchmark!\n");
+            return false;
+        }
+        region = RECT{ x, y, x + width, y + height };
+    }
+    Options::InitRegionOptions(region);
+
+    auto servePipeName = GetFlagValue(args, L"-serve", L"/serve");
+    auto connectPipeName = GetFlagValue(args, L"-connect", L"/connect");
+    bool stopService = util::impl::GetFlag(args, L"-stopService") || util::impl::GetFlag(args, L"/stopService");
+    bool inlineOutput = util::impl::GetFlag(args, L"-inline") || util::impl::GetFlag(args, L"/inline");
+    if (!servePipeName.empty() && !connectPipeName.empty())
+    {
+        wprintf(L"Cannot simultaneously serve and connect!\n");
+        return false;
+    }
+    if ((stopService || inlineOutput) && connectPipeName.empty())
+    {
+        wprintf(L"-stopService and -inline need -connect!\n");
+        return false;
+    }
+    if (!servePipeName.empty() && (count > 1 || sparse || perDisplay || strips || benchmark || region.has_value() || scale != 1.0f || !thumbnailSizes.empty()))
+    {
+        wprintf(L"-serve can't be used with -count, -sparse, -perDisplay, -strips, -benchmark, -rect, -scale or -thumbnails!\n");
+        return false;
+    }
+    if (!connectPipeName.empty() && (count > 1 || sparse || perDisplay || benchmark || scale != 1.0f || !thumbnailSizes.empty()))
+    {
+        wprintf(L"-connect can't be used with -count, -sparse, -perDisplay, -benchmark, -scale or -thumbnails!\n");
+        return false;
+    }
+    Options::InitServiceOptions(servePipeName, connectPipeName, stopService, inlineOutput);
+
+    auto tileStorePath = GetFlagValue(args, L"-store", L"/store");
+    auto reconstructPath = GetFlagValue(args, L"-reconstruct", L"/reconstruct");
+    if (tileStorePath.empty() && (format.value() == ImageFormat::Tiles || !reconstructPath.empty()))
+    {
+        tileStorePath = L"tilestore";
+    }
+    if (!reconstructPath.empty() && (count > 1 || benchmark || !servePipeName.empty() || !connectPipeName.empty()))
+    {
+        wprintf(L"-reconstruct can't be used with -count, -benchmark, -serve or -connect!\n");
+        return false;
+    }
+    if (format.value() == ImageFormat::Tiles && (sparse || benchmark || scale != 1.0f || !thumbnailSizes.empty()))
+    {
+        wprintf(L"tiles can't be used with -sparse, -benchmark, -scale or -thumbnails!\n");
+        return false;
+    }
+    Options::InitTileStoreOptions(tileStorePath, reconstructPath);
+
+    auto timelapsePath = GetFlagValue(args, L"-timelapse", L"/timelapse");
+    auto frameDelayValue = GetFlagValue(args, L"-frameDelay", L"/frameDelay");
+    auto frameDelay = std::chrono::milliseconds(frameDelayValue.empty() ? 100 : std::wcstoul(frameDelayValue.c_str(), nullptr, 10));
+    if (frameDelay.count() > UINT16_MAX)
+    {
+        wprintf(L"Invalid frame delay: %s\n", frameDelayValue.c_str());
+        return false;
+    }
+    if (!timelapsePath.empty() && (count < 2 || keepHDR || grayscale || format.value() != ImageFormat::Png))
+    {
+        wprintf(L"-timelapse needs -count, and only writes png without -keepHDR or -grayscale!\n");
+        return false;
+    }
+    Options::InitTimelapseOptions(timelapsePath, frameDelay);
+
+    auto outputDirectory = GetFlagValue(args, L"-outDir", L"/outDir");
+    auto namePattern = GetFlagValue(args, L"-name", L"/name");
+    bool asyncWrite = util::impl::GetFlag(args, L"-asyncWrite") || util::impl::GetFlag(args, L"/asyncWrite");
+    if (!outputDirectory.empty() && !connectPipeName.empty() && !inlineOutput)
+    {
+        wprintf(L"-outDir with -connect needs -inline, otherwise the service's -outDir is used!\n");
+        return false;
+    }
+    if (asyncWrite && (count < 2 || !timelapsePath.empty() || fileMode == FileWriteMode::MemoryMapped))
+    {
+        wprintf(L"-asyncWrite needs -count, and can't be used with -timelapse or -fileMode mmap!\n");
+        return false;
+    }
+    if (fileMode == FileWriteMode::Unbuffered && !asyncWrite)
+    {
+        wprintf(L"-fileMode unbuffered needs -asyncWrite!\n");
+        return false;
+    }
+    if (namePattern.empty())
+    {
+        namePattern = count > 1 ? L"screenshot_{index}" : L"screenshot";
+    }
+    else if (count > 1 && timelapsePath.empty() && namePattern.find(L"{index}") == std::wstring::npos)
+    {
+        wprintf(L"-name needs {index} with -count, or every shot gets the same name!\n");
+        return false;
+    }
+    if (!outputDirectory.empty())
+    {
+        std::error_code error;
+        std::filesystem::create_directories(outputDirectory, error);
+        if (error)
+        {
+            wprintf(L"Couldn't create the output directory: %s\n", outputDirectory.c_str());
+            return false;
+        }
+    }
+    Options::InitFileOptions(outputDirectory, namePattern, asyncWrite);
+
+    auto profilePath = GetFlagValue(args, L"-profile", L"/profile");
+    Options::InitProfileOptions(profilePath);
     if (dxDebug)
     {
         wprintf(L"Using D3D and D2D debug layers...\n");
@@ -260,5 +833,75 @@ bool ParseOptions(int argc, wchar_t* argv[])
     {
         wprintf(L"Clipping HDR content...\n");
     }
+    if (useWarp)
+    {
+        wprintf(L"Using WARP...\n");
+    }
+    if (count > 1)
+    {
+        wprintf(L"Taking %u screenshots, %lld ms apart...\n", count, static_cast<long long>(interval.count()));
+    }
+    if (!timelapsePath.empty())
+    {
+        wprintf(L"Recording a timelapse to %s...\n", timelapsePath.c_str());
+    }
+    if (sparse)
+    {
+        wprintf(L"Composing sparsely...\n");
+    }
+    if (perDisplay)
+    {
+        wprintf(L"Saving each display on its own...\n");
+    }
+    if (strips)
+    {
+        wprintf(L"Composing in strips...\n");
+    }
+    if (dirtyTiles)
+    {
+        wprintf(L"Only processing tiles that changed%s...\n", toneMapper == ToneMapperType::D2D ? L", tone mapping on the CPU" : L"");
+    }
+    if (asyncWrite)
+    {
+        wprintf(L"Writing files asynchronously...\n");
+    }
+    if (region.has_value())
+    {
+        wprintf(L"Capturing %s...\n", rectValue.c_str());
+    }
+    if (scale != 1.0f)
+    {
+        wprintf(L"Scaling by %f...\n", scale);
+    }
+    if (!thumbnailSizes.empty())
+    {
+        wprintf(L"Saving %zu thumbnails...\n", thumbnailSizes.size());
+    }
+    if (!syntheticLayout.empty())
+    {
+        wprintf(L"Using synthetic layout: %s\n", syntheticLayout.c_str());
+    }
+    if (toneMapper != ToneMapperType::D2D)
+    {
+        auto isLut = toneMapper == ToneMapperType::Lut || toneMapper == ToneMapperType::LutScalar;
+        auto isScalar = toneMapper == ToneMapperType::CpuScalar || toneMapper == ToneMapperType::LutScalar;
+        wprintf(L"Tone mapping on the CPU%s%s...\n", isLut ? L" with a 3D LUT" : L"", isScalar ? L" (scalar)" : L"");
+    }
+    if (measurePeak)
+    {
+        wprintf(L"Measuring the peak luminance of HDR captures...\n");
+    }
     return true;
+}
+
+std::wstring GetFlagValue(std::vector<std::wstring> const& args, std::wstring const& flag, std::wstring const& alias)
+{
+    for (size_t i = 0; i + 1 < args.size(); i++)
+    {
+        if (args[i] == flag || args[i] == alias)
+        {
+            return args[i + 1];
+        }
+    }
+    return {};
 }
\ No newline at end of file
@@ -29,6 +29,12 @@
 #include <d2d1_3.h>
 #include <wincodec.h>
 
+// Intrinsics, only x86 and x64 have SIMD paths
+#if defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
 // STL
 #include <memory>
 #include <filesystem>
@@ -37,6 +43,20 @@
 #include <future>
 #include <string>
 #include <map>
+#include <array>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <algorithm>
+#include <sstream>
+#include <fstream>
+#include <bit>
+#include <optional>
+#include <numeric>
+#include <random>
 
 // robmikh.common
 #include <robmikh.common/direct3d11.interop.h>